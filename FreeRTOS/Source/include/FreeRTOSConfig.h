@@ -49,6 +49,14 @@
 #ifndef configUSE_TICK_HOOK
 #define configUSE_TICK_HOOK			0
 #endif
+/* Stop the tick while idle, waking for the next task or ets_timer due */
+#ifndef configUSE_TICKLESS_IDLE
+#define configUSE_TICKLESS_IDLE		0
+#endif
+/* Time critical sections by caller, see vPortCriticalProfilePrint() */
+#ifndef configCRITICAL_PROFILE
+#define configCRITICAL_PROFILE		0
+#endif
 #ifndef configCPU_CLOCK_HZ
 /* This is the _default_ clock speed for the CPU. Can be either 80MHz
  * or 160MHz, and the system will set the clock speed to match at startup.
@@ -117,6 +125,10 @@
 #ifndef configTIMER_TASK_STACK_DEPTH
 #define configTIMER_TASK_STACK_DEPTH  ( ( unsigned short ) 512 )
 #endif
+/* os_timer callbacks are run in the timer task, see open_esplibs timers.c */
+#ifndef INCLUDE_xTimerPendFunctionCall
+#define INCLUDE_xTimerPendFunctionCall 1
+#endif
 #endif
 
 /* Co-routine definitions. */
@@ -38,12 +38,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <xtensa_ops.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
 #include "xtensa_rtos.h"
+#include "port_tickless.h"
 
 unsigned cpu_sr;
 char level1_int_disabled;
@@ -145,6 +147,81 @@ void xPortSysTickHandle (void)
     }
 }
 
+/* Defined in open_esplibs/libmain */
+int sdk_os_get_cpu_frequency(void);
+
+#if configCRITICAL_PROFILE
+/* Outermost critical section under way: when it began, and from where */
+static uint32_t critical_start;
+static uint32_t critical_caller;
+static port_critical_profile_t critical_profile;
+#endif
+
+#if configUSE_TICKLESS_IDLE
+
+/* FRC2 ticks until the next ets_timer alarm. ets_timer.c overrides this;
+ * without it, sleep is cut short by the FRC2 interrupt instead. */
+bool __attribute__((weak)) ets_timer_next_alarm(uint32_t *delay)
+{
+    return false;
+}
+
+/* Idle without the tick: set CCOMPARE0 for when the next task is due, or
+ * the next ets_timer, and wait for an interrupt. Any interrupt wakes the
+ * CPU, and the tick count is moved on by the whole ticks slept. */
+void vPortSuppressTicksAndSleep(TickType_t xExpectedIdleTime)
+{
+    uint32_t cycles_per_tick = portTICK_PERIOD_MS * sdk_os_get_cpu_frequency() * 1000;
+    uint32_t ets_delay = 0;
+    bool ets_pending = ets_timer_next_alarm(&ets_delay);
+    uint32_t ticks = port_tickless_sleep_ticks(xExpectedIdleTime,
+                                               port_tickless_max_ticks(cycles_per_tick),
+                                               ets_pending, ets_delay, 5000 * portTICK_PERIOD_MS);
+    uint32_t next_tick, last, wake, now, compare;
+
+    if (!ticks) {
+        return;
+    }
+    vPortEnterCritical();
+    RSR(next_tick, ccompare0);
+    RSR(now, ccount);
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep ||
+        (int32_t)(next_tick - now) < PORT_TICKLESS_MARGIN) {
+        /* A task is ready, or the tick is due */
+        vPortExitCritical();
+        return;
+    }
+    last = next_tick - cycles_per_tick;
+    wake = last + ticks * cycles_per_tick;
+    WSR(wake, ccompare0);
+    ESYNC();
+
+    /* The hooks may sleep themselves and set 'sleep' to 0 */
+    TickType_t sleep = ticks;
+    configPRE_SLEEP_PROCESSING(sleep);
+    if (sleep) {
+        /* Interrupts are taken as it wakes, and left enabled */
+        __asm__ __volatile__ ("waiti 0" ::: "memory");
+        _xt_disable_interrupts();
+    }
+    configPOST_SLEEP_PROCESSING(sleep);
+#if configCRITICAL_PROFILE
+    /* Interrupts were enabled while asleep, so only profile from here */
+    RSR(critical_start, ccount);
+#endif
+
+    RSR(now, ccount);
+    uint32_t step = port_tickless_correct(last, cycles_per_tick, ticks, now, &compare);
+    if (compare != wake) {
+        WSR(compare, ccompare0);
+        ESYNC();
+    }
+    vTaskStepTick(step);
+    vPortExitCritical();
+}
+
+#endif /* configUSE_TICKLESS_IDLE */
+
 /*
  * See header file for description.
  */
@@ -215,6 +292,12 @@ static unsigned portBASE_TYPE uxCriticalNesting = 0;
  */
 void IRAM vPortEnterCritical(void) {
     portDISABLE_INTERRUPTS();
+#if configCRITICAL_PROFILE
+    if (uxCriticalNesting == 0) {
+        RSR(critical_start, ccount);
+        critical_caller = (uint32_t)__builtin_return_address(0);
+    }
+#endif
     uxCriticalNesting++;
 }
 
@@ -222,10 +305,73 @@ void IRAM vPortEnterCritical(void) {
 
 void IRAM vPortExitCritical(void) {
     uxCriticalNesting--;
-    if (uxCriticalNesting == 0)
+    if (uxCriticalNesting == 0) {
+#if configCRITICAL_PROFILE
+        uint32_t now;
+        RSR(now, ccount);
+        port_critical_profile_record(&critical_profile, critical_caller, now - critical_start);
+#endif
         portENABLE_INTERRUPTS();
+    }
+}
+
+#if configCRITICAL_PROFILE
+
+void vPortCriticalProfileGet(port_critical_profile_t *pxProfile)
+{
+    vPortEnterCritical();
+    memcpy(pxProfile, &critical_profile, sizeof(critical_profile));
+    vPortExitCritical();
+}
+
+void vPortCriticalProfileReset(void)
+{
+    vPortEnterCritical();
+    port_critical_profile_reset(&critical_profile);
+    vPortExitCritical();
 }
 
+/* Print the 'uxTop' callers with the longest critical sections. Times are
+ * in microseconds at the current CPU clock; the histogram counts are from
+ * under 2^PORT_CRITICAL_PROFILE_SHIFT cycles up, doubling. Look the
+ * callers up with xtensa-lx106-elf-addr2line. */
+void vPortCriticalProfilePrint(unsigned uxTop)
+{
+    port_critical_profile_t *profile = malloc(sizeof(*profile));
+    const port_critical_caller_t *top[PORT_CRITICAL_PROFILE_CALLERS + 1];
+    uint32_t mhz = sdk_os_get_cpu_frequency();
+
+    if (!profile) {
+        printf("critical profile: out of memory\n");
+        return;
+    }
+    if (uxTop > PORT_CRITICAL_PROFILE_CALLERS + 1) {
+        uxTop = PORT_CRITICAL_PROFILE_CALLERS + 1;
+    }
+    vPortCriticalProfileGet(profile);
+    uxTop = port_critical_profile_top(profile, top, uxTop);
+
+    printf("caller          count   max us  mean us  histogram\n");
+    for (unsigned i = 0; i < uxTop; i++) {
+        const port_critical_caller_t *c = top[i];
+
+        if (c->caller) {
+            printf("0x%08x ", c->caller);
+        } else {
+            printf("other      ");
+        }
+        printf("%9u %8u %8u ", c->count, c->max_cycles / mhz,
+               (uint32_t)(c->total_cycles / c->count / mhz));
+        for (int b = 0; b < PORT_CRITICAL_PROFILE_BUCKETS; b++) {
+            printf(" %u", c->histogram[b]);
+        }
+        printf("\n");
+    }
+    free(profile);
+}
+
+#endif /* configCRITICAL_PROFILE */
+
 /* Backward compatibility, for the sdk library. */
 
 signed portBASE_TYPE xTaskGenericCreate(TaskFunction_t pxTaskCode,
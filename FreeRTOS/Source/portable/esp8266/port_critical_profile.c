@@ -0,0 +1,83 @@
+/* Critical section profile for vPortEnterCritical() in port.c
+ *
+ * Callers are kept in an open addressed table, found by a hash of the
+ * return address and the slots after it. Nothing is removed until the
+ * profile is reset, so a free slot ends the search.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "FreeRTOS.h"
+
+#if configCRITICAL_PROFILE
+
+#include <string.h>
+#include "common_macros.h"
+#include "port_critical_profile.h"
+
+#define CALLER_MASK (PORT_CRITICAL_PROFILE_CALLERS - 1)
+
+void port_critical_profile_reset(port_critical_profile_t *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+}
+
+/* Runs on every vPortExitCritical(), which may be while the flash cache is
+ * disabled */
+void IRAM port_critical_profile_record(port_critical_profile_t *profile, uint32_t caller,
+                                       uint32_t cycles)
+{
+    port_critical_caller_t *entry = &profile->other;
+    unsigned slot = ((caller >> 2) * 0x9e3779b1u) >> 16;
+
+    for (int i = 0; i < PORT_CRITICAL_PROFILE_CALLERS; i++, slot++) {
+        port_critical_caller_t *c = &profile->callers[slot & CALLER_MASK];
+
+        if (!c->count) {
+            c->caller = caller;
+            entry = c;
+            break;
+        }
+        if (c->caller == caller) {
+            entry = c;
+            break;
+        }
+    }
+    entry->count++;
+    entry->total_cycles += cycles;
+    if (cycles > entry->max_cycles) {
+        entry->max_cycles = cycles;
+    }
+    entry->histogram[port_critical_profile_bucket(cycles)]++;
+}
+
+unsigned port_critical_profile_top(const port_critical_profile_t *profile,
+                                   const port_critical_caller_t **top, unsigned n)
+{
+    unsigned found = 0;
+
+    for (int i = 0; i <= PORT_CRITICAL_PROFILE_CALLERS; i++) {
+        const port_critical_caller_t *c = i < PORT_CRITICAL_PROFILE_CALLERS ?
+                                          &profile->callers[i] : &profile->other;
+        unsigned j;
+
+        if (!c->count) {
+            continue;
+        }
+        /* Insert in order, dropping the shortest when full */
+        for (j = found; j > 0 && top[j - 1]->max_cycles < c->max_cycles; j--) {
+            if (j < n) {
+                top[j] = top[j - 1];
+            }
+        }
+        if (j < n) {
+            top[j] = c;
+            if (found < n) {
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+#endif /* configCRITICAL_PROFILE */
@@ -0,0 +1,44 @@
+/* Tick arithmetic for tickless idle in port.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "port_tickless.h"
+
+uint32_t port_tickless_max_ticks(uint32_t cycles_per_tick)
+{
+    return 0x7fffffffu / cycles_per_tick - 1;
+}
+
+uint32_t port_tickless_sleep_ticks(uint32_t expected, uint32_t max, bool ets_pending,
+                                   uint32_t ets_delay, uint32_t frc2_per_tick)
+{
+    uint32_t ticks = expected < max ? expected : max;
+
+    if (ets_pending && ets_delay / frc2_per_tick + 1 < ticks) {
+        ticks = ets_delay / frc2_per_tick + 1;
+    }
+    return ticks < 2 ? 0 : ticks;
+}
+
+uint32_t port_tickless_correct(uint32_t last, uint32_t cycles_per_tick, uint32_t ticks,
+                               uint32_t now, uint32_t *compare)
+{
+    uint32_t elapsed = (now - last) / cycles_per_tick;
+    uint32_t next;
+
+    if (elapsed >= ticks) {
+        /* Woken by the tick interrupt, or it is pending */
+        *compare = last + ticks * cycles_per_tick;
+        return ticks - 1;
+    }
+    /* Woken early by another interrupt: count the whole ticks that passed
+     * and keep the ticks on their old boundaries */
+    next = last + (elapsed + 1) * cycles_per_tick;
+    if (next - now < PORT_TICKLESS_MARGIN && elapsed + 1 < ticks) {
+        elapsed++;
+        next += cycles_per_tick;
+    }
+    *compare = next;
+    return elapsed;
+}
@@ -0,0 +1,39 @@
+/* Tick arithmetic for tickless idle in port.c
+ *
+ * The tick interrupt is CCOMPARE0, set one tick's worth of CCOUNT cycles
+ * on from the last. Tickless idle sets it several ticks on and waits for an
+ * interrupt. These work out how far, and what to tell the scheduler on
+ * waking, apart from port.c so they can be tested on a host.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _PORT_TICKLESS_H
+#define _PORT_TICKLESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CCOMPARE0 is not set this few cycles ahead of CCOUNT, as CCOUNT could
+ * pass it before the write lands, and the interrupt would not come until
+ * CCOUNT wraps */
+#define PORT_TICKLESS_MARGIN 256
+
+/* Most ticks to sleep, keeping the wake time within half the CCOUNT range */
+uint32_t port_tickless_max_ticks(uint32_t cycles_per_tick);
+
+/* Ticks to sleep: 'expected' from the scheduler, at most 'max', and no
+ * further than the tick after the next ets_timer alarm, 'ets_delay' FRC2
+ * ticks away when 'ets_pending'. Sleeping less than 2 ticks saves nothing. */
+uint32_t port_tickless_sleep_ticks(uint32_t expected, uint32_t max, bool ets_pending,
+                                   uint32_t ets_delay, uint32_t frc2_per_tick);
+
+/* Having set CCOMPARE0 to 'ticks' ticks on from the tick at 'last', and
+ * woken at 'now', the ticks to step the tick count by. Sets 'compare' to
+ * CCOMPARE0 for the next tick. When that is the wake time itself, CCOMPARE0
+ * is to be left alone: its interrupt has run or is pending, and counts the
+ * last tick. */
+uint32_t port_tickless_correct(uint32_t last, uint32_t cycles_per_tick, uint32_t ticks,
+                               uint32_t now, uint32_t *compare);
+
+#endif /* _PORT_TICKLESS_H */
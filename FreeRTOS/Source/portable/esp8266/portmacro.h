@@ -146,12 +146,27 @@ void vPortExitCritical( void );
 #define portENTER_CRITICAL()                vPortEnterCritical()
 #define portEXIT_CRITICAL()                 vPortExitCritical()
 
+/* Critical section profile, see port.c */
+#if configCRITICAL_PROFILE
+#include "port_critical_profile.h"
+
+void vPortCriticalProfileGet(port_critical_profile_t *pxProfile);
+void vPortCriticalProfileReset(void);
+void vPortCriticalProfilePrint(unsigned uxTop);
+#endif
+
 /* Task function macros as described on the FreeRTOS.org WEB site.  These are
 not necessary for to use this port.  They are defined so the common demo files
 (which build with all the ports) will build. */
 #define portTASK_FUNCTION_PROTO( vFunction, pvParameters ) void vFunction( void *pvParameters )
 #define portTASK_FUNCTION( vFunction, pvParameters ) void vFunction( void *pvParameters )
 
+/* Tickless idle, see port.c */
+#if configUSE_TICKLESS_IDLE
+void vPortSuppressTicksAndSleep(TickType_t xExpectedIdleTime);
+#define portSUPPRESS_TICKS_AND_SLEEP(xExpectedIdleTime) vPortSuppressTicksAndSleep(xExpectedIdleTime)
+#endif
+
 /* FreeRTOS API functions should not be called from the NMI handler. */
 #define portASSERT_IF_INTERRUPT_PRIORITY_INVALID() configASSERT(sdk_NMIIrqIsOn == 0)
 
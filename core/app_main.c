@@ -12,6 +12,8 @@
 #include <FreeRTOS.h>
 #include <task.h>
 #include <lwip/tcpip.h>
+#include <esp_opts.h>
+#include <esp_tcp_tune.h>
 
 #include "common_macros.h"
 #include "xtensa_ops.h"
@@ -238,7 +240,11 @@ void IRAM sdk_user_start(void) {
     sysparam_addr = flash_size - (5 + DEFAULT_SYSPARAM_SECTORS) * sdk_flashchip.sector_size;
     status = sysparam_init(sysparam_addr, flash_size);
     if (status == SYSPARAM_NOTFOUND) {
+#if SYSPARAM_LOG_MODE
+        status = sysparam_create_log_area(sysparam_addr, DEFAULT_SYSPARAM_SECTORS, false);
+#else
         status = sysparam_create_area(sysparam_addr, DEFAULT_SYSPARAM_SECTORS, false);
+#endif
         if (status == SYSPARAM_OK) {
             status = sysparam_init(sysparam_addr, 0);
         }
@@ -456,7 +462,14 @@ static __attribute__((noinline)) void user_start_phase2(void) {
         (*ctor)();
     }
 
+#if ESP_LWIP_MBOX_RING
+    sys_mbox_ring_next();
+#endif
+#if ESP_TCP_TUNE && LWIP_TCP
+    tcpip_init(esp_tcp_tune_start, NULL);
+#else
     tcpip_init(NULL, NULL);
+#endif
     sdk_wdt_init();
     xTaskCreate(sdk_user_init_task, "uiT", 1024, 0, 14, &sdk_xUserTaskHandle);
     vTaskStartScheduler();
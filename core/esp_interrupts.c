@@ -22,6 +22,12 @@ void IRAM _xt_isr_attach(uint8_t i, _xt_isr func, void *arg)
     isr[i].arg = arg;
 }
 
+_xt_isr IRAM _xt_isr_get(uint8_t i, void **arg)
+{
+    *arg = isr[i].arg;
+    return isr[i].handler;
+}
+
 /* Generic ISR handler.
 
    Handles all flags set for interrupts in 'intset'.
@@ -9,7 +9,12 @@
 
 #include "esp/iomux.h"
 #include "esp/gpio.h"
+#include "esp/interrupts.h"
+#include "esp/dport_regs.h"
 #include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
 
 #define _SPI0_SCK_GPIO  6
 #define _SPI0_MISO_GPIO 7
@@ -31,6 +36,25 @@
 
 static bool _minimal_pins[2] = {false, false};
 
+/* State of the transfer started by spi_transfer_async() (bus 1 only) */
+typedef struct
+{
+    const uint8_t *out_data;
+    uint8_t *in_data;
+    size_t len;                 // words left, including the current block
+    size_t block_len;           // words in the block being transferred
+    spi_endianness_t e;
+    spi_word_size_t word_size;
+    bool rearm;                 // command/address bits need restoring
+    SemaphoreHandle_t done;     // given when the transfer is finished
+    _xt_isr prev_isr;           // INUM_SPI handler attached before, and
+    void *prev_arg;             // restored when the transfer is finished
+    bool prev_unmasked;
+    volatile bool busy;
+} _spi_async_t;
+
+static _spi_async_t _async;
+
 bool spi_init(uint8_t bus, spi_mode_t mode, uint32_t freq_divider, bool msb, spi_endianness_t endianness, bool minimal_pins)
 {
     switch (bus)
@@ -185,7 +209,7 @@ inline static uint32_t _swap_words(uint32_t value)
     return (value << 16) | (value >> 16);
 }
 
-static void _spi_buf_prepare(uint8_t bus, size_t len, spi_endianness_t e, spi_word_size_t word_size)
+static void IRAM _spi_buf_prepare(uint8_t bus, size_t len, spi_endianness_t e, spi_word_size_t word_size)
 {
     if (e == SPI_LITTLE_ENDIAN || word_size == SPI_32BIT) return;
 
@@ -216,6 +240,19 @@ static void _spi_buf_transfer(uint8_t bus, const void *out_data, void *in_data,
     }
 }
 
+/* Start transferring the next block of an asynchronous transfer */
+static void IRAM _spi_async_start_block(uint8_t bus)
+{
+    size_t buf_size = _SPI_BUF_SIZE / (uint8_t)_async.word_size;
+
+    _async.block_len = __min(_async.len, buf_size);
+    size_t bytes = _async.block_len * (uint8_t)_async.word_size;
+    _set_size(bus, bytes);
+    _store_data(bus, _async.out_data, bytes);
+    _spi_buf_prepare(bus, _async.block_len, _async.e, _async.word_size);
+    _start(bus);
+}
+
 uint8_t spi_transfer_8(uint8_t bus, uint8_t data)
 {
     uint8_t res;
@@ -237,7 +274,7 @@ uint32_t spi_transfer_32(uint8_t bus, uint32_t data)
     return res;
 }
 
-static void _rearm_extras_bit(uint8_t bus, bool arm)
+static void IRAM _rearm_extras_bit(uint8_t bus, bool arm)
 {
     if (!_minimal_pins[bus]) return;
     static uint8_t status[2];
@@ -312,6 +349,96 @@ static void _spi_buf_read(uint8_t bus, uint8_t b, void *in_data,
     memcpy(in_data, (void *)SPI(bus).W, bytes);
 }
 
+/* SPI "transaction done" interrupt: collect the received block and start the
+ * next one, or give back the interrupt and signal the waiting task when all
+ * are done. The handler attached before is run for the other SPI sources.
+ */
+static void IRAM _spi_async_isr(void *arg)
+{
+    if (_async.prev_isr && (DPORT.SPI_INT_STATUS & ~DPORT_SPI_INT_STATUS_SPI1))
+        _async.prev_isr(_async.prev_arg);
+    if (!(DPORT.SPI_INT_STATUS & DPORT_SPI_INT_STATUS_SPI1))
+        return;
+    SPI(1).SLAVE0 &= ~SPI_SLAVE0_TRANS_DONE;
+    if (!_async.busy)
+        return;
+
+    size_t bytes = _async.block_len * (uint8_t)_async.word_size;
+    if (_async.in_data)
+    {
+        _spi_buf_prepare(1, _async.block_len, _async.e, _async.word_size);
+        memcpy(_async.in_data, (void *)SPI(1).W, bytes);
+        _async.in_data += bytes;
+    }
+    _async.out_data += bytes;
+    _async.len -= _async.block_len;
+
+    if (_async.len)
+    {
+        // Only the first block gets the command/address/dummy phases
+        _rearm_extras_bit(1, false);
+        _async.rearm = true;
+        _spi_async_start_block(1);
+        return;
+    }
+
+    SPI(1).SLAVE0 &= ~SPI_SLAVE0_TRANS_DONE_EN;
+    if (_async.rearm) _rearm_extras_bit(1, true);
+    if (!_async.prev_unmasked) _xt_isr_mask(BIT(INUM_SPI));
+    _xt_isr_attach(INUM_SPI, _async.prev_isr, _async.prev_arg);
+    _async.busy = false;
+
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(_async.done, &woken);
+    portEND_SWITCHING_ISR(woken);
+}
+
+bool spi_transfer_async(uint8_t bus, const void *out_data, void *in_data, size_t len, spi_word_size_t word_size)
+{
+    if (bus != 1 || !out_data || !len || _async.busy) return false;
+
+    if (!_async.done && !(_async.done = xSemaphoreCreateBinary())) return false;
+    // Left given by a transfer whose wait timed out
+    xSemaphoreTake(_async.done, 0);
+
+    _wait(bus);
+    _async.out_data = out_data;
+    _async.in_data = in_data;
+    _async.len = len;
+    _async.e = spi_get_endianness(bus);
+    _async.word_size = word_size;
+    _async.rearm = false;
+    _async.busy = true;
+
+    _async.prev_isr = _xt_isr_get(INUM_SPI, &_async.prev_arg);
+    _xt_isr_attach(INUM_SPI, _spi_async_isr, NULL);
+    _async.prev_unmasked = _xt_isr_unmask(BIT(INUM_SPI)) & BIT(INUM_SPI);
+
+    SPI(bus).SLAVE0 = (SPI(bus).SLAVE0 & ~SPI_SLAVE0_TRANS_DONE) | SPI_SLAVE0_TRANS_DONE_EN;
+    _spi_async_start_block(bus);
+
+    return true;
+}
+
+bool spi_transfer_async_busy(uint8_t bus)
+{
+    return bus == 1 && _async.busy;
+}
+
+bool spi_transfer_async_wait(uint8_t bus, TickType_t timeout)
+{
+    if (bus != 1) return false;
+
+    TickType_t start = xTaskGetTickCount();
+    while (_async.busy)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout && timeout != portMAX_DELAY) return false;
+        xSemaphoreTake(_async.done, timeout == portMAX_DELAY ? portMAX_DELAY : timeout - elapsed);
+    }
+    return true;
+}
+
 void spi_read(uint8_t bus, uint8_t out_byte, void *in_data, size_t len, spi_word_size_t word_size)
 {
     spi_endianness_t e = spi_get_endianness(bus);
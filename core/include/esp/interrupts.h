@@ -121,4 +121,7 @@ static inline void _xt_clear_ints(uint32_t mask)
 typedef void (* _xt_isr)(void *arg);
 void _xt_isr_attach (uint8_t i, _xt_isr func, void *arg);
 
+/* Handler attached to interrupt i, or NULL, and its argument in *arg */
+_xt_isr _xt_isr_get(uint8_t i, void **arg);
+
 #endif
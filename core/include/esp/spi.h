@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include "esp/spi_regs.h"
 #include "esp/clocks.h"
+#include <FreeRTOS.h>
 
 /**
  * Macro for use with spi_init and spi_set_frequency_div.
@@ -274,6 +275,47 @@ uint32_t spi_transfer_32(uint8_t bus, uint32_t data);
  */
 size_t spi_transfer(uint8_t bus, const void *out_data, void *in_data, size_t len, spi_word_size_t word_size);
 
+/**
+ * \brief Start transferring a buffer of words over SPI without waiting
+ * Like spi_transfer(), but returns as soon as the first block is started.
+ * The SPI interrupt then loads each following block into the hardware buffer
+ * when the previous one is done, so the CPU is free to, e.g., prepare the
+ * next frame in the meantime.
+ * Use spi_transfer_async_wait() to wait for the transfer to finish; task
+ * notifications are left to the caller.
+ * The SPI interrupt is taken over for the transfer: the handler attached
+ * before is run for the SPI0 and I2S sources, and attached again, with the
+ * interrupt masked again if it was, when the transfer is finished.
+ * Both buffers must stay valid, and no other spi_* function may be used on
+ * the bus, until the transfer is finished.
+ * Only supported on bus 1.
+ * \param bus Bus ID: 1 - user
+ * \param out_data Data to send.
+ * \param in_data Receive buffer. If NULL, received data will be lost.
+ * \param len Buffer size in words
+ * \param word_size Size of the word
+ * \return false if the transfer could not be started (wrong bus, no data or
+ *         another transfer still in progress)
+ */
+bool spi_transfer_async(uint8_t bus, const void *out_data, void *in_data, size_t len, spi_word_size_t word_size);
+
+/**
+ * \brief Check if a transfer started with spi_transfer_async() is running
+ * \param bus Bus ID: 1 - user
+ * \return true if the transfer is not finished yet
+ */
+bool spi_transfer_async_busy(uint8_t bus);
+
+/**
+ * \brief Wait for a transfer started with spi_transfer_async() to finish
+ * Only one task at a time may wait.
+ * \param bus Bus ID: 1 - user
+ * \param timeout Maximum time to wait, in ticks (portMAX_DELAY to wait
+ *        forever)
+ * \return true if the transfer is finished, false on timeout
+ */
+bool spi_transfer_async_wait(uint8_t bus, TickType_t timeout);
+
 /**
  * \brief Add permanent command bits when transfert data over SPI
  * Example:
@@ -30,9 +30,71 @@
 
 #define SPI_FLASH_SECTOR_SIZE      4096
 
+/**
+ * Set SPIFLASH_MAPPED_READ to 0 to always read through the SPI controller,
+ * instead of copying from the memory-mapped flash window when possible (see
+ * spiflash.c).
+ */
+#ifndef SPIFLASH_MAPPED_READ
+#define SPIFLASH_MAPPED_READ 1
+#endif
+
+/**
+ * Longest time, in microseconds, spiflash_erase_sector_yield() lets an erase
+ * run with interrupts disabled before suspending it.
+ */
+#ifndef SPIFLASH_ERASE_SLICE_US
+#define SPIFLASH_ERASE_SLICE_US 2000
+#endif
+
+/**
+ * Set SPIFLASH_STATS to 1 to keep count of flash operations and the time
+ * they take, see spiflash_get_stats().
+ */
+#ifndef SPIFLASH_STATS
+#define SPIFLASH_STATS 0
+#endif
+
+/**
+ * Operation types, for the statistics and for reporting the longest critical
+ * section.
+ */
+typedef enum {
+    SPIFLASH_OP_READ = 0,
+    SPIFLASH_OP_WRITE,
+    SPIFLASH_OP_ERASE,
+    SPIFLASH_OP_MAX
+} spiflash_op_t;
+
+#if SPIFLASH_STATS
+/**
+ * Number of latency histogram buckets.  Bucket 0 counts operations that took
+ * less than 1 us, bucket n those that took from 2^(n-1) to 2^n - 1 us, and
+ * the last bucket everything longer.
+ */
+#define SPIFLASH_STATS_BUCKETS 20
+
+typedef struct {
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t histogram[SPIFLASH_STATS_BUCKETS];
+} spiflash_op_stats_t;
+
+typedef struct {
+    spiflash_op_stats_t ops[SPIFLASH_OP_MAX];
+    uint32_t max_critical_us;       // longest time with interrupts disabled
+    spiflash_op_t max_critical_op;  // ...and what it was for
+} spiflash_stats_t;
+#endif
+
 /**
  * Read data from SPI flash.
  *
+ * Ranges inside the memory-mapped flash window are read without disabling
+ * the cache or interrupts.
+ *
  * @param addr Address to read from. Can be not aligned.
  * @param buf Buffer to read to. Doesn't have to be aligned.
  * @param size Size of data to read. Buffer size must be >= than data size.
@@ -61,4 +123,60 @@ bool IRAM spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size);
  */
 bool IRAM spiflash_erase_sector(uint32_t addr);
 
+/**
+ * Erase a sector, letting other tasks and interrupts run while the chip is
+ * busy.
+ *
+ * Interrupts and the cache are disabled for at most about
+ * SPIFLASH_ERASE_SLICE_US at a time, instead of for the whole erase as with
+ * spiflash_erase_sector().  In between, the erase is suspended and the
+ * calling task sleeps for a tick, so the erase takes longer overall.
+ *
+ * Until it finishes, other spiflash calls that write to flash or read from
+ * the sector complete the erase first (blocking, like
+ * spiflash_erase_sector()).  If the flash chip doesn't support erase
+ * suspend, the erase always completes in one go.
+ *
+ * Must be called from a task, with the scheduler running.
+ *
+ * @param addr Address of sector to erase. Must be sector aligned.
+ *
+ * @return true if success, otherwise false
+ */
+bool IRAM spiflash_erase_sector_yield(uint32_t addr);
+
+/**
+ * Resume an erase suspended by spiflash_erase_sector_yield(), if there is
+ * one, and wait for it to finish.
+ *
+ * For code that sends its own commands to the flash, such as the SDK
+ * spi_flash functions: call it first, with interrupts and the cache
+ * disabled.
+ */
+void IRAM spiflash_finish_suspended_erase(void);
+
+#if SPIFLASH_STATS
+/**
+ * Get a copy of the flash operation statistics collected since boot or the
+ * last spiflash_reset_stats().
+ *
+ * Times are measured with WDEV.SYS_TIME, in microseconds.  An operation's
+ * time covers the whole call, including, for
+ * spiflash_erase_sector_yield(), the time the task spent waiting.  The
+ * longest critical section is the longest time interrupts were disabled in
+ * any one go.
+ */
+void spiflash_get_stats(spiflash_stats_t *stats);
+
+/**
+ * Clear the flash operation statistics.
+ */
+void spiflash_reset_stats(void);
+
+/**
+ * Print the flash operation statistics to stdout.
+ */
+void spiflash_print_stats(void);
+#endif
+
 #endif  // __SPIFLASH_H__
@@ -13,6 +13,22 @@
 #define DEFAULT_SYSPARAM_SECTORS 4
 #endif
 
+/* Set SYSPARAM_KEY_INDEX to 1 to keep an index of all keys in RAM, so that
+ * looking up a key does not have to scan through the whole region in flash.
+ * This costs 16 bytes of heap per key.
+ */
+#ifndef SYSPARAM_KEY_INDEX
+#define SYSPARAM_KEY_INDEX 0
+#endif
+
+/* Set SYSPARAM_LOG_MODE to 1 to have the OS create a new sysparam area in
+ * log mode (see sysparam_create_log_area()) instead of the default two-region
+ * format.  Existing areas are used in whichever format they already have.
+ */
+#ifndef SYSPARAM_LOG_MODE
+#define SYSPARAM_LOG_MODE 0
+#endif
+
 /** @file sysparam.h
  *
  *  Read/write "system parameters" to persistent flash.
@@ -60,6 +76,26 @@ typedef struct {
     struct sysparam_context *ctx;
 } sysparam_iter_t;
 
+/** Structure used to collect updates for sysparam_batch_commit().  This
+ *  should be initialized by calling sysparam_batch_begin(), and is released
+ *  by sysparam_batch_commit() or sysparam_batch_abort().
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t bufsize;
+    size_t count;
+} sysparam_batch_t;
+
+/** Flash wear statistics returned by sysparam_get_erase_stats() */
+typedef struct {
+    uint32_t erases;            ///< Sector erases since sysparam_init()
+    uint16_t num_sectors;       ///< Sectors in the sysparam area
+    uint32_t min_erase_count;   ///< Lowest lifetime erase count of any sector (log mode only)
+    uint32_t max_erase_count;   ///< Highest lifetime erase count of any sector (log mode only)
+    uint32_t total_erase_count; ///< Total lifetime erases of all sectors (log mode only)
+} sysparam_erase_stats_t;
+
 /** Initialize sysparam and set up the current area of flash to use.
  *
  *  This must be called (and return successfully) before any other sysparam
@@ -122,6 +158,27 @@ sysparam_status_t sysparam_init(uint32_t base_addr, uint32_t top_addr);
  */
 sysparam_status_t sysparam_create_area(uint32_t base_addr, uint16_t num_sectors, bool force);
 
+/** Create a new log-mode sysparam area in flash at the specified address.
+ *
+ *  A log-mode area is used as a single circular log of sectors instead of
+ *  two regions which are alternately compacted into each other.  When the
+ *  log runs out of space, only its oldest sector is reclaimed (its live
+ *  entries are copied to the newest one, then it is erased), so every sector
+ *  is erased equally often, one sector at a time.  All sectors but one hold
+ *  parameters, so there is also more usable space than with
+ *  sysparam_create_area().  Each sector keeps a count of how many times it
+ *  has been erased (see sysparam_get_erase_stats()).
+ *
+ *  A single value (or a batch, see sysparam_batch_commit()) must fit in one
+ *  sector, less a few bytes of headers.
+ *
+ *  sysparam_init() recognizes either format.  The arguments and return
+ *  values are the same as for sysparam_create_area(), except that
+ *  `num_sectors` can be any number >= 3.  If the area was already in log
+ *  mode, the erase counts are kept.
+ */
+sysparam_status_t sysparam_create_log_area(uint32_t base_addr, uint16_t num_sectors, bool force);
+
 /** Get the start address and size of the currently active sysparam area
  *
  *  Fills in `base_addr` and `num_sectors` with the location and size of the
@@ -140,7 +197,8 @@ sysparam_status_t sysparam_get_info(uint32_t *base_addr, uint32_t *num_sectors);
 
 /** Compact the sysparam area.
  *
- *  This also flattens the log.
+ *  This also flattens the log.  In log mode, every sector in use is
+ *  reclaimed in turn.
  *
  *  @retval ::SYSPARAM_OK           Completed successfully
  *  @retval ::SYSPARAM_ERR_NOINIT   No current sysparam area is active
@@ -149,6 +207,19 @@ sysparam_status_t sysparam_get_info(uint32_t *base_addr, uint32_t *num_sectors);
  */
 sysparam_status_t sysparam_compact();
 
+/** Get flash wear statistics for the sysparam area
+ *
+ *  Lifetime erase counts are only recorded in log mode (see
+ *  sysparam_create_log_area()), and are left at zero otherwise.
+ *
+ *  @param[out] stats  Filled in with the current statistics
+ *
+ *  @retval ::SYSPARAM_OK           Completed successfully
+ *  @retval ::SYSPARAM_ERR_NOINIT   No current sysparam area is active
+ *  @retval ::SYSPARAM_ERR_IO       I/O error reading flash
+ */
+sysparam_status_t sysparam_get_erase_stats(sysparam_erase_stats_t *stats);
+
 /** Get the value associated with a key
  *
  *  This is the core "get value" function.  It will retrieve the value for the
@@ -420,6 +491,91 @@ sysparam_status_t sysparam_set_int8(const char *key, int8_t value);
  */
 sysparam_status_t sysparam_set_bool(const char *key, bool value);
 
+/** Start collecting a batch of updates
+ *
+ *  Updates added to the batch with sysparam_batch_set_data() (etc) are only
+ *  kept in RAM until sysparam_batch_commit() is called, which then writes all
+ *  of them at once.  Either all of the updates in a batch take effect or none
+ *  of them do, even if power is lost while committing.
+ *
+ *  @param[in] batch  A pointer to a sysparam_batch_t structure to initialize
+ *
+ *  @retval ::SYSPARAM_OK           Initialization successful
+ *  @retval ::SYSPARAM_ERR_NOINIT   sysparam_init() must be called first
+ */
+sysparam_status_t sysparam_batch_begin(sysparam_batch_t *batch);
+
+/** Add an update to a batch
+ *
+ *  This takes the same arguments as sysparam_set_data(), and a `value` of NULL
+ *  or `value_len` of 0 likewise deletes the key.  If the same key is set more
+ *  than once in a batch, only the last value is kept.  Nothing is written to
+ *  flash until sysparam_batch_commit() is called.
+ *
+ *  @param[in] batch      The batch to add the update to
+ *  @param[in] key        Key name (zero-terminated string)
+ *  @param[in] value      Pointer to a buffer containing the value data
+ *  @param[in] value_len  Length of the data in the buffer
+ *  @param[in] binary     Whether the data should be considered "binary"
+ *                        (unprintable) data
+ *
+ *  @retval ::SYSPARAM_OK           Update added to the batch
+ *  @retval ::SYSPARAM_ERR_BADVALUE Either an empty key was provided or
+ *                                  value_len is too large
+ *  @retval ::SYSPARAM_ERR_NOMEM    Unable to allocate memory
+ */
+sysparam_status_t sysparam_batch_set_data(sysparam_batch_t *batch, const char *key, const uint8_t *value, size_t value_len, bool binary);
+
+/** Add an update to a batch from a string
+ *
+ *  Performs the same function as sysparam_batch_set_data(), but accepts a
+ *  zero-terminated string value instead.
+ */
+sysparam_status_t sysparam_batch_set_string(sysparam_batch_t *batch, const char *key, const char *value);
+
+/** Add an int32_t update to a batch
+ *
+ *  Performs the same function as sysparam_batch_set_data(), but stores an
+ *  int32_t binary value like sysparam_set_int32().
+ */
+sysparam_status_t sysparam_batch_set_int32(sysparam_batch_t *batch, const char *key, int32_t value);
+
+/** Write all updates in a batch to flash
+ *
+ *  All changed values are appended to the sysparam area in one pass, which
+ *  will be compacted first (at most once) if necessary.  The batch only takes
+ *  effect once it has been written completely.  If power is lost after that
+ *  point, the remaining cleanup is finished by the next sysparam_init().
+ *
+ *  NOTE: A batch is stored in a form that sysparam code from before batches
+ *  can't read, so the region it is written to is marked with a new magic
+ *  value which that code does not recognize (it will refuse the area, and
+ *  may offer to reformat it).  The region goes back to the old format when
+ *  it is next compacted (see sysparam_compact()).  Log-mode areas are never
+ *  recognized by such code.
+ *
+ *  The resources associated with `batch` are released whether or not the
+ *  commit succeeds.
+ *
+ *  @param[in] batch  The batch to commit
+ *
+ *  @retval ::SYSPARAM_OK           All updates were written
+ *  @retval ::SYSPARAM_ERR_NOINIT   sysparam_init() must be called first
+ *  @retval ::SYSPARAM_ERR_FULL     No space left in sysparam area
+ *                                  (or too many keys in use).  Nothing was
+ *                                  changed.
+ *  @retval ::SYSPARAM_ERR_NOMEM    Unable to allocate memory
+ *  @retval ::SYSPARAM_ERR_CORRUPT  Sysparam region has bad/corrupted data
+ *  @retval ::SYSPARAM_ERR_IO       I/O error reading/writing flash
+ */
+sysparam_status_t sysparam_batch_commit(sysparam_batch_t *batch);
+
+/** Discard a batch without writing anything
+ *
+ *  Releases the resources associated with `batch`.
+ */
+void sysparam_batch_abort(sysparam_batch_t *batch);
+
 /** Begin iterating through all key/value pairs
  *
  *  This function initializes a sysparam_iter_t structure to prepare it for
@@ -26,8 +26,11 @@
 #include "include/flashchip.h"
 #include "include/esp/rom.h"
 #include "include/esp/spi_regs.h"
+#include "include/esp/wdev_regs.h"
 
 #include <FreeRTOS.h>
+#include <task.h>
+#include <stdio.h>
 #include <string.h>
 
 /**
@@ -52,99 +55,271 @@
 // http://bbs.espressif.com/viewtopic.php?f=6&t=2439
 #define SPI_READ_MAX_SIZE   60
 
+/**
+ * Note about memory-mapped reads.
+ *
+ * One megabyte of flash is mapped (read-only, through the instruction cache)
+ * at SPI_FLASH_MAPPED_BASE.  Which megabyte is decided at boot by
+ * Cache_Read_Enable() (see spiflash-cache-enable.S), and is recorded in
+ * rboot_megabyte.
+ *
+ * Reads that fall entirely inside that window are copied straight from it
+ * using aligned 32-bit loads (the only kind the mapping supports).  That needs
+ * neither a critical section nor the cache to be disabled, and a 4 KiB read
+ * becomes a memcpy instead of 69 separately polled SPI commands.
+ *
+ * Everything else (ranges outside the window, reads before the mapping is
+ * set up, or all reads if SPIFLASH_MAPPED_READ is 0) falls back to reading
+ * through SPI(0) in blocks of SPI_READ_MAX_SIZE bytes with the cache
+ * disabled.
+ *
+ * The cache is disabled and re-enabled around every write and erase, which
+ * discards anything cached, so mapped reads never return stale data.
+ */
+#define SPI_FLASH_MAPPED_BASE   0x40200000
+#define SPI_FLASH_MAPPED_SIZE   0x100000
+
+// Value of rboot_megabyte until Cache_Read_Enable() has been called
+#define RBOOT_MEGABYTE_DEFAULT  0x80
+
+extern uint8_t rboot_megabyte;
 
 /**
- * Low level SPI flash write. Write block of data up to 64 bytes.
+ * Note about erase suspend.
+ *
+ * A sector erase keeps the chip busy for tens to hundreds of milliseconds,
+ * and code can't be fetched from flash until it is done, so
+ * spiflash_erase_sector() keeps interrupts and the cache disabled throughout.
+ *
+ * spiflash_erase_sector_yield() instead lets the erase run for at most
+ * SPIFLASH_ERASE_SLICE_US at a time, then suspends it (75h, supported by the
+ * Winbond/GigaDevice/etc. parts used on ESP8266 modules), which makes the
+ * chip readable again within a few tens of microseconds.  The cache and
+ * interrupts are then re-enabled while the calling task sleeps, and the
+ * erase is resumed (7Ah) afterwards.
+ *
+ * While an erase is suspended, the chip can't be written to, and data in the
+ * sector being erased is undefined.  Any other spiflash_* call that needs
+ * either first resumes the erase and waits for it to finish, the same way
+ * spiflash_erase_sector() would.  The SDK spi_flash functions in
+ * open_esplibs always do, through spiflash_finish_suspended_erase().
+ *
+ * A chip that doesn't support suspend ignores the command and stays busy.
+ * This is noticed the first time it happens, after which erases simply run
+ * to completion.
  */
-static inline void IRAM spi_write_data(sdk_flashchip_t *chip, uint32_t addr,
-        uint8_t *buf, uint32_t size)
+#define SPI_FLASH_CMD_ERASE_SUSPEND 0x75
+#define SPI_FLASH_CMD_ERASE_RESUME  0x7A
+
+#define SPI_FLASH_STATUS_BUSY       BIT(0)
+
+// Longest time a chip may take to act on a suspend command
+#define SPI_FLASH_SUSPEND_TIMEOUT_US 100
+
+#define NO_ERASE 0xFFFFFFFF
+
+// Sector with a suspended erase, or NO_ERASE
+static volatile uint32_t erase_addr = NO_ERASE;
+
+static bool erase_suspend_unsupported;
+
+#if SPIFLASH_STATS
+static spiflash_stats_t stats;
+static uint32_t critical_start;
+#endif
+
+/**
+ * Disable interrupts and the cache, to use the SPI controller.
+ */
+static inline void IRAM flash_begin(void)
 {
-    uint32_t words = size >> 2;
-    if (size & 0b11) {
-        words++;
+    vPortEnterCritical();
+    Cache_Read_Disable();
+#if SPIFLASH_STATS
+    critical_start = WDEV.SYS_TIME;
+#endif
+}
+
+/**
+ * Re-enable the cache and interrupts.  `op` is the operation the critical
+ * section was for.
+ */
+static inline void IRAM flash_end(spiflash_op_t op)
+{
+#if SPIFLASH_STATS
+    uint32_t time = WDEV.SYS_TIME - critical_start;
+    if (time > stats.max_critical_us) {
+        stats.max_critical_us = time;
+        stats.max_critical_op = op;
     }
+#endif
+    Cache_Read_Enable(0, 0, 1);
+    vPortExitCritical();
+}
 
-    Wait_SPI_Idle(chip);  // wait for previous write to finish
+/**
+ * Time reference for stats_record().
+ */
+static inline uint32_t IRAM stats_start(void)
+{
+#if SPIFLASH_STATS
+    return WDEV.SYS_TIME;
+#else
+    return 0;
+#endif
+}
 
-    SPI(0).ADDR = (addr & 0x00FFFFFF) | (size << 24);
+/**
+ * Account for an operation that started at `start`.
+ */
+static inline void IRAM stats_record(spiflash_op_t op, uint32_t bytes,
+        uint32_t start)
+{
+#if SPIFLASH_STATS
+    spiflash_op_stats_t *op_stats = &stats.ops[op];
+    uint32_t time = WDEV.SYS_TIME - start;
+    uint32_t bucket = 0;
 
-    memcpy((void*)SPI(0).W, buf, words<<2);
+    while (bucket < SPIFLASH_STATS_BUCKETS - 1 && (time >> bucket)) {
+        bucket++;
+    }
 
-    __asm__ volatile("memw");
+    vPortEnterCritical();
+    op_stats->count++;
+    op_stats->bytes += bytes;
+    op_stats->total_us += time;
+    if (time > op_stats->max_us) {
+        op_stats->max_us = time;
+    }
+    op_stats->histogram[bucket]++;
+    vPortExitCritical();
+#endif
+}
 
-    SPI_write_enable(chip);
 
-    SPI(0).CMD = SPI_CMD_PP;
-    while (SPI(0).CMD) {}
+/**
+ * Read flash status register.
+ */
+static inline uint32_t IRAM read_status(void)
+{
+    SPI(0).RSTATUS = 0;
+    SPI(0).CMD = SPI_CMD_READ_SR;
+    while (SPI(0).CMD) {};
+
+    return SPI(0).RSTATUS & sdk_flashchip.status_mask;
 }
 
 /**
- * Write a page of flash. Data block should not cross page boundary.
+ * Send a command without address or data.
  */
-static bool IRAM spi_write_page(sdk_flashchip_t *flashchip, uint32_t dest_addr,
-    uint8_t *buf, uint32_t size)
+static void IRAM send_command(uint8_t command)
 {
-    // check if block to write doesn't cross page boundary
-    if (flashchip->page_size < size + (dest_addr % flashchip->page_size)) {
-        return false;
+    uint32_t user0 = SPI(0).USER0;
+    uint32_t user2 = SPI(0).USER2;
+
+    SPI(0).USER0 = SPI_USER0_COMMAND;
+    SPI(0).USER2 = (7 << SPI_USER2_COMMAND_BITLEN_S) | command;
+    SPI(0).CMD = SPI_CMD_USR;
+    while (SPI(0).CMD) {};
+
+    SPI(0).USER0 = user0;
+    SPI(0).USER2 = user2;
+}
+
+/**
+ * Wait up to timeout_us for the flash to become idle.
+ */
+static bool IRAM wait_idle_us(uint32_t timeout_us)
+{
+    uint32_t start = WDEV.SYS_TIME;
+
+    while (read_status() & SPI_FLASH_STATUS_BUSY) {
+        if (WDEV.SYS_TIME - start >= timeout_us) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (size < 1) {
-        return true;
+void IRAM spiflash_finish_suspended_erase(void)
+{
+    if (erase_addr != NO_ERASE) {
+        send_command(SPI_FLASH_CMD_ERASE_RESUME);
+        Wait_SPI_Idle(&sdk_flashchip);
+        erase_addr = NO_ERASE;
     }
+}
 
-    while (size >= SPI_WRITE_MAX_SIZE) {
-        spi_write_data(flashchip, dest_addr, buf, SPI_WRITE_MAX_SIZE);
+/**
+ * Check if a region overlaps the sector with a suspended erase.
+ */
+static inline bool erasing(uint32_t addr, uint32_t size)
+{
+    uint32_t sector = erase_addr;
 
-        size -= SPI_WRITE_MAX_SIZE;
-        dest_addr += SPI_WRITE_MAX_SIZE;
-        buf += SPI_WRITE_MAX_SIZE;
+    return sector != NO_ERASE && addr < sector + sdk_flashchip.sector_size &&
+        sector < addr + size;
+}
 
-        if (size < 1) {
-            return true;
-        }
+/**
+ * Low level SPI flash write. Write block of data up to 64 bytes, which must
+ * not cross a page boundary.
+ */
+static inline void IRAM spi_write_data(sdk_flashchip_t *chip, uint32_t addr,
+        uint8_t *buf, uint32_t size)
+{
+    uint32_t words = size >> 2;
+    uint32_t tail = 0;
+
+    Wait_SPI_Idle(chip);  // wait for previous write to finish
+
+    SPI(0).ADDR = (addr & 0x00FFFFFF) | (size << 24);
+
+    // Only read `size` bytes from buf, the last word is padded
+    memcpy((void*)SPI(0).W, buf, words << 2);
+    if (size & 0b11) {
+        memcpy(&tail, buf + (words << 2), size & 0b11);
+        SPI(0).W[words] = tail;
     }
 
-    spi_write_data(flashchip, dest_addr, buf, size);
+    __asm__ volatile("memw");
 
-    return true;
+    SPI_write_enable(chip);
+
+    SPI(0).CMD = SPI_CMD_PP;
+    while (SPI(0).CMD) {}
 }
 
 /**
- * Split block of data into pages and write pages.
+ * Write block of data in as few program commands as possible.
+ *
+ * Each command writes up to SPI_WRITE_MAX_SIZE bytes (the size of the SPI(0)
+ * buffer) and must not cross a page boundary, so a page takes at least
+ * page_size / SPI_WRITE_MAX_SIZE commands, each needing its own write enable.
  */
 static bool IRAM spi_write(uint32_t addr, uint8_t *dst, uint32_t size)
 {
+    uint32_t page_size = sdk_flashchip.page_size;
+    uint32_t count;
+
     if (sdk_flashchip.chip_size < (addr + size)) {
         return false;
     }
 
-    uint32_t write_bytes_to_page = sdk_flashchip.page_size -
-        (addr % sdk_flashchip.page_size);  // TODO: place for optimization
-
-    if (size < write_bytes_to_page) {
-        if (!spi_write_page(&sdk_flashchip, addr, dst, size)) {
-            return false;
+    while (size > 0) {
+        count = page_size - (addr % page_size);
+        if (count > SPI_WRITE_MAX_SIZE) {
+            count = SPI_WRITE_MAX_SIZE;
         }
-    } else {
-        if (!spi_write_page(&sdk_flashchip, addr, dst, write_bytes_to_page)) {
-            return false;
+        if (count > size) {
+            count = size;
         }
 
-        uint32_t offset = write_bytes_to_page;
-        uint32_t pages_to_write = (size - offset) / sdk_flashchip.page_size;
-        for (uint32_t i = 0; i < pages_to_write; i++) {
-            if (!spi_write_page(&sdk_flashchip, addr + offset,
-                        dst + offset, sdk_flashchip.page_size)) {
-                return false;
-            }
-            offset += sdk_flashchip.page_size;
-        }
+        spi_write_data(&sdk_flashchip, addr, dst, count);
 
-        if (!spi_write_page(&sdk_flashchip, addr + offset,
-                    dst + offset, size - offset)) {
-            return false;
-        }
+        addr += count;
+        dst += count;
+        size -= count;
     }
 
     return true;
@@ -153,18 +328,19 @@ static bool IRAM spi_write(uint32_t addr, uint8_t *dst, uint32_t size)
 bool IRAM spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size)
 {
     bool result = false;
+    uint32_t start = stats_start();
 
     if (buf) {
-        vPortEnterCritical();
-        Cache_Read_Disable();
+        flash_begin();
 
+        spiflash_finish_suspended_erase();
         result = spi_write(addr, buf, size);
 
         // make sure all write operations is finished before exiting
         Wait_SPI_Idle(&sdk_flashchip);
 
-        Cache_Read_Enable(0, 0, 1);
-        vPortExitCritical();
+        flash_end(SPIFLASH_OP_WRITE);
+        stats_record(SPIFLASH_OP_WRITE, size, start);
     }
 
     return result;
@@ -214,25 +390,115 @@ static inline bool IRAM read_data(sdk_flashchip_t *flashchip, uint32_t addr,
     return true;
 }
 
+#if SPIFLASH_MAPPED_READ
+/**
+ * Get the mapped address of a flash region, or NULL if it isn't all mapped.
+ */
+static inline const volatile uint32_t *mapped_addr(uint32_t addr,
+        uint32_t size)
+{
+    uint32_t start;
+
+    if (rboot_megabyte == RBOOT_MEGABYTE_DEFAULT) {
+        return NULL;
+    }
+    start = rboot_megabyte * SPI_FLASH_MAPPED_SIZE;
+    if (addr < start || size > SPI_FLASH_MAPPED_SIZE ||
+            addr - start > SPI_FLASH_MAPPED_SIZE - size ||
+            addr + size > sdk_flashchip.chip_size) {
+        return NULL;
+    }
+    return (const volatile uint32_t *)(SPI_FLASH_MAPPED_BASE +
+            ((addr - start) & ~0b11));
+}
+
+/**
+ * Copy data from the memory-mapped flash window.  `src` is the word holding
+ * the first byte, which is at `offset` (0..3) within it.
+ */
+static void IRAM mapped_read(const volatile uint32_t *src, uint32_t offset,
+        uint8_t *dst, uint32_t size)
+{
+    uint32_t word;
+    uint32_t count;
+
+    if (offset) {
+        word = *src++;
+        count = 4 - offset;
+        if (count > size) {
+            count = size;
+        }
+        memcpy(dst, (uint8_t*)&word + offset, count);
+        dst += count;
+        size -= count;
+    }
+
+    if (((uintptr_t)dst & 0b11) == 0) {
+        while (size >= 4) {
+            *(uint32_t*)dst = *src++;
+            dst += 4;
+            size -= 4;
+        }
+    } else {
+        while (size >= 4) {
+            word = *src++;
+            memcpy(dst, &word, 4);
+            dst += 4;
+            size -= 4;
+        }
+    }
+
+    if (size) {
+        word = *src;
+        memcpy(dst, &word, size);
+    }
+}
+#endif
+
 bool IRAM spiflash_read(uint32_t dest_addr, uint8_t *buf, uint32_t size)
 {
     bool result = false;
+    uint32_t start = stats_start();
 
     if (buf) {
-        vPortEnterCritical();
-        Cache_Read_Disable();
+#if SPIFLASH_MAPPED_READ
+        const volatile uint32_t *src = mapped_addr(dest_addr, size);
+        if (src && !erasing(dest_addr, size)) {
+            mapped_read(src, dest_addr & 0b11, buf, size);
+            stats_record(SPIFLASH_OP_READ, size, start);
+            return true;
+        }
+#endif
+        flash_begin();
 
+        if (erasing(dest_addr, size)) {
+            spiflash_finish_suspended_erase();
+        }
         result = read_data(&sdk_flashchip, dest_addr, buf, size);
 
-        Cache_Read_Enable(0, 0, 1);
-        vPortExitCritical();
+        flash_end(SPIFLASH_OP_READ);
+        stats_record(SPIFLASH_OP_READ, size, start);
     }
 
     return result;
 }
 
+/**
+ * Issue a sector erase command.  Doesn't wait for it to finish.
+ */
+static inline void IRAM start_erase(uint32_t addr)
+{
+    SPI_write_enable(&sdk_flashchip);
+
+    SPI(0).ADDR = addr & 0x00FFFFFF;
+    SPI(0).CMD = SPI_CMD_SE;
+    while (SPI(0).CMD) {};
+}
+
 bool IRAM spiflash_erase_sector(uint32_t addr)
 {
+    uint32_t start = stats_start();
+
     if ((addr + sdk_flashchip.sector_size) > sdk_flashchip.chip_size) {
         return false;
     }
@@ -241,19 +507,123 @@ bool IRAM spiflash_erase_sector(uint32_t addr)
         return false;
     }
 
-    vPortEnterCritical();
-    Cache_Read_Disable();
+    flash_begin();
 
-    SPI_write_enable(&sdk_flashchip);
-
-    SPI(0).ADDR = addr & 0x00FFFFFF;
-    SPI(0).CMD = SPI_CMD_SE;
-    while (SPI(0).CMD) {};
+    spiflash_finish_suspended_erase();
+    start_erase(addr);
 
     Wait_SPI_Idle(&sdk_flashchip);
 
-    Cache_Read_Enable(0, 0, 1);
-    vPortExitCritical();
+    flash_end(SPIFLASH_OP_ERASE);
+    stats_record(SPIFLASH_OP_ERASE, sdk_flashchip.sector_size, start);
+
+    return true;
+}
+
+/**
+ * Let a running erase continue for up to SPIFLASH_ERASE_SLICE_US, then
+ * suspend it.  Returns true if the erase has finished.
+ */
+static bool IRAM erase_slice(uint32_t addr)
+{
+    if (erase_suspend_unsupported) {
+        Wait_SPI_Idle(&sdk_flashchip);
+        return true;
+    }
+    if (wait_idle_us(SPIFLASH_ERASE_SLICE_US)) {
+        return true;
+    }
+
+    send_command(SPI_FLASH_CMD_ERASE_SUSPEND);
+    if (!wait_idle_us(SPI_FLASH_SUSPEND_TIMEOUT_US)) {
+        erase_suspend_unsupported = true;
+        Wait_SPI_Idle(&sdk_flashchip);
+        return true;
+    }
+    erase_addr = addr;
+
+    return false;
+}
+
+bool IRAM spiflash_erase_sector_yield(uint32_t addr)
+{
+    bool done;
+    uint32_t start = stats_start();
+
+    if ((addr + sdk_flashchip.sector_size) > sdk_flashchip.chip_size) {
+        return false;
+    }
+
+    if (addr & 0xFFF) {
+        return false;
+    }
+
+    flash_begin();
 
+    spiflash_finish_suspended_erase();
+    start_erase(addr);
+
+    while (1) {
+        done = erase_slice(addr);
+
+        flash_end(SPIFLASH_OP_ERASE);
+
+        if (done) {
+            break;
+        }
+
+        vTaskDelay(1);
+
+        flash_begin();
+
+        if (erase_addr != addr) {
+            // Another flash operation finished the erase for us
+            flash_end(SPIFLASH_OP_ERASE);
+            break;
+        }
+        erase_addr = NO_ERASE;
+        send_command(SPI_FLASH_CMD_ERASE_RESUME);
+    }
+
+    stats_record(SPIFLASH_OP_ERASE, sdk_flashchip.sector_size, start);
     return true;
 }
+
+#if SPIFLASH_STATS
+void spiflash_get_stats(spiflash_stats_t *result)
+{
+    vPortEnterCritical();
+    *result = stats;
+    vPortExitCritical();
+}
+
+void spiflash_reset_stats(void)
+{
+    vPortEnterCritical();
+    memset(&stats, 0, sizeof(stats));
+    vPortExitCritical();
+}
+
+void spiflash_print_stats(void)
+{
+    static const char *names[SPIFLASH_OP_MAX] = { "read", "write", "erase" };
+    spiflash_stats_t s;
+
+    spiflash_get_stats(&s);
+    for (int i = 0; i < SPIFLASH_OP_MAX; i++) {
+        spiflash_op_stats_t *op = &s.ops[i];
+
+        printf("%-5s %u ops, %u bytes, avg %u us, max %u us\n", names[i],
+                op->count, op->bytes,
+                op->count ? (uint32_t)(op->total_us / op->count) : 0,
+                op->max_us);
+        for (int j = 0; j < SPIFLASH_STATS_BUCKETS; j++) {
+            if (op->histogram[j]) {
+                printf("  < %7u us: %u\n", 1 << j, op->histogram[j]);
+            }
+        }
+    }
+    printf("longest critical section: %u us (%s)\n", s.max_critical_us,
+            names[s.max_critical_op]);
+}
+#endif
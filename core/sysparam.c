@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <sysparam.h>
@@ -18,6 +19,20 @@
  */
 #define SYSPARAM_MAGIC 0x70524f45 // "EORp" in little-endian
 
+/* The "magic" value of a region which may hold batch containers (see
+ * ENTRY_ID_BATCH).  Code from before batches does not recognize it, so it
+ * refuses such a region rather than reading it without the values inside the
+ * containers.  It only clears a bit of SYSPARAM_MAGIC, so it can be written
+ * over a region header in place before the first container goes in.
+ * Compacting writes containers out as plain entries, so the new region gets
+ * SYSPARAM_MAGIC again.
+ */
+#define SYSPARAM_BATCH_MAGIC 0x70524f44 // "DORp" in little-endian
+
+/* The "magic" value at the start of each sector of a log-mode sysparam area.
+ */
+#define SYSPARAM_LOG_MAGIC 0x4c524f45 // "EORL" in little-endian
+
 /* The size of the initial buffer created by sysparam_iter_start, etc, to hold
  * returned key-value pairs.  Setting this too small may result in a lot of
  * unnecessary reallocs.  Setting it too large will waste memory when iterating
@@ -40,10 +55,25 @@
 #define BOUNCE_BUFFER_WORDS 3
 #define BOUNCE_BUFFER_SIZE (BOUNCE_BUFFER_WORDS * sizeof(uint32_t))
 
+/* Writes larger than the bounce buffer are staged through a heap buffer of up
+ * to this many bytes instead, so that each flash page is programmed with one
+ * spiflash_write() and verified with one spiflash_read().  Every flash call
+ * disables the cache and interrupts, so fewer calls means less time spent in
+ * critical sections, while never crossing a page boundary keeps each call
+ * short.  If the buffer can't be allocated, the bounce buffer is used.
+ */
+#define WRITE_BUFFER_SIZE 256
+
+/* Number of entries the key index (if enabled) grows by each time it runs out
+ * of space.
+ */
+#define INDEX_GROW_ENTRIES 16
+
 /* Size of region/entry headers.  These should not normally need tweaking (and
  * will probably require some code changes if they are tweaked).
  */
 #define REGION_HEADER_SIZE 8 // NOTE: Must be multiple of 4
+#define LOG_HEADER_SIZE 20   // NOTE: Must be multiple of 4
 #define ENTRY_HEADER_SIZE 4  // NOTE: Must be multiple of 4
 
 /* These are limited by the format to 0xffff, but could be set lower if desired
@@ -64,12 +94,36 @@
 #define ENTRY_FLAG_INVALID  0x4000 // Valid (0) or invalid (1) entry
 #define ENTRY_FLAG_VALUE    0x2000 // Key (0) or value (1)
 #define ENTRY_FLAG_BINARY   0x1000 // Text (0) or binary (1) data
+#define ENTRY_FLAG_PENDING  0x1000 // Batch: applied (0) or pending (1)
 
 #define ENTRY_MASK_ID  0xfff
 
 #define ENTRY_ID_END   0xfff
 #define ENTRY_ID_ANY  0x1000
 
+/* Batches written by sysparam_batch_commit() are stored as a single "key"
+ * entry with id 0 (never used by real keys), whose payload is the list of
+ * entries in the batch.  While the batch is being written the container is
+ * invalid, so the whole batch is skipped.  Once it has been committed (marked
+ * valid), entries inside it are read like any others.
+ */
+#define ENTRY_ID_BATCH 0
+
+/* In log mode, this many erased sectors are always kept in reserve, so that
+ * the live entries of the oldest sector can always be copied somewhere before
+ * it is erased.
+ */
+#define LOG_SPARE_SECTORS 1
+#define LOG_MIN_SECTORS   (LOG_SPARE_SECTORS + 2)
+
+/* Ordinary entries always leave this much of each log sector free, so that
+ * the live entries of any sector can be copied into a single batch container
+ * (which may use the whole sector) when it is reclaimed.
+ */
+#define LOG_SECTOR_SLACK ENTRY_HEADER_SIZE
+
+#define LOG_SEQ_FREE 0xffffffff
+
 #ifndef SYSPARAM_DEBUG
 #define SYSPARAM_DEBUG 0
 #endif
@@ -77,6 +131,7 @@
 /******************************* Useful Macros *******************************/
 
 #define ROUND_TO_WORD_BOUNDARY(x) (((x) + 3) & 0xfffffffc)
+#define IS_REGION_MAGIC(magic) ((magic) == SYSPARAM_MAGIC || (magic) == SYSPARAM_BATCH_MAGIC)
 #define ENTRY_SIZE(payload_len) (ENTRY_HEADER_SIZE + payload_len)
 
 #define max(x, y) ((x) > (y) ? (x) : (y))
@@ -96,6 +151,19 @@ struct region_header {
     uint16_t reserved;
 } __attribute__ ((packed));
 
+/* Header at the start of every sector of a log-mode area.  `seq` and
+ * `seq_check` are both LOG_SEQ_FREE while the sector is free, and are written
+ * (with `seq_check == ~seq`) when it becomes the head of the log.
+ */
+struct log_header {
+    uint32_t magic;
+    uint16_t num_sectors;
+    uint16_t index;         // Position of this sector in the area
+    uint32_t erase_count;
+    uint32_t seq;
+    uint32_t seq_check;
+} __attribute__ ((packed));
+
 struct entry_header {
     uint16_t idflags;
     uint16_t len;
@@ -107,35 +175,133 @@ struct sysparam_context {
     int unused_keys;
     size_t compactable;
     uint16_t max_key_id;
+    bool indexed;           // Positioned via the key index (no scan stats)
+    uint32_t indexed_value; // Value address found in the key index
+    uint32_t pending_batch; // Committed batch whose old values still exist
+};
+
+/* A staged update in a sysparam_batch_t buffer.  Followed by the key and
+ * value, and padded to a word boundary.
+ */
+struct batch_record {
+    uint16_t key_len;
+    uint16_t value_len;
+    uint16_t flags;
+    int16_t key_id;          // Filled in while committing (-1 for new keys)
+    uint32_t old_value_addr; // Filled in while committing
+};
+
+#define BATCH_RECORD_BINARY 0x0001
+#define BATCH_RECORD_SKIP   0x0002 // No change needed
+
+#define BATCH_RECORD_SIZE(key_len, value_len) ROUND_TO_WORD_BOUNDARY(sizeof(struct batch_record) + (key_len) + (value_len))
+
+struct index_entry {
+    uint32_t hash;
+    uint32_t key_addr;
+    uint32_t value_addr;    // 0 if the key has no current value
+    uint16_t key_id;
+    uint16_t key_len;
 };
 
 /*************************** Global variables/data ***************************/
 
+/* In log mode, entry addresses (`cur_base`, `end_addr`, etc) are virtual: the
+ * log is numbered in sector-sized steps from the oldest sector at init time,
+ * so addresses keep increasing as the log wraps around the area.
+ * `_flash_addr()` translates them to flash addresses.  `cur_base` is the
+ * oldest sector and `log_head` the newest one.
+ */
 static struct {
     uint32_t cur_base;
     uint32_t alt_base;
     uint32_t end_addr;
     size_t region_size;
     bool force_compact;
+    bool batch_magic;       // Active region has SYSPARAM_BATCH_MAGIC
+    bool log_mode;
+    uint32_t log_base;      // Flash address of a log-mode area
+    uint16_t log_sectors;
+    uint16_t log_free;      // Erased sectors after the head
+    uint16_t log_offset;    // Sector (in the area) at virtual address 0
+    uint32_t log_seq_base;  // Sequence number of virtual address 0
+    uint32_t log_head;
+    uint32_t erases;        // Sector erases since sysparam_init()
     SemaphoreHandle_t sem;
 } _sysparam_info;
 
+#if SYSPARAM_KEY_INDEX
+/* In-RAM index of all keys in the active region, sorted by hash.  `entries`
+ * is NULL if the index could not be built, in which case all lookups fall
+ * back to scanning the flash.
+ */
+static struct {
+    struct index_entry *entries;
+    size_t count;
+    size_t size;
+} _sysparam_index;
+#endif
+
 /***************************** Internal routines *****************************/
 
 static sysparam_status_t _write_and_verify(uint32_t addr, const void *data, size_t data_size) {
     uint8_t bounce[BOUNCE_BUFFER_SIZE];
+    uint8_t *buf = bounce;
+    size_t buf_size = BOUNCE_BUFFER_SIZE;
+    size_t count;
+    sysparam_status_t status = SYSPARAM_OK;
+
+    if (data_size > BOUNCE_BUFFER_SIZE) {
+        uint8_t *write_buf = malloc(min(data_size, WRITE_BUFFER_SIZE));
+        if (write_buf) {
+            buf = write_buf;
+            buf_size = min(data_size, WRITE_BUFFER_SIZE);
+        }
+    }
 
-    for (int i = 0; i < data_size; i += BOUNCE_BUFFER_SIZE) {
-        size_t count = min(data_size - i, BOUNCE_BUFFER_SIZE);
-        memcpy(bounce, data + i, count);
-        CHECK_FLASH_OP(spiflash_write(addr + i, bounce, count));
-        CHECK_FLASH_OP(spiflash_read(addr + i, bounce, count));
-        if (memcmp(data + i, bounce, count) != 0) {
+    for (int i = 0; i < data_size; i += count) {
+        uint32_t page_left = sdk_flashchip.page_size - ((addr + i) % sdk_flashchip.page_size);
+        count = min(min(data_size - i, buf_size), page_left);
+        memcpy(buf, data + i, count);
+        if (!spiflash_write(addr + i, buf, count) || !spiflash_read(addr + i, buf, count)) {
+            debug(1, "FLASH ERR @ 0x%08x", addr + i);
+            status = SYSPARAM_ERR_IO;
+            break;
+        }
+        if (memcmp(data + i, buf, count) != 0) {
             debug(1, "Flash write (@ 0x%08x) verify failed!", addr);
-            return SYSPARAM_ERR_IO;
+            status = SYSPARAM_ERR_IO;
+            break;
         }
     }
-    return SYSPARAM_OK;
+
+    if (buf != bounce) free(buf);
+    return status;
+}
+
+/** Translate an entry address to a flash address.  These are the same except
+ *  in log mode.
+ */
+static inline uint32_t _flash_addr(uint32_t addr) {
+    uint32_t sector_size = sdk_flashchip.sector_size;
+    uint32_t sector;
+
+    if (!_sysparam_info.log_mode) return addr;
+
+    sector = (addr / sector_size + _sysparam_info.log_offset) % _sysparam_info.log_sectors;
+    return _sysparam_info.log_base + sector * sector_size + addr % sector_size;
+}
+
+/** Read from the entry address `addr`.  Entries never cross a sector
+ *  boundary in log mode, so a single translation is enough.
+ */
+static inline bool _read_entry_data(uint32_t addr, void *buf, size_t size) {
+    return spiflash_read(_flash_addr(addr), buf, size);
+}
+
+/** Write to the entry address `addr` */
+static inline sysparam_status_t _write_entry_data(uint32_t addr, const void *data, size_t size) {
+    return _write_and_verify(_flash_addr(addr), data, size);
 }
 
 /** Erase the sectors of a region */
@@ -144,17 +310,18 @@ static sysparam_status_t _format_region(uint32_t addr, uint16_t num_sectors) {
 
     for (i = 0; i < num_sectors; i++) {
         CHECK_FLASH_OP(spiflash_erase_sector(addr + (i * SPI_FLASH_SECTOR_SIZE)));
+        _sysparam_info.erases++;
     }
     return SYSPARAM_OK;
 }
 
 /** Write the magic data at the beginning of a region */
-static inline sysparam_status_t _write_region_header(uint32_t addr, uint32_t other, bool active) {
+static inline sysparam_status_t _write_region_header(uint32_t addr, uint32_t other, bool active, uint32_t magic) {
     struct region_header header;
     sysparam_status_t status;
     int16_t num_sectors;
 
-    header.magic = SYSPARAM_MAGIC;
+    header.magic = magic;
     if (addr < other) {
         num_sectors = (other - addr) / sdk_flashchip.sector_size;
         header.flags_size = num_sectors & REGION_MASK_SIZE;
@@ -193,10 +360,47 @@ static sysparam_status_t init_write_context(struct sysparam_context *ctx) {
     memset(ctx, 0, sizeof(*ctx));
     ctx->addr = _sysparam_info.end_addr;
     debug(3, "read entry header @ 0x%08x", ctx->addr);
-    CHECK_FLASH_OP(spiflash_read(ctx->addr, (void*) &ctx->entry, ENTRY_HEADER_SIZE));
+    CHECK_FLASH_OP(_read_entry_data(ctx->addr, &ctx->entry, ENTRY_HEADER_SIZE));
     return SYSPARAM_OK;
 }
 
+/** Step to the next entry in log mode
+ *
+ *  Entries never cross a sector boundary, so once the next entry would not fit
+ *  in the current sector (or the rest of it was never written) we carry on at
+ *  the start of the next sector.  Returns false at the end of the head sector.
+ */
+static bool _log_next_entry(struct sysparam_context *ctx) {
+    uint32_t sector_size = sdk_flashchip.sector_size;
+    uint32_t sector = ctx->addr - (ctx->addr % sector_size);
+    uint32_t next_addr;
+
+    if (ctx->entry.idflags == 0xffff) {
+        next_addr = sector + sector_size;
+    } else {
+        next_addr = ctx->addr + ENTRY_SIZE(ctx->entry.len);
+        if (next_addr > sector + sector_size) {
+            // As with the two-region format, make sure nothing new gets
+            // written after this, by moving writes on to a new sector.
+            debug(1, "Encountered entry with invalid length (0x%04x) @ 0x%08x.  Skipping rest of sector.",
+                    ctx->entry.len, ctx->addr);
+            if (sector == _sysparam_info.log_head) {
+                _sysparam_info.force_compact = true;
+            }
+            next_addr = sector + sector_size;
+        }
+    }
+    if (next_addr + ENTRY_HEADER_SIZE > sector + sector_size) {
+        if (sector == _sysparam_info.log_head) {
+            ctx->addr = next_addr;
+            return false;
+        }
+        next_addr = sector + sector_size + LOG_HEADER_SIZE;
+    }
+    ctx->addr = next_addr;
+    return true;
+}
+
 /** Search through the region for an entry matching the specified id
  *
  *  @param match_id  The id to match, or 0 to match any key, or 0xfff to scan
@@ -207,7 +411,9 @@ static sysparam_status_t _find_entry(struct sysparam_context *ctx, uint16_t matc
 
     while (true) {
         if (ctx->addr == _sysparam_info.cur_base) {
-            ctx->addr += REGION_HEADER_SIZE;
+            ctx->addr += _sysparam_info.log_mode ? LOG_HEADER_SIZE : REGION_HEADER_SIZE;
+        } else if (_sysparam_info.log_mode) {
+            if (!_log_next_entry(ctx)) break;
         } else {
             uint32_t next_addr = ctx->addr + ENTRY_SIZE(ctx->entry.len);
             if (next_addr > _sysparam_info.cur_base + _sysparam_info.region_size) {
@@ -235,20 +441,31 @@ static sysparam_status_t _find_entry(struct sysparam_context *ctx, uint16_t matc
         }
 
         debug(3, "read entry header @ 0x%08x", ctx->addr);
-        CHECK_FLASH_OP(spiflash_read(ctx->addr, (void*) &ctx->entry, ENTRY_HEADER_SIZE));
+        CHECK_FLASH_OP(_read_entry_data(ctx->addr, &ctx->entry, ENTRY_HEADER_SIZE));
         debug(3, "  idflags = 0x%04x", ctx->entry.idflags);
         if (ctx->entry.idflags == 0xffff) {
             // 0xffff is never a valid id field, so this means we've hit the
             // end and are looking at unwritten flash space from here on.
+            // (In log mode, only the rest of this sector may be unwritten.)
+            if (_sysparam_info.log_mode && ctx->addr < _sysparam_info.log_head) continue;
             break;
         }
 
         id = ctx->entry.idflags & ENTRY_MASK_ID;
         if ((ctx->entry.idflags & (ENTRY_FLAG_ALIVE | ENTRY_FLAG_INVALID)) == ENTRY_FLAG_ALIVE) {
             debug(3, "  entry is alive and valid");
-            if (!(ctx->entry.idflags & ENTRY_FLAG_VALUE)) {
+            if (!(ctx->entry.idflags & ENTRY_FLAG_VALUE) && id == ENTRY_ID_BATCH) {
+                debug(3, "  entry is a committed batch, stepping into it");
+                if (ctx->entry.idflags & ENTRY_FLAG_PENDING) {
+                    ctx->pending_batch = ctx->addr;
+                }
+                // Only the container header is reclaimed by compacting
+                ctx->compactable += ENTRY_HEADER_SIZE;
+                ctx->entry.len = 0;
+            } else if (!(ctx->entry.idflags & ENTRY_FLAG_VALUE)) {
                 debug(3, "  entry is a key");
-                ctx->max_key_id = id;
+                // Keys are in id order, except that log mode moves them
+                ctx->max_key_id = max(ctx->max_key_id, id);
                 ctx->unused_keys++;
                 if (!find_value) {
                     if ((id == match_id) || (match_id == ENTRY_ID_ANY)) {
@@ -285,7 +502,7 @@ static inline sysparam_status_t _read_payload(struct sysparam_context *ctx, uint
     size_t size = min(buffer_size, ctx->entry.len);
     debug(3, "read payload (%d) @ 0x%08x", size, addr);
 
-    CHECK_FLASH_OP(spiflash_read(addr, buffer, buffer_size));
+    CHECK_FLASH_OP(_read_entry_data(addr, buffer, buffer_size));
 
     return SYSPARAM_OK;
 }
@@ -298,7 +515,7 @@ static inline sysparam_status_t _compare_payload(struct sysparam_context *ctx, u
     int i;
     for (i = 0; i < size; i += BOUNCE_BUFFER_SIZE) {
         int len = min(size - i, BOUNCE_BUFFER_SIZE);
-        CHECK_FLASH_OP(spiflash_read(addr + i, (void*)bounce, len));
+        CHECK_FLASH_OP(_read_entry_data(addr + i, bounce, len));
         if (memcmp(value + i, bounce, len)) {
             // Mismatch.
             return SYSPARAM_NOTFOUND;
@@ -307,11 +524,239 @@ static inline sysparam_status_t _compare_payload(struct sysparam_context *ctx, u
     return SYSPARAM_OK;
 }
 
+/********************************* Key index *********************************/
+
+#if SYSPARAM_KEY_INDEX
+
+#define HASH_INIT 0x811c9dc5
+
+/** Add `len` bytes to a FNV-1a hash */
+static uint32_t _hash_update(uint32_t hash, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static inline bool _index_active(void) {
+    return _sysparam_index.entries != NULL;
+}
+
+static void _index_free(void) {
+    free(_sysparam_index.entries);
+    memset(&_sysparam_index, 0, sizeof(_sysparam_index));
+}
+
+/** Discard the current index and start a new, empty one */
+static sysparam_status_t _index_start(void) {
+    _index_free();
+    _sysparam_index.entries = malloc(INDEX_GROW_ENTRIES * sizeof(struct index_entry));
+    if (!_sysparam_index.entries) {
+        debug(1, "no memory for key index");
+        return SYSPARAM_ERR_NOMEM;
+    }
+    _sysparam_index.size = INDEX_GROW_ENTRIES;
+    return SYSPARAM_OK;
+}
+
+/** Position of the first index entry with a hash >= `hash` */
+static size_t _index_lower_bound(uint32_t hash) {
+    size_t lo = 0, hi = _sysparam_index.count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (_sysparam_index.entries[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static struct index_entry *_index_by_id(uint16_t key_id) {
+    for (size_t i = 0; i < _sysparam_index.count; i++) {
+        if (_sysparam_index.entries[i].key_id == key_id) {
+            return &_sysparam_index.entries[i];
+        }
+    }
+    return NULL;
+}
+
+static uint16_t _index_max_key_id(void) {
+    uint16_t max_id = 0;
+
+    for (size_t i = 0; i < _sysparam_index.count; i++) {
+        max_id = max(max_id, _sysparam_index.entries[i].key_id);
+    }
+    return max_id;
+}
+
+/** Add a key to the index.  If memory runs out, the index is dropped. */
+static void _index_add(uint32_t hash, uint32_t key_addr, uint16_t key_id, uint16_t key_len) {
+    struct index_entry *entry;
+    size_t pos;
+
+    if (!_index_active()) return;
+
+    if (_sysparam_index.count == _sysparam_index.size) {
+        size_t new_size = _sysparam_index.size + INDEX_GROW_ENTRIES;
+        entry = realloc(_sysparam_index.entries, new_size * sizeof(struct index_entry));
+        if (!entry) {
+            debug(1, "no memory to grow key index, dropping it");
+            _index_free();
+            return;
+        }
+        _sysparam_index.entries = entry;
+        _sysparam_index.size = new_size;
+    }
+
+    pos = _index_lower_bound(hash);
+    entry = &_sysparam_index.entries[pos];
+    memmove(entry + 1, entry, (_sysparam_index.count - pos) * sizeof(struct index_entry));
+    entry->hash = hash;
+    entry->key_addr = key_addr;
+    entry->value_addr = 0;
+    entry->key_id = key_id;
+    entry->key_len = key_len;
+    _sysparam_index.count++;
+}
+
+static inline void _index_add_key(const char *key, uint16_t key_len, uint32_t key_addr, uint16_t key_id) {
+    _index_add(_hash_update(HASH_INIT, (const uint8_t *)key, key_len), key_addr, key_id, key_len);
+}
+
+/** Record the address of the current value for a key (0 if deleted) */
+static void _index_set_value(uint16_t key_id, uint32_t value_addr) {
+    struct index_entry *entry;
+
+    if (!_index_active()) return;
+
+    entry = _index_by_id(key_id);
+    if (entry) {
+        entry->value_addr = value_addr;
+    }
+}
+
+/** Scan the active region and build the index from scratch.
+ *
+ *  On failure the index is left disabled.
+ */
+static sysparam_status_t _index_build(void) {
+    struct sysparam_context ctx;
+    struct index_entry *entry;
+    uint8_t bounce[BOUNCE_BUFFER_SIZE];
+    sysparam_status_t status;
+    uint32_t hash;
+
+    status = _index_start();
+    if (status != SYSPARAM_OK) return status;
+
+    // First pass: hash every key
+    _init_context(&ctx);
+    while (true) {
+        status = _find_entry(&ctx, ENTRY_ID_ANY, false);
+        if (status != SYSPARAM_OK) break;
+
+        hash = HASH_INIT;
+        for (int i = 0; i < ctx.entry.len; i += BOUNCE_BUFFER_SIZE) {
+            size_t len = min(ctx.entry.len - i, BOUNCE_BUFFER_SIZE);
+            if (!_read_entry_data(ctx.addr + ENTRY_HEADER_SIZE + i, bounce, len)) {
+                status = SYSPARAM_ERR_IO;
+                break;
+            }
+            hash = _hash_update(hash, bounce, len);
+        }
+        if (status != SYSPARAM_OK) break;
+        _index_add(hash, ctx.addr, ctx.entry.idflags & ENTRY_MASK_ID, ctx.entry.len);
+    }
+
+    // Second pass: attach values to their keys.  As with _find_value(), the
+    // first live value for a key wins.
+    if (status == SYSPARAM_NOTFOUND) {
+        _init_context(&ctx);
+        while (true) {
+            status = _find_entry(&ctx, ENTRY_ID_ANY, true);
+            if (status != SYSPARAM_OK) break;
+            entry = _index_by_id(ctx.entry.idflags & ENTRY_MASK_ID);
+            if (entry && !entry->value_addr) {
+                entry->value_addr = ctx.addr;
+            }
+        }
+    }
+
+    if (status < 0 || !_index_active()) {
+        _index_free();
+        return status < 0 ? status : SYSPARAM_ERR_NOMEM;
+    }
+    debug(2, "key index built (%d keys)", _sysparam_index.count);
+    return SYSPARAM_OK;
+}
+
+/** Find a key using the index and position `ctx` at its key entry */
+static sysparam_status_t _index_find_key(struct sysparam_context *ctx, const char *key, uint16_t key_len) {
+    uint32_t hash = _hash_update(HASH_INIT, (const uint8_t *)key, key_len);
+    struct index_entry *entry;
+    sysparam_status_t status;
+
+    for (size_t i = _index_lower_bound(hash); i < _sysparam_index.count; i++) {
+        entry = &_sysparam_index.entries[i];
+        if (entry->hash != hash) break;
+        if (entry->key_len != key_len) continue;
+
+        // Hashes can collide, so confirm against the key stored in flash.
+        ctx->addr = entry->key_addr;
+        ctx->entry.idflags = entry->key_id | ENTRY_FLAG_ALIVE;
+        ctx->entry.len = entry->key_len;
+        status = _compare_payload(ctx, (uint8_t *)key, key_len);
+        if (status == SYSPARAM_OK) {
+            ctx->indexed = true;
+            ctx->indexed_value = entry->value_addr;
+            debug(3, "index: key match @ 0x%08x", ctx->addr);
+            return SYSPARAM_OK;
+        }
+        if (status != SYSPARAM_NOTFOUND) return status;
+    }
+    ctx->entry.len = 0;
+    ctx->entry.idflags = 0;
+    return SYSPARAM_NOTFOUND;
+}
+
+/** Position `ctx` (from _index_find_key) at the value for its key */
+static sysparam_status_t _index_find_value(struct sysparam_context *ctx) {
+    if (!ctx->indexed_value) {
+        ctx->entry.len = 0;
+        ctx->entry.idflags = 0;
+        return SYSPARAM_NOTFOUND;
+    }
+    ctx->addr = ctx->indexed_value;
+    debug(3, "index: read value header @ 0x%08x", ctx->addr);
+    CHECK_FLASH_OP(_read_entry_data(ctx->addr, &ctx->entry, ENTRY_HEADER_SIZE));
+    return SYSPARAM_OK;
+}
+
+#else /* SYSPARAM_KEY_INDEX */
+
+static inline bool _index_active(void) { return false; }
+static inline void _index_free(void) {}
+static inline uint16_t _index_max_key_id(void) { return 0; }
+static inline sysparam_status_t _index_start(void) { return SYSPARAM_OK; }
+static inline void _index_add_key(const char *key, uint16_t key_len, uint32_t key_addr, uint16_t key_id) {}
+static inline void _index_set_value(uint16_t key_id, uint32_t value_addr) {}
+static inline sysparam_status_t _index_build(void) { return SYSPARAM_OK; }
+static inline sysparam_status_t _index_find_key(struct sysparam_context *ctx, const char *key, uint16_t key_len) { return SYSPARAM_NOTFOUND; }
+static inline sysparam_status_t _index_find_value(struct sysparam_context *ctx) { return SYSPARAM_NOTFOUND; }
+
+#endif /* SYSPARAM_KEY_INDEX */
+
 /** Find the entry corresponding to the specified key name */
 static sysparam_status_t _find_key(struct sysparam_context *ctx, const char *key, uint16_t key_len) {
     sysparam_status_t status;
 
     debug(3, "find key len %d: %s", key_len, key ? key : "(null)");
+    if (key && _index_active()) {
+        return _index_find_key(ctx, key, key_len);
+    }
     while (true) {
         // Find the next key entry
         status = _find_entry(ctx, ENTRY_ID_ANY, false);
@@ -340,8 +785,26 @@ static sysparam_status_t _find_key(struct sysparam_context *ctx, const char *key
 
 /** Find the value entry matching the id field from a particular key */
 static inline sysparam_status_t _find_value(struct sysparam_context *ctx, uint16_t id_field) {
+    struct sysparam_context value_ctx;
+    sysparam_status_t status;
+    uint32_t key_addr = ctx->addr;
+
     debug(3, "find value: 0x%04x", id_field);
-    return _find_entry(ctx, id_field & ENTRY_MASK_ID, true);
+    if (ctx->indexed) {
+        return _index_find_value(ctx);
+    }
+    status = _find_entry(ctx, id_field & ENTRY_MASK_ID, true);
+    if (status != SYSPARAM_NOTFOUND || !_sysparam_info.log_mode) return status;
+
+    // Reclaiming sectors in log mode can move a key after its value, so look
+    // before the key too.
+    _init_context(&value_ctx);
+    status = _find_entry(&value_ctx, id_field & ENTRY_MASK_ID, true);
+    if (status != SYSPARAM_OK) return status;
+    if (value_ctx.addr >= key_addr) return SYSPARAM_NOTFOUND;
+    ctx->addr = value_ctx.addr;
+    ctx->entry = value_ctx.entry;
+    return SYSPARAM_OK;
 }
 
 /** Write an entry at the specified address */
@@ -353,7 +816,7 @@ static inline sysparam_status_t _write_entry(uint32_t addr, uint16_t id, const u
     entry.idflags = id | ENTRY_FLAG_ALIVE | ENTRY_FLAG_INVALID;
     entry.len = len;
     debug(3, "write initial entry header @ 0x%08x", addr);
-    status = _write_and_verify(addr, &entry, ENTRY_HEADER_SIZE);
+    status = _write_entry_data(addr, &entry, ENTRY_HEADER_SIZE);
     if (status == SYSPARAM_ERR_IO) {
         // Uh-oh.. Either the flash call failed in some way or we didn't get
         // back what we wrote.  This could be a problem because depending on
@@ -364,7 +827,7 @@ static inline sysparam_status_t _write_entry(uint32_t addr, uint16_t id, const u
         // will just skip to the next spot).
         memset(&entry, 0, ENTRY_HEADER_SIZE);
         debug(3, "zeroing entry header @ 0x%08x", addr);
-        status = _write_and_verify(addr, &entry, ENTRY_HEADER_SIZE);
+        status = _write_entry_data(addr, &entry, ENTRY_HEADER_SIZE);
         if (status != SYSPARAM_OK) return status;
 
         // Make sure future writes skip past this zeroed bit
@@ -383,115 +846,922 @@ static inline sysparam_status_t _write_entry(uint32_t addr, uint16_t id, const u
     if (_sysparam_info.end_addr == addr) {
         _sysparam_info.end_addr += ENTRY_SIZE(len);
     }
-    debug(3, "write payload (%d) @ 0x%08x", len, addr + ENTRY_HEADER_SIZE);
-    status = _write_and_verify(addr + ENTRY_HEADER_SIZE, payload, len);
-    if (status != SYSPARAM_OK) return status;
-
-    debug(3, "set entry valid @ 0x%08x", addr);
-    entry.idflags &= ~ENTRY_FLAG_INVALID;
-    status = _write_and_verify(addr, &entry, ENTRY_HEADER_SIZE);
+    debug(3, "write payload (%d) @ 0x%08x", len, addr + ENTRY_HEADER_SIZE);
+    status = _write_entry_data(addr + ENTRY_HEADER_SIZE, payload, len);
+    if (status != SYSPARAM_OK) return status;
+
+    debug(3, "set entry valid @ 0x%08x", addr);
+    entry.idflags &= ~ENTRY_FLAG_INVALID;
+    status = _write_entry_data(addr, &entry, ENTRY_HEADER_SIZE);
+
+    return status;
+}
+
+/** Mark an entry as "deleted" so it won't be considered in future reads */
+static inline sysparam_status_t _delete_entry(uint32_t addr) {
+    struct entry_header entry;
+
+    debug(2, "Deleting entry @ 0x%08x", addr);
+    debug(3, "read entry header @ 0x%08x", addr);
+    CHECK_FLASH_OP(_read_entry_data(addr, &entry, ENTRY_HEADER_SIZE));
+    // Set the ID to zero to mark it as "deleted"
+    entry.idflags &= ~ENTRY_FLAG_ALIVE;
+    debug(3, "write entry header @ 0x%08x", addr);
+    return _write_entry_data(addr, &entry, ENTRY_HEADER_SIZE);
+}
+
+/** Compact the current region, removing all deleted/unused entries, and write
+ *  the result to the alternate region, then make the new alternate region the
+ *  active one.
+ *
+ *  @param key_id  A pointer to the "current" key ID, or NULL if none.
+ *
+ *  NOTE: The value corresponding to the passed key ID will not be written to
+ *  the output (because it is assumed it will be overwritten as the next step
+ *  in `sysparam_set_data` anyway).  When compacting, this routine will
+ *  automatically update *key_id to contain the ID of this key in the new
+ *  compacted result as well.
+ */
+static sysparam_status_t _compact_params(struct sysparam_context *ctx, int *key_id) {
+    uint32_t new_base = _sysparam_info.alt_base;
+    sysparam_status_t status;
+    uint32_t addr = new_base + REGION_HEADER_SIZE;
+    uint16_t current_key_id = 0;
+    sysparam_iter_t iter;
+    uint16_t binary_flag;
+    uint16_t num_sectors = _sysparam_info.region_size / sdk_flashchip.sector_size;
+
+    debug(1, "compacting region (current size %d, expect to recover %d%s bytes)...",
+            _sysparam_info.end_addr - _sysparam_info.cur_base,
+            ctx ? ctx->compactable : 0,
+            (ctx && ctx->unused_keys > 0) ? "+ (unused keys present)" : "");
+
+    status = _format_region(new_base, num_sectors);
+    if (status < 0) return status;
+    status = sysparam_iter_start(&iter);
+    if (status < 0) return status;
+
+    // The index is rebuilt for the new region as entries are written.  If it
+    // can't be allocated, lookups just go back to scanning.
+    _index_start();
+
+    while (true) {
+        status = sysparam_iter_next(&iter);
+        if (status != SYSPARAM_OK) break;
+
+        current_key_id++;
+
+        // Write the key to the new region
+        debug(2, "writing %d key @ 0x%08x", current_key_id, addr);
+        status = _write_entry(addr, current_key_id, (uint8_t *)iter.key, iter.key_len);
+        if (status < 0) break;
+        _index_add_key(iter.key, iter.key_len, addr, current_key_id);
+        addr += ENTRY_SIZE(iter.key_len);
+
+        if (key_id && (iter.ctx->entry.idflags & ENTRY_MASK_ID) == *key_id) {
+            // Update key_id to have the correct id for the compacted result
+            *key_id = current_key_id;
+            // Don't copy the old value, since we'll just be deleting it
+            // and writing a new one as soon as we return.
+            continue;
+        }
+
+        // Copy the value to the new region
+        debug(2, "writing %d value @ 0x%08x", current_key_id, addr);
+        binary_flag = iter.binary ? ENTRY_FLAG_BINARY : 0;
+        status = _write_entry(addr, current_key_id | ENTRY_FLAG_VALUE | binary_flag, iter.value, iter.value_len);
+        if (status < 0) break;
+        _index_set_value(current_key_id, addr);
+        addr += ENTRY_SIZE(iter.value_len);
+    }
+    sysparam_iter_end(&iter);
+
+    // If we broke out with an error, return the error instead of continuing.
+    if (status < 0) {
+        debug(1, "error encountered during compacting (%d)", status);
+        _index_build();
+        return status;
+    }
+
+    // Switch to officially using the new region.
+    status = _write_region_header(new_base, _sysparam_info.cur_base, true, SYSPARAM_MAGIC);
+    if (status < 0) {
+        _index_build();
+        return status;
+    }
+    status = _write_region_header(_sysparam_info.cur_base, new_base, false,
+            _sysparam_info.batch_magic ? SYSPARAM_BATCH_MAGIC : SYSPARAM_MAGIC);
+    if (status < 0) {
+        _index_free();
+        return status;
+    }
+
+    _sysparam_info.alt_base = _sysparam_info.cur_base;
+    _sysparam_info.cur_base = new_base;
+    _sysparam_info.end_addr = addr;
+    _sysparam_info.force_compact = false;
+    _sysparam_info.batch_magic = false;
+
+    if (ctx) {
+        // Fix up ctx so it doesn't point to invalid stuff
+        memset(ctx, 0, sizeof(*ctx));
+        ctx->addr = addr;
+        ctx->max_key_id = current_key_id;
+    }
+
+    debug(1, "done compacting (current size %d)", _sysparam_info.end_addr - _sysparam_info.cur_base);
+
+    return SYSPARAM_OK;
+}
+
+/** Gather the statistics for a context positioned using the key index
+ *
+ *  A context from the index has skipped the scan that normally fills in
+ *  `unused_keys`, `compactable`, etc, so scan the whole region now.  Any space
+ *  already added to `compactable` by the caller is kept.
+ */
+static void _rescan_indexed(struct sysparam_context *ctx) {
+    size_t compactable = ctx->compactable;
+
+    _init_context(ctx);
+    ctx->compactable = compactable;
+    _find_entry(ctx, ENTRY_ID_END, false);
+}
+
+/** Clear `flags` in the header of the entry at `addr` */
+static inline sysparam_status_t _clear_entry_flags(uint32_t addr, uint16_t flags) {
+    struct entry_header entry;
+
+    debug(3, "read entry header @ 0x%08x", addr);
+    CHECK_FLASH_OP(_read_entry_data(addr, &entry, ENTRY_HEADER_SIZE));
+    entry.idflags &= ~flags;
+    debug(3, "write entry header @ 0x%08x", addr);
+    return _write_entry_data(addr, &entry, ENTRY_HEADER_SIZE);
+}
+
+#define ID_BITMAP_WORDS ((MAX_KEY_ID + 32) / 32)
+
+/** Finish applying a committed batch after a restart
+ *
+ *  Old values for keys updated by the batch at `batch_addr` may still be
+ *  alive (and would be found before the new ones), so delete them and then
+ *  mark the batch as applied.  Batches written when reclaiming a log sector
+ *  also contain copies of keys, so older copies of those are deleted too.
+ */
+static sysparam_status_t _recover_batch(uint32_t batch_addr) {
+    struct sysparam_context ctx;
+    struct entry_header entry;
+    sysparam_status_t status;
+    uint32_t *ids, *key_ids;
+    uint32_t addr, end;
+    uint16_t id;
+
+    debug(1, "finishing interrupted batch @ 0x%08x", batch_addr);
+    ids = calloc(ID_BITMAP_WORDS * 2, sizeof(uint32_t));
+    if (!ids) return SYSPARAM_ERR_NOMEM;
+    key_ids = ids + ID_BITMAP_WORDS;
+
+    // Collect the ids of all keys and values (set or deleted) in the batch
+    status = SYSPARAM_OK;
+    if (!_read_entry_data(batch_addr, &entry, ENTRY_HEADER_SIZE)) {
+        free(ids);
+        return SYSPARAM_ERR_IO;
+    }
+    end = batch_addr + ENTRY_SIZE(entry.len);
+    for (addr = batch_addr + ENTRY_HEADER_SIZE; addr < end; addr += ENTRY_SIZE(entry.len)) {
+        if (!_read_entry_data(addr, &entry, ENTRY_HEADER_SIZE)) {
+            status = SYSPARAM_ERR_IO;
+            break;
+        }
+        id = entry.idflags & ENTRY_MASK_ID;
+        if (entry.idflags & ENTRY_FLAG_VALUE) {
+            ids[id / 32] |= 1u << (id % 32);
+        } else {
+            key_ids[id / 32] |= 1u << (id % 32);
+        }
+    }
+
+    // Delete any other live values (and keys) for those ids from before the
+    // batch
+    for (int find_value = 0; find_value < 2; find_value++) {
+        uint32_t *bitmap = find_value ? ids : key_ids;
+
+        _init_context(&ctx);
+        while (status == SYSPARAM_OK) {
+            status = _find_entry(&ctx, ENTRY_ID_ANY, find_value);
+            if (status != SYSPARAM_OK || ctx.addr >= batch_addr) break;
+            id = ctx.entry.idflags & ENTRY_MASK_ID;
+            if (bitmap[id / 32] & (1u << (id % 32))) {
+                status = _delete_entry(ctx.addr);
+            }
+        }
+        if (status == SYSPARAM_NOTFOUND) status = SYSPARAM_OK;
+    }
+    free(ids);
+    if (status < 0) return status;
+
+    return _clear_entry_flags(batch_addr, ENTRY_FLAG_PENDING);
+}
+
+/** Delete all but the first live value for each key
+ *
+ *  Losing power between writing a new value and deleting the old one leaves
+ *  both alive.  Reads find the first one, but the next update would only
+ *  replace that one, and the other would then show up again.
+ */
+static sysparam_status_t _delete_duplicate_values(void) {
+    struct sysparam_context ctx;
+    sysparam_status_t status;
+    uint32_t *seen;
+    uint16_t id;
+
+    seen = calloc(ID_BITMAP_WORDS, sizeof(uint32_t));
+    if (!seen) return SYSPARAM_ERR_NOMEM;
+
+    _init_context(&ctx);
+    while (true) {
+        status = _find_entry(&ctx, ENTRY_ID_ANY, true);
+        if (status != SYSPARAM_OK) break;
+        id = ctx.entry.idflags & ENTRY_MASK_ID;
+        if (seen[id / 32] & (1u << (id % 32))) {
+            debug(1, "deleting duplicate value @ 0x%08x", ctx.addr);
+            status = _delete_entry(ctx.addr);
+            if (status < 0) break;
+        }
+        seen[id / 32] |= 1u << (id % 32);
+    }
+    free(seen);
+    return status < 0 ? status : SYSPARAM_OK;
+}
+
+/********************************* Log mode **********************************/
+
+/** Read the header of sector `index` of a log-mode area at `base` */
+static inline sysparam_status_t _log_read_header(uint32_t base, uint16_t index, struct log_header *header) {
+    CHECK_FLASH_OP(spiflash_read(base + index * sdk_flashchip.sector_size, (uint8_t *)header, LOG_HEADER_SIZE));
+    return SYSPARAM_OK;
+}
+
+static inline bool _log_header_valid(struct log_header *header, uint16_t num_sectors, uint16_t index) {
+    return header->magic == SYSPARAM_LOG_MAGIC && header->num_sectors == num_sectors && header->index == index;
+}
+
+/** Erase sector `index` of a log-mode area and mark it as free
+ *
+ *  The erase count is carried over from the old header (if any), or from
+ *  `erase_count` otherwise.
+ */
+static sysparam_status_t _log_format_sector(uint32_t base, uint16_t num_sectors, uint16_t index, uint32_t erase_count) {
+    uint32_t addr = base + index * sdk_flashchip.sector_size;
+    struct log_header header;
+    sysparam_status_t status;
+
+    status = _log_read_header(base, index, &header);
+    if (status < 0) return status;
+    if (_log_header_valid(&header, num_sectors, index) && header.erase_count != 0xffffffff) {
+        erase_count = header.erase_count;
+    }
+
+    status = _format_region(addr, 1);
+    if (status < 0) return status;
+
+    header.magic = SYSPARAM_LOG_MAGIC;
+    header.num_sectors = num_sectors;
+    header.index = index;
+    header.erase_count = erase_count + 1;
+    header.seq = LOG_SEQ_FREE;
+    header.seq_check = LOG_SEQ_FREE;
+    debug(3, "write log header (erase count %d) @ 0x%08x", header.erase_count, addr);
+    return _write_and_verify(addr, &header, LOG_HEADER_SIZE);
+}
+
+/** Make the (free) sector after the head into the new head of the log */
+static sysparam_status_t _log_start_sector(void) {
+    uint32_t sector_size = sdk_flashchip.sector_size;
+    uint32_t head = _sysparam_info.log_head + sector_size;
+    uint32_t seq[2];
+    sysparam_status_t status;
+
+    if (!_sysparam_info.log_free) return SYSPARAM_ERR_FULL;
+
+    seq[0] = _sysparam_info.log_seq_base + head / sector_size;
+    seq[1] = ~seq[0];
+    debug(2, "starting log sector %d @ 0x%08x", seq[0], _flash_addr(head));
+    status = _write_and_verify(_flash_addr(head) + offsetof(struct log_header, seq), seq, sizeof(seq));
+    if (status < 0) return status;
+
+    _sysparam_info.log_head = head;
+    _sysparam_info.log_free--;
+    _sysparam_info.end_addr = head + LOG_HEADER_SIZE;
+    _sysparam_info.force_compact = false;
+    return SYSPARAM_OK;
+}
+
+/** Get the address to write a new entry of `size` bytes at (normally
+ *  `*addr`).  In log mode, this starts a new sector if the entry won't fit in
+ *  the current one.
+ */
+static sysparam_status_t _log_reserve(uint32_t *addr, size_t size) {
+    uint32_t head_end = _sysparam_info.log_head + sdk_flashchip.sector_size - LOG_SECTOR_SLACK;
+    sysparam_status_t status;
+
+    if (!_sysparam_info.log_mode) return SYSPARAM_OK;
+
+    if (!_sysparam_info.force_compact && *addr >= _sysparam_info.log_head && *addr + size <= head_end) {
+        return SYSPARAM_OK;
+    }
+    status = _log_start_sector();
+    if (status < 0) return status;
+    *addr = _sysparam_info.end_addr;
+    return SYSPARAM_OK;
+}
+
+/** Space left for ordinary entries in the head sector of the log */
+static inline size_t _log_head_space(void) {
+    uint32_t head_end = _sysparam_info.log_head + sdk_flashchip.sector_size - LOG_SECTOR_SLACK;
+
+    if (_sysparam_info.force_compact || _sysparam_info.end_addr >= head_end) return 0;
+    return head_end - _sysparam_info.end_addr;
+}
+
+/** Space left for new entries, not counting anything compacting could
+ *  recover.
+ */
+static size_t _free_space(void) {
+    if (!_sysparam_info.log_mode) {
+        return _sysparam_info.cur_base + _sysparam_info.region_size - _sysparam_info.end_addr;
+    }
+    return _log_head_space() + _sysparam_info.log_free * (sdk_flashchip.sector_size - LOG_HEADER_SIZE - LOG_SECTOR_SLACK);
+}
+
+/** Reclaim the oldest sector of the log
+ *
+ *  Live entries in the oldest sector are copied to the head of the log as a
+ *  single batch container, so that if we're interrupted, either the originals
+ *  or the copies win (see _recover_batch()).  Keys which no longer have a
+ *  value are dropped.  The oldest sector is then erased and becomes free.
+ */
+static sysparam_status_t _log_reclaim(void) {
+    uint32_t sector_size = sdk_flashchip.sector_size;
+    uint32_t tail = _sysparam_info.cur_base;
+    size_t buf_size = sector_size - LOG_HEADER_SIZE - LOG_SECTOR_SLACK;
+    struct sysparam_context ctx;
+    sysparam_status_t status;
+    uint32_t *has_value;
+    uint32_t batch_addr = 0;
+    uint8_t *buf;
+    size_t pos = 0;
+    uint16_t id;
+
+    debug(1, "reclaiming log sector @ 0x%08x", _flash_addr(tail));
+
+    if (tail == _sysparam_info.log_head) {
+        // The copies can't go in the sector we're about to erase
+        status = _log_start_sector();
+        if (status < 0) return status;
+    }
+
+    has_value = calloc(ID_BITMAP_WORDS, sizeof(uint32_t));
+    buf = malloc(buf_size);
+    if (!has_value || !buf) {
+        free(has_value);
+        free(buf);
+        return SYSPARAM_ERR_NOMEM;
+    }
+
+    _init_context(&ctx);
+    while (true) {
+        status = _find_entry(&ctx, ENTRY_ID_ANY, true);
+        if (status != SYSPARAM_OK) break;
+        id = ctx.entry.idflags & ENTRY_MASK_ID;
+        has_value[id / 32] |= 1u << (id % 32);
+    }
+
+    // Walk through the oldest sector (only), collecting everything alive
+    ctx.addr = tail + LOG_HEADER_SIZE;
+    while (status == SYSPARAM_NOTFOUND && ctx.addr + ENTRY_HEADER_SIZE <= tail + sector_size) {
+        if (!_read_entry_data(ctx.addr, &ctx.entry, ENTRY_HEADER_SIZE)) {
+            status = SYSPARAM_ERR_IO;
+            break;
+        }
+        if (ctx.entry.idflags == 0xffff || ctx.addr + ENTRY_SIZE(ctx.entry.len) > tail + sector_size) break;
+
+        id = ctx.entry.idflags & ENTRY_MASK_ID;
+        if ((ctx.entry.idflags & (ENTRY_FLAG_ALIVE | ENTRY_FLAG_INVALID)) == ENTRY_FLAG_ALIVE) {
+            if (!(ctx.entry.idflags & ENTRY_FLAG_VALUE) && id == ENTRY_ID_BATCH) {
+                // Copy the contents of batches, but not the container
+                ctx.entry.len = 0;
+            } else if ((ctx.entry.idflags & ENTRY_FLAG_VALUE) || (has_value[id / 32] & (1u << (id % 32)))) {
+                if (pos + ENTRY_SIZE(ctx.entry.len) > buf_size) {
+                    debug(1, "oldest log sector is too full to reclaim");
+                    status = SYSPARAM_ERR_FULL;
+                    break;
+                }
+                if (!_read_entry_data(ctx.addr, buf + pos, ENTRY_SIZE(ctx.entry.len))) {
+                    status = SYSPARAM_ERR_IO;
+                    break;
+                }
+                pos += ENTRY_SIZE(ctx.entry.len);
+            }
+        }
+        ctx.addr += ENTRY_SIZE(ctx.entry.len);
+    }
+    free(has_value);
+    if (status == SYSPARAM_NOTFOUND) status = SYSPARAM_OK;
+
+    if (status == SYSPARAM_OK && pos) {
+        // Unlike ordinary entries, the container may use the slack at the end
+        // of the sector.
+        batch_addr = _sysparam_info.end_addr;
+        status = _log_reserve(&batch_addr, ENTRY_SIZE(pos) - LOG_SECTOR_SLACK);
+        if (status == SYSPARAM_OK) {
+            status = _write_entry(batch_addr, ENTRY_ID_BATCH | ENTRY_FLAG_PENDING, buf, pos);
+        }
+    }
+    free(buf);
+    if (status < 0) return status;
+
+    // The copies are safely written, so the originals can go
+    status = _log_format_sector(_sysparam_info.log_base, _sysparam_info.log_sectors,
+                                _flash_addr(tail) / sector_size - _sysparam_info.log_base / sector_size, 0);
+    if (status == SYSPARAM_OK) {
+        _sysparam_info.cur_base += sector_size;
+        _sysparam_info.log_free++;
+        if (batch_addr) {
+            status = _clear_entry_flags(batch_addr, ENTRY_FLAG_PENDING);
+        }
+    } else if (batch_addr) {
+        // Make sure the originals won't be found instead of the copies
+        _recover_batch(batch_addr);
+    }
+
+    // Entries have moved around, so the index has to be redone
+    _index_build();
+
+    return status;
+}
+
+/** Total size of all live keys and values, which is how much reclaiming every
+ *  sector could shrink the log to (give or take a container header per
+ *  sector).
+ */
+static sysparam_status_t _log_live_space(size_t *live) {
+    struct sysparam_context ctx;
+    sysparam_status_t status = SYSPARAM_OK;
+
+    *live = 0;
+    for (int find_value = 0; find_value < 2; find_value++) {
+        _init_context(&ctx);
+        while (true) {
+            status = _find_entry(&ctx, ENTRY_ID_ANY, find_value);
+            if (status != SYSPARAM_OK) break;
+            *live += ENTRY_SIZE(ctx.entry.len);
+        }
+        if (status < 0) return status;
+    }
+    return SYSPARAM_OK;
+}
+
+/** Make sure there is space to write `needed_space` bytes (in entries of at
+ *  most `max_entry` bytes) to the log, reclaiming old sectors as necessary.
+ */
+static sysparam_status_t _log_make_space(size_t needed_space, size_t max_entry) {
+    size_t sector_space = sdk_flashchip.sector_size - LOG_HEADER_SIZE - LOG_SECTOR_SLACK;
+    sysparam_status_t status;
+    uint16_t new_sectors, used, tries;
+    size_t live;
+
+    if (max_entry > sector_space) {
+        debug(1, "entry too large for log sector (%d bytes)", max_entry);
+        return SYSPARAM_ERR_FULL;
+    }
+
+    // Up to two entries may be written, so we could need two new sectors, on
+    // top of the spare one.
+    if (needed_space <= _log_head_space()) {
+        new_sectors = 0;
+    } else if (needed_space <= sector_space) {
+        new_sectors = 1;
+    } else {
+        new_sectors = 2;
+    }
+    if (_sysparam_info.log_free >= LOG_SPARE_SECTORS + new_sectors) return SYSPARAM_OK;
+
+    // Before erasing anything, check that whatever is still alive, plus the
+    // new entries, will fit in the area once every sector has been reclaimed.
+    status = _log_live_space(&live);
+    if (status < 0) return status;
+    if (live + needed_space > (_sysparam_info.log_sectors - LOG_SPARE_SECTORS) * (sector_space - ENTRY_HEADER_SIZE)) {
+        debug(1, "log full (%d bytes live, need %d)", live, needed_space);
+        return SYSPARAM_ERR_FULL;
+    }
+
+    used = _sysparam_info.log_sectors - _sysparam_info.log_free;
+    for (tries = 0; _sysparam_info.log_free < LOG_SPARE_SECTORS + new_sectors; tries++) {
+        if (tries >= used) {
+            debug(1, "log full (reclaimed %d sectors without enough space)", tries);
+            return SYSPARAM_ERR_FULL;
+        }
+        status = _log_reclaim();
+        if (status < 0) return status;
+        if (needed_space <= _log_head_space()) {
+            new_sectors = 0;
+        }
+    }
+    return SYSPARAM_OK;
+}
+
+/** Find an id which is not used by any key
+ *
+ *  Key ids are never renumbered in log mode, so once they run out, ids of
+ *  keys which have since been dropped are used again.
+ */
+static sysparam_status_t _log_unused_key_id(uint16_t *key_id) {
+    struct sysparam_context ctx;
+    sysparam_status_t status;
+    uint32_t *used;
+    uint16_t id;
+
+    used = calloc(ID_BITMAP_WORDS, sizeof(uint32_t));
+    if (!used) return SYSPARAM_ERR_NOMEM;
+
+    _init_context(&ctx);
+    while (true) {
+        status = _find_entry(&ctx, ENTRY_ID_ANY, false);
+        if (status != SYSPARAM_OK) break;
+        id = ctx.entry.idflags & ENTRY_MASK_ID;
+        used[id / 32] |= 1u << (id % 32);
+    }
+    if (status == SYSPARAM_NOTFOUND) {
+        status = SYSPARAM_ERR_FULL;
+        for (id = 1; id <= MAX_KEY_ID; id++) {
+            if (!(used[id / 32] & (1u << (id % 32)))) {
+                *key_id = id;
+                status = SYSPARAM_OK;
+                break;
+            }
+        }
+    }
+    free(used);
+    return status;
+}
+
+/** Find the oldest and newest sectors of a log-mode area and set up
+ *  `_sysparam_info` to use it
+ *
+ *  Sectors left half-formatted or half-started by a power loss are formatted
+ *  again.
+ */
+static sysparam_status_t _log_init(uint32_t base, uint16_t num_sectors) {
+    uint32_t sector_size = sdk_flashchip.sector_size;
+    struct log_header *headers;
+    sysparam_status_t status = SYSPARAM_OK;
+    uint32_t max_erase_count = 0;
+    int tail = -1, used = 0;
+    uint16_t i, prev;
+
+    headers = malloc(num_sectors * sizeof(struct log_header));
+    if (!headers) return SYSPARAM_ERR_NOMEM;
+
+    for (i = 0; i < num_sectors && status == SYSPARAM_OK; i++) {
+        status = _log_read_header(base, i, &headers[i]);
+        if (_log_header_valid(&headers[i], num_sectors, i)) {
+            max_erase_count = max(max_erase_count, headers[i].erase_count);
+        }
+    }
+
+    // Sectors in use have consecutive sequence numbers, so there should be
+    // exactly one whose predecessor doesn't come just before it.
+    for (i = 0; i < num_sectors && status == SYSPARAM_OK; i++) {
+        if (!_log_header_valid(&headers[i], num_sectors, i) || headers[i].seq_check != ~headers[i].seq) continue;
+        used++;
+        prev = (i + num_sectors - 1) % num_sectors;
+        if (_log_header_valid(&headers[prev], num_sectors, prev) && headers[prev].seq_check == ~headers[prev].seq &&
+                headers[prev].seq + 1 == headers[i].seq) {
+            continue;
+        }
+        if (tail >= 0) {
+            debug(1, "log area @ 0x%08x has more than one oldest sector", base);
+            status = SYSPARAM_ERR_CORRUPT;
+        }
+        tail = i;
+    }
+    if (status == SYSPARAM_OK && tail < 0) {
+        debug(1, "log area @ 0x%08x has no sectors in use", base);
+        status = SYSPARAM_ERR_CORRUPT;
+    }
+
+    // Everything else should be free
+    for (i = 0; i < num_sectors && status == SYSPARAM_OK; i++) {
+        if (!_log_header_valid(&headers[i], num_sectors, i) ||
+                (headers[i].seq_check != ~headers[i].seq &&
+                 (headers[i].seq != LOG_SEQ_FREE || headers[i].seq_check != LOG_SEQ_FREE))) {
+            debug(2, "reformatting log sector @ 0x%08x", base + i * sector_size);
+            status = _log_format_sector(base, num_sectors, i, max_erase_count);
+        }
+    }
+
+    if (status == SYSPARAM_OK) {
+        // Number the log from the oldest sector, which is at virtual address
+        // `sector_size` (0 means "no address" elsewhere).
+        _sysparam_info.log_mode = true;
+        _sysparam_info.log_base = base;
+        _sysparam_info.log_sectors = num_sectors;
+        _sysparam_info.log_free = num_sectors - used;
+        _sysparam_info.log_offset = (tail + num_sectors - 1) % num_sectors;
+        _sysparam_info.log_seq_base = headers[tail].seq - 1;
+        _sysparam_info.log_head = used * sector_size;
+        _sysparam_info.cur_base = sector_size;
+        _sysparam_info.alt_base = 0;
+        _sysparam_info.region_size = num_sectors * sector_size;
+        _sysparam_info.end_addr = _sysparam_info.log_head + sector_size;
+        debug(3, "Log area @ 0x%08x: %d sectors in use, oldest @ 0x%08x (seq %d)", base, used, base + tail * sector_size, headers[tail].seq);
+    }
+    free(headers);
+    return status;
+}
+
+static inline struct batch_record *_batch_next(struct batch_record *rec) {
+    return (struct batch_record *)((uint8_t *)rec + BATCH_RECORD_SIZE(rec->key_len, rec->value_len));
+}
+
+#define BATCH_FOR_EACH(batch, rec) \
+    for (rec = (struct batch_record *)(batch)->buf; \
+         (uint8_t *)rec < (batch)->buf + (batch)->len; \
+         rec = _batch_next(rec))
+
+#define BATCH_RECORD_KEY(rec) ((char *)((rec) + 1))
+#define BATCH_RECORD_VALUE(rec) ((uint8_t *)((rec) + 1) + (rec)->key_len)
+
+/** Check whether the current value of a batch record (pointed to by `ctx`)
+ *  actually needs replacing
+ */
+static sysparam_status_t _batch_check_value(struct batch_record *rec, struct sysparam_context *ctx, size_t *reclaimable) {
+    sysparam_status_t status;
+    uint16_t binary_flag = (rec->flags & BATCH_RECORD_BINARY) ? ENTRY_FLAG_BINARY : 0;
+
+    rec->old_value_addr = ctx->addr;
+    if (rec->value_len && ctx->entry.len == rec->value_len &&
+            (ctx->entry.idflags & ENTRY_FLAG_BINARY) == binary_flag) {
+        status = _compare_payload(ctx, BATCH_RECORD_VALUE(rec), rec->value_len);
+        if (status == SYSPARAM_OK) {
+            rec->flags |= BATCH_RECORD_SKIP;
+            return SYSPARAM_OK;
+        }
+        if (status != SYSPARAM_NOTFOUND) return status;
+    }
+    *reclaimable += ENTRY_SIZE(ctx->entry.len);
+    return SYSPARAM_OK;
+}
+
+/** Look up the key and current value of a batch record using the index */
+static sysparam_status_t _batch_resolve(struct batch_record *rec, size_t *reclaimable) {
+    struct sysparam_context ctx;
+    sysparam_status_t status;
+
+    _init_context(&ctx);
+    status = _find_key(&ctx, BATCH_RECORD_KEY(rec), rec->key_len);
+    if (status == SYSPARAM_NOTFOUND) return SYSPARAM_OK;
+    if (status < 0) return status;
+
+    rec->key_id = ctx.entry.idflags & ENTRY_MASK_ID;
+    status = _find_value(&ctx, rec->key_id);
+    if (status == SYSPARAM_NOTFOUND) return SYSPARAM_OK;
+    if (status < 0) return status;
+
+    return _batch_check_value(rec, &ctx, reclaimable);
+}
+
+/** Look up the keys and current values of all batch records in two passes
+ *  over the region, rather than scanning once per record.  This also leaves
+ *  the region statistics in `ctx`, like `_find_entry(ctx, ENTRY_ID_END)`.
+ */
+static sysparam_status_t _batch_scan(sysparam_batch_t *batch, struct sysparam_context *ctx, size_t *reclaimable) {
+    struct sysparam_context value_ctx;
+    struct batch_record *rec;
+    sysparam_status_t status;
+    uint16_t id;
+
+    while (true) {
+        status = _find_entry(ctx, ENTRY_ID_ANY, false);
+        if (status == SYSPARAM_NOTFOUND) break;
+        if (status < 0) return status;
+        BATCH_FOR_EACH(batch, rec) {
+            if (rec->key_id < 0 && rec->key_len == ctx->entry.len) {
+                status = _compare_payload(ctx, (uint8_t *)BATCH_RECORD_KEY(rec), rec->key_len);
+                if (status == SYSPARAM_OK) {
+                    rec->key_id = ctx->entry.idflags & ENTRY_MASK_ID;
+                    break;
+                }
+                if (status != SYSPARAM_NOTFOUND) return status;
+            }
+        }
+    }
 
-    return status;
+    _init_context(&value_ctx);
+    while (true) {
+        status = _find_entry(&value_ctx, ENTRY_ID_ANY, true);
+        if (status == SYSPARAM_NOTFOUND) break;
+        if (status < 0) return status;
+        id = value_ctx.entry.idflags & ENTRY_MASK_ID;
+        BATCH_FOR_EACH(batch, rec) {
+            if (rec->key_id == id && !rec->old_value_addr) {
+                status = _batch_check_value(rec, &value_ctx, reclaimable);
+                if (status < 0) return status;
+                break;
+            }
+        }
+    }
+    return SYSPARAM_OK;
 }
 
-/** Mark an entry as "deleted" so it won't be considered in future reads */
-static inline sysparam_status_t _delete_entry(uint32_t addr) {
-    struct entry_header entry;
+/** Append a batch entry header and payload to `buf` */
+static inline size_t _batch_put_entry(uint8_t *buf, uint16_t idflags, const void *payload, uint16_t len) {
+    struct entry_header entry = { .idflags = idflags, .len = len };
 
-    debug(2, "Deleting entry @ 0x%08x", addr);
-    debug(3, "read entry header @ 0x%08x", addr);
-    CHECK_FLASH_OP(spiflash_read(addr, (uint8_t*) &entry, ENTRY_HEADER_SIZE));
-    // Set the ID to zero to mark it as "deleted"
-    entry.idflags &= ~ENTRY_FLAG_ALIVE;
-    debug(3, "write entry header @ 0x%08x", addr);
-    return _write_and_verify(addr, &entry, ENTRY_HEADER_SIZE);
+    memcpy(buf, &entry, ENTRY_HEADER_SIZE);
+    if (len) {
+        memcpy(buf + ENTRY_HEADER_SIZE, payload, len);
+    }
+    return ENTRY_SIZE(len);
 }
 
-/** Compact the current region, removing all deleted/unused entries, and write
- *  the result to the alternate region, then make the new alternate region the
- *  active one.
- *
- *  @param key_id  A pointer to the "current" key ID, or NULL if none.
- *
- *  NOTE: The value corresponding to the passed key ID will not be written to
- *  the output (because it is assumed it will be overwritten as the next step
- *  in `sysparam_set_data` anyway).  When compacting, this routine will
- *  automatically update *key_id to contain the ID of this key in the new
- *  compacted result as well.
+/** Give the active region SYSPARAM_BATCH_MAGIC, if it doesn't have it yet, so
+ *  that a batch container can be written to it.  Log-mode areas are never
+ *  recognized by code from before batches, so they are left alone.
  */
-static sysparam_status_t _compact_params(struct sysparam_context *ctx, int *key_id) {
-    uint32_t new_base = _sysparam_info.alt_base;
+static sysparam_status_t _set_batch_magic(void) {
+    uint32_t magic = SYSPARAM_BATCH_MAGIC;
     sysparam_status_t status;
-    uint32_t addr = new_base + REGION_HEADER_SIZE;
-    uint16_t current_key_id = 0;
-    sysparam_iter_t iter;
-    uint16_t binary_flag;
-    uint16_t num_sectors = _sysparam_info.region_size / sdk_flashchip.sector_size;
 
-    debug(1, "compacting region (current size %d, expect to recover %d%s bytes)...",
-            _sysparam_info.end_addr - _sysparam_info.cur_base,
-            ctx ? ctx->compactable : 0,
-            (ctx && ctx->unused_keys > 0) ? "+ (unused keys present)" : "");
+    if (_sysparam_info.log_mode || _sysparam_info.batch_magic) return SYSPARAM_OK;
 
-    status = _format_region(new_base, num_sectors);
-    if (status < 0) return status;
-    status = sysparam_iter_start(&iter);
+    debug(2, "marking region @ 0x%08x as holding batches", _sysparam_info.cur_base);
+    status = _write_and_verify(_sysparam_info.cur_base, &magic, sizeof(magic));
     if (status < 0) return status;
+    _sysparam_info.batch_magic = true;
+    return SYSPARAM_OK;
+}
+
+/** Write all staged records in a batch as a single container entry */
+static sysparam_status_t _commit_batch(sysparam_batch_t *batch) {
+    struct sysparam_context ctx;
+    struct batch_record *rec;
+    sysparam_status_t status;
+    bool compacted = false;
+    size_t needed_space, free_space, reclaimable;
+    int new_keys;
+    uint16_t next_id;
+    uint8_t *buf;
+    size_t pos;
+    uint32_t batch_addr, payload_addr;
+
+    if (_sysparam_info.log_mode) {
+        // Make room first, as reclaiming moves entries around.  The
+        // container has to fit in a single sector, so assume every key is new.
+        needed_space = ENTRY_HEADER_SIZE;
+        BATCH_FOR_EACH(batch, rec) {
+            needed_space += ENTRY_SIZE(rec->key_len) + ENTRY_SIZE(rec->value_len);
+        }
+        status = _log_make_space(needed_space, needed_space);
+        if (status < 0) return status;
+    }
 
     while (true) {
-        status = sysparam_iter_next(&iter);
-        if (status != SYSPARAM_OK) break;
+        if (_sysparam_info.force_compact && !compacted && !_sysparam_info.log_mode) {
+            status = _compact_params(NULL, NULL);
+            if (status < 0) return status;
+            compacted = true;
+        }
 
-        current_key_id++;
+        BATCH_FOR_EACH(batch, rec) {
+            rec->key_id = -1;
+            rec->old_value_addr = 0;
+            rec->flags &= ~BATCH_RECORD_SKIP;
+        }
 
-        // Write the key to the new region
-        debug(2, "writing %d key @ 0x%08x", current_key_id, addr);
-        status = _write_entry(addr, current_key_id, (uint8_t *)iter.key, iter.key_len);
-        if (status < 0) break;
-        addr += ENTRY_SIZE(iter.key_len);
+        _init_context(&ctx);
+        reclaimable = 0;
+        if (_index_active()) {
+            ctx.max_key_id = _index_max_key_id();
+            ctx.indexed = true;
+            BATCH_FOR_EACH(batch, rec) {
+                status = _batch_resolve(rec, &reclaimable);
+                if (status < 0) return status;
+            }
+        } else {
+            status = _batch_scan(batch, &ctx, &reclaimable);
+            if (status < 0) return status;
+        }
 
-        if (key_id && (iter.ctx->entry.idflags & ENTRY_MASK_ID) == *key_id) {
-            // Update key_id to have the correct id for the compacted result
-            *key_id = current_key_id;
-            // Don't copy the old value, since we'll just be deleting it
-            // and writing a new one as soon as we return.
-            continue;
+        needed_space = 0;
+        new_keys = 0;
+        BATCH_FOR_EACH(batch, rec) {
+            if (!rec->old_value_addr && !rec->value_len) {
+                // Deleting something which isn't there
+                rec->flags |= BATCH_RECORD_SKIP;
+            }
+            if (rec->flags & BATCH_RECORD_SKIP) continue;
+            if (rec->key_id < 0) {
+                needed_space += ENTRY_SIZE(rec->key_len);
+                new_keys++;
+            }
+            needed_space += ENTRY_SIZE(rec->value_len);
+        }
+        if (!needed_space) {
+            debug(1, "batch: nothing to change");
+            return SYSPARAM_OK;
+        }
+        if (needed_space > MAX_VALUE_LEN) {
+            debug(1, "batch too large (%d bytes)", needed_space);
+            return SYSPARAM_ERR_FULL;
         }
+        needed_space += ENTRY_HEADER_SIZE;
 
-        // Copy the value to the new region
-        debug(2, "writing %d value @ 0x%08x", current_key_id, addr);
-        binary_flag = iter.binary ? ENTRY_FLAG_BINARY : 0;
-        status = _write_entry(addr, current_key_id | ENTRY_FLAG_VALUE | binary_flag, iter.value, iter.value_len);
-        if (status < 0) break;
-        addr += ENTRY_SIZE(iter.value_len);
+        free_space = _free_space();
+        if (needed_space <= free_space && ctx.max_key_id + new_keys <= MAX_KEY_ID) {
+            break;
+        }
+        if (_sysparam_info.log_mode) {
+            // Log mode never compacts (or renumbers keys) in one go
+            debug(1, "log full (need %d bytes, %d new key ids)", needed_space, new_keys);
+            return SYSPARAM_ERR_FULL;
+        }
+
+        // We need to compact first (at most once).  Key ids change when
+        // compacting, so everything has to be looked up again afterwards.
+        if (ctx.indexed) {
+            _rescan_indexed(&ctx);
+        }
+        if (compacted || (needed_space > free_space + ctx.compactable + reclaimable && ctx.unused_keys <= 0)) {
+            debug(1, "region full (need %d of %d remaining)", needed_space, free_space);
+            return SYSPARAM_ERR_FULL;
+        }
+        status = _compact_params(&ctx, NULL);
+        if (status < 0) return status;
+        compacted = true;
     }
-    sysparam_iter_end(&iter);
 
-    // If we broke out with an error, return the error instead of continuing.
+    status = _set_batch_magic();
+    if (status < 0) return status;
+
+    buf = malloc(needed_space - ENTRY_HEADER_SIZE);
+    if (!buf) return SYSPARAM_ERR_NOMEM;
+
+    // Build the contents of the container.  Deletions are recorded as dead
+    // value entries so that _recover_batch() knows which keys they affect.
+    next_id = ctx.max_key_id;
+    pos = 0;
+    BATCH_FOR_EACH(batch, rec) {
+        if (rec->flags & BATCH_RECORD_SKIP) continue;
+        if (rec->key_id < 0) {
+            rec->key_id = ++next_id;
+            pos += _batch_put_entry(buf + pos, rec->key_id | ENTRY_FLAG_ALIVE, BATCH_RECORD_KEY(rec), rec->key_len);
+        }
+        if (rec->value_len) {
+            uint16_t binary_flag = (rec->flags & BATCH_RECORD_BINARY) ? ENTRY_FLAG_BINARY : 0;
+            pos += _batch_put_entry(buf + pos, rec->key_id | ENTRY_FLAG_ALIVE | ENTRY_FLAG_VALUE | binary_flag, BATCH_RECORD_VALUE(rec), rec->value_len);
+        } else {
+            pos += _batch_put_entry(buf + pos, rec->key_id | ENTRY_FLAG_VALUE, NULL, 0);
+        }
+    }
+
+    // _write_entry() only marks the container valid once all of it has been
+    // written and verified.  That is the commit point.
+    batch_addr = _sysparam_info.end_addr;
+    status = _log_reserve(&batch_addr, needed_space);
     if (status < 0) {
-        debug(1, "error encountered during compacting (%d)", status);
+        free(buf);
         return status;
     }
-
-    // Switch to officially using the new region.
-    status = _write_region_header(new_base, _sysparam_info.cur_base, true);
+    debug(1, "writing batch (%d bytes) @ 0x%08x", pos, batch_addr);
+    status = _write_entry(batch_addr, ENTRY_ID_BATCH | ENTRY_FLAG_PENDING, buf, pos);
+    free(buf);
     if (status < 0) return status;
-    status = _write_region_header(_sysparam_info.cur_base, new_base, false);
-    if (status < 0) return status;
-
-    _sysparam_info.alt_base = _sysparam_info.cur_base;
-    _sysparam_info.cur_base = new_base;
-    _sysparam_info.end_addr = addr;
-    _sysparam_info.force_compact = false;
 
-    if (ctx) {
-        // Fix up ctx so it doesn't point to invalid stuff
-        memset(ctx, 0, sizeof(*ctx));
-        ctx->addr = addr;
-        ctx->max_key_id = current_key_id;
+    // Now get rid of the old values.  If we're interrupted from here on,
+    // sysparam_init() will finish the job.
+    BATCH_FOR_EACH(batch, rec) {
+        if (rec->flags & BATCH_RECORD_SKIP) continue;
+        if (rec->old_value_addr) {
+            status = _delete_entry(rec->old_value_addr);
+            if (status < 0) return status;
+        }
     }
+    status = _clear_entry_flags(batch_addr, ENTRY_FLAG_PENDING);
+    if (status < 0) return status;
 
-    debug(1, "done compacting (current size %d)", _sysparam_info.end_addr - _sysparam_info.cur_base);
+    // Bring the index up to date
+    payload_addr = batch_addr + ENTRY_HEADER_SIZE;
+    BATCH_FOR_EACH(batch, rec) {
+        if (rec->flags & BATCH_RECORD_SKIP) continue;
+        if (rec->key_id > ctx.max_key_id) {
+            _index_add_key(BATCH_RECORD_KEY(rec), rec->key_len, payload_addr, rec->key_id);
+            payload_addr += ENTRY_SIZE(rec->key_len);
+        }
+        _index_set_value(rec->key_id, rec->value_len ? payload_addr : 0);
+        payload_addr += ENTRY_SIZE(rec->value_len);
+    }
 
     return SYSPARAM_OK;
 }
@@ -502,10 +1772,14 @@ sysparam_status_t sysparam_init(uint32_t base_addr, uint32_t top_addr) {
     sysparam_status_t status;
     uint32_t addr0, addr1;
     struct region_header header0, header1;
+    struct log_header log_header;
     struct sysparam_context ctx;
     uint16_t num_sectors;
 
     _sysparam_info.sem = xSemaphoreCreateMutex();
+    _sysparam_info.log_mode = false;
+    _sysparam_info.batch_magic = false;
+    _sysparam_info.erases = 0;
 
     // Make sure we're starting at the beginning of the sector
     base_addr -= (base_addr % sdk_flashchip.sector_size);
@@ -516,7 +1790,7 @@ sysparam_status_t sysparam_init(uint32_t base_addr, uint32_t top_addr) {
     }
     for (addr0 = base_addr; addr0 < top_addr; addr0 += sdk_flashchip.sector_size) {
         CHECK_FLASH_OP(spiflash_read(addr0, (void*) &header0, REGION_HEADER_SIZE));
-        if (header0.magic == SYSPARAM_MAGIC) {
+        if (IS_REGION_MAGIC(header0.magic) || header0.magic == SYSPARAM_LOG_MAGIC) {
             // Found a starting point...
             break;
         }
@@ -525,68 +1799,95 @@ sysparam_status_t sysparam_init(uint32_t base_addr, uint32_t top_addr) {
         return SYSPARAM_NOTFOUND;
     }
 
-    // We've found a valid header at addr0.  Now find the other half of the sysparam area.
-    num_sectors = header0.flags_size & REGION_MASK_SIZE;
-
-    if (header0.flags_size & REGION_FLAG_SECOND) {
-        addr1 = addr0 - num_sectors * sdk_flashchip.sector_size;
+    if (header0.magic == SYSPARAM_LOG_MAGIC) {
+        // Any sector of a log-mode area tells us where the whole area is.
+        CHECK_FLASH_OP(spiflash_read(addr0, (void*) &log_header, LOG_HEADER_SIZE));
+        status = _log_init(addr0 - log_header.index * sdk_flashchip.sector_size, log_header.num_sectors);
+        if (status < 0) return status;
     } else {
-        addr1 = addr0 + num_sectors * sdk_flashchip.sector_size;
-    }
-    CHECK_FLASH_OP(spiflash_read(addr1, (uint8_t*) &header1, REGION_HEADER_SIZE));
+        // We've found a valid header at addr0.  Now find the other half of the sysparam area.
+        num_sectors = header0.flags_size & REGION_MASK_SIZE;
 
-    if (header1.magic == SYSPARAM_MAGIC) {
-        // Yay! Found the other one.  Sanity-check it..
-        if ((header0.flags_size & REGION_FLAG_SECOND) == (header1.flags_size & REGION_FLAG_SECOND)) {
-            // Hmm.. they both say they're the same region.  That can't be right...
-            debug(1, "Found region headers @ 0x%08x and 0x%08x, but both claim to be the same region.", addr0, addr1);
-            return SYSPARAM_ERR_CORRUPT;
+        if (header0.flags_size & REGION_FLAG_SECOND) {
+            addr1 = addr0 - num_sectors * sdk_flashchip.sector_size;
+        } else {
+            addr1 = addr0 + num_sectors * sdk_flashchip.sector_size;
         }
-    } else {
-        // Didn't find a valid header at the alternate location (which probably means something clobbered it or something went wrong at a critical point when rewriting it.  Is the one we did find the active or stale one?
-        if (header0.flags_size & REGION_FLAG_ACTIVE) {
-            // Found the active one.  We can work with this.  Try to recreate the missing stale region...
-            debug(2, "Found active region header @ 0x%08x but no stale region @ 0x%08x. Trying to recreate stale region.", addr0, addr1);
-            status = _format_region(addr1, num_sectors);
-            if (status != SYSPARAM_OK) return status;
-            status = _write_region_header(addr1, addr0, false);
-            if (status != SYSPARAM_OK) return status;
+        CHECK_FLASH_OP(spiflash_read(addr1, (uint8_t*) &header1, REGION_HEADER_SIZE));
+
+        if (IS_REGION_MAGIC(header1.magic)) {
+            // Yay! Found the other one.  Sanity-check it..
+            if ((header0.flags_size & REGION_FLAG_SECOND) == (header1.flags_size & REGION_FLAG_SECOND)) {
+                // Hmm.. they both say they're the same region.  That can't be right...
+                debug(1, "Found region headers @ 0x%08x and 0x%08x, but both claim to be the same region.", addr0, addr1);
+                return SYSPARAM_ERR_CORRUPT;
+            }
         } else {
-            // Found the stale one.  We have no idea how old it is, so we shouldn't use it without some sort of confirmation/recovery.  We'll have to bail for now.
-            debug(1, "Found stale-region header @ 0x%08x, but no active region.", addr0);
-            return SYSPARAM_ERR_CORRUPT;
+            // Didn't find a valid header at the alternate location (which probably means something clobbered it or something went wrong at a critical point when rewriting it.  Is the one we did find the active or stale one?
+            if (header0.flags_size & REGION_FLAG_ACTIVE) {
+                // Found the active one.  We can work with this.  Try to recreate the missing stale region...
+                debug(2, "Found active region header @ 0x%08x but no stale region @ 0x%08x. Trying to recreate stale region.", addr0, addr1);
+                status = _format_region(addr1, num_sectors);
+                if (status != SYSPARAM_OK) return status;
+                status = _write_region_header(addr1, addr0, false, SYSPARAM_MAGIC);
+                if (status != SYSPARAM_OK) return status;
+            } else {
+                // Found the stale one.  We have no idea how old it is, so we shouldn't use it without some sort of confirmation/recovery.  We'll have to bail for now.
+                debug(1, "Found stale-region header @ 0x%08x, but no active region.", addr0);
+                return SYSPARAM_ERR_CORRUPT;
+            }
         }
-    }
-    // At this point we have confirmed valid regions at addr0 and addr1.
+        // At this point we have confirmed valid regions at addr0 and addr1.
 
-    _sysparam_info.region_size = num_sectors * sdk_flashchip.sector_size;
-    if (header0.flags_size & REGION_FLAG_ACTIVE) {
-        _sysparam_info.cur_base = addr0;
-        _sysparam_info.alt_base = addr1;
-        debug(3, "Active region @ 0x%08x (0x%04x).  Stale region @ 0x%08x (0x%04x).", addr0, header0.flags_size, addr1, header1.flags_size);
+        _sysparam_info.region_size = num_sectors * sdk_flashchip.sector_size;
+        if (header0.flags_size & REGION_FLAG_ACTIVE) {
+            _sysparam_info.cur_base = addr0;
+            _sysparam_info.alt_base = addr1;
+            _sysparam_info.batch_magic = header0.magic == SYSPARAM_BATCH_MAGIC;
+            debug(3, "Active region @ 0x%08x (0x%04x).  Stale region @ 0x%08x (0x%04x).", addr0, header0.flags_size, addr1, header1.flags_size);
 
-    } else {
-        _sysparam_info.cur_base = addr1;
-        _sysparam_info.alt_base = addr0;
-        debug(3, "Active region @ 0x%08x (0x%04x).  Stale region @ 0x%08x (0x%04x).", addr1, header1.flags_size, addr0, header0.flags_size);
+        } else {
+            _sysparam_info.cur_base = addr1;
+            _sysparam_info.alt_base = addr0;
+            _sysparam_info.batch_magic = header1.magic == SYSPARAM_BATCH_MAGIC;
+            debug(3, "Active region @ 0x%08x (0x%04x).  Stale region @ 0x%08x (0x%04x).", addr1, header1.flags_size, addr0, header0.flags_size);
+        }
+        _sysparam_info.end_addr = _sysparam_info.cur_base + _sysparam_info.region_size;
     }
 
     // Find the actual end
-    _sysparam_info.end_addr = _sysparam_info.cur_base + _sysparam_info.region_size;
     _sysparam_info.force_compact = false;
     _init_context(&ctx);
     status = _find_entry(&ctx, ENTRY_ID_END, false);
-    if (status < 0) {
-        _sysparam_info.cur_base = 0;
-        _sysparam_info.alt_base = 0;
-        _sysparam_info.end_addr = 0;
-        return status;
-    }
+    if (status < 0) goto failed;
     if (status == SYSPARAM_OK) {
         _sysparam_info.end_addr = ctx.addr;
     }
 
+    while (ctx.pending_batch) {
+        // We were interrupted while applying a batch, so finish it now.
+        status = _recover_batch(ctx.pending_batch);
+        if (status == SYSPARAM_OK) {
+            _init_context(&ctx);
+            status = _find_entry(&ctx, ENTRY_ID_END, false);
+        }
+        if (status < 0) goto failed;
+    }
+
+    status = _delete_duplicate_values();
+    if (status < 0) goto failed;
+
+    // Failing to build the index is not fatal, it just makes lookups slower.
+    _index_build();
+
     return SYSPARAM_OK;
+
+ failed:
+    _sysparam_info.cur_base = 0;
+    _sysparam_info.alt_base = 0;
+    _sysparam_info.end_addr = 0;
+    _sysparam_info.log_mode = false;
+    return status;
 }
 
 sysparam_status_t sysparam_create_area(uint32_t base_addr, uint16_t num_sectors, bool force) {
@@ -618,27 +1919,81 @@ sysparam_status_t sysparam_create_area(uint32_t base_addr, uint16_t num_sectors,
         }
     }
 
-    if (_sysparam_info.cur_base == base_addr || _sysparam_info.alt_base == base_addr) {
+    if (_sysparam_info.log_mode ? _sysparam_info.log_base == base_addr :
+            (_sysparam_info.cur_base == base_addr || _sysparam_info.alt_base == base_addr)) {
         // We're reformating the same region we're already using.
         // De-initialize everything to force the caller to do a clean
         // `sysparam_init()` afterwards.
         memset(&_sysparam_info, 0, sizeof(_sysparam_info));
+        _index_free();
     }
     status = _format_region(base_addr, num_sectors);
     if (status < 0) return status;
     status = _format_region(base_addr + region_size, num_sectors);
     if (status < 0) return status;
-    status = _write_region_header(base_addr, base_addr + region_size, true);
+    status = _write_region_header(base_addr, base_addr + region_size, true, SYSPARAM_MAGIC);
     if (status < 0) return status;
-    status = _write_region_header(base_addr + region_size, base_addr, false);
+    status = _write_region_header(base_addr + region_size, base_addr, false, SYSPARAM_MAGIC);
     if (status < 0) return status;
 
     return SYSPARAM_OK;
 }
 
+sysparam_status_t sysparam_create_log_area(uint32_t base_addr, uint16_t num_sectors, bool force) {
+    sysparam_status_t status;
+    uint32_t buffer[SCAN_BUFFER_SIZE];
+    uint32_t seq[2];
+    uint32_t addr;
+    int i;
+
+    if (num_sectors < LOG_MIN_SECTORS || num_sectors > REGION_MASK_SIZE) {
+        return SYSPARAM_ERR_BADVALUE;
+    }
+
+    if (!force) {
+        // As with sysparam_create_area(), make sure we're not clobbering
+        // something else.
+        for (addr = base_addr; addr < base_addr + num_sectors * sdk_flashchip.sector_size; addr += SCAN_BUFFER_SIZE * sizeof(uint32_t)) {
+            debug(3, "read %d words @ 0x%08x", SCAN_BUFFER_SIZE, addr);
+            CHECK_FLASH_OP(spiflash_read(addr, (uint8_t*)buffer, SCAN_BUFFER_SIZE * sizeof(uint32_t)));
+            for (i = 0; i < SCAN_BUFFER_SIZE; i++) {
+                if (buffer[i] != 0xffffffff) {
+                    // Uh oh, not empty.
+                    return SYSPARAM_NOTFOUND;
+                }
+            }
+        }
+    }
+
+    if (_sysparam_info.log_mode ? _sysparam_info.log_base == base_addr :
+            (_sysparam_info.cur_base == base_addr || _sysparam_info.alt_base == base_addr)) {
+        // We're reformating the area we're already using, so force the
+        // caller to do a clean `sysparam_init()` afterwards.
+        memset(&_sysparam_info, 0, sizeof(_sysparam_info));
+        _index_free();
+    }
+
+    // Erase counts are kept if the area was already in log mode
+    for (i = 0; i < num_sectors; i++) {
+        status = _log_format_sector(base_addr, num_sectors, i, 0);
+        if (status < 0) return status;
+    }
+
+    // The log starts in the first sector
+    seq[0] = 1;
+    seq[1] = ~seq[0];
+    return _write_and_verify(base_addr + offsetof(struct log_header, seq), seq, sizeof(seq));
+}
+
 sysparam_status_t sysparam_get_info(uint32_t *base_addr, uint32_t *num_sectors) {
     if (!_sysparam_info.cur_base) return SYSPARAM_ERR_NOINIT;
 
+    if (_sysparam_info.log_mode) {
+        *base_addr = _sysparam_info.log_base;
+        *num_sectors = _sysparam_info.log_sectors;
+        return SYSPARAM_OK;
+    }
+
     *base_addr = min(_sysparam_info.cur_base, _sysparam_info.alt_base);
     *num_sectors = (_sysparam_info.region_size / sdk_flashchip.sector_size) * 2;
     return SYSPARAM_OK;
@@ -648,10 +2003,47 @@ sysparam_status_t sysparam_compact() {
     xSemaphoreTake(_sysparam_info.sem, portMAX_DELAY);
     sysparam_status_t status;
 
-    if (_sysparam_info.cur_base) {
-        status = _compact_params(NULL, NULL);
+    if (!_sysparam_info.cur_base) {
+        status = SYSPARAM_ERR_NOINIT;
+    } else if (_sysparam_info.log_mode) {
+        // Reclaim every sector which is currently in use
+        int used = _sysparam_info.log_sectors - _sysparam_info.log_free;
+        status = SYSPARAM_OK;
+        for (int i = 0; i < used && status == SYSPARAM_OK; i++) {
+            status = _log_reclaim();
+        }
     } else {
+        status = _compact_params(NULL, NULL);
+    }
+
+    xSemaphoreGive(_sysparam_info.sem);
+    return status;
+}
+
+sysparam_status_t sysparam_get_erase_stats(sysparam_erase_stats_t *stats) {
+    struct log_header header;
+    sysparam_status_t status = SYSPARAM_OK;
+    uint16_t i;
+
+    xSemaphoreTake(_sysparam_info.sem, portMAX_DELAY);
+
+    memset(stats, 0, sizeof(*stats));
+    if (!_sysparam_info.cur_base) {
         status = SYSPARAM_ERR_NOINIT;
+    } else if (_sysparam_info.log_mode) {
+        stats->erases = _sysparam_info.erases;
+        stats->num_sectors = _sysparam_info.log_sectors;
+        stats->min_erase_count = 0xffffffff;
+        for (i = 0; i < _sysparam_info.log_sectors; i++) {
+            status = _log_read_header(_sysparam_info.log_base, i, &header);
+            if (status < 0) break;
+            stats->min_erase_count = min(stats->min_erase_count, header.erase_count);
+            stats->max_erase_count = max(stats->max_erase_count, header.erase_count);
+            stats->total_erase_count += header.erase_count;
+        }
+    } else {
+        stats->erases = _sysparam_info.erases;
+        stats->num_sectors = (_sysparam_info.region_size / sdk_flashchip.sector_size) * 2;
     }
 
     xSemaphoreGive(_sysparam_info.sem);
@@ -846,6 +2238,7 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
     size_t needed_space;
     int key_id = -1;
     uint32_t old_value_addr = 0;
+    uint16_t new_key_id = 0;
     uint16_t binary_flag;
 
     if (!key_len) return SYSPARAM_ERR_BADVALUE;
@@ -863,9 +2256,23 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
         goto done;
     }
 
+    if (_sysparam_info.log_mode && value_len) {
+        // Make room before looking anything up, as reclaiming old sectors
+        // moves entries around.
+        status = _log_make_space(ENTRY_SIZE(key_len) + ENTRY_SIZE(value_len), ENTRY_SIZE(max(key_len, value_len)));
+        if (status < 0) goto done;
+    }
+
     do {
         _init_context(&ctx);
         status = _find_key(&ctx, key, key_len);
+        if (status == SYSPARAM_NOTFOUND && _index_active()) {
+            // The index told us the key is new without scanning anything.
+            // It also knows the largest key id, which is all we need unless
+            // we run out of space (see below).
+            ctx.max_key_id = _index_max_key_id();
+            ctx.indexed = true;
+        }
         if (status == SYSPARAM_OK) {
             // Key already exists, see if there's a current value.
             key_id = ctx.entry.idflags & ENTRY_MASK_ID;
@@ -901,7 +2308,7 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
 
             // Append new value to the end, but first make sure we have enough
             // space.
-            free_space = _sysparam_info.cur_base + _sysparam_info.region_size - _sysparam_info.end_addr;
+            free_space = _free_space();
             needed_space = ENTRY_SIZE(value_len);
             if (key_id < 0) {
                 // We did not find a previous key entry matching this key.  We
@@ -909,11 +2316,15 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
                 key_len = strlen(key);
                 needed_space += ENTRY_SIZE(key_len);
             }
-            if (needed_space > free_space) {
+            if (needed_space > free_space && !_sysparam_info.log_mode) {
                 // Can we compact things?
                 // First, scan all remaining entries up to the end so we can
                 // get a reasonably accurate "compactable" reading.
-                _find_entry(&ctx, ENTRY_ID_END, false);
+                if (ctx.indexed) {
+                    _rescan_indexed(&ctx);
+                } else {
+                    _find_entry(&ctx, ENTRY_ID_END, false);
+                }
                 if (needed_space <= free_space + ctx.compactable) {
                     // We should be able to get enough space by compacting.
                     status = _compact_params(&ctx, &key_id);
@@ -928,7 +2339,7 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
                     if (status < 0) break;
                     old_value_addr = 0;
                 }
-                free_space = _sysparam_info.cur_base + _sysparam_info.region_size - _sysparam_info.end_addr;
+                free_space = _free_space();
             }
             if (needed_space > free_space) {
                 // Nothing we can do here.. We're full.
@@ -946,7 +2357,15 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
                 // ctx.max_key_id has the largest key_id found in the whole
                 // region.
                 if (ctx.max_key_id >= MAX_KEY_ID) {
-                    if (ctx.unused_keys > 0) {
+                    if (ctx.indexed) {
+                        _rescan_indexed(&ctx);
+                    }
+                    if (_sysparam_info.log_mode) {
+                        // Keys are never renumbered in log mode, so reuse
+                        // the id of a key that has been dropped.
+                        status = _log_unused_key_id(&new_key_id);
+                        if (status < 0) break;
+                    } else if (ctx.unused_keys > 0) {
                         status = _compact_params(&ctx, &key_id);
                         if (status < 0) break;
                         old_value_addr = 0;
@@ -958,7 +2377,7 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
                 }
             }
 
-            if (_sysparam_info.force_compact) {
+            if (_sysparam_info.force_compact && !_sysparam_info.log_mode) {
                 // We didn't need to compact above, but due to previously
                 // detected inconsistencies, we should compact anyway before
                 // writing anything new, so do that.
@@ -970,15 +2389,21 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
 
             if (key_id < 0) {
                 // Write a new key entry
-                key_id = ctx.max_key_id + 1;
+                key_id = new_key_id ? new_key_id : ctx.max_key_id + 1;
+                status = _log_reserve(&write_ctx.addr, ENTRY_SIZE(key_len));
+                if (status < 0) break;
                 status = _write_entry(write_ctx.addr, key_id, (uint8_t *)key, key_len);
                 if (status < 0) break;
+                _index_add_key(key, key_len, write_ctx.addr, key_id);
                 write_ctx.addr += ENTRY_SIZE(key_len);
             }
 
             // Write new value
+            status = _log_reserve(&write_ctx.addr, ENTRY_SIZE(value_len));
+            if (status < 0) break;
             status = _write_entry(write_ctx.addr, key_id | ENTRY_FLAG_VALUE | binary_flag, value, value_len);
             if (status < 0) break;
+            _index_set_value(key_id, write_ctx.addr);
             write_ctx.addr += ENTRY_SIZE(value_len);
             _sysparam_info.end_addr = write_ctx.addr;
         }
@@ -987,11 +2412,20 @@ sysparam_status_t sysparam_set_data(const char *key, const uint8_t *value, size_
         if (old_value_addr) {
             status = _delete_entry(old_value_addr);
             if (status < 0) break;
+            if (!value_len) {
+                _index_set_value(key_id, 0);
+            }
         }
 
-        debug(1, "New addr is 0x%08x (%d bytes remaining)", _sysparam_info.end_addr, _sysparam_info.cur_base + _sysparam_info.region_size - _sysparam_info.end_addr);
+        debug(1, "New addr is 0x%08x (%d bytes remaining)", _sysparam_info.end_addr, _free_space());
     } while (false);
 
+    if (status < 0 && _index_active()) {
+        // We don't know exactly what made it to the flash, so don't trust
+        // the index any more.
+        _index_build();
+    }
+
  done:
     xSemaphoreGive(_sysparam_info.sem);
 
@@ -1024,6 +2458,95 @@ sysparam_status_t sysparam_set_bool(const char *key, bool value) {
     return sysparam_set_data(key, buf, 1, false);
 }
 
+sysparam_status_t sysparam_batch_begin(sysparam_batch_t *batch) {
+    memset(batch, 0, sizeof(*batch));
+    if (!_sysparam_info.cur_base) return SYSPARAM_ERR_NOINIT;
+
+    return SYSPARAM_OK;
+}
+
+sysparam_status_t sysparam_batch_set_data(sysparam_batch_t *batch, const char *key, const uint8_t *value, size_t value_len, bool is_binary) {
+    size_t key_len = strlen(key);
+    struct batch_record *rec;
+    size_t rec_size, new_size;
+    uint8_t *newbuf;
+
+    if (!key_len) return SYSPARAM_ERR_BADVALUE;
+    if (key_len > MAX_KEY_LEN) return SYSPARAM_ERR_BADVALUE;
+    if (value_len > MAX_VALUE_LEN) return SYSPARAM_ERR_BADVALUE;
+
+    if (!value) value_len = 0;
+
+    // A later update to the same key replaces the earlier one
+    BATCH_FOR_EACH(batch, rec) {
+        if (rec->key_len == key_len && !memcmp(BATCH_RECORD_KEY(rec), key, key_len)) {
+            uint8_t *next = (uint8_t *)_batch_next(rec);
+            memmove(rec, next, batch->buf + batch->len - next);
+            batch->len -= next - (uint8_t *)rec;
+            batch->count--;
+            break;
+        }
+    }
+
+    rec_size = BATCH_RECORD_SIZE(key_len, value_len);
+    if (batch->len + rec_size > batch->bufsize) {
+        new_size = max(batch->len + rec_size, batch->bufsize * 2);
+        newbuf = realloc(batch->buf, new_size);
+        if (!newbuf) return SYSPARAM_ERR_NOMEM;
+        batch->buf = newbuf;
+        batch->bufsize = new_size;
+    }
+
+    rec = (struct batch_record *)(batch->buf + batch->len);
+    rec->key_len = key_len;
+    rec->value_len = value_len;
+    rec->flags = is_binary ? BATCH_RECORD_BINARY : 0;
+    rec->key_id = -1;
+    rec->old_value_addr = 0;
+    memcpy(BATCH_RECORD_KEY(rec), key, key_len);
+    if (value_len) {
+        memcpy(BATCH_RECORD_VALUE(rec), value, value_len);
+    }
+    batch->len += rec_size;
+    batch->count++;
+
+    return SYSPARAM_OK;
+}
+
+sysparam_status_t sysparam_batch_set_string(sysparam_batch_t *batch, const char *key, const char *value) {
+    return sysparam_batch_set_data(batch, key, (const uint8_t *)value, strlen(value), false);
+}
+
+sysparam_status_t sysparam_batch_set_int32(sysparam_batch_t *batch, const char *key, int32_t value) {
+    return sysparam_batch_set_data(batch, key, (const uint8_t *)&value, sizeof(value), true);
+}
+
+sysparam_status_t sysparam_batch_commit(sysparam_batch_t *batch) {
+    sysparam_status_t status;
+
+    xSemaphoreTake(_sysparam_info.sem, portMAX_DELAY);
+
+    if (!_sysparam_info.cur_base) {
+        status = SYSPARAM_ERR_NOINIT;
+    } else {
+        debug(1, "committing batch of %d updates", batch->count);
+        status = _commit_batch(batch);
+        if (status < 0 && _index_active()) {
+            _index_build();
+        }
+    }
+
+    xSemaphoreGive(_sysparam_info.sem);
+
+    sysparam_batch_abort(batch);
+    return status;
+}
+
+void sysparam_batch_abort(sysparam_batch_t *batch) {
+    if (batch->buf) free(batch->buf);
+    memset(batch, 0, sizeof(*batch));
+}
+
 sysparam_status_t sysparam_iter_start(sysparam_iter_t *iter) {
     if (!_sysparam_info.cur_base) return SYSPARAM_ERR_NOINIT;
 
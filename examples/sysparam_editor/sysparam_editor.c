@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sysparam.h>
+#include <spiflash.h>
 
 #include <espressif/spi_flash.h>
 #include "espressif/esp_common.h"
@@ -33,6 +34,10 @@ void usage(void) {
         "  dump            -- Show all currently set keys/values\n"
         "  compact         -- Compact the sysparam area\n"
         "  reformat        -- Reinitialize (clear) the sysparam area\n"
+#if SPIFLASH_STATS
+        "  flashstats      -- Show flash operation statistics\n"
+        "  flashstats-clr  -- Clear flash operation statistics\n"
+#endif
         "  echo-off        -- Disable input echo\n"
         "  echo-on         -- Enable input echo\n"
         "  help            -- Show this help screen\n"
@@ -233,6 +238,13 @@ void sysparam_editor_task(void *pvParameters) {
                 // using.
                 status = sysparam_init(base_addr, 0);
             }
+#if SPIFLASH_STATS
+        } else if (!strcmp(cmd_buffer, "flashstats")) {
+            spiflash_print_stats();
+        } else if (!strcmp(cmd_buffer, "flashstats-clr")) {
+            spiflash_reset_stats();
+            printf("Flash statistics cleared\n");
+#endif
         } else if (!strcmp(cmd_buffer, "echo-on")) {
             echo = true;
             printf("Echo on\n");
@@ -35,12 +35,16 @@
  */
 
 #include "lwip/opt.h"
+#include "esp_opts.h"
 
 #include <sntp.h>
 
 #include "lwip/timeouts.h"
 #include "lwip/udp.h"
 #include "lwip/dns.h"
+#if ESP_DNS_CACHE
+#include "esp_dns.h"
+#endif
 #include "lwip/ip_addr.h"
 #include "lwip/pbuf.h"
 
@@ -661,8 +665,13 @@ sntp_request(void *arg)
 
   /* initialize SNTP server address */
 #if SNTP_SERVER_DNS
+#if ESP_DNS_CACHE
+  err = esp_dns_gethostbyname(sntp_server_addresses[sntp_current_server], &sntp_server_address,
+    sntp_dns_found, NULL);
+#else
   err = dns_gethostbyname(sntp_server_addresses[sntp_current_server], &sntp_server_address,
     sntp_dns_found, NULL);
+#endif
   if (err == ERR_INPROGRESS) {
     /* DNS request sent, wait for sntp_dns_found being called */
     LWIP_DEBUGF(SNTP_DEBUG_STATE, ("sntp_request: Waiting for server address to be resolved.\n"));
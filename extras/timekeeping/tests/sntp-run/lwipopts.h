@@ -93,6 +93,9 @@
 #define ESP_TIMEWAIT_THRESHOLD              10000
 #endif
 
+/* The port's other options, ESP_RX_*, ESP_TCP_TUNE, ESP_DNS_CACHE and the
+ * like, are in esp_opts.h. */
+
 /** LWIP_TIMEVAL_PRIVATE: if you want to use the struct timeval provided
  * by your system, set this to 0 and include <sys/time.h> in cc.h */
 #define LWIP_TIMEVAL_PRIVATE                0
@@ -283,10 +286,10 @@ void sys_unlock_tcpip_core(void);
 /**
  * IP_REASSEMBLY==1: Reassemble incoming fragmented IP packets. Note that
  * this option does not affect outgoing packet sizes, which can be controlled
- * via IP_FRAG.
+ * via IP_FRAG. Off when ESP_IP_REASS reassembles them instead.
  */
 #ifndef IP_REASSEMBLY
-#define IP_REASSEMBLY                   1
+#define IP_REASSEMBLY                   !ESP_IP_REASS
 #endif
 
 /**
@@ -451,6 +454,31 @@ void sys_unlock_tcpip_core(void);
 #define TCP_MSS                         1460
 #endif
 
+/**
+ * TCP_WND: The size of a TCP window. This must be at least
+ * (2 * TCP_MSS) for things to work well.
+ * With ESP_TCP_TUNE this is the most a connection is given.
+ */
+#ifndef TCP_WND
+#define TCP_WND                         (4 * TCP_MSS)
+#endif
+
+/**
+ * TCP_SND_BUF: TCP sender buffer space (bytes).
+ * With ESP_TCP_TUNE this is the most a connection is given.
+ */
+#ifndef TCP_SND_BUF
+#define TCP_SND_BUF                     (2 * TCP_MSS)
+#endif
+
+/**
+ * LWIP_TCP_PCB_NUM_EXT_ARGS: The number of extension argument slots in each
+ * tcp pcb. ESP_TCP_TUNE uses one.
+ */
+#ifndef LWIP_TCP_PCB_NUM_EXT_ARGS
+#define LWIP_TCP_PCB_NUM_EXT_ARGS       ESP_TCP_TUNE
+#endif
+
 /**
  * TCP_OOSEQ_MAX_BYTES: The default maximum number of bytes queued on ooseq per
  * pcb if TCP_OOSEQ_BYTES_LIMIT is not defined. Default is 0 (no limit).
@@ -722,11 +750,26 @@ void sys_unlock_tcpip_core(void);
 #endif
 
 /**
- * LWIP_SO_RCVBUF==1: Enable SO_RCVBUF processing.
+ * LWIP_SO_RCVBUF==1: Enable SO_RCVBUF processing. On with ESP_SOCKMEM (see
+ * esp_opts.h), which must be set above this or on the command line.
  */
 #ifndef LWIP_SO_RCVBUF
+#if defined(ESP_SOCKMEM) && ESP_SOCKMEM
+#define LWIP_SO_RCVBUF                  1
+#else
 #define LWIP_SO_RCVBUF                  0
 #endif
+#endif
+
+/**
+ * RECV_BUFSIZE_DEFAULT: The default value for recv_bufsize, SO_RCVBUF in
+ * bytes, with LWIP_SO_RCVBUF. UDP and raw sockets drop what would take them
+ * over it, and with ESP_TCP_TUNE it limits a TCP socket's receive window.
+ * See esp_sockmem.h.
+ */
+#ifndef RECV_BUFSIZE_DEFAULT
+#define RECV_BUFSIZE_DEFAULT            TCP_WND
+#endif
 
 /**
  * SO_REUSE==1: Enable SO_REUSEADDR option.
@@ -23,6 +23,7 @@
 #include "FreeRTOS.h"
 #include "timers.h"
 #include "esp/types.h"
+#include "etstimer_stats.h"
 
 typedef void ETSTimerFunc(void *);
 
@@ -38,6 +39,14 @@ typedef struct ETSTimer_st {
 
 void sdk_ets_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg);
 void sdk_ets_timer_arm(ETSTimer *ptimer, uint32_t milliseconds, bool repeat_flag);
+void sdk_ets_timer_arm_us(ETSTimer *ptimer, uint32_t useconds, bool repeat_flag);
+void sdk_ets_timer_arm_ms_us(ETSTimer *ptimer, uint32_t value, bool repeat_flag, bool value_in_ms);
 void sdk_ets_timer_disarm(ETSTimer *ptimer);
 
+/* Let 'ptimer' fire up to 'useconds' late, so that it can fire on the same
+ * alarm as other timers. The slack is rounded down to a power of two FRC2
+ * ticks, at most about 6.7 seconds, and is cleared by sdk_ets_timer_setfn().
+ * Open libmain ets_timer.c only. */
+void ets_timer_set_slack(ETSTimer *ptimer, uint32_t useconds);
+
 #endif /* _ETSTIMER_H */
@@ -0,0 +1,24 @@
+/* Counters and timer slack for the open libmain ets_timer.c
+ *
+ * Only available when OPEN_LIBMAIN_ETS_TIMER is set.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ETSTIMER_STATS_H
+#define _ETSTIMER_STATS_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t alarms;        /* FRC2 alarm interrupts */
+    uint32_t wakeups;       /* Runs of the timer task */
+    uint32_t empty;         /* Wakeups that found no timer due */
+    uint32_t fired;         /* Timer callbacks run */
+    uint32_t max_batch;     /* Most callbacks run in one wakeup */
+} ets_timer_stats_t;
+
+void ets_timer_get_stats(ets_timer_stats_t *stats);
+void ets_timer_reset_stats(void);
+
+#endif /* _ETSTIMER_STATS_H */
@@ -0,0 +1,310 @@
+/* Name resolution for lwip through the DNS cache in esp_dns_cache.c
+ *
+ * Queries go to the servers set with dns_setserver(), in turn on each retry,
+ * from a UDP pcb of our own. Lookups waiting for an answer are kept with the
+ * cache entry they wait on and are called back when it is answered or given
+ * up. Looking up an address due for refresh returns it and sends a query in
+ * the background.
+ *
+ * Names ending in .local, and names too long for the cache, are left to
+ * lwip's own DNS table.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <string.h>
+#include <strings.h>
+
+#include "lwip/opt.h"
+#include "esp_opts.h"
+#include "lwip/dns.h"
+#include "lwip/udp.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "esp_dns_cache.h"
+#include "esp_dns.h"
+
+#if ESP_DNS_CACHE && LWIP_DNS
+
+#if !LWIP_TCPIP_CORE_LOCKING
+#error "esp_dns.c needs LWIP_TCPIP_CORE_LOCKING"
+#endif
+
+/* Longest response taken, the most sent over UDP without EDNS */
+#define DNS_RESPONSE_MAX 512
+
+typedef struct {
+    esp_dns_entry_t *entry;
+    dns_found_callback found;
+    void *arg;
+} waiter_t;
+
+static esp_dns_entry_t entries[ESP_DNS_CACHE_SIZE];
+static esp_dns_cache_t cache;
+static waiter_t waiters[ESP_DNS_CACHE_WAITERS];
+static struct udp_pcb *pcb;
+
+static void check_timeouts(void *arg);
+
+static void init(void)
+{
+    static const esp_dns_cache_params_t params = {
+        .min_ttl = ESP_DNS_CACHE_MIN_TTL,
+        .max_ttl = ESP_DNS_CACHE_MAX_TTL,
+        .neg_ttl = ESP_DNS_CACHE_NEG_TTL,
+        .prefetch = ESP_DNS_CACHE_PREFETCH,
+        .timeout_ms = ESP_DNS_CACHE_TIMEOUT,
+    };
+
+    if (!cache.entries) {
+        esp_dns_cache_init(&cache, entries, ESP_DNS_CACHE_SIZE, &params);
+    }
+}
+
+/* Only IPv4 addresses are cached */
+static bool use_cache(const char *name, u8_t addrtype)
+{
+    size_t len = strlen(name);
+
+#if LWIP_IPV6
+    if (addrtype == LWIP_DNS_ADDRTYPE_IPV6) {
+        return false;
+    }
+#else
+    LWIP_UNUSED_ARG(addrtype);
+#endif
+    return len < ESP_DNS_CACHE_NAME_LEN && !(len >= 6 && strcasecmp(name + len - 6, ".local") == 0);
+}
+
+static const ip_addr_t *server(unsigned n)
+{
+    const ip_addr_t *servers[DNS_MAX_SERVERS];
+    unsigned count = 0;
+
+    for (u8_t i = 0; i < DNS_MAX_SERVERS; i++) {
+        const ip_addr_t *addr = dns_getserver(i);
+        if (!ip_addr_isany(addr)) {
+            servers[count++] = addr;
+        }
+    }
+    return count ? servers[n % count] : NULL;
+}
+
+static bool is_server(const ip_addr_t *addr)
+{
+    for (u8_t i = 0; i < DNS_MAX_SERVERS; i++) {
+        if (ip_addr_cmp(addr, dns_getserver(i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void notify(esp_dns_entry_t *entry)
+{
+    char name[ESP_DNS_CACHE_NAME_LEN];
+    bool found = entry->state == ESP_DNS_FOUND;
+    ip_addr_t addr;
+
+    /* Callbacks may reuse the entry */
+    strcpy(name, entry->name);
+    ip_addr_set_ip4_u32_val(addr, entry->addr);
+    for (int i = 0; i < ESP_DNS_CACHE_WAITERS; i++) {
+        waiter_t waiter = waiters[i];
+
+        if (waiter.entry == entry) {
+            waiters[i].entry = NULL;
+            waiter.found(name, found ? &addr : NULL, waiter.arg);
+        }
+    }
+}
+
+static void recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    static uint8_t msg[DNS_RESPONSE_MAX];
+
+    if (port == DNS_SERVER_PORT && is_server(addr)) {
+        u16_t len = pbuf_copy_partial(p, msg, sizeof(msg), 0);
+        esp_dns_entry_t *entry = esp_dns_cache_answer(&cache, msg, len, sys_now());
+
+        if (entry) {
+            notify(entry);
+        } else {
+            check_timeouts(NULL);
+        }
+    }
+    pbuf_free(p);
+}
+
+/* Query 'name', or retry its query. A query that is built but can not be
+ * sent is left to time out. */
+static err_t send_query(const char *name, esp_dns_entry_t **entry)
+{
+    uint8_t msg[ESP_DNS_QUERY_MAX];
+
+    *entry = NULL;
+    if (!pcb) {
+        pcb = udp_new();
+        if (!pcb) {
+            return ERR_MEM;
+        }
+        udp_recv(pcb, recv, NULL);
+    }
+
+    size_t len = esp_dns_cache_query(&cache, name, LWIP_RAND(), sys_now(), msg, sizeof(msg), entry);
+    if (!len) {
+        return ERR_MEM;
+    }
+    const ip_addr_t *to = server((*entry)->tries);
+    if (!to) {
+        return ERR_VAL;
+    }
+
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (p) {
+        pbuf_take(p, msg, len);
+        udp_sendto(pcb, p, to, DNS_SERVER_PORT);
+        pbuf_free(p);
+    }
+    sys_timeout(cache.params.timeout_ms, check_timeouts, NULL);
+    return ERR_OK;
+}
+
+static void refresh(const char *name)
+{
+    esp_dns_entry_t *entry;
+
+    if (send_query(name, &entry) != ERR_OK && entry) {
+        esp_dns_cache_abandon(entry);
+    }
+}
+
+static void check_timeouts(void *arg)
+{
+    esp_dns_entry_t *entry;
+
+    while ((entry = esp_dns_cache_timed_out(&cache, sys_now())) != NULL) {
+        if (entry->tries + 1 < ESP_DNS_CACHE_TRIES && send_query(entry->name, &entry) == ERR_OK) {
+            continue;
+        }
+        esp_dns_cache_abandon(entry);
+        notify(entry);
+    }
+}
+
+/* Look up a cached address, refreshing it when due. */
+static esp_dns_entry_t *lookup(const char *name)
+{
+    init();
+    esp_dns_entry_t *entry = esp_dns_cache_lookup(&cache, name, sys_now());
+
+    if (entry && esp_dns_cache_stale(&cache, entry, sys_now())) {
+        refresh(entry->name);
+    }
+    return entry;
+}
+
+err_t esp_dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found,
+                            void *arg)
+{
+    int slot;
+
+    if (!hostname || !hostname[0]) {
+        return ERR_ARG;
+    }
+    if (ipaddr_aton(hostname, addr)) {
+        return ERR_OK;
+    }
+    if (!use_cache(hostname, LWIP_DNS_ADDRTYPE_IPV4)) {
+        return dns_gethostbyname(hostname, addr, found, arg);
+    }
+
+    esp_dns_entry_t *entry = lookup(hostname);
+    if (entry && entry->state == ESP_DNS_FOUND) {
+        ip_addr_set_ip4_u32_val(*addr, entry->addr);
+        return ERR_OK;
+    } else if (entry && entry->state == ESP_DNS_NOT_FOUND) {
+        return ERR_VAL;
+    }
+
+    for (slot = 0; slot < ESP_DNS_CACHE_WAITERS && waiters[slot].entry; slot++) {
+    }
+    if (slot == ESP_DNS_CACHE_WAITERS) {
+        return ERR_MEM;
+    }
+    if (!entry) {
+        err_t err = send_query(hostname, &entry);
+        if (err != ERR_OK) {
+            if (entry) {
+                esp_dns_cache_abandon(entry);
+            }
+            return err;
+        }
+    }
+    waiters[slot] = (waiter_t){ .entry = entry, .found = found, .arg = arg };
+    return ERR_INPROGRESS;
+}
+
+void esp_dns_flush(void)
+{
+    init();
+    esp_dns_cache_flush(&cache);
+}
+
+err_t esp_dns_lookup_local(const char *name, ip_addr_t *addr, u8_t addrtype)
+{
+    esp_dns_entry_t *entry = use_cache(name, addrtype) ? lookup(name) : NULL;
+
+    if (entry && entry->state == ESP_DNS_FOUND) {
+        ip_addr_set_ip4_u32_val(*addr, entry->addr);
+        return ERR_OK;
+    }
+    return ERR_ARG;
+}
+
+typedef struct {
+    sys_sem_t sem;
+    ip_addr_t *addr;
+    err_t err;
+} resolve_t;
+
+static void resolved(const char *name, const ip_addr_t *addr, void *arg)
+{
+    resolve_t *resolve = arg;
+
+    if (addr) {
+        ip_addr_copy(*resolve->addr, *addr);
+        resolve->err = ERR_OK;
+    } else {
+        resolve->err = ERR_VAL;
+    }
+    sys_sem_signal(&resolve->sem);
+}
+
+int esp_dns_netconn_resolve(const char *name, ip_addr_t *addr, u8_t addrtype, err_t *err)
+{
+    resolve_t resolve = { .addr = addr };
+
+    if (!use_cache(name, addrtype)) {
+        /* Left to netconn_gethostbyname_addrtype() */
+        return 0;
+    }
+    if (sys_sem_new(&resolve.sem, 0) != ERR_OK) {
+        *err = ERR_MEM;
+        return 1;
+    }
+
+    LOCK_TCPIP_CORE();
+    err_t result = esp_dns_gethostbyname(name, addr, resolved, &resolve);
+    UNLOCK_TCPIP_CORE();
+    if (result == ERR_INPROGRESS) {
+        sys_sem_wait(&resolve.sem);
+        result = resolve.err;
+    }
+
+    sys_sem_free(&resolve.sem);
+    *err = result;
+    return 1;
+}
+
+#endif /* ESP_DNS_CACHE && LWIP_DNS */
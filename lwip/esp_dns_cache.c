@@ -0,0 +1,352 @@
+/* DNS cache holding several names, with their TTLs, negative answers and
+ * refreshes ahead of expiry
+ *
+ * Negative answers are kept for the lesser of the TTL and minimum of the
+ * SOA record in the authority section (RFC 2308) and neg_ttl, or for
+ * neg_ttl if the server sends no SOA. The TTL of an address is the least of
+ * those of the records in the answer section, so a CNAME chain expires with
+ * its shortest link.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_dns_cache.h"
+
+#define DNS_HEADER_LEN 12
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_RD 0x0100
+#define DNS_RCODE(flags) ((flags) & 0x000f)
+#define DNS_RCODE_OK 0
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_TYPE_A 1
+#define DNS_TYPE_SOA 6
+#define DNS_CLASS_IN 1
+
+/* TTLs are limited to a week, so expiry times stay comparable. */
+#define DNS_TTL_LIMIT (7 * 24 * 3600)
+
+typedef struct {
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdlength;
+    const uint8_t *rdata;
+} dns_rr_t;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(p + 2);
+}
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static bool expired(uint32_t time, uint32_t now)
+{
+    return (int32_t)(now - time) >= 0;
+}
+
+/* Encode 'name' as a sequence of labels. Returns the length, or 0 if it is
+ * not a valid name or does not fit in 'size'. */
+static size_t encode_name(const char *name, uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t len = dot ? (size_t)(dot - name) : strlen(name);
+
+        if (len == 0 || len > 63 || pos + 1 + len + 1 > size) {
+            return 0;
+        }
+        buf[pos++] = len;
+        memcpy(buf + pos, name, len);
+        pos += len;
+        name += dot ? len + 1 : len;
+    }
+    if (pos == 0) {
+        return 0;
+    }
+    buf[pos++] = 0;
+    return pos;
+}
+
+/* Length bytes are below 64 so are not changed by tolower(). */
+static bool same_name(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the offset past the possibly compressed name at 'pos', or 0 if it
+ * runs past the end of the message. */
+static size_t skip_name(const uint8_t *msg, size_t len, size_t pos)
+{
+    while (pos < len) {
+        uint8_t n = msg[pos];
+
+        if ((n & 0xc0) == 0xc0) {
+            return pos + 2 <= len ? pos + 2 : 0;
+        } else if (n & 0xc0) {
+            return 0;
+        }
+        pos += 1 + n;
+        if (n == 0) {
+            return pos;
+        }
+    }
+    return 0;
+}
+
+/* Returns the offset past the resource record at 'pos', or 0 if it runs past
+ * the end of the message. */
+static size_t parse_rr(const uint8_t *msg, size_t len, size_t pos, dns_rr_t *rr)
+{
+    pos = skip_name(msg, len, pos);
+    if (!pos || pos + 10 > len) {
+        return 0;
+    }
+    rr->type = get16(msg + pos);
+    rr->class = get16(msg + pos + 2);
+    rr->ttl = get32(msg + pos + 4);
+    rr->rdlength = get16(msg + pos + 8);
+    rr->rdata = msg + pos + 10;
+    pos += 10 + rr->rdlength;
+    return pos <= len ? pos : 0;
+}
+
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static esp_dns_entry_t *find(esp_dns_cache_t *cache, const char *name)
+{
+    for (size_t i = 0; i < cache->count; i++) {
+        esp_dns_entry_t *entry = &cache->entries[i];
+
+        if (entry->state != ESP_DNS_EMPTY && strcasecmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void esp_dns_cache_init(esp_dns_cache_t *cache, esp_dns_entry_t *entries, size_t count,
+                        const esp_dns_cache_params_t *params)
+{
+    cache->entries = entries;
+    cache->count = count;
+    cache->params = *params;
+    cache->params.max_ttl = min_u32(cache->params.max_ttl, DNS_TTL_LIMIT);
+    cache->params.min_ttl = min_u32(cache->params.min_ttl, cache->params.max_ttl);
+    cache->params.neg_ttl = min_u32(cache->params.neg_ttl, DNS_TTL_LIMIT);
+    memset(entries, 0, count * sizeof(*entries));
+}
+
+void esp_dns_cache_flush(esp_dns_cache_t *cache)
+{
+    for (size_t i = 0; i < cache->count; i++) {
+        esp_dns_entry_t *entry = &cache->entries[i];
+
+        if (entry->querying) {
+            entry->state = ESP_DNS_PENDING;
+        } else {
+            memset(entry, 0, sizeof(*entry));
+        }
+    }
+}
+
+esp_dns_entry_t *esp_dns_cache_lookup(esp_dns_cache_t *cache, const char *name, uint32_t now)
+{
+    esp_dns_entry_t *entry = find(cache, name);
+
+    if (!entry) {
+        return NULL;
+    }
+    if (entry->state != ESP_DNS_PENDING && expired(entry->expires, now)) {
+        if (!entry->querying) {
+            entry->state = ESP_DNS_EMPTY;
+            return NULL;
+        }
+        entry->state = ESP_DNS_PENDING;
+    }
+    entry->used = now;
+    return entry;
+}
+
+bool esp_dns_cache_stale(const esp_dns_cache_t *cache, const esp_dns_entry_t *entry, uint32_t now)
+{
+    if (entry->state != ESP_DNS_FOUND || entry->querying || expired(entry->expires, now)) {
+        return false;
+    }
+    return entry->expires - now < entry->ttl_ms / 100 * cache->params.prefetch;
+}
+
+size_t esp_dns_cache_query(esp_dns_cache_t *cache, const char *name, uint16_t id, uint32_t now,
+                           uint8_t *buf, size_t size, esp_dns_entry_t **entry)
+{
+    size_t qlen = 0;
+
+    if (strlen(name) < ESP_DNS_CACHE_NAME_LEN && size > DNS_HEADER_LEN + 4) {
+        qlen = encode_name(name, buf + DNS_HEADER_LEN, size - DNS_HEADER_LEN - 4);
+    }
+    if (!qlen) {
+        return 0;
+    }
+
+    esp_dns_entry_t *e = find(cache, name);
+    if (!e) {
+        for (size_t i = 0; i < cache->count; i++) {
+            esp_dns_entry_t *other = &cache->entries[i];
+
+            if (other->state == ESP_DNS_EMPTY) {
+                e = other;
+                break;
+            }
+            if (!other->querying && (!e || (int32_t)(other->used - e->used) < 0)) {
+                e = other;
+            }
+        }
+        if (!e) {
+            return 0;
+        }
+        memset(e, 0, sizeof(*e));
+        strcpy(e->name, name);
+        e->state = ESP_DNS_PENDING;
+        e->used = now;
+    } else if (e->state != ESP_DNS_PENDING && expired(e->expires, now)) {
+        e->state = ESP_DNS_PENDING;
+    }
+
+    e->tries = e->querying ? e->tries + 1 : 0;
+    e->querying = true;
+    e->id = id;
+    e->deadline = now + cache->params.timeout_ms;
+
+    memset(buf, 0, DNS_HEADER_LEN);
+    put16(buf, id);
+    put16(buf + 2, DNS_FLAG_RD);
+    put16(buf + 4, 1);
+    put16(buf + DNS_HEADER_LEN + qlen, DNS_TYPE_A);
+    put16(buf + DNS_HEADER_LEN + qlen + 2, DNS_CLASS_IN);
+
+    *entry = e;
+    return DNS_HEADER_LEN + qlen + 4;
+}
+
+esp_dns_entry_t *esp_dns_cache_answer(esp_dns_cache_t *cache, const uint8_t *msg, size_t len,
+                                      uint32_t now)
+{
+    esp_dns_entry_t *entry = NULL;
+    uint8_t qname[ESP_DNS_QUERY_MAX];
+    dns_rr_t rr;
+
+    if (len < DNS_HEADER_LEN) {
+        return NULL;
+    }
+    uint16_t flags = get16(msg + 2);
+    uint16_t ancount = get16(msg + 6);
+    uint16_t nscount = get16(msg + 8);
+    for (size_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].querying && cache->entries[i].id == get16(msg)) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+    if (!entry || !(flags & DNS_FLAG_QR) || get16(msg + 4) != 1) {
+        return NULL;
+    }
+
+    /* The question must be the one asked */
+    size_t qlen = encode_name(entry->name, qname, sizeof(qname));
+    size_t pos = DNS_HEADER_LEN;
+    if (pos + qlen + 4 > len || !same_name(msg + pos, qname, qlen) ||
+        get16(msg + pos + qlen) != DNS_TYPE_A || get16(msg + pos + qlen + 2) != DNS_CLASS_IN) {
+        return NULL;
+    }
+    pos += qlen + 4;
+
+    if (DNS_RCODE(flags) != DNS_RCODE_OK && DNS_RCODE(flags) != DNS_RCODE_NXDOMAIN) {
+        entry->deadline = now;
+        return NULL;
+    }
+
+    bool found = false;
+    uint32_t addr = 0;
+    uint32_t ttl = UINT32_MAX;
+    for (unsigned i = 0; i < ancount; i++) {
+        pos = parse_rr(msg, len, pos, &rr);
+        if (!pos) {
+            return NULL;
+        }
+        ttl = min_u32(ttl, rr.ttl);
+        if (rr.type == DNS_TYPE_A && rr.class == DNS_CLASS_IN && rr.rdlength == 4 && !found) {
+            memcpy(&addr, rr.rdata, 4);
+            found = true;
+        }
+    }
+
+    if (DNS_RCODE(flags) == DNS_RCODE_OK && found) {
+        ttl = min_u32(ttl, cache->params.max_ttl);
+        if (ttl < cache->params.min_ttl) {
+            ttl = cache->params.min_ttl;
+        }
+        entry->state = ESP_DNS_FOUND;
+        entry->addr = addr;
+    } else {
+        ttl = cache->params.neg_ttl;
+        for (unsigned i = 0; i < nscount; i++) {
+            pos = parse_rr(msg, len, pos, &rr);
+            if (!pos) {
+                break;
+            }
+            if (rr.type == DNS_TYPE_SOA && rr.rdlength >= 20) {
+                ttl = min_u32(ttl, min_u32(rr.ttl, get32(rr.rdata + rr.rdlength - 4)));
+            }
+        }
+        entry->state = ESP_DNS_NOT_FOUND;
+        entry->addr = 0;
+    }
+
+    entry->querying = false;
+    entry->ttl_ms = ttl * 1000;
+    entry->expires = now + entry->ttl_ms;
+    return entry;
+}
+
+esp_dns_entry_t *esp_dns_cache_timed_out(esp_dns_cache_t *cache, uint32_t now)
+{
+    for (size_t i = 0; i < cache->count; i++) {
+        esp_dns_entry_t *entry = &cache->entries[i];
+
+        if (entry->querying && expired(entry->deadline, now)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void esp_dns_cache_abandon(esp_dns_entry_t *entry)
+{
+    entry->querying = false;
+    if (entry->state == ESP_DNS_PENDING) {
+        entry->state = ESP_DNS_EMPTY;
+    }
+}
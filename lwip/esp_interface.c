@@ -38,7 +38,9 @@
  * Modified by Angus Gratton based on work by @kadamski/Espressif via esp-lwip project.
  */
 #include <string.h>
+#include <stdbool.h>
 #include "lwip/opt.h"
+#include "esp_opts.h"
 
 #include "lwip/def.h"
 #include "lwip/mem.h"
@@ -46,6 +48,8 @@
 #include <lwip/stats.h>
 #include <lwip/snmp.h>
 #include "lwip/ip.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/timeouts.h"
 #include "lwip/ethip6.h"
 #include "lwip/priv/tcp_priv.h"
 #include "netif/etharp.h"
@@ -53,6 +57,9 @@
 #include "netif/ppp/pppoe.h"
 #include "FreeRTOS.h"
 #include "task.h"
+#include "esp_interface.h"
+#include "esp_tcp_tune.h"
+#include "esp_ip_reass.h"
 
 /* declared in libnet80211.a */
 int8_t sdk_ieee80211_output_pbuf(struct netif *ifp, struct pbuf* pb);
@@ -61,6 +68,58 @@ int8_t sdk_ieee80211_output_pbuf(struct netif *ifp, struct pbuf* pb);
 #define IFNAME0 'e'
 #define IFNAME1 'n'
 
+esp_lwip_stats_t esp_lwip_stats;
+
+void esp_lwip_get_stats(esp_lwip_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    *stats = esp_lwip_stats;
+    taskEXIT_CRITICAL();
+}
+
+void esp_lwip_reset_stats(void)
+{
+    taskENTER_CRITICAL();
+    memset(&esp_lwip_stats, 0, sizeof(esp_lwip_stats));
+    esp_lwip_stats.rx.pool_usage_max = pp_rx_pool_usage;
+    taskEXIT_CRITICAL();
+}
+
+size_t esp_lwip_stats_dump(void *buf, size_t size)
+{
+    uint8_t *b = buf;
+    esp_lwip_stats_t stats;
+
+    if (size < ESP_LWIP_STATS_DUMP_SIZE) {
+        return 0;
+    }
+    b[0] = ESP_LWIP_STATS_MAGIC & 0xff;
+    b[1] = ESP_LWIP_STATS_MAGIC >> 8;
+    b[2] = ESP_LWIP_STATS_VERSION;
+    b[3] = sizeof(esp_lwip_stats_t) / sizeof(uint32_t);
+    /* All the counters are 32 bit, and the ESP8266 is little endian. 'buf'
+     * need not be word aligned, so the snapshot is copied in with memcpy(). */
+    esp_lwip_get_stats(&stats);
+    memcpy(b + 4, &stats, sizeof(stats));
+
+    return ESP_LWIP_STATS_DUMP_SIZE;
+}
+
+/* Count a frame to or from 'netif'. */
+static inline void netif_stats_add(struct netif *netif, bool tx, u16_t len)
+{
+    if (netif->num < ESP_LWIP_STATS_NETIFS) {
+        esp_netif_stats_t *stats = &esp_lwip_stats.netif[netif->num];
+        if (tx) {
+            stats->tx_packets++;
+            stats->tx_bytes += len;
+        } else {
+            stats->rx_packets++;
+            stats->rx_bytes += len;
+        }
+    }
+}
+
 /**
  * In this function, the hardware should be initialized.
  * Called from ethernetif_init().
@@ -84,6 +143,51 @@ low_level_init(struct netif *netif)
     /* Do whatever else is needed to initialize interface. */
 }
 
+#define SIZEOF_STRUCT_PBUF        LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf))
+
+#if ESP_TX_BOUNCE_BUFS
+
+#define TX_BOUNCE_SIZE (1500 + SIZEOF_ETH_HDR)
+
+/* Frames kept for copying pbufs the sdk can not send directly into. Each holds
+ * a reference of its own, so once the sdk has sent the frame and freed it the
+ * reference count returns to one and it can be used again. */
+static struct {
+    struct pbuf *p;
+    void *payload;
+} tx_bounce[ESP_TX_BOUNCE_BUFS];
+
+static struct pbuf *tx_bounce_get(struct pbuf *p)
+{
+    if (p->tot_len > TX_BOUNCE_SIZE) {
+        return NULL;
+    }
+
+    for (int i = 0; i < ESP_TX_BOUNCE_BUFS; i++) {
+        struct pbuf *b = tx_bounce[i].p;
+        if (b == NULL) {
+            b = pbuf_alloc(PBUF_RAW_TX, TX_BOUNCE_SIZE, PBUF_RAM);
+            if (b == NULL) {
+                return NULL;
+            }
+            tx_bounce[i].p = b;
+            tx_bounce[i].payload = b->payload;
+        } else if (b->ref != 1) {
+            continue;
+        }
+        /* The sdk may have moved the payload and rewritten the header, so
+         * start again from the state it was allocated in. */
+        b->payload = tx_bounce[i].payload;
+        b->len = b->tot_len = p->tot_len;
+        pbuf_copy_partial(p, b->payload, p->tot_len, 0);
+        return b;
+    }
+
+    return NULL;
+}
+
+#endif /* ESP_TX_BOUNCE_BUFS */
+
 /**
  * This function should do the actual transmission of the packet. The packet is
  * contained in the pbuf that is passed to the function. This pbuf
@@ -99,7 +203,6 @@ low_level_init(struct netif *netif)
  *       to become available since the stack doesn't retry to send a packet
  *       dropped because of memory failure (except for the TCP timers).
  */
-#define SIZEOF_STRUCT_PBUF        LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf))
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
@@ -112,14 +215,28 @@ low_level_output(struct netif *netif, struct pbuf *p)
 
     /* If the pbuf does not have contiguous data, or there is not enough room
      * for the link layer header, or there are multiple pbufs in the chain then
-     * clone a pbuf to output. */
+     * copy it to a single pbuf to output. A free bounce buffer is used if there
+     * is one, which saves allocating and freeing a frame sized block of heap
+     * for each of these. */
     if ((p->type_internal & PBUF_TYPE_FLAG_STRUCT_DATA_CONTIGUOUS) == 0 ||
         (u8_t *)p->payload < (u8_t *)p + SIZEOF_STRUCT_PBUF + PBUF_LINK_ENCAPSULATION_HLEN ||
         p->next) {
+#if ESP_TX_BOUNCE_BUFS
+        struct pbuf *b = tx_bounce_get(p);
+        if (b != NULL) {
+            esp_lwip_stats.tx.bounced++;
+            sdk_ieee80211_output_pbuf(netif, b);
+            netif_stats_add(netif, true, p->tot_len);
+            LINK_STATS_INC(link.xmit);
+            return ERR_OK;
+        }
+#endif
         struct pbuf *q = pbuf_clone(PBUF_RAW_TX, PBUF_RAM, p);
         if (q == NULL) {
+            esp_lwip_stats.tx.failed++;
             return ERR_MEM;
         }
+        esp_lwip_stats.tx.cloned++;
         sdk_ieee80211_output_pbuf(netif, q);
         /* The sdk will pbuf_ref the pbuf before returning and free it later
          * when it has been sent so free the link to it here. */
@@ -132,9 +249,11 @@ low_level_output(struct netif *netif, struct pbuf *p)
          * that the number of references has returned to one before reusing the
          * pbuf.
          */
+        esp_lwip_stats.tx.direct++;
         sdk_ieee80211_output_pbuf(netif, p);
     }
 
+    netif_stats_add(netif, true, p->tot_len);
     LINK_STATS_INC(link.xmit);
     return ERR_OK;
 }
@@ -158,68 +277,228 @@ void pp_recycle_rx_pbuf(struct pbuf *p)
     taskEXIT_CRITICAL();
 }
 
-/* Set to true to copy the rx pbufs on input and free them. The pp rx buffer
- * pool is limited so this allows a large number at the expense of memory.
+/* The pp rx buffer pool is small, and once it is exhausted the driver drops
+ * frames, so received frames are copied to the heap and the pool buffer
+ * freed while more than ESP_RX_COPY_WATERMARK pool buffers are held in lwip.
+ * Below that the copy is not worth its cost, and it is skipped anyway when
+ * the heap is short.
  */
+#if ESP_IP_REASS
+/* IPv4 fragments are always copied, so that none waits for the rest of its
+ * datagram in a pool buffer. */
+static bool rx_is_ip4_fragment(struct pbuf *p)
+{
+    const struct eth_hdr *ethhdr = p->payload;
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)((const u8_t *)p->payload + SIZEOF_ETH_HDR);
+
+    return p->len >= SIZEOF_ETH_HDR + IP_HLEN && ethhdr->type == PP_HTONS(ETHTYPE_IP) &&
+        (IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) != 0;
+}
+#else
+static inline bool rx_is_ip4_fragment(struct pbuf *p)
+{
+    return false;
+}
+#endif
+
+static bool rx_should_copy(uint32_t usage, struct pbuf *p)
+{
+    if (usage <= ESP_RX_COPY_WATERMARK && !rx_is_ip4_fragment(p)) {
+        return false;
+    }
+    if (xPortGetFreeHeapSize() < ESP_RX_HEAP_RESERVE + p->tot_len) {
+        esp_lwip_stats.rx.copy_failed++;
+        return false;
+    }
+    return true;
+}
+
+#if ESP_IP_REASS
 
-#define COPY_PP_RX_PBUFS 0
+static esp_ip_datagram_t reass_datagrams[ESP_IP_REASS_DATAGRAMS];
+static esp_ip_reass_t reass;
+static bool reass_timer;
+
+static void reass_free(void *buf)
+{
+    pbuf_free(buf);
+}
+
+/* Runs while datagrams are waiting, checking their age four times over
+ * ESP_IP_REASS_MAXAGE. */
+static void reass_tmr(void *arg)
+{
+    reass_timer = esp_ip_reass_expire(&reass, sys_now());
+    if (reass_timer) {
+        sys_timeout(ESP_IP_REASS_MAXAGE / 4, reass_tmr, NULL);
+    }
+}
+
+/* Pass a reassembled datagram to ip4_input(), its fragments chained behind
+ * the first and the first's header rewritten to cover them. */
+static void reass_input(esp_ip_datagram_t *d, struct netif *inp)
+{
+    esp_ip_frag_t *frag = d->frags;
+    struct pbuf *p = frag->buf;
+    struct ip_hdr *iphdr = p->payload;
+    u16_t hlen = IPH_HL_BYTES(iphdr);
+    u32_t len = hlen + d->total;
+
+    for (frag = frag->next; frag; frag = frag->next) {
+        pbuf_cat(p, frag->buf);
+    }
+    esp_ip_reass_done(&reass, d);
+
+    if (len > 0xffff) {
+        esp_lwip_stats.reass.dropped++;
+        pbuf_free(p);
+        return;
+    }
+    IPH_LEN_SET(iphdr, lwip_htons(len));
+    IPH_OFFSET_SET(iphdr, 0);
+    IPH_CHKSUM_SET(iphdr, 0);
+    IPH_CHKSUM_SET(iphdr, inet_chksum(iphdr, hlen));
+    ip4_input(p, inp);
+}
+
+/* LWIP_HOOK_IP4_INPUT, in the tcpip thread: takes the fragments, leaving
+ * other packets to ip4_input(). The destination of a fragment is not
+ * checked until its datagram is reassembled and passed back to ip4_input().
+ */
+int esp_ip4_input_hook(struct pbuf *p, struct netif *inp)
+{
+    struct ip_hdr *iphdr = p->payload;
+
+    if ((IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) == 0) {
+        return 0;
+    }
+    if (!reass.datagrams) {
+        esp_ip_reass_init(&reass, reass_datagrams, ESP_IP_REASS_DATAGRAMS, ESP_IP_REASS_BUDGET,
+                          ESP_IP_REASS_MAXAGE, reass_free, &esp_lwip_stats.reass);
+    }
+
+    u16_t hlen = IPH_HL_BYTES(iphdr);
+    u16_t len = lwip_ntohs(IPH_LEN(iphdr));
+    /* A fragment left in a pool buffer, the heap being too short to copy
+     * it, is dropped rather than held. */
+    if (p->esf_buf || hlen < IP_HLEN || hlen > p->len || len <= hlen || len > p->tot_len
+#if CHECKSUM_CHECK_IP
+        || inet_chksum(iphdr, hlen) != 0
+#endif
+        ) {
+        esp_lwip_stats.reass.dropped++;
+        pbuf_free(p);
+        return 1;
+    }
+    pbuf_realloc(p, len);
+
+    esp_ip_reass_key_t key = {
+        .src = iphdr->src.addr,
+        .dst = iphdr->dest.addr,
+        .id = IPH_ID(iphdr),
+        .proto = IPH_PROTO(iphdr),
+    };
+    u16_t offset = (lwip_ntohs(IPH_OFFSET(iphdr)) & IP_OFFMASK) * 8;
+    bool more = (IPH_OFFSET(iphdr) & PP_HTONS(IP_MF)) != 0;
+    u16_t charge = LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf)) + SIZEOF_ETH_HDR + len;
+
+    /* Only the first fragment keeps its header */
+    if (offset != 0) {
+        pbuf_remove_header(p, hlen);
+    }
+    esp_ip_datagram_t *d = esp_ip_reass_add(&reass, &key, offset, len - hlen, more, p, charge,
+                                            sys_now());
+    if (d) {
+        reass_input(d, inp);
+    } else if (!reass_timer) {
+        reass_timer = true;
+        sys_timeout(ESP_IP_REASS_MAXAGE / 4, reass_tmr, NULL);
+    }
+    return 1;
+}
+
+#endif /* ESP_IP_REASS */
 
 #if TCP_QUEUE_OOSEQ
 
-/* Return the number of ooseq bytes that can be retained given the current
- * size 'n'. */
-size_t ooseq_bytes_limit(struct tcp_pcb *pcb)
+/* Sizes of the ooseq queue of a pcb, split into the pbufs from the pp rx pool
+ * and those on the heap. */
+typedef struct {
+    size_t pool_pbufs;
+    size_t pool_bytes;
+    size_t heap_pbufs;
+    size_t heap_bytes;
+} ooseq_usage_t;
+
+static void ooseq_usage(struct tcp_pcb *pcb, ooseq_usage_t *usage)
 {
-#if COPY_PP_RX_PBUFS
-    struct tcp_seg *ooseq = pcb->ooseq;
-    size_t ooseq_blen = 0;
-    for (; ooseq != NULL; ooseq = ooseq->next) {
-        struct pbuf *p = ooseq->p;
-        ooseq_blen += p->tot_len;
+    memset(usage, 0, sizeof(*usage));
+    for (struct tcp_seg *ooseq = pcb->ooseq; ooseq != NULL; ooseq = ooseq->next) {
+        for (struct pbuf *p = ooseq->p; p != NULL; p = p->next) {
+            if (p->esf_buf) {
+                usage->pool_pbufs++;
+                usage->pool_bytes += p->len;
+            } else {
+                usage->heap_pbufs++;
+                usage->heap_bytes += p->len;
+            }
+        }
     }
+}
 
-    size_t free = xPortGetFreeHeapSize();
-    ssize_t target = ((ssize_t)free - 8000) + ooseq_blen;
+/* Return the number of ooseq bytes that can be retained given the current
+ * size 'n'. The pool is pre-allocated so its buffers are only limited in
+ * number, below, while heap pbufs may use the heap down to the reserve.
+ * With ESP_TCP_TUNE the total is also held to the connection's share of the
+ * heap. */
+size_t ooseq_bytes_limit(struct tcp_pcb *pcb)
+{
+    ooseq_usage_t usage;
+    ooseq_usage(pcb, &usage);
 
-    if (target < 0) {
-        target = 0;
+    ssize_t heap = (ssize_t)xPortGetFreeHeapSize() - ESP_RX_HEAP_RESERVE + (ssize_t)usage.heap_bytes;
+    if (heap < 0) {
+        heap = 0;
     }
 
-    return target;
-#else
-    /* The pool is pre-allocated so there is no need to look at the dynamic
-     * memory usage, just consider the number of them below. */
-    return 8000;
+    size_t limit = usage.pool_bytes + heap;
+#if ESP_TCP_TUNE && LWIP_TCP
+    limit = LWIP_MIN(limit, esp_tcp_tune_ooseq_bytes());
 #endif
+    if (usage.pool_bytes + usage.heap_bytes > limit) {
+        esp_lwip_stats.ooseq_bytes_over++;
+    }
+
+    return limit;
 }
 
 /* Return the number of ooseq pbufs that can be retained given the current
- * size 'n'. */
+ * size 'n'. Pool pbufs are only queued while few are held elsewhere in lwip,
+ * to avoid exhausting the pool, and heap pbufs while the heap is above the
+ * reserve. */
 size_t ooseq_pbufs_limit(struct tcp_pcb *pcb)
 {
-    struct tcp_seg *ooseq = pcb->ooseq;
-    size_t ooseq_qlen = 0;
-    for (; ooseq != NULL; ooseq = ooseq->next) {
-        struct pbuf *p = ooseq->p;
-        ooseq_qlen += pbuf_clen(p);
-    }
+    ooseq_usage_t usage;
+    ooseq_usage(pcb, &usage);
 
-#if COPY_PP_RX_PBUFS
-    /* More likely memory limited, but set some limit. */
-    ssize_t limit = 10;
-#else
-    /* Set a small limit if using the pp rx pool, to avoid exhausting it. */
-    ssize_t limit = 2;
-#endif
+    ssize_t pool = ESP_RX_OOSEQ_POOL_PBUFS - ((ssize_t)pp_rx_pool_usage - (ssize_t)usage.pool_pbufs);
+    if (pool <= 0) {
+        esp_lwip_stats.rx.ooseq_pool_full++;
+        pool = 0;
+    }
 
-    size_t usage = pp_rx_pool_usage;
-    ssize_t target = limit - ((ssize_t)usage - ooseq_qlen);
+    size_t heap = ESP_RX_OOSEQ_HEAP_PBUFS;
+    if (xPortGetFreeHeapSize() < ESP_RX_HEAP_RESERVE) {
+        esp_lwip_stats.rx.ooseq_heap_low++;
+        heap = 0;
+    }
 
-    if (target < 0) {
-        target = 0;
+    size_t limit = pool + heap;
+    if (usage.pool_pbufs + usage.heap_pbufs > limit) {
+        esp_lwip_stats.ooseq_pbufs_over++;
     }
 
-    return target;
+    return limit;
 }
 
 #endif /* TCP_QUEUE_OOSEQ */
@@ -256,6 +535,11 @@ void ethernetif_input(struct netif *netif, struct pbuf *p)
     taskENTER_CRITICAL();
     uint32_t usage = pp_rx_pool_usage + 1;
     pp_rx_pool_usage = usage;
+    esp_lwip_stats.rx.frames++;
+    netif_stats_add(netif, false, p->tot_len);
+    if (usage > esp_lwip_stats.rx.pool_usage_max) {
+        esp_lwip_stats.rx.pool_usage_max = usage;
+    }
     taskEXIT_CRITICAL();
 
     switch(htons(ethhdr->type)) {
@@ -279,17 +563,19 @@ void ethernetif_input(struct netif *netif, struct pbuf *p)
     {
 	/* full packet send to tcpip_thread to process */
 
-#if COPY_PP_RX_PBUFS
-        /* Optionally copy the rx pool buffer and free it immediately. This
-         * helps avoid exhausting the limited rx buffer pool but uses more
-         * memory. */
-        struct pbuf *q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
-        pbuf_free(p);
-        if (q == NULL) {
-            return;
+        /* Copy the rx pool buffer and free it immediately when the pool is
+         * running low. If the copy fails keep using the pool buffer rather
+         * than dropping the frame. */
+        if (rx_should_copy(usage, p)) {
+            struct pbuf *q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+            if (q != NULL) {
+                esp_lwip_stats.rx.copied++;
+                pbuf_free(p);
+                p = q;
+            } else {
+                esp_lwip_stats.rx.copy_failed++;
+            }
         }
-        p = q;
-#endif
 
         if (netif->input(p, netif) != ERR_OK) {
 	    LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
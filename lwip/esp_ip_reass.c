@@ -0,0 +1,246 @@
+/* IPv4 reassembly within a byte budget
+ *
+ * Each incomplete datagram keeps a list of its fragments in order of
+ * offset. A fragment overlapping another, other than an exact duplicate, or
+ * disagreeing about the length of the datagram, drops the whole datagram
+ * (as RFC 5722 has for IPv6): rebuilding from overlaps is what most attacks
+ * on reassembly rely on, and the sender retransmits the lot anyway.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ip_reass.h"
+
+/* Largest IPv4 datagram data, after the shortest header */
+#define IP_DATA_MAX (65535 - 20)
+
+static uint32_t frag_charge(uint16_t charge)
+{
+    return ((charge + 3u) & ~3u) + sizeof(esp_ip_frag_t);
+}
+
+static void drop(esp_ip_reass_t *reass, esp_ip_datagram_t *d)
+{
+    esp_ip_frag_t *frag = d->frags;
+
+    while (frag) {
+        esp_ip_frag_t *next = frag->next;
+        reass->free_buf(frag->buf);
+        free(frag);
+        frag = next;
+    }
+    reass->charged -= d->charge;
+    memset(d, 0, sizeof(*d));
+}
+
+static bool same_key(const esp_ip_reass_key_t *a, const esp_ip_reass_key_t *b)
+{
+    return a->src == b->src && a->dst == b->dst && a->id == b->id && a->proto == b->proto;
+}
+
+static esp_ip_datagram_t *find(esp_ip_reass_t *reass, const esp_ip_reass_key_t *key)
+{
+    for (size_t i = 0; i < reass->count; i++) {
+        esp_ip_datagram_t *d = &reass->datagrams[i];
+        if (d->used && same_key(&d->key, key)) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+/* The incomplete datagram started first, other than 'keep' */
+static esp_ip_datagram_t *oldest(esp_ip_reass_t *reass, const esp_ip_datagram_t *keep)
+{
+    esp_ip_datagram_t *found = NULL;
+
+    for (size_t i = 0; i < reass->count; i++) {
+        esp_ip_datagram_t *d = &reass->datagrams[i];
+        if (d->used && d != keep && (!found || (int32_t)(d->started - found->started) < 0)) {
+            found = d;
+        }
+    }
+    return found;
+}
+
+static void evict(esp_ip_reass_t *reass, esp_ip_datagram_t *d)
+{
+    drop(reass, d);
+    reass->stats->evicted++;
+}
+
+/* Drop 'd' and the fragment that was to join it */
+static void reject(esp_ip_reass_t *reass, esp_ip_datagram_t *d, void *buf)
+{
+    reass->free_buf(buf);
+    reass->stats->dropped++;
+    if (d && d->used) {
+        evict(reass, d);
+    }
+}
+
+static bool complete(const esp_ip_datagram_t *d)
+{
+    uint32_t end = 0;
+
+    if (!d->total) {
+        return false;
+    }
+    for (const esp_ip_frag_t *frag = d->frags; frag; frag = frag->next) {
+        if (frag->offset != end) {
+            return false;
+        }
+        end += frag->len;
+    }
+    return end == d->total;
+}
+
+void esp_ip_reass_init(esp_ip_reass_t *reass, esp_ip_datagram_t *datagrams, size_t count,
+                       uint32_t budget, uint32_t max_age_ms, void (*free_buf)(void *buf),
+                       esp_ip_reass_stats_t *stats)
+{
+    memset(datagrams, 0, count * sizeof(*datagrams));
+    reass->datagrams = datagrams;
+    reass->count = count;
+    reass->budget = budget;
+    reass->charged = 0;
+    reass->max_age_ms = max_age_ms;
+    reass->free_buf = free_buf;
+    reass->stats = stats;
+}
+
+esp_ip_datagram_t *esp_ip_reass_add(esp_ip_reass_t *reass, const esp_ip_reass_key_t *key,
+                                    uint16_t offset, uint16_t len, bool more, void *buf,
+                                    uint16_t charge, uint32_t now)
+{
+    esp_ip_datagram_t *d = find(reass, key);
+    uint32_t end = (uint32_t)offset + len;
+    uint32_t cost = frag_charge(charge);
+
+    reass->stats->fragments++;
+    if (len == 0 || end > IP_DATA_MAX || (more && (len & 7)) || cost > reass->budget) {
+        reject(reass, d, buf);
+        return NULL;
+    }
+
+    if (d && d->total && (end > d->total || (!more && end != d->total))) {
+        reject(reass, d, buf);
+        return NULL;
+    }
+
+    /* Find where it goes, and whether it overlaps */
+    esp_ip_frag_t *prev = NULL;
+    esp_ip_frag_t *next = d ? d->frags : NULL;
+    while (next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+    if (next && next->offset == offset && next->len == len) {
+        /* A duplicate, as when the sender retransmits */
+        reass->free_buf(buf);
+        return NULL;
+    }
+    if ((prev && prev->offset + prev->len > offset) || (next && (end > next->offset || !more))) {
+        reject(reass, d, buf);
+        return NULL;
+    }
+
+    /* Make room, oldest first, unless this datagram will not fit alone */
+    if (d && d->charge + cost > reass->budget) {
+        reject(reass, d, buf);
+        return NULL;
+    }
+    while (reass->charged + cost > reass->budget) {
+        esp_ip_datagram_t *victim = oldest(reass, d);
+        if (!victim) {
+            reject(reass, d, buf);
+            return NULL;
+        }
+        evict(reass, victim);
+    }
+    if (!d) {
+        for (size_t i = 0; i < reass->count && !d; i++) {
+            if (!reass->datagrams[i].used) {
+                d = &reass->datagrams[i];
+            }
+        }
+        if (!d) {
+            d = oldest(reass, NULL);
+            if (!d) {
+                reject(reass, NULL, buf);
+                return NULL;
+            }
+            evict(reass, d);
+        }
+        d->used = true;
+        d->key = *key;
+        d->started = now;
+    }
+
+    esp_ip_frag_t *frag = malloc(sizeof(*frag));
+    if (!frag) {
+        reass->free_buf(buf);
+        reass->stats->dropped++;
+        if (!d->frags) {
+            memset(d, 0, sizeof(*d));
+        }
+        return NULL;
+    }
+    frag->buf = buf;
+    frag->offset = offset;
+    frag->len = len;
+    frag->charge = charge;
+    frag->next = next;
+    if (prev) {
+        prev->next = frag;
+    } else {
+        d->frags = frag;
+    }
+    d->charge += cost;
+    reass->charged += cost;
+    if (!more) {
+        d->total = end;
+    }
+
+    if (complete(d)) {
+        reass->stats->completed++;
+        return d;
+    }
+    return NULL;
+}
+
+void esp_ip_reass_done(esp_ip_reass_t *reass, esp_ip_datagram_t *datagram)
+{
+    esp_ip_frag_t *frag = datagram->frags;
+
+    while (frag) {
+        esp_ip_frag_t *next = frag->next;
+        free(frag);
+        frag = next;
+    }
+    reass->charged -= datagram->charge;
+    memset(datagram, 0, sizeof(*datagram));
+}
+
+bool esp_ip_reass_expire(esp_ip_reass_t *reass, uint32_t now)
+{
+    bool pending = false;
+
+    for (size_t i = 0; i < reass->count; i++) {
+        esp_ip_datagram_t *d = &reass->datagrams[i];
+
+        if (!d->used) {
+            continue;
+        }
+        if (now - d->started >= reass->max_age_ms) {
+            drop(reass, d);
+            reass->stats->expired++;
+        } else {
+            pending = true;
+        }
+    }
+    return pending;
+}
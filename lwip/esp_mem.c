@@ -0,0 +1,104 @@
+/* Heap allocation for lwip, with dedicated pools for the structures it
+ * allocates most often
+ *
+ * With MEM_LIBC_MALLOC and MEMP_MEM_MALLOC every memp element (tcp_seg, pbuf
+ * header, tcp_pcb, netbuf, ...) is a separate malloc() call. The short lived
+ * ones left scattered between longer lived allocations slowly fragment the
+ * heap. When ESP_MEMP_POOLS is set, mem_clib_malloc() and friends (see
+ * esp_opts.h) serve allocations of exactly those element sizes from fixed
+ * pools, falling back to the heap when a pool is empty.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "esp_opts.h"
+#include "lwip/pbuf.h"
+#include "lwip/netbuf.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/priv/memp_priv.h"
+#include "esp_mempool.h"
+#include "esp_mem.h"
+
+#if ESP_MEMP_POOLS
+
+/* The size memp_malloc() asks mem_malloc() for */
+#define MEMP_ELEMENT_SIZE(type) (MEMP_SIZE + MEMP_ALIGN_SIZE(sizeof(type)))
+#define POOL_WORDS(type, count) (((MEMP_ELEMENT_SIZE(type) + 3) / 4) * (count))
+
+#if LWIP_TCP && ESP_MEMP_NUM_TCP_SEG
+static uint32_t tcp_seg_blocks[POOL_WORDS(struct tcp_seg, ESP_MEMP_NUM_TCP_SEG)];
+#endif
+#if ESP_MEMP_NUM_PBUF
+static uint32_t pbuf_blocks[POOL_WORDS(struct pbuf, ESP_MEMP_NUM_PBUF)];
+#endif
+#if LWIP_TCP && ESP_MEMP_NUM_TCP_PCB
+static uint32_t tcp_pcb_blocks[POOL_WORDS(struct tcp_pcb, ESP_MEMP_NUM_TCP_PCB)];
+#endif
+#if LWIP_NETCONN && ESP_MEMP_NUM_NETBUF
+static uint32_t netbuf_blocks[POOL_WORDS(struct netbuf, ESP_MEMP_NUM_NETBUF)];
+#endif
+
+static esp_mempool_t pools[] = {
+#if LWIP_TCP && ESP_MEMP_NUM_TCP_SEG
+    ESP_MEMPOOL_INIT("TCP_SEG", MEMP_ELEMENT_SIZE(struct tcp_seg), ESP_MEMP_NUM_TCP_SEG, tcp_seg_blocks),
+#endif
+#if ESP_MEMP_NUM_PBUF
+    ESP_MEMPOOL_INIT("PBUF", MEMP_ELEMENT_SIZE(struct pbuf), ESP_MEMP_NUM_PBUF, pbuf_blocks),
+#endif
+#if LWIP_TCP && ESP_MEMP_NUM_TCP_PCB
+    ESP_MEMPOOL_INIT("TCP_PCB", MEMP_ELEMENT_SIZE(struct tcp_pcb), ESP_MEMP_NUM_TCP_PCB, tcp_pcb_blocks),
+#endif
+#if LWIP_NETCONN && ESP_MEMP_NUM_NETBUF
+    ESP_MEMPOOL_INIT("NETBUF", MEMP_ELEMENT_SIZE(struct netbuf), ESP_MEMP_NUM_NETBUF, netbuf_blocks),
+#endif
+};
+
+#define NPOOLS (sizeof(pools) / sizeof(pools[0]))
+
+void *esp_mem_malloc(size_t size)
+{
+    void *ptr = esp_mempool_alloc(pools, NPOOLS, size);
+
+    return ptr ? ptr : malloc(size);
+}
+
+void *esp_mem_calloc(size_t count, size_t size)
+{
+    void *ptr = esp_mempool_alloc(pools, NPOOLS, count * size);
+
+    if (!ptr) {
+        return calloc(count, size);
+    }
+    memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void esp_mem_free(void *ptr)
+{
+    if (ptr && !esp_mempool_free(pools, NPOOLS, ptr)) {
+        free(ptr);
+    }
+}
+
+const esp_mempool_t *esp_mem_pools(size_t *count)
+{
+    *count = NPOOLS;
+    return pools;
+}
+
+void esp_mem_print_pools(void)
+{
+    printf("%-8s %5s %5s %5s %5s %9s\n", "pool", "size", "count", "used", "max", "fallbacks");
+    for (size_t i = 0; i < NPOOLS; i++) {
+        const esp_mempool_t *pool = &pools[i];
+        printf("%-8s %5u %5u %5u %5u %9u\n", pool->name, pool->size, pool->count,
+               pool->used, pool->max_used, pool->fallbacks);
+    }
+}
+
+#endif /* ESP_MEMP_POOLS */
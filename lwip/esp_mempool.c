@@ -0,0 +1,71 @@
+/* Fixed size block pools, used in front of the heap for the most frequently
+ * allocated lwip structures
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "FreeRTOS.h"
+#include "esp_mempool.h"
+
+void *esp_mempool_alloc(esp_mempool_t *pools, size_t npools, size_t size)
+{
+    esp_mempool_t *first = NULL;
+
+    for (size_t i = 0; i < npools; i++) {
+        esp_mempool_t *pool = &pools[i];
+        void *block = NULL;
+
+        if (pool->size != size) {
+            continue;
+        }
+        if (!first) {
+            first = pool;
+        }
+
+        portENTER_CRITICAL();
+        if (pool->free) {
+            block = pool->free;
+            pool->free = *(void **)block;
+        } else if (pool->unused < pool->count) {
+            block = (uint8_t *)pool->blocks + pool->unused++ * pool->size;
+        }
+        if (block) {
+            pool->used++;
+            if (pool->used > pool->max_used) {
+                pool->max_used = pool->used;
+            }
+        }
+        portEXIT_CRITICAL();
+
+        if (block) {
+            return block;
+        }
+    }
+
+    if (first) {
+        first->fallbacks++;
+    }
+    return NULL;
+}
+
+bool esp_mempool_free(esp_mempool_t *pools, size_t npools, void *ptr)
+{
+    for (size_t i = 0; i < npools; i++) {
+        esp_mempool_t *pool = &pools[i];
+        uint8_t *start = pool->blocks;
+
+        if ((uint8_t *)ptr < start || (uint8_t *)ptr >= start + pool->count * pool->size) {
+            continue;
+        }
+
+        portENTER_CRITICAL();
+        *(void **)ptr = pool->free;
+        pool->free = ptr;
+        pool->used--;
+        portEXIT_CRITICAL();
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,159 @@
+/* Memory held by each lwip socket
+ *
+ * Data waiting in a socket's mailbox is counted in bytes by lwip
+ * (recv_avail, with LWIP_SO_RCVBUF, which ESP_SOCKMEM turns on). The rest is
+ * found by walking the pbufs the socket and its pcb hold, which also shows
+ * how many of them are wifi rx pool buffers that the driver is waiting for.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "lwip/api.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "lwip/raw.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/sockets_priv.h"
+#include "esp_sockmem.h"
+
+#if ESP_SOCKMEM && LWIP_SOCKET
+
+static const char *type_name(uint8_t type)
+{
+    switch (type) {
+    case NETCONN_TCP:
+        return "tcp";
+    case NETCONN_UDP:
+        return "udp";
+    case NETCONN_RAW:
+        return "raw";
+    default:
+        return "?";
+    }
+}
+
+static void count_pbufs(const struct pbuf *p, uint32_t *bytes, uint16_t *pool)
+{
+    for (; p != NULL; p = p->next) {
+        *bytes += p->len;
+        if (p->esf_buf) {
+            (*pool)++;
+        }
+    }
+}
+
+static void report_tcp(const struct tcp_pcb *pcb, esp_sockmem_t *s)
+{
+    s->tcp_state = pcb->state;
+    s->local_port = pcb->local_port;
+    if (pcb->state == LISTEN) {
+        return;
+    }
+    s->remote_port = pcb->remote_port;
+    s->remote_addr = ip4_addr_get_u32(ip_2_ip4(&pcb->remote_ip));
+#if TCP_QUEUE_OOSEQ
+    for (const struct tcp_seg *seg = pcb->ooseq; seg != NULL; seg = seg->next) {
+        count_pbufs(seg->p, &s->ooseq, &s->pool_pbufs);
+    }
+#endif
+    count_pbufs(pcb->refused_data, &s->refused, &s->pool_pbufs);
+    for (const struct tcp_seg *seg = pcb->unsent; seg != NULL; seg = seg->next) {
+        s->send_queued += seg->len;
+    }
+    for (const struct tcp_seg *seg = pcb->unacked; seg != NULL; seg = seg->next) {
+        s->send_queued += seg->len;
+    }
+}
+
+static bool report_socket(int fd, esp_sockmem_t *s)
+{
+    struct lwip_sock *sock = lwip_socket_dbg_get_socket(fd);
+
+    if (!sock || !sock->conn) {
+        return false;
+    }
+    struct netconn *conn = sock->conn;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->type = NETCONNTYPE_GROUP(netconn_type(conn));
+    s->rcvbuf = netconn_get_recvbufsize(conn);
+    s->recv_queued = conn->recv_avail;
+
+    switch (s->type) {
+    case NETCONN_TCP:
+        count_pbufs(sock->lastdata.pbuf, &s->recv_held, &s->pool_pbufs);
+        if (conn->pcb.tcp) {
+            report_tcp(conn->pcb.tcp, s);
+        }
+        break;
+    case NETCONN_UDP:
+        if (sock->lastdata.netbuf) {
+            count_pbufs(sock->lastdata.netbuf->p, &s->recv_held, &s->pool_pbufs);
+        }
+        if (conn->pcb.udp) {
+            s->local_port = conn->pcb.udp->local_port;
+            s->remote_port = conn->pcb.udp->remote_port;
+            s->remote_addr = ip4_addr_get_u32(ip_2_ip4(&conn->pcb.udp->remote_ip));
+        }
+        break;
+    default:
+        if (sock->lastdata.netbuf) {
+            count_pbufs(sock->lastdata.netbuf->p, &s->recv_held, &s->pool_pbufs);
+        }
+        break;
+    }
+    return true;
+}
+
+int esp_sockmem_report(esp_sockmem_t *report, int max)
+{
+    int n = 0;
+
+    LOCK_TCPIP_CORE();
+    for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + NUM_SOCKETS && n < max; fd++) {
+        if (report_socket(fd, &report[n])) {
+            n++;
+        }
+    }
+    UNLOCK_TCPIP_CORE();
+    return n;
+}
+
+void esp_sockmem_print(void)
+{
+    esp_sockmem_t report[NUM_SOCKETS];
+    int n = esp_sockmem_report(report, NUM_SOCKETS);
+
+    printf("fd  type       state local remote                rcvbuf queued   held  ooseq refused   send pool\n");
+    for (int i = 0; i < n; i++) {
+        esp_sockmem_t *s = &report[i];
+        ip4_addr_t remote = { .addr = s->remote_addr };
+
+        printf("%-3d %-4s %11s %5u %15s:%-5u %6d %6d %6u %6u %7u %6u %4u\n", s->fd,
+               type_name(s->type),
+               s->type == NETCONN_TCP ? tcp_debug_state_str(s->tcp_state) : "-",
+               s->local_port, ip4addr_ntoa(&remote), s->remote_port, (int)s->rcvbuf,
+               (int)s->recv_queued, (unsigned)s->recv_held, (unsigned)s->ooseq,
+               (unsigned)s->refused, (unsigned)s->send_queued, s->pool_pbufs);
+    }
+}
+
+int32_t esp_sockmem_tcp_rcvbuf(const struct tcp_pcb *pcb)
+{
+    for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + NUM_SOCKETS; fd++) {
+        struct lwip_sock *sock = lwip_socket_dbg_get_socket(fd);
+
+        if (sock && sock->conn && sock->conn->pcb.tcp == pcb &&
+            NETCONNTYPE_GROUP(netconn_type(sock->conn)) == NETCONN_TCP) {
+            return netconn_get_recvbufsize(sock->conn);
+        }
+    }
+    return INT32_MAX;
+}
+
+#endif /* ESP_SOCKMEM && LWIP_SOCKET */
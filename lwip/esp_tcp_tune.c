@@ -0,0 +1,184 @@
+/* Runtime tuning of TCP buffering to the free heap
+ *
+ * A connection's share of the heap budget goes half to its receive window
+ * and a quarter each to its send buffer and ooseq queue, each between its
+ * floor and the compile time maximum.
+ *
+ * The windows and send buffers are reduced by withholding part of them: the
+ * withheld amount is taken out of pcb->rcv_wnd and pcb->snd_buf, so lwip
+ * keeps that much less free as data comes and goes, and is handed back with
+ * tcp_recved() and by adding it to snd_buf. Only what is free at the time
+ * can be withheld, and the rest is taken at later tunings. lwip does not
+ * move the right edge of an announced window back, so a window closes as
+ * data arrives rather than shrinking. The amounts withheld are kept in a
+ * pcb ext arg. With ESP_SOCKMEM a socket's receive window is also held to
+ * its SO_RCVBUF.
+ *
+ * Data buffered by TCP is itself taken from the free heap, so busy
+ * connections shrink the budget until they drain, which keeps the heap
+ * from being exhausted rather than letting it swing.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "lwip/opt.h"
+#include "esp_opts.h"
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/timeouts.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_tcp_tune.h"
+#include "esp_sockmem.h"
+
+#if ESP_TCP_TUNE && LWIP_TCP
+
+#if LWIP_WND_SCALE
+#error "esp_tcp_tune.c expects 16 bit windows"
+#endif
+
+static esp_tcp_tune_params_t params = {
+    .enabled = true,
+    .heap_reserve = ESP_TCP_TUNE_HEAP_RESERVE,
+    .heap_share = ESP_TCP_TUNE_HEAP_SHARE,
+    .min_wnd = ESP_TCP_TUNE_MIN_WND,
+    .min_snd_buf = ESP_TCP_TUNE_MIN_SND_BUF,
+    .interval_ms = ESP_TCP_TUNE_INTERVAL,
+};
+
+static esp_tcp_tune_state_t state = {
+    .wnd = TCP_WND,
+    .snd_buf = TCP_SND_BUF,
+    .ooseq_bytes = TCP_WND,
+};
+
+static u8_t ext_arg_id;
+
+/* The receive window withheld from a pcb in the high half of its ext arg,
+ * and the send buffer in the low half */
+#define WITHHELD(rx, tx) ((void *)(uintptr_t)(((uint32_t)(rx) << 16) | (tx)))
+#define WITHHELD_RX(arg) ((uint16_t)((uintptr_t)(arg) >> 16))
+#define WITHHELD_TX(arg) ((uint16_t)(uintptr_t)(arg))
+
+static uint16_t clamp(uint32_t value, uint16_t min, uint16_t max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+static void tune_pcb(struct tcp_pcb *pcb)
+{
+    void *arg = tcp_ext_arg_get(pcb, ext_arg_id);
+    uint16_t rx = WITHHELD_RX(arg), tx = WITHHELD_TX(arg);
+    uint16_t wnd = state.wnd;
+#if ESP_SOCKMEM && LWIP_SOCKET
+    /* SO_RCVBUF, keeping room for a segment so the window still opens */
+    int32_t rcvbuf = esp_sockmem_tcp_rcvbuf(pcb);
+    if (rcvbuf < wnd) {
+        wnd = LWIP_MAX(rcvbuf, TCP_MSS);
+    }
+#endif
+    uint16_t rx_target = TCP_WND_MAX(pcb) - wnd;
+    uint16_t tx_target = TCP_SND_BUF - state.snd_buf;
+
+    if (rx_target > rx) {
+        tcpwnd_size_t take = LWIP_MIN(rx_target - rx, pcb->rcv_wnd);
+        pcb->rcv_wnd -= take;
+        rx += take;
+        tcp_update_rcv_ann_wnd(pcb);
+    } else if (rx_target < rx) {
+        tcp_recved(pcb, rx - rx_target);
+        rx = rx_target;
+    }
+
+    if (tx_target > tx) {
+        tcpwnd_size_t take = LWIP_MIN(tx_target - tx, pcb->snd_buf);
+        pcb->snd_buf -= take;
+        tx += take;
+    } else if (tx_target < tx) {
+        pcb->snd_buf += tx - tx_target;
+        tx = tx_target;
+    }
+
+    tcp_ext_arg_set(pcb, ext_arg_id, WITHHELD(rx, tx));
+}
+
+static void tune(void *arg)
+{
+    esp_tcp_tune_params_t p;
+    unsigned active = 0;
+
+    esp_tcp_tune_get_params(&p);
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+        active++;
+    }
+
+    uint32_t free_heap = xPortGetFreeHeapSize();
+    esp_tcp_tune_state_t s = { .free_heap = free_heap, .active = active };
+    if (p.enabled) {
+        uint32_t budget = 0;
+        if (free_heap > p.heap_reserve) {
+            budget = (free_heap - p.heap_reserve) / 100 * p.heap_share / LWIP_MAX(active, 1);
+        }
+        s.wnd = clamp(budget / 2, p.min_wnd, TCP_WND);
+        s.snd_buf = clamp(budget / 4, p.min_snd_buf, TCP_SND_BUF);
+        s.ooseq_bytes = LWIP_MIN(budget / 4, s.wnd);
+    } else {
+        s.wnd = TCP_WND;
+        s.snd_buf = TCP_SND_BUF;
+        s.ooseq_bytes = TCP_WND;
+    }
+    taskENTER_CRITICAL();
+    state = s;
+    taskEXIT_CRITICAL();
+
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+        tune_pcb(pcb);
+    }
+
+    sys_timeout(p.interval_ms, tune, NULL);
+}
+
+void esp_tcp_tune_start(void *arg)
+{
+    ext_arg_id = tcp_ext_arg_alloc_id();
+    tune(NULL);
+}
+
+void esp_tcp_tune_get_params(esp_tcp_tune_params_t *p)
+{
+    taskENTER_CRITICAL();
+    *p = params;
+    taskEXIT_CRITICAL();
+}
+
+void esp_tcp_tune_set_params(const esp_tcp_tune_params_t *p)
+{
+    esp_tcp_tune_params_t checked = *p;
+
+    /* A writer can always make progress with a send buffer of a segment,
+     * whatever is in flight. */
+    checked.min_wnd = clamp(checked.min_wnd, TCP_MSS, TCP_WND);
+    checked.min_snd_buf = clamp(checked.min_snd_buf, TCP_MSS, TCP_SND_BUF);
+    checked.heap_share = LWIP_MIN(checked.heap_share, 100);
+    if (checked.interval_ms == 0) {
+        checked.interval_ms = ESP_TCP_TUNE_INTERVAL;
+    }
+
+    taskENTER_CRITICAL();
+    params = checked;
+    taskEXIT_CRITICAL();
+}
+
+void esp_tcp_tune_get_state(esp_tcp_tune_state_t *s)
+{
+    taskENTER_CRITICAL();
+    *s = state;
+    taskEXIT_CRITICAL();
+}
+
+size_t esp_tcp_tune_ooseq_bytes(void)
+{
+    return state.ooseq_bytes;
+}
+
+#endif /* ESP_TCP_TUNE && LWIP_TCP */
@@ -41,6 +41,11 @@
 #include <esp/hwrand.h>
 #include <fcntl.h>
 
+/* lwip/def.h includes this before lwip/opt.h, so take the options here, with
+ * the port's own defaults and hooks after them. */
+#include "lwipopts.h"
+#include "esp_opts.h"
+
 struct ip4_addr;
 struct esf_buf;
 void sdk_system_station_got_ip_set(struct ip4_addr *, struct ip4_addr *, struct ip4_addr *);
@@ -53,6 +58,24 @@ struct tcp_pcb;
 size_t ooseq_bytes_limit(struct tcp_pcb *);
 size_t ooseq_pbufs_limit(struct tcp_pcb *);
 
+void *esp_mem_malloc(size_t);
+void *esp_mem_calloc(size_t, size_t);
+void esp_mem_free(void *);
+
+/* The DNS hooks take an ip_addr_t, which is only a struct ip4_addr without
+ * IPv6 */
+#if LWIP_IPV6
+struct ip_addr;
+int8_t esp_dns_lookup_local(const char *, struct ip_addr *, uint8_t);
+int esp_dns_netconn_resolve(const char *, struct ip_addr *, uint8_t, int8_t *);
+#else
+int8_t esp_dns_lookup_local(const char *, struct ip4_addr *, uint8_t);
+int esp_dns_netconn_resolve(const char *, struct ip4_addr *, uint8_t, int8_t *);
+#endif
+
+struct netif;
+int esp_ip4_input_hook(struct pbuf *, struct netif *);
+
 /* Define generic types used in lwIP */
 typedef uint8_t    u8_t;
 typedef int8_t    s8_t;
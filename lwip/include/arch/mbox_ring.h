@@ -0,0 +1,74 @@
+/* Lock-free mailbox ring with a single consumer task
+ *
+ * A fixed size ring of message pointers, used in place of a FreeRTOS queue
+ * for the tcpip thread mailbox (see sys_arch.c). Any number of tasks and
+ * interrupt handlers may post, but only one task may fetch. Posting takes no
+ * lock and does not enter the scheduler unless the consumer is blocked
+ * waiting for a message, in which case it is woken with a task notification.
+ *
+ * The consumer task uses its task notification value while blocked in
+ * mbox_ring_fetch(), so it must not use task notifications for anything else.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _MBOX_RING_H
+#define _MBOX_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    volatile uint32_t seq;
+    void *msg;
+} mbox_ring_slot_t;
+
+typedef struct {
+    uint32_t mask;
+    volatile uint32_t tail;         /* Next position producers claim */
+    volatile uint32_t head;         /* Next position the consumer takes */
+    volatile uint32_t waiting;      /* Consumer is about to block */
+    TaskHandle_t volatile consumer; /* Set by the first fetch */
+    mbox_ring_slot_t slots[];
+} mbox_ring_t;
+
+/* Allocate a ring for at least 'size' messages. The size is rounded up to a
+ * power of two. Returns NULL if out of memory. */
+mbox_ring_t *mbox_ring_new(uint32_t size);
+
+/* Free a ring. */
+void mbox_ring_free(mbox_ring_t *ring);
+
+/* Post a message, returning false if the ring is full. */
+bool mbox_ring_trypost(mbox_ring_t *ring, void *msg);
+
+/* Post a message from an interrupt handler, returning false if the ring is
+ * full. Sets '*woken' if a context switch is needed, as the FreeRTOS
+ * *FromISR() functions do. */
+bool mbox_ring_trypost_fromisr(mbox_ring_t *ring, void *msg, BaseType_t *woken);
+
+/* Post a message, waiting for space if the ring is full. */
+void mbox_ring_post(mbox_ring_t *ring, void *msg);
+
+/* Take the next message without blocking, returning false if there is none.
+ * Only the consumer task may call this. */
+bool mbox_ring_tryfetch(mbox_ring_t *ring, void **msg);
+
+/* Take the next message, blocking for up to 'ticks' (portMAX_DELAY to wait
+ * forever). Returns false on timeout. Only the consumer task may call this. */
+bool mbox_ring_fetch(mbox_ring_t *ring, void **msg, TickType_t ticks);
+
+/* Number of messages in the ring. Only exact when no post is in progress. */
+uint32_t mbox_ring_count(mbox_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MBOX_RING_H */
@@ -58,5 +58,10 @@ typedef TaskHandle_t sys_thread_t;
 void sys_arch_msleep(uint32_t ms);
 #define sys_msleep(ms) sys_arch_msleep(ms)
 
+/* Make the next mailbox created a lock-free ring rather than a queue. Only one
+ * mailbox can be a ring, and only one task may fetch from it, so this is used
+ * just before tcpip_init() for the tcpip thread mailbox. */
+void sys_mbox_ring_next(void);
+
 #endif /* __ARCH_SYS_ARCH_H__ */
 
@@ -0,0 +1,39 @@
+/* Name resolution for lwip through the DNS cache in esp_dns_cache.c (see
+ * esp_dns.c)
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_DNS_H
+#define _ESP_DNS_H
+
+#include "lwip/opt.h"
+#include "lwip/dns.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* As dns_gethostbyname(): returns ERR_OK with the address in 'addr',
+ * ERR_INPROGRESS when 'found' will be called with the answer, or an error,
+ * ERR_VAL if the name is known not to exist. Called in the tcpip thread or
+ * with the core locked. */
+err_t esp_dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found,
+                            void *arg);
+
+/* Forget all the names. Called in the tcpip thread or with the core
+ * locked. */
+void esp_dns_flush(void);
+
+/* DNS_LOOKUP_LOCAL_EXTERN, giving dns_gethostbyname() the cached addresses */
+err_t esp_dns_lookup_local(const char *name, ip_addr_t *addr, u8_t addrtype);
+
+/* LWIP_HOOK_NETCONN_EXTERNAL_RESOLVE, resolving names for netconn_gethostbyname()
+ * and so the socket API */
+int esp_dns_netconn_resolve(const char *name, ip_addr_t *addr, u8_t addrtype, err_t *err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_DNS_H */
@@ -0,0 +1,106 @@
+/* DNS cache holding several names, with their TTLs, negative answers and
+ * refreshes ahead of expiry (see esp_dns.c for its use with lwip)
+ *
+ * The cache builds the queries for the names it is asked to resolve and
+ * takes the answers, leaving sending and receiving them, and timing out
+ * queries, to the caller. Times are in milliseconds from any free running
+ * clock that wraps at 2^32, TTLs in seconds. Only IPv4 addresses are kept.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_DNS_CACHE_H
+#define _ESP_DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest name kept, including the terminating nul */
+#ifndef ESP_DNS_CACHE_NAME_LEN
+#define ESP_DNS_CACHE_NAME_LEN 64
+#endif
+
+/* Largest query built */
+#define ESP_DNS_QUERY_MAX (12 + ESP_DNS_CACHE_NAME_LEN + 1 + 4)
+
+typedef enum {
+    ESP_DNS_EMPTY = 0,
+    ESP_DNS_PENDING,        /* Queried, and no answer yet */
+    ESP_DNS_FOUND,
+    ESP_DNS_NOT_FOUND,      /* The name, or an address for it, does not exist */
+} esp_dns_state_t;
+
+typedef struct {
+    char name[ESP_DNS_CACHE_NAME_LEN];
+    uint8_t state;
+    bool querying;          /* A query is outstanding, also while refreshing */
+    uint8_t tries;          /* Queries sent for the outstanding one, less one */
+    uint16_t id;            /* Of the outstanding query */
+    uint32_t addr;          /* IPv4, network byte order */
+    uint32_t expires;
+    uint32_t ttl_ms;        /* As answered, after the limits below */
+    uint32_t deadline;      /* Of the outstanding query */
+    uint32_t used;          /* Last looked up, to replace the least used */
+} esp_dns_entry_t;
+
+typedef struct {
+    uint32_t min_ttl;       /* Answers are kept for at least this long, s */
+    uint32_t max_ttl;       /* and at most this long */
+    uint32_t neg_ttl;       /* Most that a negative answer is kept, s */
+    uint8_t prefetch;       /* Percentage of the TTL left when a lookup refreshes */
+    uint16_t timeout_ms;    /* Of each query */
+} esp_dns_cache_params_t;
+
+typedef struct {
+    esp_dns_entry_t *entries;
+    size_t count;
+    esp_dns_cache_params_t params;
+} esp_dns_cache_t;
+
+void esp_dns_cache_init(esp_dns_cache_t *cache, esp_dns_entry_t *entries, size_t count,
+                        const esp_dns_cache_params_t *params);
+
+/* Empty the cache, other than queries outstanding. */
+void esp_dns_cache_flush(esp_dns_cache_t *cache);
+
+/* Find 'name'. Returns NULL unless it is being queried or has an answer
+ * that has not expired. An expired answer being refreshed becomes pending
+ * again. */
+esp_dns_entry_t *esp_dns_cache_lookup(esp_dns_cache_t *cache, const char *name, uint32_t now);
+
+/* True if 'entry' holds an address that is due to be refreshed, and no query
+ * is outstanding. */
+bool esp_dns_cache_stale(const esp_dns_cache_t *cache, const esp_dns_entry_t *entry, uint32_t now);
+
+/* Build a query with 'id' for the address of 'name' into 'buf', recording it
+ * in the entry for the name, which takes the place of the least recently
+ * used entry without a query outstanding if there was none. Sending another
+ * for a name already being queried counts a retry. Returns the length of the
+ * query, or 0 if the name can not be queried or every entry is being
+ * queried. */
+size_t esp_dns_cache_query(esp_dns_cache_t *cache, const char *name, uint16_t id, uint32_t now,
+                           uint8_t *buf, size_t size, esp_dns_entry_t **entry);
+
+/* Take a response. Returns the entry it answered, now FOUND or NOT_FOUND,
+ * and NULL if it answers no outstanding query. A server failure returns
+ * NULL and times the query out at once, to be retried or given up. */
+esp_dns_entry_t *esp_dns_cache_answer(esp_dns_cache_t *cache, const uint8_t *msg, size_t len,
+                                      uint32_t now);
+
+/* Returns an entry whose query has timed out, or NULL if none has. */
+esp_dns_entry_t *esp_dns_cache_timed_out(esp_dns_cache_t *cache, uint32_t now);
+
+/* Give up the outstanding query of 'entry'. An address being refreshed is
+ * kept until it expires. */
+void esp_dns_cache_abandon(esp_dns_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_DNS_CACHE_H */
@@ -0,0 +1,90 @@
+/* Counters for the lwip interface to the ESP wifi driver (esp_interface.c)
+ * and the lwip port (sys_arch.c)
+ *
+ * These are always enabled, unlike LWIP_STATS. They are plain increments
+ * without locking, so a count can very occasionally be lost when two tasks
+ * update the same one, which is accepted to keep them cheap.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_INTERFACE_H
+#define _ESP_INTERFACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_ip_reass.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of PP RX pool buffers currently held by lwip */
+extern volatile uint32_t pp_rx_pool_usage;
+
+/* Number of network interfaces counted, by netif->num. The station and
+ * softap interfaces are the first two added. */
+#define ESP_LWIP_STATS_NETIFS 2
+
+typedef struct {
+    uint32_t rx_packets;
+    uint32_t rx_bytes;
+    uint32_t tx_packets;
+    uint32_t tx_bytes;
+} esp_netif_stats_t;
+
+typedef struct {
+    uint32_t frames;            /* Frames received from the driver */
+    uint32_t copied;            /* Frames copied to the heap, freeing the pool buffer */
+    uint32_t copy_failed;       /* Copies wanted but not made for lack of heap */
+    uint32_t pool_usage_max;    /* Highest pp_rx_pool_usage seen */
+    uint32_t ooseq_pool_full;   /* ooseq limits computed with no pool pbufs to spare */
+    uint32_t ooseq_heap_low;    /* ooseq limits computed with the heap below the reserve */
+} esp_rx_stats_t;
+
+typedef struct {
+    uint32_t direct;            /* Frames passed to the driver as they were */
+    uint32_t bounced;           /* Frames copied into a pre-allocated bounce buffer */
+    uint32_t cloned;            /* Frames copied into a new heap pbuf */
+    uint32_t failed;            /* Frames dropped, no memory to copy them to */
+} esp_tx_stats_t;
+
+typedef struct {
+    esp_netif_stats_t netif[ESP_LWIP_STATS_NETIFS];
+    esp_rx_stats_t rx;
+    esp_tx_stats_t tx;
+    uint32_t mbox_full;         /* Messages dropped as the mailbox was full,
+                                   such as frames passed to tcpip_input() */
+    uint32_t ooseq_bytes_over;  /* ooseq queues trimmed to the bytes limit */
+    uint32_t ooseq_pbufs_over;  /* ooseq queues trimmed to the pbufs limit */
+    esp_ip_reass_stats_t reass; /* IPv4 reassembly, with ESP_IP_REASS */
+} esp_lwip_stats_t;
+
+/* The live counters. Use esp_lwip_get_stats() for a consistent copy. */
+extern esp_lwip_stats_t esp_lwip_stats;
+
+/* Copy the counters into 'stats'. */
+void esp_lwip_get_stats(esp_lwip_stats_t *stats);
+
+/* Reset the counters, starting rx.pool_usage_max from the current usage. */
+void esp_lwip_reset_stats(void);
+
+/* Binary dump of the counters: a 4 byte header of ESP_LWIP_STATS_MAGIC (2
+ * bytes, little endian), ESP_LWIP_STATS_VERSION and the number of counters
+ * that follow, then each counter of esp_lwip_stats_t in order as a 32 bit
+ * little endian value. Counters are only ever added at the end, so a reader
+ * can use the count to handle dumps from older and newer versions.
+ */
+#define ESP_LWIP_STATS_MAGIC     0x534c  /* "LS" */
+#define ESP_LWIP_STATS_VERSION   2  /* 2: reass added */
+#define ESP_LWIP_STATS_DUMP_SIZE (4 + sizeof(esp_lwip_stats_t))
+
+/* Write the binary dump to 'buf', returning the number of bytes written, or
+ * 0 if 'size' is less than ESP_LWIP_STATS_DUMP_SIZE. */
+size_t esp_lwip_stats_dump(void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_INTERFACE_H */
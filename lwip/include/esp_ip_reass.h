@@ -0,0 +1,94 @@
+/* IPv4 reassembly within a byte budget (see esp_ip_reass.c, and esp_interface.c
+ * for its use with lwip)
+ *
+ * Fragments are held in the caller's buffers, which the reassembly takes
+ * ownership of, each charged against the budget at a size the caller gives.
+ * A fragment that would take the total over the budget, or needs a datagram
+ * slot when all are taken, evicts the oldest incomplete datagrams first; one
+ * that would take its own datagram over the budget drops that datagram.
+ * Times are in milliseconds from any free running clock that wraps at 2^32.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_IP_REASS_H
+#define _ESP_IP_REASS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A fragment is identified by these fields of its IP header (RFC 791) */
+typedef struct {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t id;
+    uint8_t proto;
+} esp_ip_reass_key_t;
+
+typedef struct esp_ip_frag {
+    struct esp_ip_frag *next;   /* In order of offset */
+    void *buf;
+    uint16_t offset;            /* Of its data in the datagram, bytes */
+    uint16_t len;
+    uint16_t charge;
+} esp_ip_frag_t;
+
+typedef struct {
+    esp_ip_reass_key_t key;
+    bool used;
+    uint16_t total;             /* Data length, once the last fragment is in */
+    uint32_t started;
+    uint32_t charge;
+    esp_ip_frag_t *frags;
+} esp_ip_datagram_t;
+
+typedef struct {
+    uint32_t fragments;         /* Taken */
+    uint32_t completed;         /* Datagrams reassembled */
+    uint32_t evicted;           /* Incomplete datagrams dropped to make room */
+    uint32_t expired;           /* Incomplete datagrams dropped for their age */
+    uint32_t dropped;           /* Fragments dropped: inconsistent, or too big
+                                   for the budget */
+} esp_ip_reass_stats_t;
+
+typedef struct {
+    esp_ip_datagram_t *datagrams;
+    size_t count;
+    uint32_t budget;            /* Bytes */
+    uint32_t charged;
+    uint32_t max_age_ms;
+    void (*free_buf)(void *buf);
+    esp_ip_reass_stats_t *stats;
+} esp_ip_reass_t;
+
+void esp_ip_reass_init(esp_ip_reass_t *reass, esp_ip_datagram_t *datagrams, size_t count,
+                       uint32_t budget, uint32_t max_age_ms, void (*free_buf)(void *buf),
+                       esp_ip_reass_stats_t *stats);
+
+/* Take a fragment of 'len' bytes of data at 'offset', 'more' being the MF
+ * flag, held in 'buf'. Charges are rounded up to a multiple of 4 bytes, and
+ * a record of each fragment is charged on top. Returns the datagram if it
+ * is now complete: its fragments are in order in 'frags', and the caller
+ * takes their buffers and calls esp_ip_reass_done(). Otherwise returns NULL,
+ * 'buf' being held or freed. */
+esp_ip_datagram_t *esp_ip_reass_add(esp_ip_reass_t *reass, const esp_ip_reass_key_t *key,
+                                    uint16_t offset, uint16_t len, bool more, void *buf,
+                                    uint16_t charge, uint32_t now);
+
+/* Release a completed datagram, once its buffers have been taken. */
+void esp_ip_reass_done(esp_ip_reass_t *reass, esp_ip_datagram_t *datagram);
+
+/* Drop the datagrams started 'max_age_ms' or more before 'now'. Returns true
+ * if any are still incomplete. */
+bool esp_ip_reass_expire(esp_ip_reass_t *reass, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_IP_REASS_H */
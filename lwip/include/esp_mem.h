@@ -0,0 +1,33 @@
+/* Heap allocation for lwip, with dedicated pools for the structures it
+ * allocates most often (see esp_mem.c)
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_MEM_H
+#define _ESP_MEM_H
+
+#include <stddef.h>
+#include "esp_mempool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* lwip's mem_clib_malloc(), mem_clib_calloc() and mem_clib_free() when
+ * ESP_MEMP_POOLS is set. */
+void *esp_mem_malloc(size_t size);
+void *esp_mem_calloc(size_t count, size_t size);
+void esp_mem_free(void *ptr);
+
+/* The pools, for their usage and fallback counts. */
+const esp_mempool_t *esp_mem_pools(size_t *count);
+
+/* Print a table of the pools and their counts. */
+void esp_mem_print_pools(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_MEM_H */
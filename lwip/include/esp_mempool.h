@@ -0,0 +1,52 @@
+/* Fixed size block pools, used in front of the heap for the most frequently
+ * allocated lwip structures (see esp_mem.c)
+ *
+ * Each pool hands out blocks of exactly one size from its own storage, so
+ * short lived allocations of that size no longer break up the heap. A
+ * request of another size, or one made while the pool is empty, is left to
+ * the caller to allocate from the heap.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_MEMPOOL_H
+#define _ESP_MEMPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;
+    uint16_t size;          /* Block size, a multiple of 4 */
+    uint16_t count;         /* Number of blocks in 'blocks' */
+    void *blocks;
+    void *free;             /* Freed blocks, linked through their first word */
+    uint16_t unused;        /* Blocks from here on have never been handed out */
+    uint16_t used;
+    uint16_t max_used;
+    uint32_t fallbacks;     /* Requests left to the heap as the pool was empty */
+} esp_mempool_t;
+
+/* Initialiser for a pool of 'count' blocks of 'size' bytes in 'storage',
+ * which must be 4 byte aligned and at least size * count bytes. */
+#define ESP_MEMPOOL_INIT(pool_name, block_size, block_count, storage) \
+    { .name = pool_name, .size = (block_size), .count = (block_count), .blocks = (storage) }
+
+/* Take a block from the first pool of exactly 'size' bytes with one free.
+ * Returns NULL if no pool is of that size, or all of them are empty. */
+void *esp_mempool_alloc(esp_mempool_t *pools, size_t npools, size_t size);
+
+/* Return 'ptr' to the pool it came from. Returns false if it is not from any
+ * of the pools, and so must have come from the heap. */
+bool esp_mempool_free(esp_mempool_t *pools, size_t npools, void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_MEMPOOL_H */
@@ -0,0 +1,228 @@
+/* Options of the esp-open-rtos lwip port, and the lwip hooks it installs
+ *
+ * Each may be set in the application's lwipopts.h or on the command line;
+ * the defaults here fill in the rest. arch/cc.h includes this after
+ * lwipopts.h, so lwip and the port sources see the same values whichever
+ * lwipopts.h the application uses.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_OPTS_H
+#define _ESP_OPTS_H
+
+/* Received frames arrive in buffers from the small pre-allocated PP RX pool
+ * of the wifi driver. See esp_interface.c. */
+
+/* Copy received frames into heap pbufs, returning the pool buffer at once,
+ * while more than this many pool buffers are held by lwip. Zero copies every
+ * frame. */
+#ifndef ESP_RX_COPY_WATERMARK
+#define ESP_RX_COPY_WATERMARK               2
+#endif
+
+/* Free heap to keep in reserve: frames are not copied, and no heap pbufs are
+ * held on the TCP ooseq queues, below this. */
+#ifndef ESP_RX_HEAP_RESERVE
+#define ESP_RX_HEAP_RESERVE                 8000
+#endif
+
+/* Maximum number of pool pbufs, held anywhere in lwip, that still allows a
+ * pool pbuf to be queued on a TCP ooseq queue. */
+#ifndef ESP_RX_OOSEQ_POOL_PBUFS
+#define ESP_RX_OOSEQ_POOL_PBUFS             2
+#endif
+
+/* Maximum number of heap pbufs on each TCP ooseq queue. */
+#ifndef ESP_RX_OOSEQ_HEAP_PBUFS
+#define ESP_RX_OOSEQ_HEAP_PBUFS             10
+#endif
+
+/* Number of pre-allocated full size frames kept to copy chained or
+ * non-contiguous pbufs into for transmission, rather than cloning each to a
+ * new heap pbuf. They are allocated when first needed. Zero always clones. */
+#ifndef ESP_TX_BOUNCE_BUFS
+#define ESP_TX_BOUNCE_BUFS                  2
+#endif
+
+/* Use a lock-free ring (see arch/mbox_ring.h) rather than a FreeRTOS queue for
+ * the tcpip thread mailbox, which every received frame is posted to. Off by
+ * default until sys_arch.c has been built and run against lwip on the
+ * device. */
+#ifndef ESP_LWIP_MBOX_RING
+#define ESP_LWIP_MBOX_RING                  0
+#endif
+
+/* Hold each TCP connection's receive window, send buffer and ooseq queue to
+ * a share of the free heap, between the floors below and TCP_WND, TCP_SND_BUF
+ * and the ooseq limits. See esp_tcp_tune.h, which can change the policy at
+ * run time. Off by default until it has been built and measured against
+ * lwip. */
+#ifndef ESP_TCP_TUNE
+#define ESP_TCP_TUNE                        0
+#endif
+
+/* Free heap not shared between the connections. */
+#ifndef ESP_TCP_TUNE_HEAP_RESERVE
+#define ESP_TCP_TUNE_HEAP_RESERVE           ESP_RX_HEAP_RESERVE
+#endif
+
+/* Percentage of the free heap above the reserve shared between the
+ * connections. */
+#ifndef ESP_TCP_TUNE_HEAP_SHARE
+#define ESP_TCP_TUNE_HEAP_SHARE             50
+#endif
+
+#ifndef ESP_TCP_TUNE_MIN_WND
+#define ESP_TCP_TUNE_MIN_WND                (2 * TCP_MSS)
+#endif
+
+/* At least TCP_MSS. */
+#ifndef ESP_TCP_TUNE_MIN_SND_BUF
+#define ESP_TCP_TUNE_MIN_SND_BUF            TCP_MSS
+#endif
+
+/* Milliseconds between tunings. */
+#ifndef ESP_TCP_TUNE_INTERVAL
+#define ESP_TCP_TUNE_INTERVAL               500
+#endif
+
+/* Report the memory held by each socket (esp_sockmem.h), and limit the data
+ * each socket holds received in bytes with SO_RCVBUF, which turns on
+ * LWIP_SO_RCVBUF. lwipopts.h settles that before this file is read, so set
+ * this ahead of it there or on the command line. Off by default until
+ * esp_sockmem.c has been built and run against lwip. */
+#ifndef ESP_SOCKMEM
+#define ESP_SOCKMEM                         0
+#endif
+
+#if ESP_SOCKMEM && !LWIP_SO_RCVBUF
+#error "ESP_SOCKMEM needs LWIP_SO_RCVBUF"
+#endif
+
+/**
+ * ESP_MEMP_POOLS==1: Allocate the memp elements lwip uses most, of the sizes
+ * below, from dedicated fixed size pools rather than straight from the heap,
+ * to limit heap fragmentation. A request made while its pool is empty falls
+ * back to the heap. See esp_mem.c.
+ */
+#ifndef ESP_MEMP_POOLS
+#define ESP_MEMP_POOLS                  0
+#endif
+
+/**
+ * ESP_MEMP_NUM_*: the number of elements in each pool, zero for none.
+ */
+#ifndef ESP_MEMP_NUM_TCP_SEG
+#define ESP_MEMP_NUM_TCP_SEG            32
+#endif
+#ifndef ESP_MEMP_NUM_PBUF
+#define ESP_MEMP_NUM_PBUF               16
+#endif
+#ifndef ESP_MEMP_NUM_TCP_PCB
+#define ESP_MEMP_NUM_TCP_PCB            4
+#endif
+#ifndef ESP_MEMP_NUM_NETBUF
+#define ESP_MEMP_NUM_NETBUF             8
+#endif
+
+#if ESP_MEMP_POOLS
+#define mem_clib_malloc                 esp_mem_malloc
+#define mem_clib_calloc                 esp_mem_calloc
+#define mem_clib_free                   esp_mem_free
+#endif
+
+/**
+ * ESP_IP_REASS==1: Reassemble incoming fragmented IPv4 packets in the port
+ * rather than with IP_REASSEMBLY. Fragments are always copied out of the
+ * wifi driver's rx pool buffers, and those waiting are held within a budget
+ * of heap bytes, the oldest datagrams being dropped first. See esp_ip_reass.h.
+ * Off by default until the port glue in esp_interface.c has been built and
+ * run against lwip.
+ */
+#ifndef ESP_IP_REASS
+#define ESP_IP_REASS                    0
+#endif
+
+/**
+ * ESP_IP_REASS_BUDGET: Bytes of heap fragments waiting for reassembly may use.
+ */
+#ifndef ESP_IP_REASS_BUDGET
+#define ESP_IP_REASS_BUDGET             6000
+#endif
+
+/**
+ * ESP_IP_REASS_DATAGRAMS: Number of datagrams reassembled at once.
+ */
+#ifndef ESP_IP_REASS_DATAGRAMS
+#define ESP_IP_REASS_DATAGRAMS          4
+#endif
+
+/**
+ * ESP_IP_REASS_MAXAGE: Milliseconds a datagram waits for all its fragments.
+ */
+#ifndef ESP_IP_REASS_MAXAGE
+#define ESP_IP_REASS_MAXAGE             (IP_REASS_MAXAGE * 1000)
+#endif
+
+#if ESP_IP_REASS
+#define LWIP_HOOK_IP4_INPUT(p, inp)     esp_ip4_input_hook(p, inp)
+#endif
+
+/* Resolve names through the cache in esp_dns.c, which keeps the answers for
+ * several names for their TTLs, keeps negative answers, and refreshes
+ * addresses ahead of expiry. It serves the socket and netconn APIs and
+ * sntp, and gives its addresses to callers of dns_gethostbyname(). lwip's
+ * own DNS table still resolves .local names, names too long for the cache,
+ * and names first looked up with dns_gethostbyname(). Off by default until
+ * esp_dns.c and its hooks have been built and run against lwip. */
+#ifndef ESP_DNS_CACHE
+#define ESP_DNS_CACHE                   0
+#endif
+
+/* Number of names kept. */
+#ifndef ESP_DNS_CACHE_SIZE
+#define ESP_DNS_CACHE_SIZE              4
+#endif
+
+/* Least and most time an address is kept, seconds. */
+#ifndef ESP_DNS_CACHE_MIN_TTL
+#define ESP_DNS_CACHE_MIN_TTL           30
+#endif
+#ifndef ESP_DNS_CACHE_MAX_TTL
+#define ESP_DNS_CACHE_MAX_TTL           86400
+#endif
+
+/* Most time a negative answer is kept, seconds. */
+#ifndef ESP_DNS_CACHE_NEG_TTL
+#define ESP_DNS_CACHE_NEG_TTL           60
+#endif
+
+/* Refresh an address looked up with less than this percentage of its TTL
+ * left. */
+#ifndef ESP_DNS_CACHE_PREFETCH
+#define ESP_DNS_CACHE_PREFETCH          10
+#endif
+
+/* Milliseconds to wait for each answer, and the number of queries sent for
+ * a name, to each of the DNS servers in turn. */
+#ifndef ESP_DNS_CACHE_TIMEOUT
+#define ESP_DNS_CACHE_TIMEOUT           2000
+#endif
+#ifndef ESP_DNS_CACHE_TRIES
+#define ESP_DNS_CACHE_TRIES             4
+#endif
+
+/* Number of lookups that can wait for answers at once. */
+#ifndef ESP_DNS_CACHE_WAITERS
+#define ESP_DNS_CACHE_WAITERS           4
+#endif
+
+#if ESP_DNS_CACHE
+#define DNS_LOOKUP_LOCAL_EXTERN(name, addr, addrtype) \
+    esp_dns_lookup_local(name, addr, addrtype)
+#define LWIP_HOOK_NETCONN_EXTERNAL_RESOLVE(name, addr, addrtype, err) \
+    esp_dns_netconn_resolve(name, addr, addrtype, err)
+#endif
+
+#endif /* _ESP_OPTS_H */
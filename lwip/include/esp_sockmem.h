@@ -0,0 +1,55 @@
+/* Memory held by each lwip socket (see esp_sockmem.c)
+ *
+ * With ESP_SOCKMEM, received data is limited per socket in bytes by
+ * SO_RCVBUF (LWIP_SO_RCVBUF): UDP and raw sockets drop datagrams that would
+ * take them over it, and with ESP_TCP_TUNE a TCP socket's receive window is
+ * held to it.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_SOCKMEM_H
+#define _ESP_SOCKMEM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int fd;
+    uint8_t type;           /* NETCONN_TCP, NETCONN_UDP or NETCONN_RAW */
+    uint8_t tcp_state;      /* enum tcp_state, for TCP */
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint32_t remote_addr;   /* IPv4, network byte order */
+    int32_t rcvbuf;         /* SO_RCVBUF */
+    /* Bytes */
+    int32_t recv_queued;    /* Received and waiting to be read */
+    uint32_t recv_held;     /* Partly read */
+    uint32_t ooseq;         /* TCP segments received out of order */
+    uint32_t refused;       /* TCP data not yet taken, the mailbox being full */
+    uint32_t send_queued;   /* TCP data unsent or unacknowledged */
+    /* Of the pbufs held, partly read, out of order or refused, those from
+     * the wifi driver's rx pool */
+    uint16_t pool_pbufs;
+} esp_sockmem_t;
+
+/* Fill 'report' with up to 'max' open sockets. Returns the number filled. */
+int esp_sockmem_report(esp_sockmem_t *report, int max);
+
+/* Print a line for each open socket. */
+void esp_sockmem_print(void);
+
+struct tcp_pcb;
+
+/* SO_RCVBUF of the socket of 'pcb', or INT32_MAX if it has none. Called in
+ * the tcpip thread or with the core locked. */
+int32_t esp_sockmem_tcp_rcvbuf(const struct tcp_pcb *pcb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_SOCKMEM_H */
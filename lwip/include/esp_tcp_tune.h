@@ -0,0 +1,59 @@
+/* Runtime tuning of TCP buffering to the free heap (see esp_tcp_tune.c)
+ *
+ * TCP_WND, TCP_SND_BUF and the ooseq limits set the most a connection may
+ * buffer. Every ESP_TCP_TUNE_INTERVAL ms the tcpip thread shares a part of
+ * the free heap above a reserve between the active connections, and each
+ * connection's receive window, send buffer and ooseq queue are held to its
+ * share, between a floor and those maximums.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ESP_TCP_TUNE_H
+#define _ESP_TCP_TUNE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    bool enabled;           /* When false, connections get the maximums */
+    uint32_t heap_reserve;  /* Free heap left out of the share, bytes */
+    uint8_t heap_share;     /* Percentage of the rest shared by connections */
+    uint16_t min_wnd;       /* Floors, bytes */
+    uint16_t min_snd_buf;
+    uint16_t interval_ms;   /* Period of re-tuning */
+} esp_tcp_tune_params_t;
+
+/* The outcome of the last tuning */
+typedef struct {
+    uint32_t free_heap;
+    uint16_t active;        /* Connections sharing the budget */
+    uint16_t wnd;           /* Per connection */
+    uint16_t snd_buf;
+    uint16_t ooseq_bytes;
+} esp_tcp_tune_state_t;
+
+/* Start tuning. Called by the tcpip thread as it starts, see tcpip_init(). */
+void esp_tcp_tune_start(void *arg);
+
+void esp_tcp_tune_get_params(esp_tcp_tune_params_t *params);
+
+/* Takes effect at the next tuning, except that the interval takes effect
+ * after the next one. */
+void esp_tcp_tune_set_params(const esp_tcp_tune_params_t *params);
+
+void esp_tcp_tune_get_state(esp_tcp_tune_state_t *state);
+
+/* Per connection ooseq byte limit, used by ooseq_bytes_limit(). */
+size_t esp_tcp_tune_ooseq_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ESP_TCP_TUNE_H */
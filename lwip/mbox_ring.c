@@ -0,0 +1,186 @@
+/* Lock-free mailbox ring with a single consumer task
+ *
+ * This is a bounded queue in the style of Dmitry Vyukov's: each slot holds a
+ * sequence number telling producers when it is free to fill, and the consumer
+ * when it has been filled. Producers claim a position by advancing the tail
+ * with a compare-and-set, write the message, then publish it by advancing the
+ * slot sequence. The consumer needs no atomic operations at all.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include "arch/mbox_ring.h"
+
+#ifndef MBOX_RING_CAS
+#include <esp/interrupts.h>
+
+/* The lx106 has no compare-and-set instruction, but with a single core masking
+ * interrupts around the compare and the store is enough. */
+static inline bool ring_cas(volatile uint32_t *p, uint32_t expected, uint32_t desired)
+{
+    uint32_t ps = _xt_disable_interrupts();
+    bool ok = *p == expected;
+    if (ok) {
+        *p = desired;
+    }
+    _xt_restore_interrupts(ps);
+    return ok;
+}
+
+#define MBOX_RING_CAS(p, expected, desired) ring_cas(p, expected, desired)
+
+/* With one in-order core this only has to stop the compiler reordering
+ * memory accesses. */
+#define MBOX_RING_BARRIER() __asm__ volatile ("memw" ::: "memory")
+#endif
+
+mbox_ring_t *mbox_ring_new(uint32_t size)
+{
+    uint32_t n = 2;
+
+    while (n < size) {
+        n <<= 1;
+    }
+
+    mbox_ring_t *ring = malloc(sizeof(mbox_ring_t) + n * sizeof(mbox_ring_slot_t));
+    if (!ring) {
+        return NULL;
+    }
+    ring->mask = n - 1;
+    ring->tail = 0;
+    ring->head = 0;
+    ring->waiting = 0;
+    ring->consumer = NULL;
+    for (uint32_t i = 0; i < n; i++) {
+        ring->slots[i].seq = i;
+        ring->slots[i].msg = NULL;
+    }
+
+    return ring;
+}
+
+void mbox_ring_free(mbox_ring_t *ring)
+{
+    free(ring);
+}
+
+/* Claim a position and publish 'msg' in it. Returns false if full. */
+static inline bool ring_put(mbox_ring_t *ring, void *msg)
+{
+    uint32_t pos = ring->tail;
+    mbox_ring_slot_t *slot;
+
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        int32_t diff = (int32_t)(slot->seq - pos);
+        if (diff == 0) {
+            if (MBOX_RING_CAS(&ring->tail, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The consumer has not taken the message a lap behind yet */
+            return false;
+        }
+        /* Another producer took this position, try the next */
+        pos = ring->tail;
+    }
+
+    slot->msg = msg;
+    MBOX_RING_BARRIER();
+    slot->seq = pos + 1;
+    /* The consumer sets 'waiting' then checks for messages, so one of us is
+     * certain to see the other. */
+    MBOX_RING_BARRIER();
+
+    return true;
+}
+
+bool mbox_ring_trypost(mbox_ring_t *ring, void *msg)
+{
+    if (!ring_put(ring, msg)) {
+        return false;
+    }
+    if (ring->waiting) {
+        xTaskNotifyGive(ring->consumer);
+    }
+    return true;
+}
+
+bool mbox_ring_trypost_fromisr(mbox_ring_t *ring, void *msg, BaseType_t *woken)
+{
+    if (!ring_put(ring, msg)) {
+        return false;
+    }
+    if (ring->waiting) {
+        vTaskNotifyGiveFromISR(ring->consumer, woken);
+    }
+    return true;
+}
+
+void mbox_ring_post(mbox_ring_t *ring, void *msg)
+{
+    while (!mbox_ring_trypost(ring, msg)) {
+        /* Full, which should be rare, so rather than keeping a list of
+         * waiting producers just give the consumer a tick to catch up. */
+        vTaskDelay(1);
+    }
+}
+
+bool mbox_ring_tryfetch(mbox_ring_t *ring, void **msg)
+{
+    uint32_t pos = ring->head;
+    mbox_ring_slot_t *slot = &ring->slots[pos & ring->mask];
+
+    if ((int32_t)(slot->seq - (pos + 1)) < 0) {
+        return false;
+    }
+    MBOX_RING_BARRIER();
+    *msg = slot->msg;
+    MBOX_RING_BARRIER();
+    /* Free for the producer a lap ahead */
+    slot->seq = pos + ring->mask + 1;
+    ring->head = pos + 1;
+
+    return true;
+}
+
+bool mbox_ring_fetch(mbox_ring_t *ring, void **msg, TickType_t ticks)
+{
+    if (mbox_ring_tryfetch(ring, msg)) {
+        return true;
+    }
+
+    if (!ring->consumer) {
+        ring->consumer = xTaskGetCurrentTaskHandle();
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        ring->waiting = 1;
+        MBOX_RING_BARRIER();
+        if (mbox_ring_tryfetch(ring, msg)) {
+            ring->waiting = 0;
+            return true;
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks) {
+                ring->waiting = 0;
+                return false;
+            }
+            wait = ticks - elapsed;
+        }
+        /* A notification may be left over from a post that was seen without
+         * blocking, so this can return with nothing there; just go round. */
+        ulTaskNotifyTake(pdTRUE, wait);
+        ring->waiting = 0;
+    }
+}
+
+uint32_t mbox_ring_count(mbox_ring_t *ring)
+{
+    return ring->tail - ring->head;
+}
@@ -41,6 +41,7 @@
 
 /* ------------------------ lwIP includes --------------------------------- */
 #include "lwip/opt.h"
+#include "esp_opts.h"
 
 #include "lwip/err.h"
 #include "lwip/debug.h"
@@ -50,6 +51,9 @@
 #include "lwip/stats.h"
 #include "lwip/tcpip.h"
 
+#include "esp_interface.h"
+#include "arch/mbox_ring.h"
+
 #if configUSE_16_BIT_TICKS == 1
 #error This port requires 32 bit ticks or timer overflow will fail
 #endif
@@ -192,6 +196,30 @@ void sys_mutex_free(sys_mutex_t *pxMutex)
     *pxMutex = NULL;
 }
 
+#if ESP_LWIP_MBOX_RING
+
+/* The one mailbox that is a mbox_ring_t rather than a queue, if created. */
+static mbox_ring_t *ring_mbox;
+static bool ring_next;
+
+void sys_mbox_ring_next(void)
+{
+    ring_next = true;
+}
+
+#define MBOX_IS_RING(mbox) (ring_mbox != NULL && (void *)*(mbox) == (void *)ring_mbox)
+
+#else
+
+void sys_mbox_ring_next(void)
+{
+}
+
+#define MBOX_IS_RING(mbox) 0
+#define ring_mbox ((mbox_ring_t *)NULL)
+
+#endif /* ESP_LWIP_MBOX_RING */
+
 /*---------------------------------------------------------------------------*
  * Routine:  sys_mbox_new
  *---------------------------------------------------------------------------*
@@ -206,6 +234,21 @@ err_t sys_mbox_new(sys_mbox_t *mbox, int size)
 {
     LWIP_ASSERT("size > 0", size > 0);
 
+#if ESP_LWIP_MBOX_RING
+    if (ring_next) {
+        LWIP_ASSERT("one ring mailbox", ring_mbox == NULL);
+        ring_next = false;
+        ring_mbox = mbox_ring_new(size);
+        *mbox = (sys_mbox_t)ring_mbox;
+        if (ring_mbox == NULL) {
+            SYS_STATS_INC(mbox.err);
+            return ERR_MEM;
+        }
+        SYS_STATS_INC_USED(mbox);
+        return ERR_OK;
+    }
+#endif
+
     *mbox = xQueueCreate(size, sizeof(void *));
 
     if (*mbox == NULL) {
@@ -233,7 +276,11 @@ void sys_mbox_free(sys_mbox_t *mbox)
 {
     UBaseType_t msgs_waiting;
 
-    msgs_waiting = uxQueueMessagesWaiting(*mbox);
+    if (MBOX_IS_RING(mbox)) {
+        msgs_waiting = mbox_ring_count(ring_mbox);
+    } else {
+        msgs_waiting = uxQueueMessagesWaiting(*mbox);
+    }
     configASSERT(msgs_waiting == 0);
 
 #if SYS_STATS
@@ -243,6 +290,14 @@ void sys_mbox_free(sys_mbox_t *mbox)
     SYS_STATS_DEC(mbox.used);
 #endif /* SYS_STATS */
 
+#if ESP_LWIP_MBOX_RING
+    if (MBOX_IS_RING(mbox)) {
+        mbox_ring_free(ring_mbox);
+        ring_mbox = NULL;
+        return;
+    }
+#endif
+
     vQueueDelete(*mbox);
 }
 
@@ -257,6 +312,10 @@ void sys_mbox_free(sys_mbox_t *mbox)
  *---------------------------------------------------------------------------*/
 void sys_mbox_post(sys_mbox_t *mbox, void *msg)
 {
+    if (MBOX_IS_RING(mbox)) {
+        mbox_ring_post(ring_mbox, msg);
+        return;
+    }
     while (xQueueSendToBack(*mbox, &msg, portMAX_DELAY) != pdTRUE);
 }
 
@@ -275,19 +334,37 @@ void sys_mbox_post(sys_mbox_t *mbox, void *msg)
  *---------------------------------------------------------------------------*/
 err_t sys_mbox_trypost(sys_mbox_t *mbox, void *msg)
 {
-    if (xQueueSendToBack(*mbox, &msg, 0) == pdTRUE) {
+    if (MBOX_IS_RING(mbox)) {
+        if (mbox_ring_trypost(ring_mbox, msg)) {
+            return ERR_OK;
+        }
+    } else if (xQueueSendToBack(*mbox, &msg, 0) == pdTRUE) {
         return ERR_OK;
     }
 
     /* The queue was already full. */
     SYS_STATS_INC(mbox.err);
+    esp_lwip_stats.mbox_full++;
     return ERR_MEM;
 }
 
-err_t sys_mbox_trypost_fromisr(sys_mbox_t *q, void *msg)
+err_t sys_mbox_trypost_fromisr(sys_mbox_t *mbox, void *msg)
 {
-    /* Quietly fail - not implemented. */
-    return ERR_MEM;
+    BaseType_t woken = pdFALSE;
+    BaseType_t posted;
+
+    if (MBOX_IS_RING(mbox)) {
+        posted = mbox_ring_trypost_fromisr(ring_mbox, msg, &woken);
+    } else {
+        posted = xQueueSendToBackFromISR(*mbox, &msg, &woken) == pdTRUE;
+    }
+    if (!posted) {
+        esp_lwip_stats.mbox_full++;
+        return ERR_MEM;
+    }
+
+    portEND_SWITCHING_ISR(woken);
+    return ERR_OK;
 }
 
 /*---------------------------------------------------------------------------*
@@ -322,6 +399,14 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
         msg = &msg_dummy;
     }
 
+    if (MBOX_IS_RING(mbox)) {
+        if (mbox_ring_fetch(ring_mbox, msg, timeout == 0 ? portMAX_DELAY : timeout / portTICK_PERIOD_MS)) {
+            return 0;
+        }
+        *msg = NULL;
+        return SYS_ARCH_TIMEOUT;
+    }
+
     if (timeout == 0) {
         while (xQueueReceive(*mbox, &(*msg), portMAX_DELAY) != pdTRUE);
         return 0;
@@ -358,7 +443,11 @@ u32_t sys_arch_mbox_tryfetch(sys_mbox_t *mbox, void **msg)
         msg = &msg_dummy;
     }
 
-    if (xQueueReceive(*mbox, &(*msg), 0) == pdTRUE) {
+    if (MBOX_IS_RING(mbox)) {
+        if (mbox_ring_tryfetch(ring_mbox, msg)) {
+            return ERR_OK;
+        }
+    } else if (xQueueReceive(*mbox, &(*msg), 0) == pdTRUE) {
         return ERR_OK;
     }
 
@@ -37,6 +37,7 @@ sdk_SpiFlashOpResult sdk_SPIWrite(uint32_t des_addr, uint32_t *src_addr, uint32_
 // timers.o
 void sdk_os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg);
 void sdk_os_timer_arm(ETSTimer *ptimer, uint32_t milliseconds, bool repeat_flag);
+void sdk_os_timer_arm_us(ETSTimer *ptimer, uint32_t useconds, bool repeat_flag);
 void sdk_os_timer_disarm(ETSTimer *ptimer);
 
 // uart.o
@@ -18,6 +18,12 @@
  *  - Removed unused debug variables
  *  - xTaskGenericCreate is replaced with xTaskCreate
  *  - simplified time to ticks conversion (simply multiply by 5)
+ *  - pending timers are kept in a timing wheel rather than a sorted list,
+ *    see ets_timer_queue.c
+ *  - timers can be given slack, so that timers due close together fire on
+ *    one alarm, and all timers due are fired as one batch per wakeup
+ *  - counters of alarms, wakeups and callbacks, see etstimer_stats.h
+ *  - the timer task's stack can be set with ETS_TIMER_TASK_STACK
  *
  * This timer should be used with caution together with other tasks. As the
  * timer callback is executed within timer task context, access to data that
@@ -62,34 +68,43 @@ void sdk_ets_timer_init() {
 #include <timers.h>
 #include <queue.h>
 #include <stdio.h>
+#include "etstimer_stats.h"
+#include "ets_timer_queue.h"
+
+#if ETS_TIMER_WHEEL
+#define pending_init   ets_timer_wheel_init
+#define pending_add    ets_timer_wheel_add
+#define pending_remove ets_timer_wheel_remove
+#define pending_next   ets_timer_wheel_next
+#define pending_expire ets_timer_wheel_expire
+static ets_timer_wheel_t pending;
+#else
+#define pending_init   ets_timer_list_init
+#define pending_add    ets_timer_list_add
+#define pending_remove ets_timer_list_remove
+#define pending_next   ets_timer_list_next
+#define pending_expire ets_timer_list_expire
+static ets_timer_list_t pending;
+#endif
 
-typedef void ets_timer_func_t(void *);
+/* os_timers are fired from the timer task too (see timers.c), but their
+ * callbacks run in the FreeRTOS timer task */
+#ifndef ETS_TIMER_TASK_STACK
+#define ETS_TIMER_TASK_STACK 200
+#endif
 
-/**
- * This structure is used for both timers: ets_timer.c and timer.c
- */
-typedef struct ets_timer_st {
-    struct ets_timer_st  *next;
-    TimerHandle_t timer_handle;  // not used in ets_timer.c
-    uint32_t fire_ticks;         // FRC2 timer value when timer should fire
-    uint32_t period_ticks;       // timer value in FRC2 ticks for rpeating timers
-    ets_timer_func_t *callback;
-    bool repeat;                 // not used in ets_timer.c
-    void *timer_arg;
-} ets_timer_t;
+static TaskHandle_t task_handle = NULL;
 
-/**
- * Special values of ets_timer_t::next field
- */
-#define ETS_TIMER_NOT_ARMED (ets_timer_t*)(0xffffffff)
-#define ETS_TIMER_LIST_END  (ets_timer_t*)(0)
+/* Timers due and not yet fired by timer_task, linked through 'batch'. They
+ * count as armed, with 'next' set to ETS_TIMER_BATCHED. */
+static ets_timer_t *batch;
 
-/**
- * Linked list of timers
- */
-static ets_timer_t* timer_list = 0;
+static ets_timer_stats_t stats;
 
-static TaskHandle_t task_handle = NULL;
+static inline bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
 
 void sdk_ets_timer_setfn(ets_timer_t *timer, ets_timer_func_t *func, void *parg)
 {
@@ -97,6 +112,7 @@ void sdk_ets_timer_setfn(ets_timer_t *timer, ets_timer_func_t *func, void *parg)
     timer->timer_arg = parg;
     timer->fire_ticks = 0;
     timer->period_ticks = 0;
+    timer->slack = 0;
     timer->next = ETS_TIMER_NOT_ARMED;
 }
 
@@ -125,58 +141,29 @@ static void set_alarm(uint32_t ticks)
 }
 
 /**
- *
- * Pending timer list example:
- *
- * | Timer:      | T0 | T1 | T2 | T3 |
- * |-------------|----|----|----|----|
- * | fire_ticks: | 10 | 20 | 30 | 40 |
- * | next:       | T1 | T2 | T3 | 0  |
- *
- *
- * For example we need to add a timer that should fire at 25 ticks:
- *
- * | Timer:      | T0 | T1  | new | T2 | T3 |
- * |-------------|----|-----|-----|----|----|
- * | fire_ticks: | 10 | 20  | 25  | 30 | 40 |
- * | next:       | T1 | new | T2  | T3 | 0  |
- *
- * We squeeze the timer into the list so the list will always remain sorted
+ * Add a timer to the pending timers (see ets_timer_queue.c), and set the
+ * alarm for the next event. On the wheel this is not always a timer due but
+ * may be the start of a slot whose timers move down a level, so the alarm
+ * is set whichever it is.
  *
  * Note: if add the same timer twice the system halts
 */
-static void add_pending_timer(uint32_t ticks, ets_timer_t *timer)
+static void add_pending_timer(uint32_t ticks, ets_timer_t *timer, uint32_t now)
 {
-    ets_timer_t *prev = 0;
-    ets_timer_t *curr = timer_list;
-    while (curr) {
-        if (((int32_t)ticks - (int32_t)curr->fire_ticks) < 1) {
-            // found a timer that should fire later
-            // so our timer should fire earlier
-            break;
-        }
-        prev = curr;
-        curr = curr->next;
-    }
-
-    timer->next = curr;
-    timer->fire_ticks = ticks;
-
-    if (prev != 0) {
-        prev->next = timer;
-    } else {
-        // Our timer is the first in the line to fire
-        timer_list = timer;
-        set_alarm(ticks);
-    }
+    uint32_t next;
 
     // This situation might happen if adding the same timer twice
-    if (timer == timer->next) {
+    if (timer->next != ETS_TIMER_NOT_ARMED) {
         // This seems like an error: %s is used for line number
         // In the recent SDK Espressif fixed the format to "%s %u\n"
         printf("%s %s \n", "ets_timer.c", (char*)209);
         while (1);
     }
+
+    pending_add(&pending, timer, ticks, now);
+    if (pending_next(&pending, &next)) {
+        set_alarm(next);
+    }
 }
 
 /**
@@ -206,7 +193,8 @@ void sdk_ets_timer_arm_ms_us(ets_timer_t *timer, uint32_t value,
         timer->period_ticks = ticks;
     }
     vPortEnterCritical();
-    add_pending_timer(TIMER_FRC2.COUNT + ticks, timer);
+    uint32_t now = TIMER_FRC2.COUNT;
+    add_pending_timer(now + ticks, timer, now);
     vPortExitCritical();
 }
 
@@ -224,25 +212,42 @@ void sdk_ets_timer_arm_us(ets_timer_t *timer, uint32_t useconds,
             /*value in ms=*/false);
 }
 
+static void remove_batched(ets_timer_t *timer)
+{
+    for (ets_timer_t **link = &batch; *link; link = &(*link)->batch) {
+        if (*link == timer) {
+            *link = timer->batch;
+            break;
+        }
+    }
+}
+
+void ets_timer_set_slack(ets_timer_t *timer, uint32_t useconds)
+{
+    uint8_t slack = ets_timer_slack(useconds < UINT32_MAX / 5 ? useconds * 5 : UINT32_MAX);
+
+    vPortEnterCritical();
+    if (timer->next == ETS_TIMER_NOT_ARMED || timer->next == ETS_TIMER_BATCHED) {
+        timer->slack = slack;
+    } else {
+        /* The queue is ordered by the slack, so take it out to change it */
+        pending_remove(&pending, timer);
+        timer->slack = slack;
+        add_pending_timer(timer->fire_ticks, timer, TIMER_FRC2.COUNT);
+    }
+    vPortExitCritical();
+}
+
 /**
  * Function removes a timer from the pending timers list.
  */
 void sdk_ets_timer_disarm(ets_timer_t *timer)
 {
     vPortEnterCritical();
-    ets_timer_t *curr = timer_list;
-    ets_timer_t *prev = 0;
-    while (curr) {
-        if (curr == timer) {
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                timer_list = curr->next;
-            }
-            break;
-        }
-        prev = curr;
-        curr = curr->next;
+    if (timer->next == ETS_TIMER_BATCHED) {
+        remove_batched(timer);
+    } else {
+        pending_remove(&pending, timer);
     }
     timer->next = ETS_TIMER_NOT_ARMED;
     timer->period_ticks = 0;
@@ -250,39 +255,92 @@ void sdk_ets_timer_disarm(ets_timer_t *timer)
 }
 
 /**
- * Check the list of pending timers for expired ones and process them.
+ * Fire the pending timers that are due.
+ *
+ * All timers due are taken off the queue at once, against one reading of
+ * the clock, and fired in turn. Repeating timers go back on the queue
+ * without setting the alarm, which is set once when the batch is done.
+ * Timers that came due while the callbacks ran are fired as another batch.
  */
 static inline void process_pending_timers()
 {
+    ets_timer_t *timer;
+    ets_timer_t **tail;
+    uint32_t now, next;
+    uint32_t fired = 0;
+
     vPortEnterCritical();
-    int32_t ticks = TIMER_FRC2.COUNT;
-    while (timer_list) {
-        if (((int32_t)timer_list->fire_ticks - ticks) < 1) {
-            ets_timer_t *timer = timer_list;
-            timer_list = timer->next;
-            timer->next = ETS_TIMER_NOT_ARMED;
+    now = TIMER_FRC2.COUNT;
+    do {
+        tail = &batch;
+        while ((timer = pending_expire(&pending, now)) != NULL) {
+            timer->next = ETS_TIMER_BATCHED;
+            *tail = timer;
+            tail = &timer->batch;
+        }
+        *tail = NULL;
 
+        while ((timer = batch) != NULL) {
+            batch = timer->batch;
+            timer->next = ETS_TIMER_NOT_ARMED;
             vPortExitCritical();
             timer->callback(timer->timer_arg);
             vPortEnterCritical();
+            fired++;
 
-            if (timer->next == ETS_TIMER_NOT_ARMED) {
-                if (timer->period_ticks) {
-                    timer->fire_ticks = timer->fire_ticks + timer->period_ticks;
-                    add_pending_timer(timer->fire_ticks, timer);
-                }
+            if (timer->next == ETS_TIMER_NOT_ARMED && timer->period_ticks) {
+                pending_add(&pending, timer, timer->fire_ticks + timer->period_ticks, now);
             }
-            ticks = TIMER_FRC2.COUNT;
-        } else {
-            if (timer_list) {
-                set_alarm(timer_list->fire_ticks);
-            }
-            break;
         }
+        now = TIMER_FRC2.COUNT;
+    } while (pending_next(&pending, &next) && !before(now, next));
+
+    if (pending_next(&pending, &next)) {
+        set_alarm(next);
+    }
+    stats.wakeups++;
+    stats.fired += fired;
+    if (!fired) {
+        stats.empty++;
+    }
+    if (fired > stats.max_batch) {
+        stats.max_batch = fired;
     }
     vPortExitCritical();
 }
 
+/**
+ * FRC2 ticks until the next pending timer, for tickless idle in port.c
+ */
+bool ets_timer_next_alarm(uint32_t *delay)
+{
+    uint32_t next;
+    bool pending_timer;
+
+    vPortEnterCritical();
+    pending_timer = pending_next(&pending, &next);
+    if (pending_timer) {
+        int32_t ticks = next - TIMER_FRC2.COUNT;
+        *delay = ticks > 0 ? ticks : 0;
+    }
+    vPortExitCritical();
+    return pending_timer;
+}
+
+void ets_timer_get_stats(ets_timer_stats_t *out)
+{
+    vPortEnterCritical();
+    *out = stats;
+    vPortExitCritical();
+}
+
+void ets_timer_reset_stats(void)
+{
+    vPortEnterCritical();
+    stats = (ets_timer_stats_t){ 0 };
+    vPortExitCritical();
+}
+
 /**
  * .Lfunc002
  */
@@ -290,6 +348,7 @@ static void IRAM frc2_isr(void *arg)
 {
     BaseType_t task_woken = 0;
 
+    stats.alarms++;
     BaseType_t result = xTaskNotifyFromISR(task_handle, 0, eNoAction, &task_woken);
     if (result != pdTRUE) {
         printf("TIMQ_FL:%d!!", (uint32_t)result);
@@ -314,22 +373,22 @@ static void timer_task(void* param)
 
 void sdk_ets_timer_init()
 {
-    timer_list = 0;
-
     _xt_isr_attach(INUM_TIMER_FRC2, frc2_isr, NULL);
 
     /* Original code calls xTaskGenericCreate:
      * xTaskGenericCreate(task_handle, "rtc_timer_task", 200, 0, 12, &handle,
      *     NULL, NULL);
      */
-    xTaskCreate(timer_task, "rtc_timer_task", 200, 0, 12, &task_handle);
-    printf("frc2_timer_task_hdl:%p, prio:%d, stack:%d\n", task_handle, 12, 200);
+    xTaskCreate(timer_task, "rtc_timer_task", ETS_TIMER_TASK_STACK, 0, 12, &task_handle);
+    printf("frc2_timer_task_hdl:%p, prio:%d, stack:%d\n", task_handle, 12, ETS_TIMER_TASK_STACK);
 
     TIMER_FRC2.ALARM = 0;
     TIMER_FRC2.CTRL =  VAL2FIELD(TIMER_CTRL_CLKDIV, TIMER_CLKDIV_16)
         | TIMER_CTRL_RUN;
     TIMER_FRC2.LOAD = 0;
 
+    pending_init(&pending, TIMER_FRC2.COUNT);
+
     DPORT.INT_ENABLE |= DPORT_INT_ENABLE_TIMER1;
 
    _xt_isr_unmask(BIT(INUM_TIMER_FRC2));
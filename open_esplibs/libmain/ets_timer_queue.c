@@ -0,0 +1,348 @@
+/* Queues of pending ets_timers: the sorted list and the timing wheel
+ *
+ * The wheel keeps each slot as an unsorted list, linked both ways through
+ * 'next' and 'pprev' so a timer is removed without a search. Which slots
+ * are in use is kept in a bitmap per level, so the next slot in use is found
+ * without visiting the empty ones.
+ *
+ * A timer is put on the first level whose slots, counting on from the
+ * one holding 'base', reach its time. When 'base' comes to the start of a
+ * slot on a higher level, the timers in it are put back on the wheel, now
+ * landing on a lower level. A slot never holds timers from more than one
+ * turn of its level.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "open_esplibs.h"
+
+#if OPEN_LIBMAIN_ETS_TIMER
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ets_timer_queue.h"
+
+#define SLOT_MASK (ETS_TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) (ETS_TIMER_WHEEL_SHIFT + (level) * 6)
+
+/* Furthest a timer is placed from 'base', so it stays within the top level.
+ * A timer further out is moved down when it comes within this. */
+#define MAX_DELTA ((1u << 31) - (1u << LEVEL_SHIFT(ETS_TIMER_WHEEL_LEVELS - 1)) - 1)
+
+static inline bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+void ets_timer_list_init(ets_timer_list_t *list, uint32_t now)
+{
+    list->head = ETS_TIMER_LIST_END;
+}
+
+/**
+ *
+ * Pending timer list example:
+ *
+ * | Timer:      | T0 | T1 | T2 | T3 |
+ * |-------------|----|----|----|----|
+ * | fire_ticks: | 10 | 20 | 30 | 40 |
+ * | next:       | T1 | T2 | T3 | 0  |
+ *
+ *
+ * For example we need to add a timer that should fire at 25 ticks:
+ *
+ * | Timer:      | T0 | T1  | new | T2 | T3 |
+ * |-------------|----|-----|-----|----|----|
+ * | fire_ticks: | 10 | 20  | 25  | 30 | 40 |
+ * | next:       | T1 | new | T2  | T3 | 0  |
+ *
+ * We squeeze the timer into the list so the list will always remain sorted
+ */
+void ets_timer_list_add(ets_timer_list_t *list, ets_timer_t *timer, uint32_t ticks, uint32_t now)
+{
+    ets_timer_t *prev = 0;
+    ets_timer_t *curr = list->head;
+
+    timer->fire_ticks = ticks;
+    uint32_t due = ets_timer_due(timer);
+    while (curr) {
+        if ((int32_t)(due - ets_timer_due(curr)) < 1) {
+            // found a timer that should fire later
+            // so our timer should fire earlier
+            break;
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+
+    timer->next = curr;
+
+    if (prev != 0) {
+        prev->next = timer;
+    } else {
+        list->head = timer;
+    }
+}
+
+void ets_timer_list_remove(ets_timer_list_t *list, ets_timer_t *timer)
+{
+    ets_timer_t *curr = list->head;
+    ets_timer_t *prev = 0;
+    while (curr) {
+        if (curr == timer) {
+            if (prev) {
+                prev->next = curr->next;
+            } else {
+                list->head = curr->next;
+            }
+            break;
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+    timer->next = ETS_TIMER_NOT_ARMED;
+}
+
+bool ets_timer_list_next(ets_timer_list_t *list, uint32_t *ticks)
+{
+    if (!list->head) {
+        return false;
+    }
+    *ticks = ets_timer_due(list->head);
+    return true;
+}
+
+ets_timer_t *ets_timer_list_expire(ets_timer_list_t *list, uint32_t now)
+{
+    ets_timer_t *timer = list->head;
+
+    if (!timer || (int32_t)(ets_timer_due(timer) - now) >= 1) {
+        return NULL;
+    }
+    list->head = timer->next;
+    timer->next = ETS_TIMER_NOT_ARMED;
+    return timer;
+}
+
+/* Distance from 'start' to the first slot in use in 'bits', going round,
+ * or -1 if there is none. */
+static inline int first_slot(uint64_t bits, unsigned start)
+{
+    if (!bits) {
+        return -1;
+    }
+    if (start) {
+        bits = (bits >> start) | (bits << (ETS_TIMER_WHEEL_SLOTS - start));
+    }
+    return __builtin_ctzll(bits);
+}
+
+/* Windows of 'level' from the one holding 'from' to the one holding 'to',
+ * counting round the 32 bit clock. */
+static inline uint32_t windows(uint32_t from, uint32_t to, int level)
+{
+    uint32_t shift = LEVEL_SHIFT(level);
+
+    return ((to >> shift) - (from >> shift)) & (0xffffffffu >> shift);
+}
+
+static void place(ets_timer_wheel_t *wheel, ets_timer_t *timer)
+{
+    uint32_t delta = ets_timer_due(timer) - wheel->base;
+    int level;
+
+    if ((int32_t)delta < 0) {
+        delta = 0;
+    } else if (delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+    }
+    uint32_t ticks = wheel->base + delta;
+    for (level = 0; level < ETS_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (windows(wheel->base, ticks, level) < ETS_TIMER_WHEEL_SLOTS) {
+            break;
+        }
+    }
+
+    unsigned slot = (ticks >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    ets_timer_t **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+    wheel->count++;
+}
+
+static inline bool in_slots(ets_timer_wheel_t *wheel, ets_timer_t **pprev)
+{
+    ets_timer_t **slots = &wheel->slots[0][0];
+
+    return pprev >= slots && pprev < slots + ETS_TIMER_WHEEL_LEVELS * ETS_TIMER_WHEEL_SLOTS;
+}
+
+static void unlink_timer(ets_timer_wheel_t *wheel, ets_timer_t *timer)
+{
+    ets_timer_t **pprev = timer->pprev;
+
+    *pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = pprev;
+    } else {
+        /* Last in its slot: clear the slot's bit if it was the only one */
+        if (in_slots(wheel, pprev)) {
+            ptrdiff_t n = pprev - &wheel->slots[0][0];
+            wheel->occupied[n / ETS_TIMER_WHEEL_SLOTS] &= ~(1ULL << (n & SLOT_MASK));
+        }
+    }
+    timer->next = ETS_TIMER_NOT_ARMED;
+    wheel->count--;
+}
+
+/* Whether 'timer' is on the wheel. Timers are disarmed before
+ * sdk_ets_timer_setfn() first sets them up, holding whatever was in their
+ * memory, so the links are followed back to a slot, each checked to point
+ * at the timer before it, before anything is written through them. */
+static bool on_wheel(ets_timer_wheel_t *wheel, ets_timer_t *timer)
+{
+    ets_timer_t *curr = timer;
+
+    if (timer->next == ETS_TIMER_NOT_ARMED) {
+        return false;
+    }
+    for (uint32_t n = 0; n < wheel->count; n++) {
+        ets_timer_t **pprev = curr->pprev;
+
+        if (!pprev || ((uintptr_t)pprev & (sizeof(void *) - 1)) || *pprev != curr) {
+            return false;
+        }
+        if (in_slots(wheel, pprev)) {
+            return true;
+        }
+        curr = (ets_timer_t *)((char *)pprev - offsetof(ets_timer_t, next));
+    }
+    return false;
+}
+
+/* The next thing due: the first timer, or a slot on a higher level to move
+ * down, whichever comes first. Sets 'level' and 'slot', and 'timer' for the
+ * first level. */
+static bool next_event(ets_timer_wheel_t *wheel, uint32_t *ticks, int *level, unsigned *slot,
+                       ets_timer_t **timer)
+{
+    bool found = false;
+
+    for (int l = 0; l < ETS_TIMER_WHEEL_LEVELS; l++) {
+        uint32_t shift = LEVEL_SHIFT(l);
+        unsigned start = (wheel->base >> shift) & SLOT_MASK;
+        int d = first_slot(wheel->occupied[l], start);
+        uint32_t t;
+
+        if (d < 0) {
+            continue;
+        }
+        unsigned s = (start + d) & SLOT_MASK;
+        if (l == 0) {
+            ets_timer_t *first = wheel->slots[0][s];
+            t = ets_timer_due(first);
+            for (ets_timer_t *curr = first->next; curr; curr = curr->next) {
+                uint32_t due = ets_timer_due(curr);
+                if (before(due, t)) {
+                    first = curr;
+                    t = due;
+                }
+            }
+            *timer = first;
+        } else {
+            t = ((wheel->base >> shift) + d) << shift;
+        }
+        if (!found || before(t, *ticks)) {
+            found = true;
+            *ticks = t;
+            *level = l;
+            *slot = s;
+        }
+    }
+    return found;
+}
+
+void ets_timer_wheel_init(ets_timer_wheel_t *wheel, uint32_t now)
+{
+    for (int level = 0; level < ETS_TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < ETS_TIMER_WHEEL_SLOTS; slot++) {
+            wheel->slots[level][slot] = NULL;
+        }
+        wheel->occupied[level] = 0;
+    }
+    wheel->base = now;
+    wheel->count = 0;
+}
+
+void ets_timer_wheel_add(ets_timer_wheel_t *wheel, ets_timer_t *timer, uint32_t ticks, uint32_t now)
+{
+    uint32_t next;
+
+    /* 'base' only moves on when the wheel is expired, which can be up to a
+     * top level slot apart, or never when it is empty. Timers are placed
+     * from 'base', so keep it within a top level slot of the clock. It can
+     * move on to 'now' when nothing is due before then. */
+    if (!before(now, wheel->base + (1u << LEVEL_SHIFT(ETS_TIMER_WHEEL_LEVELS - 1))) &&
+        (!ets_timer_wheel_next(wheel, &next) || before(now, next))) {
+        wheel->base = now;
+    }
+    timer->fire_ticks = ticks;
+    place(wheel, timer);
+}
+
+void ets_timer_wheel_remove(ets_timer_wheel_t *wheel, ets_timer_t *timer)
+{
+    if (on_wheel(wheel, timer)) {
+        unlink_timer(wheel, timer);
+    }
+    timer->next = ETS_TIMER_NOT_ARMED;
+}
+
+bool ets_timer_wheel_next(ets_timer_wheel_t *wheel, uint32_t *ticks)
+{
+    int level;
+    unsigned slot;
+    ets_timer_t *timer;
+
+    return next_event(wheel, ticks, &level, &slot, &timer);
+}
+
+ets_timer_t *ets_timer_wheel_expire(ets_timer_wheel_t *wheel, uint32_t now)
+{
+    uint32_t ticks;
+    int level;
+    unsigned slot;
+    ets_timer_t *timer;
+
+    while (next_event(wheel, &ticks, &level, &slot, &timer) && !before(now, ticks)) {
+        if (before(wheel->base, ticks)) {
+            wheel->base = ticks;
+        }
+        if (level == 0) {
+            unlink_timer(wheel, timer);
+            return timer;
+        }
+
+        /* Move the slot's timers down */
+        timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+        while (timer) {
+            ets_timer_t *next = timer->next;
+            wheel->count--;
+            place(wheel, timer);
+            timer = next;
+        }
+    }
+    if (before(wheel->base, now)) {
+        wheel->base = now;
+    }
+    return NULL;
+}
+
+#endif /* OPEN_LIBMAIN_ETS_TIMER */
@@ -0,0 +1,130 @@
+/* Queues of pending ets_timers, in FRC2 ticks (see ets_timer_queue.c)
+ *
+ * Two queues with the same operations: the sorted list of the SDK, where
+ * arming and disarming walk the list, and a hierarchical timing wheel, where
+ * both take constant time. ets_timer.c uses the wheel unless ETS_TIMER_WHEEL
+ * is 0. Neither locks: the caller holds a critical section.
+ *
+ * Times are compared as signed differences, so a timer can be armed up to
+ * 2^31 ticks (about 429 seconds) ahead, less 2^26 (13 seconds) on the wheel
+ * and less its slack.
+ *
+ * A timer with slack may fire that much after its time. Both queues order
+ * timers by when they are due, which is their time moved on within the
+ * slack to the point with the most low bits clear. Timers due close
+ * together with enough slack then share a due time, and fire on one alarm.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _ETS_TIMER_QUEUE_H
+#define _ETS_TIMER_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ETS_TIMER_WHEEL
+#define ETS_TIMER_WHEEL 1
+#endif
+
+typedef void ets_timer_func_t(void *);
+
+/**
+ * This structure is used for both timers: ets_timer.c and timer.c
+ */
+typedef struct ets_timer_st {
+    struct ets_timer_st  *next;
+    union {
+        void *timer_handle;          // TimerHandle_t, in timer.c
+        struct ets_timer_st **pprev; // link to this timer, in the wheel
+        struct ets_timer_st *batch;  // next timer to fire, in ets_timer.c
+    };
+    uint32_t fire_ticks;         // FRC2 timer value when timer should fire
+    uint32_t period_ticks;       // timer value in FRC2 ticks for rpeating timers
+    ets_timer_func_t *callback;
+    union {
+        bool repeat;             // in timer.c
+        uint8_t slack;           // log2 of slack + 1 ticks, in ets_timer.c
+    };
+    void *timer_arg;
+} ets_timer_t;
+
+/**
+ * Special values of ets_timer_t::next field
+ */
+#define ETS_TIMER_NOT_ARMED (ets_timer_t*)(0xffffffff)
+#define ETS_TIMER_LIST_END  (ets_timer_t*)(0)
+#define ETS_TIMER_BATCHED   (ets_timer_t*)(0xfffffffe)
+
+/* Most slack a timer can have: 2^25 - 1 ticks, about 6.7 seconds */
+#define ETS_TIMER_SLACK_MAX 25
+
+/* Slack setting for up to 'ticks' of slack */
+static inline uint8_t ets_timer_slack(uint32_t ticks)
+{
+    if (ticks >= (1u << ETS_TIMER_SLACK_MAX) - 1) {
+        return ETS_TIMER_SLACK_MAX;
+    }
+    return 31 - __builtin_clz(ticks + 1);
+}
+
+/* When 'timer' is due: the time in [fire_ticks, fire_ticks + slack] with
+ * the most low bits clear. */
+static inline uint32_t ets_timer_due(const ets_timer_t *timer)
+{
+    if (!timer->slack) {
+        return timer->fire_ticks;
+    }
+    uint32_t limit = timer->fire_ticks + ((1u << timer->slack) - 1);
+    uint32_t diff = timer->fire_ticks ^ limit;
+
+    return limit & ~((0x80000000u >> __builtin_clz(diff)) - 1);
+}
+
+typedef struct {
+    ets_timer_t *head;
+} ets_timer_list_t;
+
+/* The wheel has ETS_TIMER_WHEEL_LEVELS levels of 64 slots. A slot of the
+ * first level holds the timers due in a window of 2^ETS_TIMER_WHEEL_SHIFT
+ * ticks, and each level's slots are 64 times wider than the one below.
+ * Timers are moved down a level as their window comes up, so only the
+ * first level is ever searched for a time, one slot at most. */
+#define ETS_TIMER_WHEEL_LEVELS 3
+#define ETS_TIMER_WHEEL_SLOTS  64
+#define ETS_TIMER_WHEEL_SHIFT  13   /* 1.6 ms at 5 MHz */
+
+typedef struct {
+    ets_timer_t *slots[ETS_TIMER_WHEEL_LEVELS][ETS_TIMER_WHEEL_SLOTS];
+    uint64_t occupied[ETS_TIMER_WHEEL_LEVELS];
+    uint32_t base;          /* Ticks processed up to */
+    uint32_t count;         /* Timers on the wheel */
+} ets_timer_wheel_t;
+
+/* Each queue has:
+ *
+ *  init    Start empty at 'now'.
+ *  add     Arm 'timer' to fire at 'ticks', 'now' being the current time.
+ *          The timer must not be armed already.
+ *  remove  Disarm 'timer', if it is armed.
+ *  next    Set 'ticks' to when expire() should next be called, returning
+ *          false if the queue is empty. The wheel may ask to be called
+ *          before its first timer is due, to move timers down a level.
+ *  expire  Take the first timer due by 'now', or return NULL, with none due.
+ *
+ * A timer taken or removed has 'next' set to ETS_TIMER_NOT_ARMED. Its
+ * 'slack' must not change while it is armed.
+ */
+void ets_timer_list_init(ets_timer_list_t *list, uint32_t now);
+void ets_timer_list_add(ets_timer_list_t *list, ets_timer_t *timer, uint32_t ticks, uint32_t now);
+void ets_timer_list_remove(ets_timer_list_t *list, ets_timer_t *timer);
+bool ets_timer_list_next(ets_timer_list_t *list, uint32_t *ticks);
+ets_timer_t *ets_timer_list_expire(ets_timer_list_t *list, uint32_t now);
+
+void ets_timer_wheel_init(ets_timer_wheel_t *wheel, uint32_t now);
+void ets_timer_wheel_add(ets_timer_wheel_t *wheel, ets_timer_t *timer, uint32_t ticks, uint32_t now);
+void ets_timer_wheel_remove(ets_timer_wheel_t *wheel, ets_timer_t *timer);
+bool ets_timer_wheel_next(ets_timer_wheel_t *wheel, uint32_t *ticks);
+ets_timer_t *ets_timer_wheel_expire(ets_timer_wheel_t *wheel, uint32_t now);
+
+#endif /* _ETS_TIMER_QUEUE_H */
@@ -13,6 +13,7 @@
 #include "esp/rom.h"
 #include "sdk_internal.h"
 #include "espressif/spi_flash.h"
+#include "spiflash.h"
 
 sdk_flashchip_t sdk_flashchip = {
     0x001640ef,      // device_id
@@ -57,6 +58,8 @@ sdk_SpiFlashOpResult IRAM sdk_SPIWrite(uint32_t des_addr, uint32_t *src_addr, ui
     uint32_t full_pages;
     uint32_t bytes_remaining;
 
+    spiflash_finish_suspended_erase();
+
     if (des_addr + size <= sdk_flashchip.chip_size) {
         first_page_portion = sdk_flashchip.page_size - (des_addr % sdk_flashchip.page_size);
         if (size < first_page_portion) {
@@ -91,6 +94,7 @@ sdk_SpiFlashOpResult IRAM sdk_SPIWrite(uint32_t des_addr, uint32_t *src_addr, ui
 }
 
 sdk_SpiFlashOpResult IRAM sdk_SPIRead(uint32_t src_addr, uint32_t *des_addr, uint32_t size) {
+    spiflash_finish_suspended_erase();
     if (SPI_read_data(&sdk_flashchip, src_addr, des_addr, size)) {
         return SPI_FLASH_RESULT_ERR;
     } else {
@@ -99,6 +103,7 @@ sdk_SpiFlashOpResult IRAM sdk_SPIRead(uint32_t src_addr, uint32_t *des_addr, uin
 }
 
 sdk_SpiFlashOpResult IRAM sdk_SPIEraseSector(uint16_t sec) {
+    spiflash_finish_suspended_erase();
     if (sec >= sdk_flashchip.chip_size / sdk_flashchip.sector_size) {
         return SPI_FLASH_RESULT_ERR;
     }
@@ -131,6 +136,7 @@ sdk_SpiFlashOpResult IRAM sdk_spi_flash_read_status(uint32_t *status) {
 
     portENTER_CRITICAL();
     Cache_Read_Disable();
+    spiflash_finish_suspended_erase();
     result = SPI_read_status(&sdk_flashchip, status);
     Cache_Read_Enable(0, 0, 1);
     portEXIT_CRITICAL();
@@ -142,6 +148,7 @@ sdk_SpiFlashOpResult IRAM sdk_spi_flash_write_status(uint32_t status) {
 
     portENTER_CRITICAL();
     Cache_Read_Disable();
+    spiflash_finish_suspended_erase();
     result = SPI_write_status(&sdk_flashchip, status);
     Cache_Read_Enable(0, 0, 1);
     portEXIT_CRITICAL();
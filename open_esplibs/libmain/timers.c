@@ -1,4 +1,5 @@
-/* Recreated Espressif libmain timers.o contents.
+/* Recreated Espressif libmain timers.o contents, with os_timers run as
+   ets_timers rather than FreeRTOS software timers.
 
    Copyright (C) 2015 Espressif Systems. Derived from MIT Licensed SDK libraries.
    BSD Licensed as described in the file LICENSE
@@ -7,16 +8,68 @@
 #if OPEN_LIBMAIN_TIMERS
 // The contents of this file are only built if OPEN_LIBMAIN_TIMERS is set to true
 
+#include "FreeRTOS.h"
+#include "timers.h"
 #include "etstimer.h"
 #include "stdio.h"
 
+/* The SDK runs os_timers as FreeRTOS software timers, counting in
+ * milliseconds/10 ticks, so periods under 10 ms fire a tick early or late,
+ * or at once. Here they are ets_timers on the FRC2 alarm instead (see
+ * ets_timer.c), with microsecond resolution.
+ *
+ * Their callbacks still run in the FreeRTOS timer task, at
+ * configTIMER_TASK_PRIORITY, not in the ets_timer task at priority 12: a
+ * slow os_timer callback must not hold up the tcpip and wifi tasks, or the
+ * other ets_timers. The ets_timer only passes the callback to the timer
+ * task with xTimerPendFunctionCall().
+ *
+ * FRC2 counts at 5 MHz, so an os_timer can be armed for up to
+ * OS_TIMER_MAX_MS. Longer times are cut down to that. */
+#define OS_TIMER_MAX_MS 400000
+
+/* Each os_timer's ets_timer calls os_timer_fire() with its entry here,
+ * which holds the os_timer callback. 'seq' changes whenever the timer is
+ * armed, disarmed or given a new callback, so that a callback already
+ * passed to the timer task is dropped if the timer changed since. */
 struct timer_list_st {
     struct timer_list_st *next;
     ETSTimer *timer;
+    ETSTimerFunc *func;
+    void *arg;
+    uint32_t seq;
 };
 
 static struct timer_list_st *timer_list;
-static uint8_t armed_timer_count;
+
+/* In the FreeRTOS timer task */
+static void os_timer_run(void *param, uint32_t seq) {
+    struct timer_list_st *entry = param;
+    ETSTimerFunc *func;
+    void *arg;
+    bool current;
+
+    vPortEnterCritical();
+    func = entry->func;
+    arg = entry->arg;
+    current = seq == entry->seq;
+    vPortExitCritical();
+    if (current) {
+        func(arg);
+    }
+}
+
+/* In the ets_timer task. Waits if the timer task's queue is full, which
+ * lets the timer task run. */
+static void os_timer_fire(void *param) {
+    struct timer_list_st *entry = param;
+
+    xTimerPendFunctionCall(os_timer_run, entry, entry->seq, portMAX_DELAY);
+}
+
+static struct timer_list_st *timer_entry(ETSTimer *ptimer) {
+    return ptimer->timer_func == os_timer_fire ? ptimer->timer_arg : NULL;
+}
 
 void sdk_os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg) {
     struct timer_list_st *entry = 0;
@@ -26,19 +79,17 @@ void sdk_os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg) {
     if (timer_list) {
         for (entry = timer_list; ; entry = entry->next) {
             if (entry->timer == ptimer) {
-                if (ptimer->timer_arg == parg && ptimer->timer_func == pfunction) {
+                if (entry->arg == parg && entry->func == pfunction &&
+                    ptimer->timer_func == os_timer_fire) {
                     return;
                 }
-                if (ptimer->timer_handle) {
-                    if (!xTimerDelete(ptimer->timer_handle, 50)) {
-                        printf("Timer Delete Failed\n");
-                    }
-                    armed_timer_count--;
-                }
-                ptimer->timer_func = pfunction;
-                ptimer->timer_arg = parg;
-                ptimer->timer_handle = 0;
-                ptimer->timer_ms = 0;
+                vPortEnterCritical();
+                sdk_ets_timer_disarm(ptimer);
+                sdk_ets_timer_setfn(ptimer, os_timer_fire, entry);
+                entry->func = pfunction;
+                entry->arg = parg;
+                entry->seq++;
+                vPortExitCritical();
                 return;
             }
             if (!entry->next) {
@@ -46,13 +97,14 @@ void sdk_os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg) {
             }
         }
     }
-    ptimer->timer_func = pfunction;
-    ptimer->timer_arg = parg;
-    ptimer->timer_handle = 0;
-    ptimer->timer_ms = 0;
-    new_entry = (struct timer_list_st *)pvPortMalloc(8);
+    /* Not seen before, so it may not have been set up: don't disarm it */
+    new_entry = (struct timer_list_st *)pvPortMalloc(sizeof(*new_entry));
     new_entry->timer = ptimer;
+    new_entry->func = pfunction;
+    new_entry->arg = parg;
+    new_entry->seq = 0;
     new_entry->next = 0;
+    sdk_ets_timer_setfn(ptimer, os_timer_fire, new_entry);
     tailptr = &entry->next;
     if (!timer_list) {
         tailptr = &timer_list;
@@ -60,47 +112,41 @@ void sdk_os_timer_setfn(ETSTimer *ptimer, ETSTimerFunc *pfunction, void *parg) {
     *tailptr = new_entry;
 }
 
-static void timer_tramp(TimerHandle_t xTimer)
-{
-    ETSTimer *ptimer = pvTimerGetTimerID(xTimer);
-    ptimer->timer_func(ptimer->timer_arg);
-}
+static void timer_arm(ETSTimer *ptimer, uint32_t value, bool repeat_flag, bool value_in_ms) {
+    uint32_t max = value_in_ms ? OS_TIMER_MAX_MS : OS_TIMER_MAX_MS * 1000;
+    struct timer_list_st *entry = timer_entry(ptimer);
 
-void sdk_os_timer_arm(ETSTimer *ptimer, uint32_t milliseconds, bool repeat_flag) {
-    if (!ptimer->timer_handle) {
-        ptimer->timer_repeat = repeat_flag;
-        ptimer->timer_ms = milliseconds;
-        ptimer->timer_handle = xTimerCreate(0, milliseconds/10, repeat_flag, ptimer, timer_tramp);
-        armed_timer_count++;
-        if (!ptimer->timer_handle) {
-            //FIXME: should print an error? (original code doesn't)
-            return;
-        }
-    }
-    if (ptimer->timer_repeat != repeat_flag) {
-        ptimer->timer_repeat = repeat_flag;
-        // FIXME: This is wrong.  The original code is directly modifying
-        // internal FreeRTOS structures to try to change the uxAutoReload of an
-        // existing timer.  The correct way to do this is probably to use
-        // xTimerDelete and then xTimerCreate to recreate the timer with a
-        // different uxAutoReload setting.
-        ((uint32_t *)ptimer->timer_handle)[7] = repeat_flag;
+    if (value > max) {
+        printf("os_timer %u%s too long\n", value, value_in_ms ? "ms" : "us");
+        value = max;
     }
-    if (ptimer->timer_ms != milliseconds) {
-        ptimer->timer_ms = milliseconds;
-        xTimerChangePeriod(ptimer->timer_handle, milliseconds/10, 10);
-    }
-    if (!xTimerStart(ptimer->timer_handle, 50)) {
-        printf("Timer Start Failed\n");
+    /* Arming an armed os_timer starts it again */
+    vPortEnterCritical();
+    sdk_ets_timer_disarm(ptimer);
+    if (entry) {
+        entry->seq++;
     }
+    sdk_ets_timer_arm_ms_us(ptimer, value, repeat_flag, value_in_ms);
+    vPortExitCritical();
+}
+
+void sdk_os_timer_arm(ETSTimer *ptimer, uint32_t milliseconds, bool repeat_flag) {
+    timer_arm(ptimer, milliseconds, repeat_flag, true);
+}
+
+void sdk_os_timer_arm_us(ETSTimer *ptimer, uint32_t useconds, bool repeat_flag) {
+    timer_arm(ptimer, useconds, repeat_flag, false);
 }
 
 void sdk_os_timer_disarm(ETSTimer *ptimer) {
-    if (ptimer->timer_handle) {
-        if (!xTimerStop(ptimer->timer_handle, 50)) {
-            printf("Timer Stop Failed\n");
-        }
+    struct timer_list_st *entry = timer_entry(ptimer);
+
+    vPortEnterCritical();
+    sdk_ets_timer_disarm(ptimer);
+    if (entry) {
+        entry->seq++;
     }
+    vPortExitCritical();
 }
 
 #endif /* OPEN_LIBMAIN_TIMERS */
@@ -0,0 +1,105 @@
+/* Accuracy and jitter of os_timers run on the FRC2 alarm
+ *
+ * Arms a repeating os_timer for each of a range of periods, most of them
+ * under the 10 ms FreeRTOS tick, and timestamps every callback with the
+ * FRC2 count. Prints, for each period, the mean interval, the spread of the
+ * intervals, and how late the callbacks came against the ideal schedule.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "etstimer.h"
+#include "espressif/osapi.h"
+#include "esp/timer.h"
+
+#include "testcase.h"
+
+DEFINE_SOLO_TESTCASE(09_os_timer_accuracy);
+
+#define FIRES 40
+#define TICKS_PER_US 5
+
+static ETSTimer timer;
+static uint32_t start;
+static uint32_t fired_at[FIRES];
+static volatile int fire_count;
+
+static void timer_cb(void *arg)
+{
+    int n = fire_count;
+
+    if (n < FIRES) {
+        fired_at[n] = timer_get_count(FRC2);
+        fire_count = n + 1;
+    }
+    if (n + 1 >= FIRES) {
+        sdk_os_timer_disarm(&timer);
+    }
+}
+
+static void measure(uint32_t period_us)
+{
+    uint32_t period = period_us * TICKS_PER_US;
+    uint32_t min = UINT32_MAX, max = 0;
+    int32_t late_min = INT32_MAX, late_max = INT32_MIN;
+
+    fire_count = 0;
+    sdk_os_timer_setfn(&timer, timer_cb, NULL);
+    start = timer_get_count(FRC2);
+    if (period_us % 1000) {
+        sdk_os_timer_arm_us(&timer, period_us, true);
+    } else {
+        sdk_os_timer_arm(&timer, period_us / 1000, true);
+    }
+    vTaskDelay((FIRES + 2) * period_us / 1000 / portTICK_PERIOD_MS + 2);
+    sdk_os_timer_disarm(&timer);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(FIRES, fire_count, "Timer fire count isn't correct");
+    for (int i = 0; i < FIRES; i++) {
+        int32_t late = fired_at[i] - (start + (i + 1) * period);
+        if (late < late_min) {
+            late_min = late;
+        }
+        if (late > late_max) {
+            late_max = late;
+        }
+        if (i > 0) {
+            uint32_t interval = fired_at[i] - fired_at[i - 1];
+            if (interval < min) {
+                min = interval;
+            }
+            if (interval > max) {
+                max = interval;
+            }
+        }
+    }
+    uint32_t mean = (fired_at[FIRES - 1] - fired_at[0]) / (FIRES - 1);
+
+    printf("period %6u us: mean %6u us, interval %6u..%6u us, late %5d..%5d us\n",
+           period_us, mean / TICKS_PER_US, min / TICKS_PER_US, max / TICKS_PER_US,
+           late_min / TICKS_PER_US, late_max / TICKS_PER_US);
+
+    /* Never early, and repeats keep to the period rather than drifting */
+    TEST_ASSERT_TRUE_MESSAGE(late_min >= 0, "Timer fired early");
+    TEST_ASSERT_INT_WITHIN_MESSAGE(10 * TICKS_PER_US, period, mean, "Timer period wrong");
+    TEST_ASSERT_TRUE_MESSAGE(late_max < 1000 * TICKS_PER_US, "Timer fired over 1 ms late");
+}
+
+static void test_task(void *pvParameters)
+{
+    static const uint32_t periods_us[] = { 500, 1000, 2000, 5000, 7500, 10000, 15000 };
+
+    for (int i = 0; i < sizeof(periods_us) / sizeof(periods_us[0]); i++) {
+        measure(periods_us[i]);
+    }
+    TEST_PASS();
+}
+
+static void a_09_os_timer_accuracy(void)
+{
+    xTaskCreate(test_task, "test_task", 512, NULL, 2, NULL);
+}
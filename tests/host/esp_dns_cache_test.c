@@ -0,0 +1,432 @@
+/* Host-side tests for the DNS cache in lwip/esp_dns_cache.c
+ *
+ * Queries built by the cache are sent over loopback UDP to a stub DNS server
+ * in this process, which answers them from a table of records, and the
+ * answers are passed back to the cache. Time is simulated.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "esp_dns_cache.h"
+#include "host_test.h"
+
+#define CACHE_SIZE 4
+
+typedef struct {
+    const char *name;
+    uint8_t rcode;
+    const char *addr;       /* NULL for no A record */
+    uint32_t ttl;
+    const char *cname;      /* Answered as an alias for this, with 'addr' */
+    uint32_t cname_ttl;
+    bool soa;               /* Authority SOA with these, for negative answers */
+    uint32_t soa_ttl;
+    uint32_t soa_minimum;
+    bool drop;              /* No answer at all */
+} stub_record_t;
+
+static stub_record_t records[] = {
+    { "broker.example.com", 0, "10.0.0.1", 300 },
+    { "short.example.com", 0, "10.0.0.2", 1 },
+    { "long.example.com", 0, "10.0.0.3", 10 * 24 * 3600 },
+    { "ota.example.com", 0, "10.0.0.4", 600, "cdn.example.net", 100 },
+    { "gone.example.com", 3, NULL, 0, NULL, 0, true, 3600, 20 },
+    { "lame.example.com", 3, NULL, 0, NULL, 0, true, 3600, 300 },
+    { "nosoa.example.com", 3 },
+    { "ipv6only.example.com", 0, NULL, 0, NULL, 0, true, 30, 3600 },
+    { "broken.example.com", 2 },
+    { "silent.example.com", 0, NULL, 0, NULL, 0, false, 0, 0, true },
+    { "pool.example.org", 0, "10.0.1.1", 100 },
+    { "a.example.org", 0, "10.0.2.1", 300 },
+    { "b.example.org", 0, "10.0.2.2", 300 },
+    { "c.example.org", 0, "10.0.2.3", 300 },
+    { "d.example.org", 0, "10.0.2.4", 300 },
+    { "e.example.org", 0, "10.0.2.5", 300 },
+};
+
+static const esp_dns_cache_params_t params = {
+    .min_ttl = 30,
+    .max_ttl = 86400,
+    .neg_ttl = 60,
+    .prefetch = 10,
+    .timeout_ms = 2000,
+};
+
+static esp_dns_entry_t entries[CACHE_SIZE];
+static esp_dns_cache_t cache;
+static int server_fd = -1, client_fd = -1;
+static struct sockaddr_in server_addr;
+static uint16_t next_id = 0x1234;
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, value >> 16);
+    put16(p + 2, value);
+}
+
+static size_t put_rr(uint8_t *p, uint16_t name_ptr, uint16_t type, uint32_t ttl, uint16_t rdlength)
+{
+    put16(p, 0xc000 | name_ptr);
+    put16(p + 2, type);
+    put16(p + 4, 1);
+    put32(p + 6, ttl);
+    put16(p + 10, rdlength);
+    return 12;
+}
+
+static size_t put_name(uint8_t *p, const char *name)
+{
+    size_t pos = 0;
+
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t len = dot ? (size_t)(dot - name) : strlen(name);
+
+        p[pos++] = len;
+        memcpy(p + pos, name, len);
+        pos += len;
+        name += dot ? len + 1 : len;
+    }
+    p[pos++] = 0;
+    return pos;
+}
+
+static stub_record_t *find_record(const char *name)
+{
+    for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+        if (strcasecmp(records[i].name, name) == 0) {
+            return &records[i];
+        }
+    }
+    return NULL;
+}
+
+static void start_stub(void)
+{
+    socklen_t len = sizeof(server_addr);
+
+    if (server_fd >= 0) {
+        return;
+    }
+    server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    client_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    getsockname(server_fd, (struct sockaddr *)&server_addr, &len);
+}
+
+/* Answer one query, from the table of records */
+static void stub_serve(void)
+{
+    uint8_t msg[512];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    char name[256] = "";
+    ssize_t len = recvfrom(server_fd, msg, sizeof(msg), 0, (struct sockaddr *)&from, &fromlen);
+    size_t pos = 12;
+    stub_record_t *record;
+
+    if (len < 12) {
+        return;
+    }
+    while (pos < (size_t)len && msg[pos]) {
+        if (name[0]) {
+            strcat(name, ".");
+        }
+        strncat(name, (char *)msg + pos + 1, msg[pos]);
+        pos += 1 + msg[pos];
+    }
+    pos += 1 + 4;
+    record = find_record(name);
+    if (pos > (size_t)len || !record || record->drop) {
+        return;
+    }
+
+    uint16_t ancount = 0, nscount = 0;
+    uint16_t a_name = 12;
+    put16(msg + 2, 0x8180 | record->rcode);
+    if (record->cname) {
+        size_t rdlength = put_name(msg + pos + 12, record->cname);
+
+        pos += put_rr(msg + pos, 12, 5, record->cname_ttl, rdlength);
+        a_name = pos;
+        pos += rdlength;
+        ancount++;
+    }
+    if (record->addr) {
+        pos += put_rr(msg + pos, a_name, 1, record->ttl, 4);
+        inet_pton(AF_INET, record->addr, msg + pos);
+        pos += 4;
+        ancount++;
+    }
+    if (record->soa) {
+        pos += put_rr(msg + pos, 12, 6, record->soa_ttl, 22);
+        msg[pos++] = 0;
+        msg[pos++] = 0;
+        for (int i = 0; i < 4; i++, pos += 4) {
+            put32(msg + pos, 1);
+        }
+        put32(msg + pos, record->soa_minimum);
+        pos += 4;
+        nscount++;
+    }
+    put16(msg + 6, ancount);
+    put16(msg + 8, nscount);
+    put16(msg + 10, 0);
+    sendto(server_fd, msg, pos, 0, (struct sockaddr *)&from, fromlen);
+}
+
+static void send_query(const char *name, uint32_t now, esp_dns_entry_t **entry)
+{
+    uint8_t msg[ESP_DNS_QUERY_MAX];
+    size_t len = esp_dns_cache_query(&cache, name, next_id++, now, msg, sizeof(msg), entry);
+
+    CHECK(len > 0);
+    sendto(client_fd, msg, len, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    stub_serve();
+}
+
+/* Pass the next response to the cache, NULL if there is none */
+static esp_dns_entry_t *receive(uint32_t now)
+{
+    uint8_t msg[512];
+    struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+
+    if (poll(&pfd, 1, 100) != 1) {
+        return NULL;
+    }
+    ssize_t len = recv(client_fd, msg, sizeof(msg), 0);
+    return esp_dns_cache_answer(&cache, msg, len, now);
+}
+
+static esp_dns_entry_t *resolve(const char *name, uint32_t now)
+{
+    esp_dns_entry_t *entry;
+
+    send_query(name, now, &entry);
+    CHECK(receive(now) == entry);
+    return entry;
+}
+
+static void reset(void)
+{
+    start_stub();
+    esp_dns_cache_init(&cache, entries, CACHE_SIZE, &params);
+}
+
+static uint32_t ip(const char *addr)
+{
+    return inet_addr(addr);
+}
+
+HOST_TEST(test_found_and_expires)
+{
+    reset();
+    CHECK(!esp_dns_cache_lookup(&cache, "broker.example.com", 0));
+
+    esp_dns_entry_t *entry = resolve("broker.example.com", 1000);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+    CHECK_EQ(ip("10.0.0.1"), entry->addr);
+    CHECK(!entry->querying);
+
+    CHECK(esp_dns_cache_lookup(&cache, "Broker.Example.COM", 2000) == entry);
+    CHECK(esp_dns_cache_lookup(&cache, "broker.example.com", 300999) == entry);
+    CHECK(!esp_dns_cache_lookup(&cache, "broker.example.com", 301000));
+    CHECK_EQ(ESP_DNS_EMPTY, entry->state);
+}
+
+HOST_TEST(test_ttl_limits)
+{
+    reset();
+    esp_dns_entry_t *entry = resolve("short.example.com", 0);
+    CHECK_EQ(30000, entry->ttl_ms);
+
+    entry = resolve("long.example.com", 0);
+    CHECK_EQ(86400000, entry->ttl_ms);
+}
+
+HOST_TEST(test_cname)
+{
+    reset();
+    esp_dns_entry_t *entry = resolve("ota.example.com", 0);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+    CHECK_EQ(ip("10.0.0.4"), entry->addr);
+    // Expires with the shorter lived alias
+    CHECK_EQ(100000, entry->ttl_ms);
+}
+
+HOST_TEST(test_negative)
+{
+    reset();
+    // The SOA minimum, below its TTL
+    esp_dns_entry_t *entry = resolve("gone.example.com", 0);
+    CHECK_EQ(ESP_DNS_NOT_FOUND, entry->state);
+    CHECK_EQ(20000, entry->ttl_ms);
+    CHECK(esp_dns_cache_lookup(&cache, "gone.example.com", 19999) == entry);
+    CHECK(!esp_dns_cache_lookup(&cache, "gone.example.com", 20000));
+
+    // Limited to neg_ttl
+    entry = resolve("lame.example.com", 0);
+    CHECK_EQ(60000, entry->ttl_ms);
+    entry = resolve("nosoa.example.com", 0);
+    CHECK_EQ(ESP_DNS_NOT_FOUND, entry->state);
+    CHECK_EQ(60000, entry->ttl_ms);
+
+    // No address for the name, limited by the SOA TTL
+    entry = resolve("ipv6only.example.com", 0);
+    CHECK_EQ(ESP_DNS_NOT_FOUND, entry->state);
+    CHECK_EQ(30000, entry->ttl_ms);
+}
+
+HOST_TEST(test_prefetch)
+{
+    stub_record_t *record = find_record("pool.example.org");
+
+    reset();
+    esp_dns_entry_t *entry = resolve("pool.example.org", 0);
+    CHECK(!esp_dns_cache_stale(&cache, entry, 90000));
+    CHECK(esp_dns_cache_stale(&cache, entry, 90001));
+
+    // The address is still served while it is refreshed
+    record->addr = "10.0.1.2";
+    esp_dns_entry_t *refreshing;
+    send_query("pool.example.org", 95000, &refreshing);
+    CHECK(refreshing == entry);
+    CHECK(!esp_dns_cache_stale(&cache, entry, 95000));
+    CHECK(esp_dns_cache_lookup(&cache, "pool.example.org", 96000) == entry);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+    CHECK_EQ(ip("10.0.1.1"), entry->addr);
+
+    CHECK(receive(97000) == entry);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+    CHECK_EQ(ip("10.0.1.2"), entry->addr);
+    CHECK_EQ(197000, entry->expires);
+
+    // Expiring while being refreshed makes it pending again
+    send_query("pool.example.org", 190000, &refreshing);
+    CHECK(esp_dns_cache_lookup(&cache, "pool.example.org", 197000) == entry);
+    CHECK_EQ(ESP_DNS_PENDING, entry->state);
+    CHECK(receive(198000) == entry);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+    record->addr = "10.0.1.1";
+}
+
+HOST_TEST(test_timeout_and_retry)
+{
+    esp_dns_entry_t *entry, *retry;
+
+    reset();
+    send_query("silent.example.com", 0, &entry);
+    CHECK_EQ(ESP_DNS_PENDING, entry->state);
+    CHECK_EQ(0, entry->tries);
+    CHECK(!receive(0));
+    CHECK(!esp_dns_cache_timed_out(&cache, 1999));
+    CHECK(esp_dns_cache_timed_out(&cache, 2000) == entry);
+
+    send_query("silent.example.com", 2000, &retry);
+    CHECK(retry == entry);
+    CHECK_EQ(1, entry->tries);
+    CHECK(!esp_dns_cache_timed_out(&cache, 3999));
+    esp_dns_cache_abandon(entry);
+    CHECK(!esp_dns_cache_timed_out(&cache, 10000));
+    CHECK(!esp_dns_cache_lookup(&cache, "silent.example.com", 4000));
+
+    // A server failure times the query out at once
+    send_query("broken.example.com", 5000, &entry);
+    CHECK(!receive(5000));
+    CHECK(entry->querying);
+    CHECK(esp_dns_cache_timed_out(&cache, 5000) == entry);
+
+    // An answer to a query that was since retried is not taken
+    send_query("broker.example.com", 6000, &entry);
+    send_query("broker.example.com", 6500, &retry);
+    CHECK(retry == entry);
+    CHECK(!receive(7000));
+    CHECK(receive(7000) == entry);
+    CHECK_EQ(ESP_DNS_FOUND, entry->state);
+}
+
+HOST_TEST(test_replaces_least_used)
+{
+    const char *names[] = { "a.example.org", "b.example.org", "c.example.org", "d.example.org" };
+    esp_dns_entry_t *entry;
+
+    reset();
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        CHECK(resolve(names[i], i));
+    }
+    CHECK(esp_dns_cache_lookup(&cache, "a.example.org", 10));
+    CHECK(esp_dns_cache_lookup(&cache, "c.example.org", 11));
+    CHECK(esp_dns_cache_lookup(&cache, "d.example.org", 12));
+
+    CHECK(resolve("e.example.org", 20));
+    CHECK(!esp_dns_cache_lookup(&cache, "b.example.org", 21));
+    CHECK(esp_dns_cache_lookup(&cache, "a.example.org", 21));
+
+    // Entries being queried are not replaced
+    reset();
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        send_query(names[i], 0, &entry);
+        CHECK(receive(0) == entry);
+    }
+    uint8_t msg[ESP_DNS_QUERY_MAX];
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        CHECK(esp_dns_cache_query(&cache, names[i], 1, 100, msg, sizeof(msg), &entry));
+    }
+    CHECK_EQ(0, esp_dns_cache_query(&cache, "e.example.org", 2, 100, msg, sizeof(msg), &entry));
+}
+
+HOST_TEST(test_bad_names)
+{
+    uint8_t msg[ESP_DNS_QUERY_MAX];
+    char name[ESP_DNS_CACHE_NAME_LEN + 1];
+    esp_dns_entry_t *entry;
+
+    reset();
+    CHECK_EQ(0, esp_dns_cache_query(&cache, "", 1, 0, msg, sizeof(msg), &entry));
+    CHECK_EQ(0, esp_dns_cache_query(&cache, "a..b", 1, 0, msg, sizeof(msg), &entry));
+    memset(name, 'a', sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    CHECK_EQ(0, esp_dns_cache_query(&cache, name, 1, 0, msg, sizeof(msg), &entry));
+    name[ESP_DNS_CACHE_NAME_LEN - 1] = 0;
+    name[20] = '.';
+    CHECK_EQ(sizeof(msg), esp_dns_cache_query(&cache, name, 1, 0, msg, sizeof(msg), &entry));
+
+    // Only the name that could be queried took an entry
+    int used = 0;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        used += entries[i].state != ESP_DNS_EMPTY;
+    }
+    CHECK_EQ(1, used);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_found_and_expires),
+    HOST_TEST_ENTRY(test_ttl_limits),
+    HOST_TEST_ENTRY(test_cname),
+    HOST_TEST_ENTRY(test_negative),
+    HOST_TEST_ENTRY(test_prefetch),
+    HOST_TEST_ENTRY(test_timeout_and_retry),
+    HOST_TEST_ENTRY(test_replaces_least_used),
+    HOST_TEST_ENTRY(test_bad_names),
+};
+
+HOST_TEST_MAIN("esp_dns_cache", tests)
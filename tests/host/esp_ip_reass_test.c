@@ -0,0 +1,334 @@
+/* Host-side tests for the IPv4 reassembly in lwip/esp_ip_reass.c
+ *
+ * Datagrams of patterned data are split into fragments, each held in a
+ * buffer of its own, and fed in crafted orders: shuffled, duplicated,
+ * overlapping, interleaved and abandoned. Every buffer handed over must come
+ * back, either in a completed datagram or through free_buf.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_ip_reass.h"
+#include "host_test.h"
+
+#define DATAGRAMS 3
+#define BUDGET 4000
+#define MAX_AGE 3000
+/* Charged for each fragment on top of its data, as for a pbuf */
+#define OVERHEAD 30
+
+typedef struct {
+    uint16_t offset;
+    uint16_t len;
+    bool more;
+} frag_t;
+
+static esp_ip_datagram_t datagrams[DATAGRAMS];
+static esp_ip_reass_t reass;
+static esp_ip_reass_stats_t stats;
+static int held;
+static int freed;
+
+static void free_buf(void *buf)
+{
+    freed++;
+    held--;
+    free(buf);
+}
+
+static void reset(uint32_t budget)
+{
+    memset(&stats, 0, sizeof(stats));
+    held = freed = 0;
+    esp_ip_reass_init(&reass, datagrams, DATAGRAMS, budget, MAX_AGE, free_buf, &stats);
+}
+
+static uint8_t pattern(uint16_t id, uint32_t pos)
+{
+    return (uint8_t)(id * 7 + pos * 13 + (pos >> 8));
+}
+
+static esp_ip_reass_key_t key(uint16_t id)
+{
+    return (esp_ip_reass_key_t){ .src = 0x0a000001, .dst = 0x0a000002, .id = id, .proto = 17 };
+}
+
+static esp_ip_datagram_t *add(uint16_t id, frag_t f, uint32_t now)
+{
+    esp_ip_reass_key_t k = key(id);
+    uint8_t *buf = malloc(f.len ? f.len : 1);
+
+    for (uint32_t i = 0; i < f.len; i++) {
+        buf[i] = pattern(id, f.offset + i);
+    }
+    held++;
+    return esp_ip_reass_add(&reass, &k, f.offset, f.len, f.more, buf, f.len + OVERHEAD, now);
+}
+
+/* Check a completed datagram holds 'total' bytes of the pattern of 'id', in
+ * order, then release it. */
+static bool check_datagram(esp_ip_datagram_t *d, uint16_t id, uint16_t total)
+{
+    uint32_t pos = 0;
+    bool ok = d != NULL && d->total == total;
+
+    for (esp_ip_frag_t *frag = ok ? d->frags : NULL; frag; frag = frag->next) {
+        const uint8_t *buf = frag->buf;
+
+        ok = ok && frag->offset == pos;
+        for (uint32_t i = 0; ok && i < frag->len; i++) {
+            ok = buf[i] == pattern(id, pos + i);
+        }
+        pos += frag->len;
+        free(frag->buf);
+        held--;
+    }
+    if (d) {
+        esp_ip_reass_done(&reass, d);
+    }
+    return ok && pos == total;
+}
+
+static int used(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < DATAGRAMS; i++) {
+        n += datagrams[i].used;
+    }
+    return n;
+}
+
+HOST_TEST(test_in_order)
+{
+    const frag_t frags[] = { { 0, 1480, true }, { 1480, 1480, true }, { 2960, 40, false } };
+
+    reset(BUDGET * 2);
+    CHECK(add(1, frags[0], 0) == NULL);
+    CHECK(add(1, frags[1], 1) == NULL);
+    CHECK(check_datagram(add(1, frags[2], 2), 1, 3000));
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, reass.charged);
+    CHECK_EQ(0, used());
+    CHECK_EQ(1, stats.completed);
+    CHECK_EQ(3, stats.fragments);
+}
+
+HOST_TEST(test_out_of_order)
+{
+    /* Every order of four fragments, the last one short */
+    const frag_t frags[] = { { 0, 504, true }, { 504, 504, true }, { 1008, 504, true },
+                             { 1512, 100, false } };
+    const int orders[][4] = {
+        { 3, 2, 1, 0 }, { 1, 3, 0, 2 }, { 2, 0, 3, 1 }, { 0, 3, 2, 1 }, { 3, 0, 1, 2 },
+    };
+
+    reset(BUDGET);
+    for (int o = 0; o < 5; o++) {
+        for (int i = 0; i < 3; i++) {
+            CHECK(add(10 + o, frags[orders[o][i]], 0) == NULL);
+        }
+        CHECK(check_datagram(add(10 + o, frags[orders[o][3]], 0), 10 + o, 1612));
+    }
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, freed);
+    CHECK_EQ(5, stats.completed);
+}
+
+HOST_TEST(test_interleaved)
+{
+    const frag_t a[] = { { 0, 800, true }, { 800, 200, false } };
+    const frag_t b[] = { { 0, 400, true }, { 400, 400, true }, { 800, 8, false } };
+
+    reset(BUDGET);
+    CHECK(add(1, a[1], 0) == NULL);
+    CHECK(add(2, b[2], 0) == NULL);
+    CHECK(add(2, b[0], 0) == NULL);
+    CHECK_EQ(2, used());
+    CHECK(check_datagram(add(1, a[0], 0), 1, 1000));
+    CHECK(check_datagram(add(2, b[1], 0), 2, 808));
+    CHECK_EQ(0, held);
+}
+
+HOST_TEST(test_duplicates)
+{
+    const frag_t frags[] = { { 0, 800, true }, { 800, 800, false } };
+
+    reset(BUDGET);
+    CHECK(add(1, frags[1], 0) == NULL);
+    uint32_t charged = reass.charged;
+    CHECK(add(1, frags[1], 0) == NULL);
+    CHECK_EQ(1, freed);
+    CHECK_EQ(charged, reass.charged);
+    CHECK(check_datagram(add(1, frags[0], 0), 1, 1600));
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, stats.dropped);
+}
+
+HOST_TEST(test_overlaps_drop_datagram)
+{
+    reset(BUDGET);
+
+    /* Overlapping the one before */
+    CHECK(add(1, (frag_t){ 0, 800, true }, 0) == NULL);
+    CHECK(add(1, (frag_t){ 792, 800, true }, 0) == NULL);
+    CHECK_EQ(0, used());
+    CHECK_EQ(0, held);
+
+    /* Overlapping the one after */
+    CHECK(add(2, (frag_t){ 800, 800, false }, 0) == NULL);
+    CHECK(add(2, (frag_t){ 400, 408, true }, 0) == NULL);
+    CHECK_EQ(0, used());
+    CHECK_EQ(0, held);
+
+    /* Same offset, different length */
+    CHECK(add(3, (frag_t){ 0, 800, true }, 0) == NULL);
+    CHECK(add(3, (frag_t){ 0, 400, true }, 0) == NULL);
+    CHECK_EQ(0, used());
+
+    /* Two different ends */
+    CHECK(add(4, (frag_t){ 800, 800, false }, 0) == NULL);
+    CHECK(add(4, (frag_t){ 1600, 80, false }, 0) == NULL);
+    CHECK_EQ(0, used());
+
+    /* Data past the end */
+    CHECK(add(5, (frag_t){ 800, 800, false }, 0) == NULL);
+    CHECK(add(5, (frag_t){ 1600, 80, true }, 0) == NULL);
+    CHECK_EQ(0, used());
+
+    /* An end before data already taken */
+    CHECK(add(6, (frag_t){ 1600, 80, true }, 0) == NULL);
+    CHECK(add(6, (frag_t){ 800, 800, false }, 0) == NULL);
+    CHECK_EQ(0, used());
+
+    /* A fragment with more to follow must be a multiple of 8 bytes */
+    CHECK(add(7, (frag_t){ 0, 100, true }, 0) == NULL);
+    CHECK(add(8, (frag_t){ 0, 0, false }, 0) == NULL);
+
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, reass.charged);
+    CHECK_EQ(8, stats.dropped);
+    CHECK_EQ(6, stats.evicted);
+    CHECK_EQ(0, stats.completed);
+}
+
+HOST_TEST(test_budget_evicts_oldest)
+{
+    const frag_t first = { 0, 1480, true };
+
+    reset(BUDGET);
+    /* Two incomplete datagrams fill most of the budget */
+    CHECK(add(1, first, 0) == NULL);
+    CHECK(add(2, first, 10) == NULL);
+    CHECK(reass.charged <= BUDGET);
+
+    /* The third pushes out the oldest */
+    CHECK(add(3, first, 20) == NULL);
+    CHECK_EQ(1, stats.evicted);
+    CHECK_EQ(1, freed);
+    CHECK(reass.charged <= BUDGET);
+    CHECK_EQ(2, used());
+
+    /* The datagram evicted starts again when its fragments come back */
+    CHECK(add(1, (frag_t){ 1480, 20, false }, 30) == NULL);
+    CHECK_EQ(1, stats.evicted);
+    CHECK(check_datagram(add(2, (frag_t){ 1480, 20, false }, 40), 2, 1500));
+    CHECK(check_datagram(add(3, (frag_t){ 1480, 20, false }, 50), 3, 1500));
+    CHECK(check_datagram(add(1, first, 60), 1, 1500));
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, reass.charged);
+}
+
+HOST_TEST(test_budget_drops_own_datagram)
+{
+    reset(BUDGET);
+    /* A datagram outgrowing the budget alone is dropped, not the others */
+    CHECK(add(1, (frag_t){ 0, 200, true }, 0) == NULL);
+    CHECK(add(2, (frag_t){ 0, 1480, true }, 10) == NULL);
+    CHECK(add(2, (frag_t){ 1480, 1480, true }, 20) == NULL);
+    CHECK(add(2, (frag_t){ 2960, 1480, true }, 30) == NULL);
+    CHECK_EQ(1, stats.evicted);
+    CHECK_EQ(1, stats.dropped);
+    CHECK_EQ(1, used());
+    CHECK_EQ(1, held);
+    CHECK(!esp_ip_reass_expire(&reass, MAX_AGE));
+    CHECK_EQ(0, held);
+
+    /* As is one fragment larger than the whole budget */
+    reset(1000);
+    CHECK(add(1, (frag_t){ 0, 1480, true }, 0) == NULL);
+    CHECK_EQ(0, used());
+    CHECK_EQ(0, held);
+    CHECK_EQ(1, stats.dropped);
+}
+
+HOST_TEST(test_slots_evict_oldest)
+{
+    reset(BUDGET * 4);
+    for (int id = 1; id <= DATAGRAMS; id++) {
+        CHECK(add(id, (frag_t){ 0, 8, true }, id) == NULL);
+    }
+    CHECK(add(DATAGRAMS + 1, (frag_t){ 0, 8, true }, DATAGRAMS + 1) == NULL);
+    CHECK_EQ(1, stats.evicted);
+    CHECK_EQ(DATAGRAMS, used());
+    for (int i = 0; i < DATAGRAMS; i++) {
+        CHECK(datagrams[i].key.id != 1);
+    }
+    CHECK(!esp_ip_reass_expire(&reass, DATAGRAMS + 1 + MAX_AGE));
+    CHECK_EQ(0, held);
+}
+
+HOST_TEST(test_expire)
+{
+    reset(BUDGET);
+    /* Times near the wrap of the clock */
+    uint32_t t0 = UINT32_MAX - 1000;
+
+    CHECK(add(1, (frag_t){ 0, 800, true }, t0) == NULL);
+    CHECK(add(2, (frag_t){ 0, 800, true }, t0 + 2000) == NULL);
+    CHECK(esp_ip_reass_expire(&reass, t0 + MAX_AGE - 1));
+    CHECK_EQ(0, stats.expired);
+    CHECK(esp_ip_reass_expire(&reass, t0 + MAX_AGE));
+    CHECK_EQ(1, stats.expired);
+    CHECK_EQ(1, used());
+    CHECK(!esp_ip_reass_expire(&reass, t0 + 2000 + MAX_AGE));
+    CHECK_EQ(2, stats.expired);
+    CHECK_EQ(0, held);
+    CHECK_EQ(0, reass.charged);
+}
+
+HOST_TEST(test_keys)
+{
+    reset(BUDGET);
+    esp_ip_reass_key_t k = key(1);
+    uint8_t *buf = malloc(8);
+
+    /* The same id from another protocol is another datagram */
+    CHECK(add(1, (frag_t){ 0, 8, true }, 0) == NULL);
+    k.proto = 6;
+    held++;
+    CHECK(esp_ip_reass_add(&reass, &k, 8, 8, false, buf, 8, 0) == NULL);
+    CHECK_EQ(2, used());
+    CHECK(!esp_ip_reass_expire(&reass, MAX_AGE));
+    CHECK_EQ(0, held);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_in_order),
+    HOST_TEST_ENTRY(test_out_of_order),
+    HOST_TEST_ENTRY(test_interleaved),
+    HOST_TEST_ENTRY(test_duplicates),
+    HOST_TEST_ENTRY(test_overlaps_drop_datagram),
+    HOST_TEST_ENTRY(test_budget_evicts_oldest),
+    HOST_TEST_ENTRY(test_budget_drops_own_datagram),
+    HOST_TEST_ENTRY(test_slots_evict_oldest),
+    HOST_TEST_ENTRY(test_expire),
+    HOST_TEST_ENTRY(test_keys),
+};
+
+HOST_TEST_MAIN("esp_ip_reass", tests)
@@ -0,0 +1,104 @@
+/* Host-side tests for the fixed size lwip memp pools in lwip/esp_mempool.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "esp_mempool.h"
+#include "host_test.h"
+
+unsigned host_critical_nesting;
+
+static uint32_t small_a[4 * 16 / 4];
+static uint32_t small_b[2 * 16 / 4];
+static uint32_t large[3 * 200 / 4];
+
+static void init_pools(esp_mempool_t *pools)
+{
+    pools[0] = (esp_mempool_t)ESP_MEMPOOL_INIT("A", 16, 4, small_a);
+    pools[1] = (esp_mempool_t)ESP_MEMPOOL_INIT("B", 16, 2, small_b);
+    pools[2] = (esp_mempool_t)ESP_MEMPOOL_INIT("LARGE", 200, 3, large);
+}
+
+HOST_TEST(test_exact_size)
+{
+    esp_mempool_t pools[3];
+
+    init_pools(pools);
+    CHECK(!esp_mempool_alloc(pools, 3, 15));
+    CHECK(!esp_mempool_alloc(pools, 3, 17));
+    CHECK(!esp_mempool_alloc(pools, 3, 100));
+    CHECK_EQ(0, pools[0].fallbacks);
+    CHECK_EQ(0, pools[2].fallbacks);
+
+    uint8_t *p = esp_mempool_alloc(pools, 3, 200);
+    CHECK(p == (uint8_t *)large);
+    CHECK_EQ(1, pools[2].used);
+    CHECK_EQ(0, pools[0].used);
+    CHECK(esp_mempool_free(pools, 3, p));
+    CHECK_EQ(0, pools[2].used);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+HOST_TEST(test_exhaust_and_reuse)
+{
+    esp_mempool_t pools[3];
+    void *blocks[6];
+
+    init_pools(pools);
+
+    // The first pool of the size is used up before the second
+    for (int i = 0; i < 6; i++) {
+        blocks[i] = esp_mempool_alloc(pools, 3, 16);
+        CHECK(blocks[i]);
+        for (int j = 0; j < i; j++) {
+            CHECK(blocks[i] != blocks[j]);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        CHECK((uint8_t *)blocks[i] == (uint8_t *)small_a + i * 16);
+    }
+    for (int i = 4; i < 6; i++) {
+        CHECK((uint8_t *)blocks[i] == (uint8_t *)small_b + (i - 4) * 16);
+    }
+    CHECK_EQ(4, pools[0].used);
+    CHECK_EQ(2, pools[1].used);
+
+    // With both empty, the request is left to the heap and counted once
+    CHECK(!esp_mempool_alloc(pools, 3, 16));
+    CHECK_EQ(1, pools[0].fallbacks);
+    CHECK_EQ(0, pools[1].fallbacks);
+
+    // Freed blocks go back to their own pool, most recent first
+    CHECK(esp_mempool_free(pools, 3, blocks[1]));
+    CHECK(esp_mempool_free(pools, 3, blocks[5]));
+    CHECK_EQ(3, pools[0].used);
+    CHECK_EQ(1, pools[1].used);
+    CHECK(esp_mempool_alloc(pools, 3, 16) == blocks[1]);
+    CHECK(esp_mempool_alloc(pools, 3, 16) == blocks[5]);
+    CHECK_EQ(4, pools[0].max_used);
+    CHECK_EQ(2, pools[1].max_used);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+HOST_TEST(test_free_foreign)
+{
+    esp_mempool_t pools[3];
+    uint32_t other[4];
+
+    init_pools(pools);
+    CHECK(!esp_mempool_free(pools, 3, other));
+    CHECK(!esp_mempool_free(pools, 3, (uint8_t *)small_a + sizeof(small_a)));
+    CHECK(!esp_mempool_free(pools, 0, small_a));
+    CHECK_EQ(0, pools[0].used);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_exact_size),
+    HOST_TEST_ENTRY(test_exhaust_and_reuse),
+    HOST_TEST_ENTRY(test_free_foreign),
+};
+
+HOST_TEST_MAIN("esp_mempool", tests)
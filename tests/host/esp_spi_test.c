@@ -0,0 +1,185 @@
+/* Host-side tests for spi_transfer_async() in core/esp_spi.c, run against
+ * the register-level SPI controller simulation in spi_sim.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp/spi.h"
+#include "esp/interrupts.h"
+#include "spi_sim.h"
+#include "host_test.h"
+
+#define BUS 1
+#define MAX_BYTES 4096
+
+static uint8_t out[MAX_BYTES], in_sync[MAX_BYTES], in_async[MAX_BYTES];
+static uint8_t log_sync[MAX_BYTES];
+static uint32_t seed = 1;
+
+static void fill_out(void)
+{
+    for (int i = 0; i < MAX_BYTES; i++) {
+        seed = seed * 1103515245 + 12345;
+        out[i] = seed >> 16;
+    }
+}
+
+/* Run the same transfer with spi_transfer() and spi_transfer_async(), and
+ * check that the bus sees, and the caller gets, exactly the same bytes.
+ */
+static void check_transfer(size_t len, spi_word_size_t word_size, bool receive)
+{
+    size_t bytes = len * word_size;
+    uint32_t transactions, work = 0;
+
+    fill_out();
+    memset(in_sync, 0, sizeof(in_sync));
+    memset(in_async, 0, sizeof(in_async));
+
+    spi_sim_reset_stats();
+    CHECK_EQ(len, spi_transfer(BUS, out, receive ? in_sync : NULL, len, word_size));
+    CHECK_EQ(bytes, spi_sim_hspi.out_len);
+    memcpy(log_sync, spi_sim_hspi.out, bytes);
+    transactions = spi_sim_hspi.transactions;
+    CHECK_EQ((bytes + 63) / 64, transactions);
+    CHECK_EQ(0, spi_sim_hspi.interrupts);
+
+    spi_sim_reset_stats();
+    CHECK(spi_transfer_async(BUS, out, receive ? in_async : NULL, len, word_size));
+    while (spi_transfer_async_busy(BUS)) {
+        work++;
+    }
+    CHECK(spi_transfer_async_wait(BUS, portMAX_DELAY));
+    CHECK_EQ(bytes, spi_sim_hspi.out_len);
+    CHECK_MEM(log_sync, spi_sim_hspi.out, bytes);
+    CHECK_MEM(in_sync, in_async, sizeof(in_sync));
+    CHECK_EQ(transactions, spi_sim_hspi.transactions);
+    CHECK_EQ(transactions, spi_sim_hspi.interrupts);
+    CHECK_EQ(0, spi_sim_hspi.uncleared_interrupts);
+    CHECK_EQ(0, spi_sim_hspi.overruns);
+    // The caller got to run while the transfer was going on
+    CHECK(work > 0);
+}
+
+HOST_TEST(test_async_matches_sync)
+{
+    static const size_t sizes[] = {
+        1, 2, 3, 4, 5, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 1024,
+    };
+    static const spi_word_size_t word_sizes[] = { SPI_8BIT, SPI_16BIT, SPI_32BIT };
+
+    CHECK(spi_sim_init());
+    for (int e = 0; e < 2; e++) {
+        CHECK(spi_init(BUS, SPI_MODE0, SPI_FREQ_DIV_10M, true, e, true));
+        for (int w = 0; w < 3; w++) {
+            for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+                check_transfer(sizes[s], word_sizes[w], true);
+                check_transfer(sizes[s], word_sizes[w], false);
+            }
+        }
+    }
+    spi_sim_free();
+}
+
+/* As with spi_transfer(), the command is only sent before the first block,
+ * and is still set afterwards.
+ */
+HOST_TEST(test_async_command)
+{
+    CHECK(spi_sim_init());
+    CHECK(spi_init(BUS, SPI_MODE0, SPI_FREQ_DIV_10M, true, SPI_LITTLE_ENDIAN, true));
+    spi_set_command(BUS, 8, 0xab);
+
+    check_transfer(200, SPI_8BIT, true);
+    CHECK_EQ(1, spi_sim_hspi.command_phases);
+    CHECK(SPI(BUS).USER0 & SPI_USER0_COMMAND);
+
+    check_transfer(10, SPI_8BIT, true);
+    CHECK_EQ(1, spi_sim_hspi.command_phases);
+    CHECK(SPI(BUS).USER0 & SPI_USER0_COMMAND);
+
+    spi_clear_command(BUS);
+    spi_sim_free();
+}
+
+HOST_TEST(test_async_errors)
+{
+    CHECK(spi_sim_init());
+    CHECK(spi_init(BUS, SPI_MODE0, SPI_FREQ_DIV_10M, true, SPI_LITTLE_ENDIAN, true));
+
+    CHECK(!spi_transfer_async(0, out, NULL, 10, SPI_8BIT));
+    CHECK(!spi_transfer_async(BUS, NULL, NULL, 10, SPI_8BIT));
+    CHECK(!spi_transfer_async(BUS, out, NULL, 0, SPI_8BIT));
+    CHECK(!spi_transfer_async_busy(BUS));
+    CHECK(spi_transfer_async_wait(BUS, 0));
+
+    CHECK(spi_transfer_async(BUS, out, in_async, MAX_BYTES, SPI_8BIT));
+    CHECK(spi_transfer_async_busy(BUS));
+    CHECK(!spi_transfer_async(BUS, out, NULL, 10, SPI_8BIT));
+    CHECK(!spi_transfer_async_wait(BUS, 0));
+    CHECK(spi_transfer_async_wait(BUS, portMAX_DELAY));
+    CHECK(!spi_transfer_async_busy(BUS));
+    CHECK_EQ(MAX_BYTES, spi_sim_hspi.out_len);
+
+    // The bus can be used normally again
+    CHECK_EQ(3, spi_transfer(BUS, out, in_sync, 3, SPI_8BIT));
+    spi_sim_free();
+}
+
+static void other_isr(void *arg)
+{
+}
+
+HOST_TEST(test_async_shares_interrupt)
+{
+    static int other_arg;
+    BaseType_t woken;
+    void *arg;
+
+    CHECK(spi_sim_init());
+    CHECK(spi_init(BUS, SPI_MODE0, SPI_FREQ_DIV_10M, true, SPI_LITTLE_ENDIAN, true));
+
+    // Another driver's handler, with the interrupt masked, and a
+    // notification the caller has not taken yet
+    _xt_isr_attach(INUM_SPI, other_isr, &other_arg);
+    vTaskNotifyGiveFromISR(xTaskGetCurrentTaskHandle(), &woken);
+
+    CHECK(spi_transfer_async(BUS, out, in_async, 1000, SPI_8BIT));
+    CHECK(_xt_isr_get(INUM_SPI, &arg) != other_isr);
+    CHECK(spi_transfer_async_wait(BUS, portMAX_DELAY));
+    CHECK_EQ(1000, spi_sim_hspi.out_len);
+
+    // Handed back as it was
+    CHECK(_xt_isr_get(INUM_SPI, &arg) == other_isr);
+    CHECK(arg == &other_arg);
+    CHECK(!(_xt_isr_mask(0) & BIT(INUM_SPI)));
+    // The caller's notification is still there, and only that
+    CHECK_EQ(1, ulTaskNotifyTake(pdTRUE, 0));
+    CHECK_EQ(0, ulTaskNotifyTake(pdTRUE, 0));
+
+    // A transfer left to finish without waiting does not let the wait for
+    // the next one return early
+    CHECK(spi_transfer_async(BUS, out, NULL, 100, SPI_8BIT));
+    while (spi_transfer_async_busy(BUS)) {
+    }
+    spi_sim_reset_stats();
+    CHECK(spi_transfer_async(BUS, out, NULL, MAX_BYTES, SPI_8BIT));
+    CHECK(spi_transfer_async_wait(BUS, portMAX_DELAY));
+    CHECK(!spi_transfer_async_busy(BUS));
+    CHECK_EQ(MAX_BYTES, spi_sim_hspi.out_len);
+    spi_sim_free();
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_async_matches_sync),
+    HOST_TEST_ENTRY(test_async_command),
+    HOST_TEST_ENTRY(test_async_errors),
+    HOST_TEST_ENTRY(test_async_shares_interrupt),
+};
+
+HOST_TEST_MAIN("esp_spi", tests)
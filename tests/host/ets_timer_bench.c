@@ -0,0 +1,152 @@
+/* Benchmark for the pending ets_timer queues in
+ * open_esplibs/libmain/ets_timer_queue.c: the sorted list against the timing
+ * wheel, with 10 to 500 timers armed.
+ *
+ * Timers are armed with a mix of delays like those on the ESP8266: many of a
+ * few milliseconds (PWM, LEDs), some of hundreds of milliseconds (wifi) and
+ * a few of seconds (watchdogs). Each timer is disarmed and armed again in
+ * turn, at a random point within its period, then the clock is run from
+ * alarm to alarm with the timers repeating.
+ * Reports the average and worst time of each arm and disarm, which on the
+ * ESP8266 is spent with interrupts disabled, and of expiring each timer.
+ * Each queue is also run with every timer given slack of a sixteenth of its
+ * period, to show how many alarms coalescing saves.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ets_timer_queue.h"
+
+#define MAX_TIMERS 500
+#define ROUNDS 20
+#define TICKS_PER_MS 5000
+#define RUN_TICKS (10 * 1000 * TICKS_PER_MS)
+
+typedef struct {
+    const char *name;
+    void (*init)(void *queue, uint32_t now);
+    void (*add)(void *queue, ets_timer_t *timer, uint32_t ticks, uint32_t now);
+    void (*remove)(void *queue, ets_timer_t *timer);
+    bool (*next)(void *queue, uint32_t *ticks);
+    ets_timer_t *(*expire)(void *queue, uint32_t now);
+} queue_ops_t;
+
+static const queue_ops_t queues[] = {
+    { "list", (void *)ets_timer_list_init, (void *)ets_timer_list_add,
+      (void *)ets_timer_list_remove, (void *)ets_timer_list_next, (void *)ets_timer_list_expire },
+    { "wheel", (void *)ets_timer_wheel_init, (void *)ets_timer_wheel_add,
+      (void *)ets_timer_wheel_remove, (void *)ets_timer_wheel_next, (void *)ets_timer_wheel_expire },
+};
+
+static union {
+    ets_timer_list_t list;
+    ets_timer_wheel_t wheel;
+} queue;
+static ets_timer_t timers[MAX_TIMERS];
+static uint32_t periods[MAX_TIMERS];
+
+typedef struct {
+    uint64_t total;
+    uint32_t count;
+    uint32_t max;
+} op_stats_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void count(op_stats_t *stats, uint64_t start)
+{
+    uint32_t ns = now_ns() - start;
+
+    stats->total += ns;
+    stats->count++;
+    if (ns > stats->max) {
+        stats->max = ns;
+    }
+}
+
+static uint32_t random_period(void)
+{
+    int r = rand() % 100;
+
+    if (r < 60) {
+        return (1 + rand() % 20) * TICKS_PER_MS;
+    } else if (r < 90) {
+        return (100 + rand() % 900) * TICKS_PER_MS;
+    }
+    return (1000 + rand() % 59000) * TICKS_PER_MS;
+}
+
+static void run(const queue_ops_t *q, int ntimers, bool slack)
+{
+    op_stats_t arm = { 0 }, disarm = { 0 }, expire = { 0 };
+    uint32_t now = 0u - RUN_TICKS / 2;
+    uint32_t next;
+    ets_timer_t *timer;
+    uint32_t alarms = 0;
+
+    srand(ntimers);
+    q->init(&queue, now);
+    for (int i = 0; i < ntimers; i++) {
+        timers[i].next = ETS_TIMER_NOT_ARMED;
+        periods[i] = random_period();
+        timers[i].slack = slack ? ets_timer_slack(periods[i] / 16) : 0;
+        q->add(&queue, &timers[i], now + rand() % periods[i], now);
+    }
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < ntimers; i++) {
+            uint64_t start = now_ns();
+            q->remove(&queue, &timers[i]);
+            count(&disarm, start);
+            uint32_t ticks = now + 1 + rand() % periods[i];
+            start = now_ns();
+            q->add(&queue, &timers[i], ticks, now);
+            count(&arm, start);
+        }
+    }
+
+    uint32_t end = now + RUN_TICKS;
+    while (q->next(&queue, &next) && (int32_t)(next - end) < 0) {
+        now = next;
+        alarms++;
+        uint64_t start = now_ns();
+        while ((timer = q->expire(&queue, now)) != NULL) {
+            q->add(&queue, timer, timer->fire_ticks + periods[timer - timers], now);
+        }
+        count(&expire, start);
+    }
+
+    printf("%-5s%s %6d %8.0f %8.1f %7u %8.1f %7u %8u %8.1f %7u\n", q->name, slack ? "+s" : "  ", ntimers,
+           (arm.count + disarm.count) * 1e9 / (arm.total + disarm.total),
+           (double)arm.total / arm.count, arm.max, (double)disarm.total / disarm.count,
+           disarm.max, alarms, (double)expire.total / expire.count, expire.max);
+}
+
+int main(void)
+{
+    static const int timer_counts[] = { 10, 50, 100, 200, 500 };
+
+    printf("Arm and disarm in turn %d times, then run %d seconds of repeating timers\n",
+           ROUNDS, RUN_TICKS / TICKS_PER_MS / 1000);
+    printf("+s: with slack of 1/16 of each timer's period\n");
+    printf("%-7s %6s %8s %8s %7s %8s %7s %8s %8s %7s\n", "queue", "timers", "ops/s",
+           "arm ns", "max", "disarm", "max", "alarms", "alarm ns", "max");
+    for (int t = 0; t < sizeof(timer_counts) / sizeof(timer_counts[0]); t++) {
+        for (int i = 0; i < sizeof(queues) / sizeof(queues[0]); i++) {
+            run(&queues[i], timer_counts[t], false);
+            run(&queues[i], timer_counts[t], true);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+/* Forced into open_esplibs/libmain/ets_timer.c built for the host, for the
+ * declarations FreeRTOS.h brings in on the device through esp8266.h
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "task.h"
+#include "esp/interrupts.h"
+#include "esp/dport_regs.h"
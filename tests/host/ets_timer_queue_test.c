@@ -0,0 +1,405 @@
+/* Host-side tests for the pending ets_timer queues in
+ * open_esplibs/libmain/ets_timer_queue.c
+ *
+ * Each test runs on both the sorted list and the timing wheel. The FRC2
+ * clock is simulated, and is started close to wrapping round so that every
+ * test crosses the wrap. Timers with slack are ordered by when they are due
+ * rather than by their time.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ets_timer_queue.h"
+#include "host_test.h"
+
+#define TIMERS 64
+#define START (0u - 5000000)    /* One second before the wrap */
+/* Furthest a timer is armed ahead on the wheel */
+#define MAX_AHEAD ((1u << 31) - (1u << 26))
+
+typedef struct {
+    const char *name;
+    void (*init)(void *queue, uint32_t now);
+    void (*add)(void *queue, ets_timer_t *timer, uint32_t ticks, uint32_t now);
+    void (*remove)(void *queue, ets_timer_t *timer);
+    bool (*next)(void *queue, uint32_t *ticks);
+    ets_timer_t *(*expire)(void *queue, uint32_t now);
+} queue_ops_t;
+
+static const queue_ops_t queues[] = {
+    { "list", (void *)ets_timer_list_init, (void *)ets_timer_list_add,
+      (void *)ets_timer_list_remove, (void *)ets_timer_list_next, (void *)ets_timer_list_expire },
+    { "wheel", (void *)ets_timer_wheel_init, (void *)ets_timer_wheel_add,
+      (void *)ets_timer_wheel_remove, (void *)ets_timer_wheel_next, (void *)ets_timer_wheel_expire },
+};
+
+static union {
+    ets_timer_list_t list;
+    ets_timer_wheel_t wheel;
+} queue;
+static ets_timer_t timers[TIMERS];
+static uint32_t fired_at[TIMERS];
+
+static bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+static void reset(const queue_ops_t *q)
+{
+    memset(timers, 0, sizeof(timers));
+    for (int i = 0; i < TIMERS; i++) {
+        timers[i].next = ETS_TIMER_NOT_ARMED;
+        timers[i].timer_arg = (void *)(intptr_t)i;
+    }
+    q->init(&queue, START);
+}
+
+static bool armed(int i)
+{
+    return timers[i].next != ETS_TIMER_NOT_ARMED;
+}
+
+/* Expire the timers due by 'now', recording when, and check they come in
+ * order and none is left due. */
+static bool expire(const queue_ops_t *q, uint32_t now, int *count)
+{
+    ets_timer_t *timer;
+    bool ok = true;
+    bool first = true;
+    uint32_t last = 0;
+
+    while ((timer = q->expire(&queue, now)) != NULL) {
+        int i = timer - timers;
+
+        ok = ok && !before(now, ets_timer_due(timer)) && !armed(i);
+        ok = ok && (first || !before(ets_timer_due(timer), last));
+        first = false;
+        last = ets_timer_due(timer);
+        fired_at[i] = now;
+        if (count) {
+            (*count)++;
+        }
+    }
+    for (int i = 0; i < TIMERS; i++) {
+        ok = ok && !(armed(i) && !before(now, ets_timer_due(&timers[i])));
+    }
+    return ok;
+}
+
+/* next() must come no later than the first timer due. */
+static bool check_next(const queue_ops_t *q)
+{
+    bool any = false;
+    uint32_t first = 0;
+    uint32_t next;
+
+    for (int i = 0; i < TIMERS; i++) {
+        if (armed(i) && (!any || before(ets_timer_due(&timers[i]), first))) {
+            any = true;
+            first = ets_timer_due(&timers[i]);
+        }
+    }
+    if (!q->next(&queue, &next)) {
+        return !any;
+    }
+    return any && !before(first, next);
+}
+
+/* Run the clock from alarm to alarm, as ets_timer.c does, until 'end'.
+ * Returns the number of alarms. */
+static int run_alarms(const queue_ops_t *q, uint32_t now, uint32_t end, bool *ok)
+{
+    uint32_t next;
+    int alarms = 0;
+
+    while (q->next(&queue, &next) && !before(end, next)) {
+        if (before(next, now)) {
+            next = now;
+        }
+        now = next;
+        alarms++;
+        *ok = *ok && expire(q, now, NULL);
+    }
+    return alarms;
+}
+
+HOST_TEST(test_order)
+{
+    static const uint32_t delays[] = { 500, 0, 20000, 20000, 3, 8192, 8191, 1u << 19, 5000000,
+                                       40000000, 400, 1u << 30, 7, 123456789, 8193 };
+    const int n = sizeof(delays) / sizeof(delays[0]);
+
+    for (int q = 0; q < 2; q++) {
+        int count = 0;
+
+        reset(&queues[q]);
+        for (int i = 0; i < n; i++) {
+            queues[q].add(&queue, &timers[i], START + delays[i], START);
+        }
+        CHECK(check_next(&queues[q]));
+        CHECK(expire(&queues[q], START + (1u << 30), &count));
+        CHECK_EQ(n, count);
+        CHECK(!queues[q].next(&queue, &(uint32_t){ 0 }));
+    }
+}
+
+HOST_TEST(test_fires_on_time)
+{
+    for (int q = 0; q < 2; q++) {
+        bool ok = true;
+
+        reset(&queues[q]);
+        for (int i = 0; i < TIMERS; i++) {
+            uint32_t delay = (uint32_t)i * i * i * 7919 % MAX_AHEAD;
+            queues[q].add(&queue, &timers[i], START + delay, START);
+        }
+        run_alarms(&queues[q], START, START + MAX_AHEAD, &ok);
+        CHECK(ok);
+        for (int i = 0; i < TIMERS; i++) {
+            CHECK(!armed(i));
+            CHECK_EQ(timers[i].fire_ticks, fired_at[i]);
+        }
+    }
+}
+
+HOST_TEST(test_remove)
+{
+    for (int q = 0; q < 2; q++) {
+        int count = 0;
+
+        reset(&queues[q]);
+        /* Several in one slot of each level, and alone in others */
+        for (int i = 0; i < 12; i++) {
+            uint32_t delay = (i % 3 == 0 ? 100 : i % 3 == 1 ? 2000000 : 100000000) + i;
+            queues[q].add(&queue, &timers[i], START + delay, START);
+        }
+        queues[q].add(&queue, &timers[12], START + 50000, START);
+
+        static const int order[] = { 12, 0, 9, 6, 3, 4, 1, 7, 10, 11, 5, 8 };
+        for (int k = 0; k < 12; k++) {
+            queues[q].remove(&queue, &timers[order[k]]);
+            CHECK(!armed(order[k]));
+            CHECK(check_next(&queues[q]));
+            /* Removing one not armed does nothing */
+            queues[q].remove(&queue, &timers[order[k]]);
+            CHECK(check_next(&queues[q]));
+        }
+        CHECK(expire(&queues[q], START + (1u << 30), &count));
+        CHECK_EQ(1, count);
+        CHECK(!queues[q].next(&queue, &(uint32_t){ 0 }));
+
+        /* Removing a zeroed timer, never set up, does nothing */
+        queues[q].add(&queue, &timers[0], START + 100, START);
+        memset(&timers[1], 0, sizeof(timers[1]));
+        queues[q].remove(&queue, &timers[1]);
+        CHECK(!armed(1));
+        CHECK(armed(0));
+        CHECK(check_next(&queues[q]));
+
+        /* Nor one left with stale links, from the stack, pointing back at
+         * it from outside the wheel or from a timer it doesn't follow */
+        ets_timer_t *stale = &timers[1];
+        queues[q].add(&queue, &timers[2], START + 200, START);
+        timers[1].next = &timers[3];
+        timers[1].pprev = &stale;
+        queues[q].remove(&queue, &timers[1]);
+        CHECK(stale == &timers[1]);
+        CHECK(!armed(1));
+        timers[1].next = &timers[3];
+        timers[1].pprev = &timers[2].next;
+        queues[q].remove(&queue, &timers[1]);
+        CHECK(!armed(1));
+        CHECK(armed(0) && armed(2));
+        CHECK(check_next(&queues[q]));
+        CHECK(expire(&queues[q], START + 1000, &count));
+        CHECK_EQ(3, count);
+    }
+}
+
+HOST_TEST(test_late)
+{
+    for (int q = 0; q < 2; q++) {
+        int count = 0;
+
+        reset(&queues[q]);
+        /* Expired well after its time, and armed for a time already past,
+         * as a repeating timer whose callback ran long is */
+        queues[q].add(&queue, &timers[0], START + 1000, START);
+        CHECK(expire(&queues[q], START + 30000000, &count));
+        queues[q].add(&queue, &timers[0], START + 2000, START + 30000000);
+        queues[q].add(&queue, &timers[1], START + 30000100, START + 30000000);
+        CHECK(check_next(&queues[q]));
+        CHECK(expire(&queues[q], START + 30000000, &count));
+        CHECK_EQ(2, count);
+        CHECK(armed(1));
+        CHECK(expire(&queues[q], START + 30000100, &count));
+        CHECK_EQ(3, count);
+    }
+}
+
+HOST_TEST(test_idle_wheel)
+{
+    const queue_ops_t *q = &queues[1];
+    bool ok = true;
+
+    /* Timers armed long after the wheel went empty, and long after it was
+     * last expired, still wait for their time */
+    reset(q);
+    q->add(&queue, &timers[0], START + 1000, START);
+    CHECK(expire(q, START + 1000, NULL));
+    q->add(&queue, &timers[1], START + 2000000000u, START + 1500000000u);
+    run_alarms(q, START + 1500000000u, START + 1900000000u, &ok);
+    CHECK(armed(1));
+    q->add(&queue, &timers[2], START + 1900000000u + MAX_AHEAD, START + 1900000000u);
+    CHECK(check_next(q));
+    int alarms = run_alarms(q, START + 1900000000u, START + 1900000000u + MAX_AHEAD, &ok);
+    CHECK(ok);
+    CHECK_EQ(timers[1].fire_ticks, fired_at[1]);
+    CHECK_EQ(timers[2].fire_ticks, fired_at[2]);
+    /* Moving a far timer down takes an alarm a level at most */
+    CHECK(alarms <= 2 * ETS_TIMER_WHEEL_LEVELS + 2);
+}
+
+HOST_TEST(test_slack_settings)
+{
+    static const uint32_t starts[] = { 0, 1, 12345, 0xfffffff0u, 0u - 1, 0x7fffffffu, 0x80000001u };
+
+    CHECK_EQ(0, ets_timer_slack(0));
+    CHECK_EQ(1, ets_timer_slack(1));
+    CHECK_EQ(1, ets_timer_slack(2));
+    CHECK_EQ(2, ets_timer_slack(3));
+    CHECK_EQ(12, ets_timer_slack(5000));
+    CHECK_EQ(ETS_TIMER_SLACK_MAX, ets_timer_slack(0xffffffffu));
+
+    /* Due within the slack, also across the wrap */
+    for (int i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+        for (int slack = 0; slack <= ETS_TIMER_SLACK_MAX; slack++) {
+            ets_timer_t timer = { .fire_ticks = starts[i], .slack = slack };
+            uint32_t late = ets_timer_due(&timer) - starts[i];
+
+            CHECK(late <= (1u << slack) - 1);
+        }
+    }
+}
+
+HOST_TEST(test_slack)
+{
+    int alarms[2][2];
+
+    for (int q = 0; q < 2; q++) {
+        for (int with_slack = 0; with_slack < 2; with_slack++) {
+            bool ok = true;
+
+            /* Timers a few hundred microseconds apart, each allowed a
+             * millisecond late */
+            reset(&queues[q]);
+            for (int i = 0; i < TIMERS; i++) {
+                timers[i].slack = with_slack ? ets_timer_slack(5000) : 0;
+                queues[q].add(&queue, &timers[i], START + 1000 + i * 1500, START);
+            }
+            CHECK(check_next(&queues[q]));
+            alarms[q][with_slack] = run_alarms(&queues[q], START, START + 1000000, &ok);
+            CHECK(ok);
+            for (int i = 0; i < TIMERS; i++) {
+                CHECK(!armed(i));
+                CHECK(!before(fired_at[i], timers[i].fire_ticks));
+                CHECK(fired_at[i] - timers[i].fire_ticks <= 4095);
+            }
+        }
+        CHECK_EQ(TIMERS, alarms[q][0]);
+        CHECK(alarms[q][1] * 2 <= alarms[q][0]);
+    }
+}
+
+HOST_TEST(test_random)
+{
+    for (int q = 0; q < 2; q++) {
+        uint32_t now = START;
+        uint32_t period[TIMERS] = { 0 };
+        bool ok = true;
+
+        reset(&queues[q]);
+        srand(1);
+        for (int step = 0; step < 20000 && ok; step++) {
+            int i = rand() % TIMERS;
+            uint32_t delay;
+
+            switch (rand() % 4) {
+            case 0:
+                delay = rand() % 10000;
+                break;
+            case 1:
+                delay = rand() % 5000000;
+                break;
+            case 2:
+                delay = rand() % 500000000;
+                break;
+            default:
+                delay = ((uint32_t)rand() << 8) % MAX_AHEAD;
+                break;
+            }
+            switch (rand() % 5) {
+            case 0:
+            case 1:
+                if (!armed(i)) {
+                    period[i] = rand() % 3 == 0 ? delay + 1 : 0;
+                    timers[i].slack = rand() % 2 ? rand() % (ETS_TIMER_SLACK_MAX + 1) : 0;
+                    queues[q].add(&queue, &timers[i], now + delay, now);
+                }
+                break;
+            case 2:
+                queues[q].remove(&queue, &timers[i]);
+                break;
+            default: {
+                /* Move the clock on, to an alarm or by a random step */
+                uint32_t next;
+                if (rand() % 2 && queues[q].next(&queue, &next) && !before(next, now)) {
+                    now = next;
+                } else {
+                    now += rand() % 3 ? rand() % 20000 : rand() % 50000000;
+                }
+                ets_timer_t *timer;
+                while ((timer = queues[q].expire(&queue, now)) != NULL) {
+                    int t = timer - timers;
+                    ok = ok && !before(now, ets_timer_due(timer));
+                    if (period[t]) {
+                        queues[q].add(&queue, timer, timer->fire_ticks + period[t], now);
+                    }
+                }
+                for (int k = 0; k < TIMERS; k++) {
+                    ok = ok && !(armed(k) && !before(now, ets_timer_due(&timers[k])));
+                }
+                break;
+            }
+            }
+            ok = ok && check_next(&queues[q]);
+            if (q == 1) {
+                int n = 0;
+                for (int k = 0; k < TIMERS; k++) {
+                    n += armed(k);
+                }
+                ok = ok && queue.wheel.count == n;
+            }
+        }
+        CHECK(ok);
+    }
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_order),
+    HOST_TEST_ENTRY(test_fires_on_time),
+    HOST_TEST_ENTRY(test_remove),
+    HOST_TEST_ENTRY(test_late),
+    HOST_TEST_ENTRY(test_idle_wheel),
+    HOST_TEST_ENTRY(test_slack_settings),
+    HOST_TEST_ENTRY(test_slack),
+    HOST_TEST_ENTRY(test_random),
+};
+
+HOST_TEST_MAIN("ets_timer_queue", tests)
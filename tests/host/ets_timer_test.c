@@ -0,0 +1,214 @@
+/* Host-side tests for the alarm handling in open_esplibs/libmain/ets_timer.c
+ *
+ * The FRC2 and DPORT registers are mapped at their real addresses. The
+ * timer task is run from the test: each time it waits, the clock moves on
+ * to the programmed alarm and the FRC2 interrupt is raised, so a timer that
+ * fires late shows how far the alarm had been set.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp/interrupts.h"
+#include "esp/timer_regs.h"
+#include "ets_timer_queue.h"
+#include "host_test.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define REGS_PAGE   0x60000000
+#define DPORT_PAGE  0x3ff00000
+#define PAGE_SIZE   4096
+
+/* Waits for the alarm before a timer should have fired */
+#define MAX_ALARMS 16
+
+/* set_alarm() in ets_timer.c sets an alarm this close at most this late */
+#define MAX_LATE 44
+
+/* As defined in ets_timer.c, on its own ets_timer_t rather than ETSTimer */
+void sdk_ets_timer_init(void);
+void sdk_ets_timer_setfn(ets_timer_t *timer, ets_timer_func_t *func, void *parg);
+void sdk_ets_timer_arm(ets_timer_t *timer, uint32_t milliseconds, bool repeat_flag);
+void sdk_ets_timer_arm_us(ets_timer_t *timer, uint32_t useconds, bool repeat_flag);
+void sdk_ets_timer_disarm(ets_timer_t *timer);
+
+unsigned host_critical_nesting;
+
+static TaskFunction_t timer_task;
+static _xt_isr frc2_isr;
+static jmp_buf task_exit;
+static unsigned alarms;
+static bool fired;
+static uint32_t fired_at;
+
+void _xt_isr_attach(uint8_t i, _xt_isr func, void *arg)
+{
+    if (i == INUM_TIMER_FRC2) {
+        frc2_isr = func;
+    }
+}
+
+uint32_t _xt_isr_unmask(uint32_t unmask)
+{
+    return 0;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack_depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *created)
+{
+    timer_task = func;
+    if (created) {
+        *created = (TaskHandle_t)&timer_task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                              BaseType_t *higher_priority_task_woken)
+{
+    return pdTRUE;
+}
+
+/* The timer task waiting: move the clock on to the alarm and raise it. An
+ * alarm left behind the clock would only come round after FRC2 wraps. */
+BaseType_t xTaskNotifyWait(uint32_t bits_to_clear_on_entry, uint32_t bits_to_clear_on_exit,
+                           uint32_t *notification_value, TickType_t ticks_to_wait)
+{
+    if (fired || ++alarms > MAX_ALARMS
+        || (int32_t)(TIMER_FRC2.ALARM - TIMER_FRC2.COUNT) <= 0) {
+        longjmp(task_exit, 1);
+    }
+    TIMER_FRC2.COUNT = TIMER_FRC2.ALARM;
+    frc2_isr(NULL);
+    return pdTRUE;
+}
+
+static void callback(void *arg)
+{
+    fired = true;
+    fired_at = TIMER_FRC2.COUNT;
+}
+
+static void *map_fixed(uintptr_t addr)
+{
+    void *p = mmap((void *)addr, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    return p == (void *)addr ? p : NULL;
+}
+
+static void setup(void)
+{
+    static bool done;
+
+    if (!done) {
+        CHECK(map_fixed(REGS_PAGE) != NULL);
+        CHECK(map_fixed(DPORT_PAGE) != NULL);
+        TIMER_FRC2.COUNT = 1000;
+        sdk_ets_timer_init();
+        CHECK(timer_task != NULL);
+        CHECK(frc2_isr != NULL);
+        done = true;
+    }
+}
+
+/* Run the timer task until 'timer' fires or too many alarms have passed */
+static void run(void)
+{
+    fired = false;
+    alarms = 0;
+    if (!setjmp(task_exit)) {
+        timer_task(NULL);
+    }
+}
+
+/* Arm a single timer on the empty wheel, starting at 'start', and check the
+ * alarm is set for it and that it fires on time */
+static void check_alone(uint32_t start, uint32_t us)
+{
+    static ets_timer_t timer;
+    uint32_t ticks = us * 5;
+    uint32_t due = start + ticks;
+
+    /* Left armed by a case that failed */
+    sdk_ets_timer_disarm(&timer);
+
+    TIMER_FRC2.COUNT = start;
+    sdk_ets_timer_setfn(&timer, callback, NULL);
+    sdk_ets_timer_arm_us(&timer, us, false);
+    CHECK_EQ(0, host_critical_nesting);
+
+    /* Set ahead of now, and not after the timer is due */
+    int32_t alarm = TIMER_FRC2.ALARM - start;
+    CHECK(alarm > 0);
+    CHECK(alarm <= ticks);
+
+    run();
+    CHECK(fired);
+    CHECK((int32_t)(fired_at - due) >= 0);
+    CHECK((int32_t)(fired_at - due) <= MAX_LATE);
+}
+
+HOST_TEST(test_long_timer_alone)
+{
+    static const uint32_t us[] = {
+        1000, 50000, 104000, 105000, 122469, 200000, 1002469, 5000000, 60000000, 400000000,
+    };
+    uint32_t start = 1000;
+
+    setup();
+    for (int i = 0; i < sizeof(us) / sizeof(us[0]); i++) {
+        check_alone(start, us[i]);
+        start = TIMER_FRC2.COUNT + 12345;
+    }
+}
+
+HOST_TEST(test_across_wrap)
+{
+    static const uint32_t us[] = { 105000, 1002469, 60000000 };
+
+    setup();
+    for (int i = 0; i < sizeof(us) / sizeof(us[0]); i++) {
+        check_alone(0u - us[i] * 5 / 2, us[i]);
+    }
+}
+
+HOST_TEST(test_earlier_timer_first)
+{
+    static ets_timer_t later, sooner;
+    uint32_t start = TIMER_FRC2.COUNT + 1000;
+
+    setup();
+    /* A long timer, then a shorter one due before the first event */
+    TIMER_FRC2.COUNT = start;
+    sdk_ets_timer_setfn(&later, callback, NULL);
+    sdk_ets_timer_arm(&later, 3000, false);
+    sdk_ets_timer_setfn(&sooner, callback, NULL);
+    sdk_ets_timer_arm_us(&sooner, 2000, false);
+    CHECK_EQ(start + 2000 * 5, TIMER_FRC2.ALARM);
+
+    run();
+    CHECK(fired);
+    CHECK_EQ(start + 2000 * 5, fired_at);
+    run();
+    CHECK(fired);
+    CHECK((int32_t)(fired_at - (start + 3000 * 5000)) >= 0);
+    CHECK((int32_t)(fired_at - (start + 3000 * 5000)) <= MAX_LATE);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_long_timer_alone),
+    HOST_TEST_ENTRY(test_across_wrap),
+    HOST_TEST_ENTRY(test_earlier_timer_first),
+};
+
+HOST_TEST_MAIN("ets_timer", tests)
@@ -0,0 +1,210 @@
+/* RAM-backed stand-in for core/spiflash.c on the host
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "spiflash.h"
+#include "flashchip.h"
+#include "flash_emu.h"
+
+sdk_flashchip_t sdk_flashchip;
+flash_emu_stats_t flash_emu_stats;
+unsigned host_critical_nesting;
+
+static uint8_t *flash_image;
+static uint32_t *sector_erases;
+static int fail_after = -1;
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+void flash_emu_init(uint32_t size)
+{
+    free(flash_image);
+    flash_image = malloc(size);
+    if (!flash_image) {
+        fprintf(stderr, "flash_emu: unable to allocate %u bytes\n", size);
+        exit(1);
+    }
+    memset(flash_image, 0xff, size);
+    free(sector_erases);
+    sector_erases = calloc(size / FLASH_EMU_SECTOR_SIZE, sizeof(uint32_t));
+
+    sdk_flashchip.device_id = 0x1640ef;
+    sdk_flashchip.chip_size = size;
+    sdk_flashchip.block_size = 64 * 1024;
+    sdk_flashchip.sector_size = FLASH_EMU_SECTOR_SIZE;
+    sdk_flashchip.page_size = FLASH_EMU_PAGE_SIZE;
+    sdk_flashchip.status_mask = 0xffff;
+
+    fail_after = -1;
+    flash_emu_reset_stats();
+}
+
+void flash_emu_free(void)
+{
+    free(flash_image);
+    flash_image = NULL;
+    free(sector_erases);
+    sector_erases = NULL;
+    memset(&sdk_flashchip, 0, sizeof(sdk_flashchip));
+}
+
+void flash_emu_reset_stats(void)
+{
+    memset(&flash_emu_stats, 0, sizeof(flash_emu_stats));
+}
+
+uint8_t *flash_emu_data(void)
+{
+    return flash_image;
+}
+
+void flash_emu_fail_after(int count)
+{
+    fail_after = count;
+}
+
+uint32_t flash_emu_sector_erases(uint32_t addr)
+{
+    return sector_erases[addr / FLASH_EMU_SECTOR_SIZE];
+}
+
+static void account(uint64_t ns)
+{
+    flash_emu_stats.busy_ns += ns;
+    if (ns > flash_emu_stats.max_busy_ns) {
+        flash_emu_stats.max_busy_ns = ns;
+    }
+}
+
+/* Returns false once the simulated power cut has happened */
+static bool power_ok(void)
+{
+    if (fail_after < 0) {
+        return true;
+    }
+    if (fail_after == 0) {
+        return false;
+    }
+    fail_after--;
+    return true;
+}
+
+bool spiflash_read(uint32_t addr, uint8_t *buf, uint32_t size)
+{
+    uint64_t ns = FLASH_EMU_CALL_OVERHEAD_NS;
+    uint32_t cmds;
+
+    if (!buf || !flash_image) {
+        return false;
+    }
+    if (size && (addr + size) > sdk_flashchip.chip_size) {
+        return false;
+    }
+
+    vPortEnterCritical();
+    memcpy(buf, flash_image + addr, size);
+    vPortExitCritical();
+
+    cmds = (size + FLASH_EMU_READ_MAX_SIZE - 1) / FLASH_EMU_READ_MAX_SIZE;
+    ns += cmds * FLASH_EMU_READ_CMD_NS + size * FLASH_EMU_READ_BYTE_NS;
+
+    flash_emu_stats.read_calls++;
+    flash_emu_stats.read_cmds += cmds;
+    flash_emu_stats.read_bytes += size;
+    account(ns);
+
+    return true;
+}
+
+bool spiflash_write(uint32_t addr, uint8_t *buf, uint32_t size)
+{
+    uint64_t ns = FLASH_EMU_CALL_OVERHEAD_NS;
+    bool result = true;
+
+    if (!buf || !flash_image) {
+        return false;
+    }
+    if (sdk_flashchip.chip_size < (addr + size)) {
+        return false;
+    }
+
+    vPortEnterCritical();
+
+    // Split on page boundaries first, then into program commands, exactly
+    // like spi_write()/spi_write_page() in core/spiflash.c.
+    while (size) {
+        uint32_t page_left = FLASH_EMU_PAGE_SIZE - (addr % FLASH_EMU_PAGE_SIZE);
+        uint32_t count = min(min(size, page_left), FLASH_EMU_WRITE_MAX_SIZE);
+
+        if (!power_ok()) {
+            result = false;
+            break;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t old = flash_image[addr + i];
+            flash_emu_stats.bit_violations += __builtin_popcount(~old & buf[i] & 0xff);
+            flash_image[addr + i] = old & buf[i];
+        }
+        flash_emu_stats.program_cmds++;
+        flash_emu_stats.write_bytes += count;
+        ns += FLASH_EMU_PROGRAM_CMD_NS + count * FLASH_EMU_PROGRAM_BYTE_NS;
+
+        addr += count;
+        buf += count;
+        size -= count;
+    }
+
+    vPortExitCritical();
+
+    flash_emu_stats.write_calls++;
+    account(ns);
+
+    return result;
+}
+
+bool spiflash_erase_sector(uint32_t addr)
+{
+    if (!flash_image) {
+        return false;
+    }
+    if ((addr + sdk_flashchip.sector_size) > sdk_flashchip.chip_size) {
+        return false;
+    }
+    if (addr & 0xFFF) {
+        return false;
+    }
+    if (fail_after == 0) {
+        return false;
+    }
+
+    vPortEnterCritical();
+    memset(flash_image + addr, 0xff, sdk_flashchip.sector_size);
+    vPortExitCritical();
+
+    sector_erases[addr / FLASH_EMU_SECTOR_SIZE]++;
+    flash_emu_stats.erase_calls++;
+    account(FLASH_EMU_CALL_OVERHEAD_NS + FLASH_EMU_SECTOR_ERASE_NS);
+
+    return true;
+}
+
+void flash_emu_print_stats(const char *label)
+{
+    printf("%-24s reads %6u (%8llu B)  writes %6u (%7llu B, %6u cmds)  "
+           "erases %4u  busy %9.3f ms  max %7.3f ms\n",
+           label,
+           flash_emu_stats.read_calls,
+           (unsigned long long)flash_emu_stats.read_bytes,
+           flash_emu_stats.write_calls,
+           (unsigned long long)flash_emu_stats.write_bytes,
+           flash_emu_stats.program_cmds,
+           flash_emu_stats.erase_calls,
+           flash_emu_stats.busy_ns / 1e6,
+           flash_emu_stats.max_busy_ns / 1e6);
+}
@@ -0,0 +1,82 @@
+/* RAM-backed stand-in for core/spiflash.c on the host
+ *
+ * Implements spiflash_read(), spiflash_write() and spiflash_erase_sector()
+ * on top of a malloc()'d buffer, following NOR flash rules: programming can
+ * only clear bits (1->0), erasing works on whole 4 KiB sectors and resets
+ * them to 0xff, and program operations are split into 256-byte pages the
+ * same way the real driver does.
+ *
+ * Every operation is counted, and a rough model of the time the real chip
+ * would spend busy (with the cache disabled and interrupts off) is kept so
+ * that benchmarks can compare algorithms without hardware.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _FLASH_EMU_H
+#define _FLASH_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLASH_EMU_SECTOR_SIZE 4096
+#define FLASH_EMU_PAGE_SIZE   256
+
+/* Rough timing model (in ns) of a 40 MHz QIO flash chip as driven by
+ * core/spiflash.c.  Figures are typical datasheet values, and are only meant
+ * for relative comparisons.
+ */
+#define FLASH_EMU_READ_MAX_SIZE     60      // bytes per SPI read command
+#define FLASH_EMU_WRITE_MAX_SIZE    64      // bytes per SPI page program command
+
+#define FLASH_EMU_CALL_OVERHEAD_NS  2000    // cache off/on + critical section
+#define FLASH_EMU_READ_CMD_NS       1500
+#define FLASH_EMU_READ_BYTE_NS      200
+#define FLASH_EMU_PROGRAM_CMD_NS    20000
+#define FLASH_EMU_PROGRAM_BYTE_NS   2500
+#define FLASH_EMU_SECTOR_ERASE_NS   45000000
+
+typedef struct {
+    uint32_t read_calls;
+    uint32_t write_calls;
+    uint32_t erase_calls;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint32_t read_cmds;        // SPI read commands issued
+    uint32_t program_cmds;     // SPI page program commands issued
+    uint32_t bit_violations;   // bits a write tried to take from 0 to 1
+    uint64_t busy_ns;          // modelled time spent with interrupts off
+    uint64_t max_busy_ns;      // longest single modelled operation
+} flash_emu_stats_t;
+
+extern flash_emu_stats_t flash_emu_stats;
+
+/** Allocate an erased flash image of `size` bytes (multiple of 4 KiB) and set
+ *  up sdk_flashchip to describe it.  Any previous image is discarded.
+ */
+void flash_emu_init(uint32_t size);
+
+/** Release the flash image */
+void flash_emu_free(void);
+
+/** Zero all counters in flash_emu_stats */
+void flash_emu_reset_stats(void);
+
+/** Direct access to the flash image, for inspection and fault injection */
+uint8_t *flash_emu_data(void);
+
+/** Simulate power loss: after `count` more page program commands, all
+ *  further writes and erases fail without touching the image.  A negative
+ *  count disables fault injection.
+ */
+void flash_emu_fail_after(int count);
+
+/** Number of times the sector containing `addr` has been erased since
+ *  flash_emu_init()
+ */
+uint32_t flash_emu_sector_erases(uint32_t addr);
+
+/** Print the counters in flash_emu_stats on one line, prefixed by `label` */
+void flash_emu_print_stats(const char *label);
+
+#endif /* _FLASH_EMU_H */
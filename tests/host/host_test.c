@@ -0,0 +1,27 @@
+/* Minimal test runner for the host-side test programs
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include "host_test.h"
+
+jmp_buf host_test_jmp;
+
+int host_test_run(const char *suite, const host_test_case_t *tests, int count)
+{
+    int failed = 0;
+
+    printf("%s: running %d cases\n", suite, count);
+    for (int i = 0; i < count; i++) {
+        if (setjmp(host_test_jmp) == 0) {
+            tests[i].func();
+            printf("  PASS %s\n", tests[i].name);
+        } else {
+            printf("  FAIL %s\n", tests[i].name);
+            failed++;
+        }
+    }
+    printf("%s: %d passed, %d failed\n", suite, count - failed, failed);
+
+    return failed;
+}
@@ -0,0 +1,55 @@
+/* Minimal assertion helpers for the host-side test programs
+ *
+ * Each test program registers its cases with HOST_TEST() and calls
+ * host_test_run() from main().  A failed check reports the location and
+ * aborts the current case, and the process exit status is the number of
+ * failed cases.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _HOST_TEST_H
+#define _HOST_TEST_H
+
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+
+typedef struct {
+    const char *name;
+    void (*func)(void);
+} host_test_case_t;
+
+extern jmp_buf host_test_jmp;
+
+#define HOST_TEST(name) static void name(void)
+#define HOST_TEST_ENTRY(name) { #name, name }
+
+#define CHECK(cond) do { if (!(cond)) { \
+        printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        longjmp(host_test_jmp, 1); \
+    } } while (0)
+
+#define CHECK_EQ(expected, actual) do { \
+        long long __e = (long long)(expected), __a = (long long)(actual); \
+        if (__e != __a) { \
+            printf("    %s:%d: %s: expected %lld, got %lld\n", \
+                   __FILE__, __LINE__, #actual, __e, __a); \
+            longjmp(host_test_jmp, 1); \
+        } } while (0)
+
+#define CHECK_MEM(expected, actual, len) do { \
+        if (memcmp((expected), (actual), (len))) { \
+            printf("    %s:%d: %s does not match\n", __FILE__, __LINE__, #actual); \
+            longjmp(host_test_jmp, 1); \
+        } } while (0)
+
+/** Run all cases in `tests`, returns the number of failures */
+int host_test_run(const char *suite, const host_test_case_t *tests, int count);
+
+#define HOST_TEST_MAIN(suite, tests) \
+    int main(void) { \
+        return host_test_run(suite, tests, sizeof(tests) / sizeof(tests[0])); \
+    }
+
+#endif /* _HOST_TEST_H */
@@ -0,0 +1,55 @@
+/* Host stand-in for FreeRTOS.h
+ *
+ * Provides just enough of the FreeRTOS API for core sources (sysparam.c etc.)
+ * to be compiled and exercised as a single-threaded Linux program.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define portTICK_PERIOD_MS 10
+
+/* Critical sections nest, exactly like the esp8266 port.  The harness can
+ * inspect host_critical_nesting to assert that a code path always leaves the
+ * critical section balanced.
+ */
+extern unsigned host_critical_nesting;
+
+#if HOST_THREADS
+/* Built with HOST_THREADS the RTOS stand-ins run on real threads
+ * (rtos_threads.c), and a critical section holds one process-wide lock. */
+void vPortEnterCritical(void);
+void vPortExitCritical(void);
+#else
+static inline void vPortEnterCritical(void) { host_critical_nesting++; }
+static inline void vPortExitCritical(void) { host_critical_nesting--; }
+#endif
+
+#define portENTER_CRITICAL() vPortEnterCritical()
+#define portEXIT_CRITICAL()  vPortExitCritical()
+#define taskENTER_CRITICAL() portENTER_CRITICAL()
+#define taskEXIT_CRITICAL()  portEXIT_CRITICAL()
+
+#define configMAX_PRIORITIES 15
+#define configMINIMAL_STACK_SIZE 256
+
+size_t xPortGetFreeHeapSize(void);
+
+#define portEND_SWITCHING_ISR(woken) ((void)(woken))
+
+#endif /* _HOST_FREERTOS_H */
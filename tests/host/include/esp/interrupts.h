@@ -0,0 +1,35 @@
+/* Host stand-in for esp/interrupts.h
+ *
+ * Programs that exercise interrupt-driven code provide the definitions and
+ * decide when handlers run (see spi_sim.c).
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _XTENSA_INTERRUPTS_H
+#define _XTENSA_INTERRUPTS_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <common_macros.h>
+
+typedef enum {
+    INUM_WDEV_FIQ = 0,
+    INUM_SLC = 1,
+    INUM_SPI = 2,
+    INUM_RTC = 3,
+    INUM_GPIO = 4,
+    INUM_UART = 5,
+    INUM_TICK = 6,
+    INUM_SOFT = 7,
+    INUM_WDT = 8,
+    INUM_TIMER_FRC1 = 9,
+    INUM_TIMER_FRC2 = 10,
+} xt_isr_num_t;
+
+typedef void (* _xt_isr)(void *arg);
+void _xt_isr_attach(uint8_t i, _xt_isr func, void *arg);
+_xt_isr _xt_isr_get(uint8_t i, void **arg);
+uint32_t _xt_isr_unmask(uint32_t unmask);
+uint32_t _xt_isr_mask(uint32_t mask);
+
+#endif
@@ -0,0 +1,70 @@
+/* Host stand-in for semphr.h
+ *
+ * The host harness is single threaded, so mutexes only need to track that
+ * take/give calls are balanced, and a binary semaphore is a mutex created
+ * taken; taking either never blocks. Built with HOST_THREADS, semaphores
+ * and mutexes block for real, and are provided by rtos_threads.c.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _HOST_SEMPHR_H
+#define _HOST_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+#if HOST_THREADS
+
+typedef struct host_sem *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem);
+
+#else
+
+typedef struct host_mutex {
+    volatile int held;      // given from simulated interrupts
+} *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    static struct host_mutex mutexes[8];
+    static unsigned next;
+    SemaphoreHandle_t m = &mutexes[next++ % 8];
+    m->held = 0;
+    return m;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t ticks) {
+    (void)ticks;
+    if (m->held) return pdFALSE;
+    m->held = 1;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m) {
+    if (!m->held) return pdFALSE;
+    m->held = 0;
+    return pdTRUE;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    SemaphoreHandle_t m = xSemaphoreCreateMutex();
+    m->held = 1;
+    return m;
+}
+
+static inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t m, BaseType_t *woken) {
+    *woken = pdTRUE;
+    return xSemaphoreGive(m);
+}
+
+#endif /* HOST_THREADS */
+
+#endif /* _HOST_SEMPHR_H */
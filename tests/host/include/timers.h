@@ -0,0 +1,12 @@
+/* Host stand-in for timers.h
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _HOST_TIMERS_H
+#define _HOST_TIMERS_H
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#endif /* _HOST_TIMERS_H */
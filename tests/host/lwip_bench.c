@@ -0,0 +1,289 @@
+/* Network benchmarks for the esp-open-rtos lwip configuration and port, run
+ * on the host (lwip_host.c) against a second lwip process on the other end
+ * of a socketpair, or with -t against the Linux stack on the other end of a
+ * TAP interface
+ *
+ * - TCP bulk transfer, lwip sending and lwip receiving
+ * - TCP request/response latency with small messages
+ * - UDP multicast, received by lwip and sent by lwip
+ *
+ * Each prints its result and the esp_interface.c counters for the run.
+ * The socketpair needs no privileges. Creating the TAP interface needs
+ * CAP_NET_ADMIN, for example run as root or in a container started with
+ * --cap-add NET_ADMIN --device /dev/net/tun. Pass a file name to capture all
+ * frames to it in pcap format.
+ *
+ * The figures depend on the host and on the simulated driver, so they are
+ * for comparing changes to the lwip configuration and port, not predictions
+ * for the device.
+ *
+ * This, lwip_bench_loop.c and lwip_host.c were written without the lwip
+ * submodule checked out and have not yet been built or run.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+#include "esp_interface.h"
+#include "lwip_host.h"
+#include "lwip_bench.h"
+
+#define BULK_BYTES (4 * 1024 * 1024)
+#define WRITE_SIZE 2920
+#define RR_ROUNDS 2000
+#define RR_SIZE 32
+#define MCAST_COUNT 5000
+#define MCAST_SIZE 512
+#define MCAST_RATE 2000
+
+static const bench_peer_t *peer;
+static esp_lwip_stats_t stats_before;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void stats_start(void)
+{
+    esp_lwip_get_stats(&stats_before);
+}
+
+static void stats_print(void)
+{
+    esp_lwip_stats_t s;
+
+    esp_lwip_get_stats(&s);
+    printf("    rx frames %u copied %u pool max %u | tx direct %u bounced %u cloned %u failed %u"
+           " | mbox full %u | driver drops rx %u tx %u\n",
+           s.rx.frames - stats_before.rx.frames, s.rx.copied - stats_before.rx.copied,
+           s.rx.pool_usage_max, s.tx.direct - stats_before.tx.direct,
+           s.tx.bounced - stats_before.tx.bounced, s.tx.cloned - stats_before.tx.cloned,
+           s.tx.failed - stats_before.tx.failed, s.mbox_full - stats_before.mbox_full,
+           lwip_host_rx_dropped, lwip_host_tx_dropped);
+}
+
+static int tcp_connect(uint16_t port)
+{
+    struct sockaddr_in sa;
+    int s = lwip_socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = inet_addr(LWIP_HOST_PEER_ADDR);
+    if (lwip_connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        printf("connect to port %u failed\n", port);
+        lwip_close(s);
+        return -1;
+    }
+    return s;
+}
+
+static void bench_tcp_send(void)
+{
+    static uint8_t buf[WRITE_SIZE];
+    int s = tcp_connect(BENCH_SINK_PORT);
+
+    if (s < 0) {
+        return;
+    }
+    stats_start();
+    uint64_t start = now_us();
+    for (size_t sent = 0; sent < BULK_BYTES; sent += sizeof(buf)) {
+        if (lwip_write(s, buf, sizeof(buf)) != sizeof(buf)) {
+            printf("write failed\n");
+            break;
+        }
+    }
+    lwip_close(s);
+    uint64_t received = peer->sink_wait(30000);
+    uint64_t elapsed = now_us() - start;
+
+    printf("tcp send     %8.2f Mbit/s  (%llu bytes in %.2f s)\n", received * 8.0 / elapsed,
+           (unsigned long long)received, elapsed / 1e6);
+    stats_print();
+}
+
+static void bench_tcp_receive(void)
+{
+    static uint8_t buf[TCP_MSS * 2];
+    uint64_t received = 0;
+    int len;
+
+    peer->source_set(BULK_BYTES);
+    stats_start();
+    uint64_t start = now_us();
+    int s = tcp_connect(BENCH_SOURCE_PORT);
+    if (s < 0) {
+        return;
+    }
+    while ((len = lwip_read(s, buf, sizeof(buf))) > 0) {
+        received += len;
+    }
+    uint64_t elapsed = now_us() - start;
+    lwip_close(s);
+
+    printf("tcp receive  %8.2f Mbit/s  (%llu bytes in %.2f s)\n", received * 8.0 / elapsed,
+           (unsigned long long)received, elapsed / 1e6);
+    stats_print();
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench_tcp_rr(void)
+{
+    static uint32_t latency_us[RR_ROUNDS];
+    uint8_t buf[RR_SIZE];
+    uint64_t total = 0;
+    int one = 1;
+    int s = tcp_connect(BENCH_ECHO_PORT);
+    int n;
+
+    if (s < 0) {
+        return;
+    }
+    lwip_setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    memset(buf, 0x55, sizeof(buf));
+    stats_start();
+    for (n = 0; n < RR_ROUNDS; n++) {
+        uint64_t start = now_us();
+        int got = 0, len;
+
+        if (lwip_write(s, buf, sizeof(buf)) != sizeof(buf)) {
+            break;
+        }
+        while (got < sizeof(buf) && (len = lwip_read(s, buf + got, sizeof(buf) - got)) > 0) {
+            got += len;
+        }
+        if (got < sizeof(buf)) {
+            break;
+        }
+        latency_us[n] = now_us() - start;
+        total += latency_us[n];
+    }
+    lwip_close(s);
+    if (n == 0) {
+        printf("tcp rr       failed\n");
+        return;
+    }
+
+    qsort(latency_us, n, sizeof(latency_us[0]), compare_u32);
+    printf("tcp rr       %8.1f us avg  %u us p50  %u us p99  %u us max  (%d x %d bytes)\n",
+           (double)total / n, latency_us[n / 2], latency_us[n * 99 / 100], latency_us[n - 1],
+           n, RR_SIZE);
+    stats_print();
+}
+
+static void bench_mcast_receive(void)
+{
+    static uint8_t buf[MCAST_SIZE];
+    struct sockaddr_in sa;
+    struct ip_mreq mreq;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 500000 };
+    unsigned received = 0;
+    uint64_t first = 0, last = 0;
+    int s = lwip_socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(BENCH_MCAST_PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    mreq.imr_multiaddr.s_addr = inet_addr(BENCH_MCAST_TO_LWIP);
+    mreq.imr_interface.s_addr = inet_addr(LWIP_HOST_ADDR);
+    if (lwip_bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        lwip_setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        printf("udp mcast rx failed to join %s\n", BENCH_MCAST_TO_LWIP);
+        lwip_close(s);
+        return;
+    }
+    lwip_setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    stats_start();
+    peer->mcast_send_start(MCAST_COUNT, MCAST_SIZE, MCAST_RATE);
+    while (lwip_recv(s, buf, sizeof(buf), 0) > 0) {
+        last = now_us();
+        if (!received++) {
+            first = last;
+        }
+    }
+    lwip_close(s);
+
+    printf("udp mcast rx %8u of %u received, %.0f/s offered  (%d bytes)\n", received,
+           MCAST_COUNT, received > 1 ? (received - 1) * 1e6 / (last - first) : 0.0, MCAST_SIZE);
+    stats_print();
+}
+
+static void bench_mcast_send(void)
+{
+    static uint8_t buf[MCAST_SIZE];
+    struct sockaddr_in sa;
+    unsigned failed = 0;
+    int s = lwip_socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (!peer->mcast_listen_start()) {
+        lwip_close(s);
+        return;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(BENCH_MCAST_PORT);
+    sa.sin_addr.s_addr = inet_addr(BENCH_MCAST_TO_PEER);
+
+    stats_start();
+    uint64_t start = now_us();
+    for (unsigned i = 0; i < MCAST_COUNT; i++) {
+        if (lwip_sendto(s, buf, sizeof(buf), 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+            failed++;
+        }
+    }
+    uint64_t elapsed = now_us() - start;
+    lwip_close(s);
+    sys_msleep(200);
+    unsigned received = peer->mcast_listen_stop();
+
+    printf("udp mcast tx %8.0f/s sent, %u send errors, %u of %u received  (%d bytes)\n",
+           MCAST_COUNT * 1e6 / elapsed, failed, received, MCAST_COUNT, MCAST_SIZE);
+    stats_print();
+}
+
+int main(int argc, char **argv)
+{
+    const char *pcap_path = NULL;
+    bool tap = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            tap = true;
+        } else {
+            pcap_path = argv[i];
+        }
+    }
+    peer = tap ? &bench_peer_linux : &bench_peer_loop;
+    if (!(tap ? lwip_host_init(pcap_path) : bench_loop_init(pcap_path)) || !peer->start()) {
+        return 1;
+    }
+    /* Let ARP and IGMP settle */
+    sys_msleep(500);
+
+    bench_tcp_send();
+    bench_tcp_receive();
+    bench_tcp_rr();
+    bench_mcast_receive();
+    bench_mcast_send();
+    return 0;
+}
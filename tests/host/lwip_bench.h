@@ -0,0 +1,50 @@
+/* Other end of lwip_bench: the Linux stack on ordinary sockets on the host
+ * side of the TAP interface (lwip_bench_peer.c), or a second process running
+ * lwip across a socketpair (lwip_bench_loop.c)
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _LWIP_BENCH_H
+#define _LWIP_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_SINK_PORT     5001    /* Reads and counts until closed */
+#define BENCH_SOURCE_PORT   5002    /* Writes peer_source_bytes then closes */
+#define BENCH_ECHO_PORT     5003    /* Echoes */
+#define BENCH_MCAST_PORT    5004
+#define BENCH_MCAST_TO_LWIP "239.255.77.1"
+#define BENCH_MCAST_TO_PEER "239.255.77.2"
+
+typedef struct {
+    /* Start the TCP servers. */
+    bool (*start)(void);
+
+    /* Wait for the sink connection to be closed, up to 'timeout_ms'.
+     * Returns the number of bytes it received. Each call waits for a new
+     * connection. */
+    uint64_t (*sink_wait)(unsigned timeout_ms);
+
+    /* Number of bytes the source server writes to each connection. */
+    void (*source_set)(uint64_t bytes);
+
+    /* Send 'count' datagrams of 'size' bytes to BENCH_MCAST_TO_LWIP, at up
+     * to 'rate' per second, from a thread of its own. */
+    void (*mcast_send_start)(unsigned count, size_t size, unsigned rate);
+
+    /* Count datagrams sent to BENCH_MCAST_TO_PEER, from start to stop. */
+    bool (*mcast_listen_start)(void);
+    unsigned (*mcast_listen_stop)(void);
+} bench_peer_t;
+
+extern const bench_peer_t bench_peer_linux;
+extern const bench_peer_t bench_peer_loop;
+
+/* Fork the process for bench_peer_loop, and start lwip_host on this end of
+ * the link. The peer runs in the child, which does not return. */
+bool bench_loop_init(const char *pcap_path);
+
+#endif /* _LWIP_BENCH_H */
@@ -0,0 +1,439 @@
+/* Other end of lwip_bench in loopback mode: a second process running the
+ * same lwip configuration and port (lwip_host.c) across a socketpair, which
+ * needs no privileges
+ *
+ * The process is forked before either end starts lwip. The servers are as
+ * in lwip_bench_peer.c, on lwip sockets. The two processes share the state
+ * below, in shared memory with process-shared locks: the bench's calls set
+ * it, and the peer's control thread starts and stops the multicast threads
+ * to match.
+ *
+ * Both ends are lwip, so the figures are not comparable with those against
+ * the Linux stack across the TAP interface.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "lwip/sockets.h"
+#include "lwip_host.h"
+#include "lwip_bench.h"
+#include "tap_if.h"
+
+#define READY_TIMEOUT_MS 5000
+
+typedef struct {
+    unsigned count;
+    size_t size;
+    unsigned rate;
+} mcast_send_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int ready;                  /* 1 servers listening, -1 failed to */
+    uint64_t sink_bytes;
+    unsigned sink_connections;
+    uint64_t source_bytes;
+    unsigned mcast_sends;       /* Sends asked for */
+    unsigned mcast_started;     /* and started by the peer */
+    mcast_send_t mcast_send;
+    bool listen;                /* Multicast listening asked for */
+    int listening;              /* 1 listening, -1 failed to, 0 stopped */
+    unsigned listen_count;
+} shared_t;
+
+static shared_t *shared;
+
+/* Bench process */
+static unsigned sink_waited;
+
+/* Peer process */
+static volatile bool listen_run;
+static unsigned listen_count;
+
+static struct timespec deadline(unsigned timeout_ms)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_REALTIME, &end);
+    end.tv_sec += timeout_ms / 1000;
+    end.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (end.tv_nsec >= 1000000000) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000;
+    }
+    return end;
+}
+
+static int listen_on(uint16_t port)
+{
+    struct sockaddr_in sa;
+    int one = 1;
+    int s = lwip_socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = inet_addr(LWIP_HOST_PEER_ADDR);
+    lwip_setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lwip_bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 || lwip_listen(s, 1) < 0) {
+        printf("peer: listen on port %u failed\n", port);
+        lwip_close(s);
+        return -1;
+    }
+    return s;
+}
+
+static void *sink_thread(void *arg)
+{
+    static uint8_t buf[4096];
+    int s = (intptr_t)arg;
+
+    for (;;) {
+        int c = lwip_accept(s, NULL, NULL);
+        uint64_t bytes = 0;
+        int len;
+
+        while ((len = lwip_read(c, buf, sizeof(buf))) > 0) {
+            bytes += len;
+        }
+        lwip_close(c);
+        pthread_mutex_lock(&shared->lock);
+        shared->sink_bytes = bytes;
+        shared->sink_connections++;
+        pthread_cond_broadcast(&shared->changed);
+        pthread_mutex_unlock(&shared->lock);
+    }
+    return NULL;
+}
+
+static void *source_thread(void *arg)
+{
+    static uint8_t buf[2 * TCP_MSS];
+    int s = (intptr_t)arg;
+
+    for (;;) {
+        int c = lwip_accept(s, NULL, NULL);
+        pthread_mutex_lock(&shared->lock);
+        uint64_t remaining = shared->source_bytes;
+        pthread_mutex_unlock(&shared->lock);
+
+        while (remaining) {
+            size_t n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+            int len = lwip_write(c, buf, n);
+            if (len <= 0) {
+                break;
+            }
+            remaining -= len;
+        }
+        lwip_close(c);
+    }
+    return NULL;
+}
+
+static void *echo_thread(void *arg)
+{
+    static uint8_t buf[2048];
+    int s = (intptr_t)arg;
+    int one = 1;
+
+    for (;;) {
+        int c = lwip_accept(s, NULL, NULL);
+        int len;
+
+        lwip_setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        while ((len = lwip_read(c, buf, sizeof(buf))) > 0) {
+            if (lwip_write(c, buf, len) != len) {
+                break;
+            }
+        }
+        lwip_close(c);
+    }
+    return NULL;
+}
+
+static int mcast_socket(void)
+{
+    struct in_addr iface;
+    u8_t ttl = 1, loop = 0;
+    int s = lwip_socket(AF_INET, SOCK_DGRAM, 0);
+
+    iface.s_addr = inet_addr(LWIP_HOST_PEER_ADDR);
+    lwip_setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    lwip_setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    lwip_setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    return s;
+}
+
+static void *mcast_send_thread(void *arg)
+{
+    static uint8_t buf[1472];
+    mcast_send_t send = *(mcast_send_t *)arg;
+    struct sockaddr_in sa;
+    struct timespec next;
+    int s = mcast_socket();
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(BENCH_MCAST_PORT);
+    sa.sin_addr.s_addr = inet_addr(BENCH_MCAST_TO_LWIP);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (unsigned i = 0; i < send.count; i++) {
+        memcpy(buf, &i, sizeof(i));
+        lwip_sendto(s, buf, send.size, 0, (struct sockaddr *)&sa, sizeof(sa));
+        next.tv_nsec += 1000000000 / send.rate;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    lwip_close(s);
+    return NULL;
+}
+
+static void *mcast_listen_thread(void *arg)
+{
+    static uint8_t buf[2048];
+    int s = (intptr_t)arg;
+
+    while (listen_run) {
+        if (lwip_recv(s, buf, sizeof(buf), 0) > 0) {
+            listen_count++;
+        }
+    }
+    lwip_close(s);
+    return NULL;
+}
+
+static int mcast_listen_socket(void)
+{
+    struct sockaddr_in sa;
+    struct ip_mreq mreq;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    int s = mcast_socket();
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(BENCH_MCAST_PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    mreq.imr_multiaddr.s_addr = inet_addr(BENCH_MCAST_TO_PEER);
+    mreq.imr_interface.s_addr = inet_addr(LWIP_HOST_PEER_ADDR);
+    lwip_setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (lwip_bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        lwip_setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        printf("peer: multicast listen failed\n");
+        lwip_close(s);
+        return -1;
+    }
+    return s;
+}
+
+/* Runs in the peer process, starting and stopping the multicast threads
+ * as the bench asks */
+static void control(void)
+{
+    static mcast_send_t send;
+    pthread_t thread, listener;
+
+    pthread_mutex_lock(&shared->lock);
+    for (;;) {
+        if (shared->mcast_started != shared->mcast_sends) {
+            shared->mcast_started = shared->mcast_sends;
+            send = shared->mcast_send;
+            pthread_create(&thread, NULL, mcast_send_thread, &send);
+            pthread_detach(thread);
+        } else if (shared->listen && !shared->listening) {
+            int s = mcast_listen_socket();
+
+            shared->listening = -1;
+            if (s >= 0) {
+                listen_count = 0;
+                listen_run = true;
+                pthread_create(&listener, NULL, mcast_listen_thread, (void *)(intptr_t)s);
+                shared->listening = 1;
+            }
+            pthread_cond_broadcast(&shared->changed);
+        } else if (!shared->listen && shared->listening) {
+            if (shared->listening > 0) {
+                listen_run = false;
+                pthread_mutex_unlock(&shared->lock);
+                pthread_join(listener, NULL);
+                pthread_mutex_lock(&shared->lock);
+                shared->listen_count = listen_count;
+            }
+            shared->listening = 0;
+            pthread_cond_broadcast(&shared->changed);
+        } else {
+            pthread_cond_wait(&shared->changed, &shared->lock);
+        }
+    }
+}
+
+/* Runs in the peer process, and does not return */
+static void peer_run(void)
+{
+    static const struct {
+        uint16_t port;
+        void *(*thread)(void *);
+    } servers[] = {
+        { BENCH_SINK_PORT, sink_thread },
+        { BENCH_SOURCE_PORT, source_thread },
+        { BENCH_ECHO_PORT, echo_thread },
+    };
+    int ready = 1;
+
+    lwip_host_start(true);
+    for (int i = 0; i < sizeof(servers) / sizeof(servers[0]); i++) {
+        pthread_t thread;
+        int s = listen_on(servers[i].port);
+        if (s < 0) {
+            ready = -1;
+            break;
+        }
+        pthread_create(&thread, NULL, servers[i].thread, (void *)(intptr_t)s);
+        pthread_detach(thread);
+    }
+
+    pthread_mutex_lock(&shared->lock);
+    shared->ready = ready;
+    pthread_cond_broadcast(&shared->changed);
+    pthread_mutex_unlock(&shared->lock);
+    if (ready < 0) {
+        exit(1);
+    }
+    control();
+}
+
+bool bench_loop_init(const char *pcap_path)
+{
+    pthread_mutexattr_t lock_attr;
+    pthread_condattr_t cond_attr;
+    int pid;
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                  -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("loop: mmap");
+        return false;
+    }
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_setpshared(&lock_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shared->changed, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    pid = tap_if_fork(pcap_path);
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        peer_run();
+    }
+    lwip_host_start(false);
+    return true;
+}
+
+static bool loop_start(void)
+{
+    struct timespec end = deadline(READY_TIMEOUT_MS);
+
+    pthread_mutex_lock(&shared->lock);
+    while (!shared->ready &&
+           pthread_cond_timedwait(&shared->changed, &shared->lock, &end) != ETIMEDOUT) {
+    }
+    bool ready = shared->ready > 0;
+    pthread_mutex_unlock(&shared->lock);
+
+    if (!ready) {
+        printf("loop: peer did not start\n");
+    }
+    return ready;
+}
+
+static uint64_t loop_sink_wait(unsigned timeout_ms)
+{
+    struct timespec end = deadline(timeout_ms);
+    uint64_t bytes = 0;
+
+    pthread_mutex_lock(&shared->lock);
+    while (shared->sink_connections == sink_waited &&
+           pthread_cond_timedwait(&shared->changed, &shared->lock, &end) != ETIMEDOUT) {
+    }
+    if (shared->sink_connections != sink_waited) {
+        bytes = shared->sink_bytes;
+        sink_waited = shared->sink_connections;
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return bytes;
+}
+
+static void loop_source_set(uint64_t bytes)
+{
+    pthread_mutex_lock(&shared->lock);
+    shared->source_bytes = bytes;
+    pthread_mutex_unlock(&shared->lock);
+}
+
+static void loop_mcast_send_start(unsigned count, size_t size, unsigned rate)
+{
+    pthread_mutex_lock(&shared->lock);
+    shared->mcast_send = (mcast_send_t){ count, size < sizeof(unsigned) ? sizeof(unsigned) : size,
+                                         rate };
+    shared->mcast_sends++;
+    pthread_cond_broadcast(&shared->changed);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+static bool loop_mcast_listen_start(void)
+{
+    pthread_mutex_lock(&shared->lock);
+    shared->listen = true;
+    pthread_cond_broadcast(&shared->changed);
+    while (!shared->listening) {
+        pthread_cond_wait(&shared->changed, &shared->lock);
+    }
+    bool listening = shared->listening > 0;
+    if (!listening) {
+        shared->listen = false;
+        pthread_cond_broadcast(&shared->changed);
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return listening;
+}
+
+static unsigned loop_mcast_listen_stop(void)
+{
+    pthread_mutex_lock(&shared->lock);
+    shared->listen = false;
+    pthread_cond_broadcast(&shared->changed);
+    while (shared->listening) {
+        pthread_cond_wait(&shared->changed, &shared->lock);
+    }
+    unsigned count = shared->listen_count;
+    pthread_mutex_unlock(&shared->lock);
+
+    return count;
+}
+
+const bench_peer_t bench_peer_loop = {
+    .start = loop_start,
+    .sink_wait = loop_sink_wait,
+    .source_set = loop_source_set,
+    .mcast_send_start = loop_mcast_send_start,
+    .mcast_listen_start = loop_mcast_listen_start,
+    .mcast_listen_stop = loop_mcast_listen_stop,
+};
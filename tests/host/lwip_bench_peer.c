@@ -0,0 +1,277 @@
+/* Linux end of lwip_bench, on ordinary sockets on the host side of the TAP
+ * interface
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwip_host.h"
+#include "lwip_bench.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sink_closed = PTHREAD_COND_INITIALIZER;
+static uint64_t sink_bytes;
+static unsigned sink_connections, sink_waited;
+static uint64_t source_bytes;
+
+static int listen_on(uint16_t port)
+{
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port) };
+    int one = 1;
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+
+    inet_pton(AF_INET, LWIP_HOST_PEER_ADDR, &sa.sin_addr);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(s, 1) < 0) {
+        perror("peer: listen");
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+static void *sink_thread(void *arg)
+{
+    static uint8_t buf[65536];
+    int s = (intptr_t)arg;
+
+    for (;;) {
+        int c = accept(s, NULL, NULL);
+        uint64_t bytes = 0;
+        ssize_t len;
+
+        while ((len = read(c, buf, sizeof(buf))) > 0) {
+            bytes += len;
+        }
+        close(c);
+        pthread_mutex_lock(&lock);
+        sink_bytes = bytes;
+        sink_connections++;
+        pthread_cond_broadcast(&sink_closed);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void *source_thread(void *arg)
+{
+    static uint8_t buf[8192];
+    int s = (intptr_t)arg;
+
+    for (;;) {
+        int c = accept(s, NULL, NULL);
+        pthread_mutex_lock(&lock);
+        uint64_t remaining = source_bytes;
+        pthread_mutex_unlock(&lock);
+
+        while (remaining) {
+            size_t n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+            ssize_t len = write(c, buf, n);
+            if (len <= 0) {
+                break;
+            }
+            remaining -= len;
+        }
+        close(c);
+    }
+    return NULL;
+}
+
+static void *echo_thread(void *arg)
+{
+    static uint8_t buf[2048];
+    int s = (intptr_t)arg;
+    int one = 1;
+
+    for (;;) {
+        int c = accept(s, NULL, NULL);
+        ssize_t len;
+
+        setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        while ((len = read(c, buf, sizeof(buf))) > 0) {
+            if (write(c, buf, len) != len) {
+                break;
+            }
+        }
+        close(c);
+    }
+    return NULL;
+}
+
+static bool peer_start(void)
+{
+    static const struct {
+        uint16_t port;
+        void *(*thread)(void *);
+    } servers[] = {
+        { BENCH_SINK_PORT, sink_thread },
+        { BENCH_SOURCE_PORT, source_thread },
+        { BENCH_ECHO_PORT, echo_thread },
+    };
+
+    for (int i = 0; i < sizeof(servers) / sizeof(servers[0]); i++) {
+        pthread_t thread;
+        int s = listen_on(servers[i].port);
+        if (s < 0) {
+            return false;
+        }
+        pthread_create(&thread, NULL, servers[i].thread, (void *)(intptr_t)s);
+        pthread_detach(thread);
+    }
+    return true;
+}
+
+static uint64_t peer_sink_wait(unsigned timeout_ms)
+{
+    struct timespec end;
+    uint64_t bytes = 0;
+
+    clock_gettime(CLOCK_REALTIME, &end);
+    end.tv_sec += timeout_ms / 1000;
+    end.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (end.tv_nsec >= 1000000000) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (sink_connections == sink_waited &&
+           pthread_cond_timedwait(&sink_closed, &lock, &end) != ETIMEDOUT) {
+    }
+    if (sink_connections != sink_waited) {
+        bytes = sink_bytes;
+        sink_waited = sink_connections;
+    }
+    pthread_mutex_unlock(&lock);
+
+    return bytes;
+}
+
+static void peer_source_set(uint64_t bytes)
+{
+    pthread_mutex_lock(&lock);
+    source_bytes = bytes;
+    pthread_mutex_unlock(&lock);
+}
+
+static int mcast_socket(void)
+{
+    struct in_addr iface;
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    unsigned char ttl = 1, loop = 0;
+
+    inet_pton(AF_INET, LWIP_HOST_PEER_ADDR, &iface);
+    setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface));
+    setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    return s;
+}
+
+typedef struct {
+    unsigned count;
+    size_t size;
+    unsigned rate;
+} mcast_send_t;
+
+static void *mcast_send_thread(void *arg)
+{
+    static uint8_t buf[1472];
+    mcast_send_t send = *(mcast_send_t *)arg;
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(BENCH_MCAST_PORT) };
+    struct timespec next;
+    int s = mcast_socket();
+
+    inet_pton(AF_INET, BENCH_MCAST_TO_LWIP, &sa.sin_addr);
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (unsigned i = 0; i < send.count; i++) {
+        memcpy(buf, &i, sizeof(i));
+        sendto(s, buf, send.size, 0, (struct sockaddr *)&sa, sizeof(sa));
+        next.tv_nsec += 1000000000 / send.rate;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    close(s);
+    return NULL;
+}
+
+static void peer_mcast_send_start(unsigned count, size_t size, unsigned rate)
+{
+    static mcast_send_t send;
+    pthread_t thread;
+
+    send = (mcast_send_t){ count, size < sizeof(unsigned) ? sizeof(unsigned) : size, rate };
+    pthread_create(&thread, NULL, mcast_send_thread, &send);
+    pthread_detach(thread);
+}
+
+static pthread_t listen_thread;
+static volatile bool listening;
+static volatile unsigned listen_count;
+
+static void *mcast_listen_thread(void *arg)
+{
+    static uint8_t buf[2048];
+    int s = (intptr_t)arg;
+
+    while (listening) {
+        if (recv(s, buf, sizeof(buf), 0) > 0) {
+            listen_count++;
+        }
+    }
+    close(s);
+    return NULL;
+}
+
+static bool peer_mcast_listen_start(void)
+{
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(BENCH_MCAST_PORT),
+                              .sin_addr.s_addr = htonl(INADDR_ANY) };
+    struct ip_mreq mreq;
+    struct timeval timeout = { .tv_usec = 100000 };
+    int one = 1;
+    int s = mcast_socket();
+
+    inet_pton(AF_INET, BENCH_MCAST_TO_PEER, &mreq.imr_multiaddr);
+    inet_pton(AF_INET, LWIP_HOST_PEER_ADDR, &mreq.imr_interface);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        perror("peer: multicast listen");
+        close(s);
+        return false;
+    }
+    listen_count = 0;
+    listening = true;
+    pthread_create(&listen_thread, NULL, mcast_listen_thread, (void *)(intptr_t)s);
+    return true;
+}
+
+static unsigned peer_mcast_listen_stop(void)
+{
+    listening = false;
+    pthread_join(listen_thread, NULL);
+    return listen_count;
+}
+
+const bench_peer_t bench_peer_linux = {
+    .start = peer_start,
+    .sink_wait = peer_sink_wait,
+    .source_set = peer_source_set,
+    .mcast_send_start = peer_mcast_send_start,
+    .mcast_listen_start = peer_mcast_listen_start,
+    .mcast_listen_stop = peer_mcast_listen_stop,
+};
@@ -0,0 +1,195 @@
+/* Host harness running the esp-open-rtos lwip configuration and port on
+ * Linux
+ *
+ * The lwip submodule, lwipopts.h, sys_arch.c and esp_interface.c are built
+ * unmodified against the threaded RTOS stand-ins (rtos_threads.c built with
+ * HOST_THREADS). This file plays the parts of the SDK that esp_interface.c
+ * talks to, on a TAP interface or on a socketpair to a second process
+ * running the same (see tap_if.h):
+ *
+ * - Received frames are copied into buffers from a small rx pool, as the
+ *   wifi driver's, and passed to ethernetif_input() in a pbuf referencing
+ *   the buffer. Frames that arrive while the pool is empty are dropped.
+ *   sdk_system_pp_recycle_rx_pkt() returns buffers to the pool.
+ *
+ * - sdk_ieee80211_output_pbuf() takes a reference to the frame and queues it
+ *   for a driver task, which writes it to the TAP and frees it, so frames
+ *   stay referenced after low_level_output() returns as on the device.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+#include "lwip/tcpip.h"
+#include "lwip/ip4_addr.h"
+#include "netif/ethernet.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "esp_tcp_tune.h"
+#include "lwip_host.h"
+#include "tap_if.h"
+
+/* About the size of the wifi driver's rx buffer pool */
+#ifndef LWIP_HOST_RX_POOL
+#define LWIP_HOST_RX_POOL 8
+#endif
+
+#define LWIP_HOST_TX_QUEUE 16
+#define FRAME_SIZE 1536
+
+/* Free heap reported to esp_interface.c, which holds back from copying rx
+ * frames when the heap is low. About what an application has with the wifi
+ * station up. */
+#ifndef LWIP_HOST_FREE_HEAP
+#define LWIP_HOST_FREE_HEAP 40000
+#endif
+
+/* Declared in sdk_internal.h */
+err_t ethernetif_init(struct netif *netif);
+void ethernetif_input(struct netif *netif, struct pbuf *p);
+struct pbuf *sdk_pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+
+struct esf_buf {
+    struct esf_buf *next;
+    uint8_t data[FRAME_SIZE];
+};
+
+unsigned host_critical_nesting;
+volatile unsigned lwip_host_rx_dropped;
+volatile unsigned lwip_host_tx_dropped;
+
+static struct netif sta_netif;
+static struct esf_buf rx_pool[LWIP_HOST_RX_POOL];
+static struct esf_buf *rx_free;
+static QueueHandle_t tx_queue;
+
+static const uint8_t sta_hwaddr[ETH_HWADDR_LEN] = { 0x02, 0x00, 0x00, 0xe5, 0x82, 0x66 };
+static const uint8_t peer_hwaddr[ETH_HWADDR_LEN] = { 0x02, 0x00, 0x00, 0xe5, 0x82, 0x67 };
+
+uint32_t hwrand(void)
+{
+    return random();
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+    return LWIP_HOST_FREE_HEAP;
+}
+
+void sdk_system_station_got_ip_set(struct ip4_addr *ip, struct ip4_addr *mask, struct ip4_addr *gw)
+{
+}
+
+void sdk_system_pp_recycle_rx_pkt(struct esf_buf *esf)
+{
+    taskENTER_CRITICAL();
+    esf->next = rx_free;
+    rx_free = esf;
+    taskEXIT_CRITICAL();
+}
+
+int8_t sdk_ieee80211_output_pbuf(struct netif *netif, struct pbuf *p)
+{
+    pbuf_ref(p);
+    if (xQueueSendToBack(tx_queue, &p, 0) != pdTRUE) {
+        lwip_host_tx_dropped++;
+        pbuf_free(p);
+    }
+    return 0;
+}
+
+static void rx_task(void *arg)
+{
+    static uint8_t frame[FRAME_SIZE];
+
+    for (;;) {
+        int len = tap_if_read(frame, sizeof(frame));
+        if (len <= 0) {
+            continue;
+        }
+
+        taskENTER_CRITICAL();
+        struct esf_buf *esf = rx_free;
+        if (esf) {
+            rx_free = esf->next;
+        }
+        taskEXIT_CRITICAL();
+        if (!esf) {
+            lwip_host_rx_dropped++;
+            continue;
+        }
+
+        memcpy(esf->data, frame, len);
+        struct pbuf *p = sdk_pbuf_alloc(3, len, 2);
+        if (!p) {
+            sdk_system_pp_recycle_rx_pkt(esf);
+            lwip_host_rx_dropped++;
+            continue;
+        }
+        p->payload = esf->data;
+        p->esf_buf = esf;
+        ethernetif_input(&sta_netif, p);
+    }
+}
+
+static void tx_task(void *arg)
+{
+    static uint8_t frame[FRAME_SIZE];
+    struct pbuf *p;
+
+    for (;;) {
+        if (xQueueReceive(tx_queue, &p, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        u16_t len = pbuf_copy_partial(p, frame, sizeof(frame), 0);
+        tap_if_write(frame, len);
+        pbuf_free(p);
+    }
+}
+
+bool lwip_host_init(const char *pcap_path)
+{
+    if (!tap_if_open(LWIP_HOST_TAP, LWIP_HOST_PEER_ADDR, LWIP_HOST_NETMASK, pcap_path)) {
+        return false;
+    }
+    lwip_host_start(false);
+    return true;
+}
+
+void lwip_host_start(bool peer)
+{
+    ip4_addr_t addr, netmask, gw;
+
+    for (int i = 0; i < LWIP_HOST_RX_POOL; i++) {
+        sdk_system_pp_recycle_rx_pkt(&rx_pool[i]);
+    }
+    tx_queue = xQueueCreate(LWIP_HOST_TX_QUEUE, sizeof(struct pbuf *));
+    xTaskCreate(rx_task, "rx", 0, NULL, 0, NULL);
+    xTaskCreate(tx_task, "tx", 0, NULL, 0, NULL);
+
+#if ESP_LWIP_MBOX_RING
+    sys_mbox_ring_next();
+#endif
+#if ESP_TCP_TUNE
+    tcpip_init(esp_tcp_tune_start, NULL);
+#else
+    tcpip_init(NULL, NULL);
+#endif
+
+    ip4addr_aton(peer ? LWIP_HOST_PEER_ADDR : LWIP_HOST_ADDR, &addr);
+    ip4addr_aton(LWIP_HOST_NETMASK, &netmask);
+    ip4addr_aton(peer ? LWIP_HOST_ADDR : LWIP_HOST_PEER_ADDR, &gw);
+
+    LOCK_TCPIP_CORE();
+    netif_add(&sta_netif, &addr, &netmask, &gw, NULL, ethernetif_init, tcpip_input);
+    memcpy(sta_netif.hwaddr, peer ? peer_hwaddr : sta_hwaddr, ETH_HWADDR_LEN);
+    netif_set_default(&sta_netif);
+    netif_set_up(&sta_netif);
+    UNLOCK_TCPIP_CORE();
+}
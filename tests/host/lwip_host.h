@@ -0,0 +1,33 @@
+/* Host harness running the esp-open-rtos lwip configuration and port
+ * (lwipopts.h, sys_arch.c, esp_interface.c) on Linux, with a TAP interface
+ * or a socketpair in place of the wifi driver (see lwip_host.c)
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _LWIP_HOST_H
+#define _LWIP_HOST_H
+
+#include <stdbool.h>
+
+#define LWIP_HOST_TAP       "esptap0"
+#define LWIP_HOST_NETMASK   "255.255.255.0"
+#define LWIP_HOST_PEER_ADDR "192.168.77.1"   /* Linux end of the TAP, or the peer process */
+#define LWIP_HOST_ADDR      "192.168.77.2"   /* lwip netif */
+
+/* Frames the simulated driver could not pass to lwip as its rx pool was
+ * empty, and frames it could not queue for sending. */
+extern volatile unsigned lwip_host_rx_dropped;
+extern volatile unsigned lwip_host_tx_dropped;
+
+/* Open the TAP interface, start tcpip_thread and add the netif as the
+ * station interface. Frames are also captured to 'pcap_path' if it is not
+ * NULL. */
+bool lwip_host_init(const char *pcap_path);
+
+/* Start tcpip_thread and add the netif as the station interface, on a link
+ * already opened with tap_if_fork(). With 'peer' the netif takes
+ * LWIP_HOST_PEER_ADDR, for the process on the other end. */
+void lwip_host_start(bool peer);
+
+#endif /* _LWIP_HOST_H */
@@ -0,0 +1,167 @@
+/* Benchmark for the tcpip thread mailbox: the lock-free ring in
+ * lwip/mbox_ring.c against a queue used as sys_arch.c uses a FreeRTOS queue.
+ *
+ * Producer threads post as tcpip_input() does, with a non-blocking post
+ * retried when the mailbox is full, and the consumer blocks in fetch as the
+ * tcpip thread does. Reports messages per second and the latency from post
+ * to fetch.
+ *
+ * On the host the queue is a mutex and condition variables (rtos_threads.c),
+ * and the ring uses real atomics, so the figures compare the designs rather
+ * than predicting the ESP8266 numbers.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "queue.h"
+#include "arch/mbox_ring.h"
+
+#define MBOX_SIZE 16    /* TCPIP_MBOX_SIZE */
+#define MSGS 200000
+
+typedef struct {
+    const char *name;
+    void *(*create)(void);
+    bool (*trypost)(void *mbox, void *msg);
+    void (*fetch)(void *mbox, void **msg);
+    void (*free)(void *mbox);
+} mbox_impl_t;
+
+static void *queue_create(void)
+{
+    return xQueueCreate(MBOX_SIZE, sizeof(void *));
+}
+
+static bool queue_trypost(void *mbox, void *msg)
+{
+    return xQueueSendToBack(mbox, &msg, 0) == pdTRUE;
+}
+
+static void queue_fetch(void *mbox, void **msg)
+{
+    while (xQueueReceive(mbox, msg, portMAX_DELAY) != pdTRUE);
+}
+
+static void queue_free(void *mbox)
+{
+    vQueueDelete(mbox);
+}
+
+static void *ring_create(void)
+{
+    return mbox_ring_new(MBOX_SIZE);
+}
+
+static bool ring_trypost(void *mbox, void *msg)
+{
+    return mbox_ring_trypost(mbox, msg);
+}
+
+static void ring_fetch(void *mbox, void **msg)
+{
+    mbox_ring_fetch(mbox, msg, portMAX_DELAY);
+}
+
+static void ring_free(void *mbox)
+{
+    mbox_ring_free(mbox);
+}
+
+static const mbox_impl_t impls[] = {
+    { "queue", queue_create, queue_trypost, queue_fetch, queue_free },
+    { "ring", ring_create, ring_trypost, ring_fetch, ring_free },
+};
+
+static uint64_t post_ns[MSGS];
+static uint32_t latency_ns[MSGS];
+
+typedef struct {
+    const mbox_impl_t *impl;
+    void *mbox;
+    uint32_t first, count;
+    uint32_t full;
+} producer_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *producer(void *arg)
+{
+    producer_t *p = arg;
+
+    for (uint32_t i = p->first; i < p->first + p->count; i++) {
+        post_ns[i] = now_ns();
+        while (!p->impl->trypost(p->mbox, (void *)(uintptr_t)i)) {
+            p->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run(const mbox_impl_t *impl, int nproducers)
+{
+    producer_t producers[nproducers];
+    pthread_t threads[nproducers];
+    void *mbox = impl->create();
+    uint32_t full = 0;
+    uint64_t total_latency = 0;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < nproducers; i++) {
+        producers[i] = (producer_t){ impl, mbox, i * (MSGS / nproducers), MSGS / nproducers, 0 };
+        pthread_create(&threads[i], NULL, producer, &producers[i]);
+    }
+    for (uint32_t n = 0; n < MSGS / nproducers * nproducers; n++) {
+        void *msg;
+        impl->fetch(mbox, &msg);
+        uintptr_t i = (uintptr_t)msg;
+        latency_ns[n] = now_ns() - post_ns[i];
+        total_latency += latency_ns[n];
+    }
+    uint64_t elapsed = now_ns() - start;
+    for (int i = 0; i < nproducers; i++) {
+        pthread_join(threads[i], NULL);
+        full += producers[i].full;
+    }
+    impl->free(mbox);
+
+    uint32_t n = MSGS / nproducers * nproducers;
+    qsort(latency_ns, n, sizeof(latency_ns[0]), compare_u32);
+    printf("%-6s %9d %12.0f %9.2f %9.2f %9.2f %9u\n", impl->name, nproducers,
+           n * 1e9 / elapsed, total_latency / 1e3 / n, latency_ns[n * 99 / 100] / 1e3,
+           latency_ns[n - 1] / 1e3, full);
+}
+
+int main(void)
+{
+    static const int producer_counts[] = { 1, 2, 4 };
+
+    printf("%d messages through a %d entry mailbox\n", MSGS, MBOX_SIZE);
+    printf("%-6s %9s %12s %9s %9s %9s %9s\n", "mbox", "producers", "msgs/s",
+           "avg us", "p99 us", "max us", "full");
+    for (int p = 0; p < sizeof(producer_counts) / sizeof(producer_counts[0]); p++) {
+        for (int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            run(&impls[i], producer_counts[p]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+/* Forced into lwip/mbox_ring.c for the host build, replacing the single core
+ * ESP8266 compare-and-set and barrier with real atomics so that the ring can
+ * be exercised from several threads.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#define MBOX_RING_CAS(p, expected, desired) __sync_bool_compare_and_swap(p, expected, desired)
+#define MBOX_RING_BARRIER() __sync_synchronize()
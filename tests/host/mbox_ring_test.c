@@ -0,0 +1,182 @@
+/* Host-side tests for the lock-free tcpip mailbox ring in lwip/mbox_ring.c,
+ * including a stress test with producers on several threads
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "arch/mbox_ring.h"
+#include "host_test.h"
+
+#define MSG(producer, seq) ((void *)(uintptr_t)(((producer) << 24) | (seq)))
+#define MSG_PRODUCER(msg) ((uintptr_t)(msg) >> 24)
+#define MSG_SEQ(msg) ((uintptr_t)(msg) & 0xffffff)
+
+HOST_TEST(test_order_and_full)
+{
+    mbox_ring_t *ring = mbox_ring_new(5);
+    void *msg;
+
+    CHECK(ring);
+    CHECK_EQ(7, ring->mask);
+    CHECK(!mbox_ring_tryfetch(ring, &msg));
+
+    // Several laps of the ring, filling it each time
+    for (int lap = 0; lap < 4; lap++) {
+        for (int i = 0; i < 8; i++) {
+            CHECK(mbox_ring_trypost(ring, MSG(lap, i)));
+        }
+        CHECK(!mbox_ring_trypost(ring, MSG(lap, 8)));
+        CHECK_EQ(8, mbox_ring_count(ring));
+        for (int i = 0; i < 8; i++) {
+            CHECK(mbox_ring_tryfetch(ring, &msg));
+            CHECK(msg == MSG(lap, i));
+        }
+        CHECK(!mbox_ring_tryfetch(ring, &msg));
+        CHECK_EQ(0, mbox_ring_count(ring));
+    }
+
+    // Interleaved, so the positions wrap part way through the slots
+    for (int i = 0; i < 100; i++) {
+        CHECK(mbox_ring_trypost(ring, MSG(1, i)));
+        CHECK(mbox_ring_trypost(ring, MSG(2, i)));
+        CHECK(mbox_ring_tryfetch(ring, &msg));
+        CHECK(msg == MSG(1, i));
+        CHECK(mbox_ring_tryfetch(ring, &msg));
+        CHECK(msg == MSG(2, i));
+    }
+
+    mbox_ring_free(ring);
+}
+
+HOST_TEST(test_fetch_timeout)
+{
+    mbox_ring_t *ring = mbox_ring_new(4);
+    void *msg = MSG(1, 1);
+
+    TickType_t start = xTaskGetTickCount();
+    CHECK(!mbox_ring_fetch(ring, &msg, 2));
+    CHECK(xTaskGetTickCount() - start >= 2);
+    CHECK(ring->consumer == xTaskGetCurrentTaskHandle());
+    CHECK_EQ(0, ring->waiting);
+
+    CHECK(mbox_ring_trypost(ring, MSG(1, 2)));
+    CHECK(mbox_ring_fetch(ring, &msg, 0));
+    CHECK(msg == MSG(1, 2));
+
+    mbox_ring_free(ring);
+}
+
+/* Only a consumer that is blocked, or about to block, is notified */
+HOST_TEST(test_wakeup)
+{
+    mbox_ring_t *ring = mbox_ring_new(4);
+    BaseType_t woken = pdFALSE;
+    void *msg;
+
+    ring->consumer = xTaskGetCurrentTaskHandle();
+    CHECK(mbox_ring_trypost_fromisr(ring, MSG(1, 1), &woken));
+    CHECK(!woken);
+    CHECK_EQ(0, ulTaskNotifyTake(pdTRUE, 0));
+
+    ring->waiting = 1;
+    CHECK(mbox_ring_trypost_fromisr(ring, MSG(1, 2), &woken));
+    CHECK(woken);
+    CHECK_EQ(1, ulTaskNotifyTake(pdTRUE, 0));
+    ring->waiting = 0;
+
+    CHECK(mbox_ring_tryfetch(ring, &msg));
+    CHECK(msg == MSG(1, 1));
+    CHECK(mbox_ring_tryfetch(ring, &msg));
+    CHECK(msg == MSG(1, 2));
+
+    mbox_ring_free(ring);
+}
+
+#define STRESS_PRODUCERS 4
+#define STRESS_MSGS 50000
+#define STRESS_POST_MSGS 500
+
+typedef struct {
+    mbox_ring_t *ring;
+    uintptr_t id;
+    uint32_t count;
+    uint32_t full;
+} producer_t;
+
+/* Posts as the wifi driver does, as tcpip_input() uses trypost */
+static void *trypost_producer(void *arg)
+{
+    producer_t *p = arg;
+
+    for (uint32_t i = 0; i < p->count; i++) {
+        bool isr = i & 1;
+        BaseType_t woken;
+        while (!(isr ? mbox_ring_trypost_fromisr(p->ring, MSG(p->id, i), &woken)
+                     : mbox_ring_trypost(p->ring, MSG(p->id, i)))) {
+            p->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *post_producer(void *arg)
+{
+    producer_t *p = arg;
+
+    for (uint32_t i = 0; i < p->count; i++) {
+        mbox_ring_post(p->ring, MSG(p->id, i));
+    }
+    return NULL;
+}
+
+HOST_TEST(test_stress)
+{
+    producer_t producers[STRESS_PRODUCERS + 1];
+    pthread_t threads[STRESS_PRODUCERS + 1];
+    uint32_t next[STRESS_PRODUCERS + 1] = { 0 };
+    uint32_t total = 0, expected = 0, full = 0;
+    mbox_ring_t *ring = mbox_ring_new(16);
+
+    for (int i = 0; i <= STRESS_PRODUCERS; i++) {
+        producers[i] = (producer_t){ ring, i, i < STRESS_PRODUCERS ? STRESS_MSGS : STRESS_POST_MSGS };
+        expected += producers[i].count;
+        CHECK_EQ(0, pthread_create(&threads[i], NULL,
+                                   i < STRESS_PRODUCERS ? trypost_producer : post_producer,
+                                   &producers[i]));
+    }
+
+    // Every message arrives exactly once, in order from each producer
+    while (total < expected) {
+        void *msg;
+        CHECK(mbox_ring_fetch(ring, &msg, 1000 / portTICK_PERIOD_MS));
+        uintptr_t id = MSG_PRODUCER(msg);
+        CHECK(id <= STRESS_PRODUCERS);
+        CHECK_EQ(next[id], MSG_SEQ(msg));
+        next[id]++;
+        total++;
+    }
+
+    for (int i = 0; i <= STRESS_PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        full += producers[i].full;
+    }
+    CHECK_EQ(0, mbox_ring_count(ring));
+    printf("  %u messages from %d threads, ring full %u times\n", total,
+           STRESS_PRODUCERS + 1, full);
+
+    mbox_ring_free(ring);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_order_and_full),
+    HOST_TEST_ENTRY(test_fetch_timeout),
+    HOST_TEST_ENTRY(test_wakeup),
+    HOST_TEST_ENTRY(test_stress),
+};
+
+HOST_TEST_MAIN("mbox_ring", tests)
@@ -0,0 +1,347 @@
+/* Heap fragmentation soak benchmark for the lwip memp pools in
+ * lwip/esp_mempool.c
+ *
+ * Runs a long, randomised but repeatable mix of the allocations lwip makes
+ * while receiving and sending TCP data - pbuf headers, copied frames,
+ * tcp_segs, netbufs, outgoing PBUF_RAM frames, the odd tcp_pcb - interleaved
+ * with longer lived application allocations, against a simulated 80 KiB
+ * heap. Each run reports the allocation rate, failed allocations, and how
+ * broken up the free space got, first with every allocation on the heap
+ * (MEMP_MEM_MALLOC as it was) and then with the hot element sizes served
+ * from pools, whose storage is taken out of the heap.
+ *
+ * The heap is a first fit allocator with boundary tags, not newlib's, and
+ * element sizes are approximate for the ESP8266, so the figures compare the
+ * two setups rather than predict the device.
+ *
+ * Pass the number of steps as the only argument (default 2000000).
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "esp_mempool.h"
+
+unsigned host_critical_nesting;
+
+#define HEAP_SIZE (80 * 1024)
+
+/* Approximate memp element sizes on the ESP8266 */
+#define SIZE_TCP_SEG 20
+#define SIZE_PBUF    24
+#define SIZE_TCP_PCB 196
+#define SIZE_NETBUF  16
+
+/* Pool sizes, as the esp_opts.h defaults */
+#define NUM_TCP_SEG 32
+#define NUM_PBUF    16
+#define NUM_TCP_PCB 4
+#define NUM_NETBUF  8
+
+/* Simulated heap: blocks carry their size and a used bit in a header and a
+ * footer word, and free blocks are on a list in address order linked by
+ * offsets, so first fit favours the low end of the heap. */
+
+#define TAG_SIZE   4
+#define MIN_BLOCK  16
+#define NO_BLOCK   0xffffffff
+
+static uint8_t heap[HEAP_SIZE] __attribute__((aligned(8)));
+static uint32_t heap_size;
+static uint32_t free_list;
+
+static uint32_t *tag(uint32_t off) { return (uint32_t *)(heap + off); }
+static uint32_t block_size(uint32_t off) { return *tag(off) & ~1u; }
+static int block_used(uint32_t off) { return *tag(off) & 1; }
+static uint32_t *next_free(uint32_t off) { return tag(off + 4); }
+static uint32_t *prev_free(uint32_t off) { return tag(off + 8); }
+
+static void set_block(uint32_t off, uint32_t size, int used)
+{
+    *tag(off) = size | used;
+    *tag(off + size - TAG_SIZE) = size | used;
+}
+
+static void push_free(uint32_t off)
+{
+    uint32_t prev = NO_BLOCK, next = free_list;
+
+    while (next != NO_BLOCK && next < off) {
+        prev = next;
+        next = *next_free(next);
+    }
+    *next_free(off) = next;
+    *prev_free(off) = prev;
+    if (prev != NO_BLOCK) {
+        *next_free(prev) = off;
+    } else {
+        free_list = off;
+    }
+    if (next != NO_BLOCK) {
+        *prev_free(next) = off;
+    }
+}
+
+static void unlink_free(uint32_t off)
+{
+    uint32_t next = *next_free(off), prev = *prev_free(off);
+
+    if (prev != NO_BLOCK) {
+        *next_free(prev) = next;
+    } else {
+        free_list = next;
+    }
+    if (next != NO_BLOCK) {
+        *prev_free(next) = prev;
+    }
+}
+
+static void heap_init(uint32_t size)
+{
+    heap_size = size & ~7u;
+    free_list = NO_BLOCK;
+    set_block(0, heap_size, 0);
+    push_free(0);
+}
+
+static void *heap_alloc(size_t n)
+{
+    uint32_t need = (n + 2 * TAG_SIZE + 7) & ~7u;
+
+    if (need < MIN_BLOCK) {
+        need = MIN_BLOCK;
+    }
+    for (uint32_t off = free_list; off != NO_BLOCK; off = *next_free(off)) {
+        uint32_t size = block_size(off);
+        if (size < need) {
+            continue;
+        }
+        unlink_free(off);
+        if (size - need >= MIN_BLOCK) {
+            set_block(off + need, size - need, 0);
+            push_free(off + need);
+            size = need;
+        }
+        set_block(off, size, 1);
+        return heap + off + TAG_SIZE;
+    }
+    return NULL;
+}
+
+static void heap_free(void *ptr)
+{
+    uint32_t off = (uint8_t *)ptr - heap - TAG_SIZE;
+    uint32_t size = block_size(off);
+    uint32_t next = off + size;
+
+    if (next < heap_size && !block_used(next)) {
+        unlink_free(next);
+        size += block_size(next);
+    }
+    if (off > 0 && !(*tag(off - TAG_SIZE) & 1)) {
+        uint32_t prev = off - (*tag(off - TAG_SIZE) & ~1u);
+        unlink_free(prev);
+        size += off - prev;
+        off = prev;
+    }
+    set_block(off, size, 0);
+    push_free(off);
+}
+
+static void heap_free_space(uint32_t *total, uint32_t *largest)
+{
+    *total = *largest = 0;
+    for (uint32_t off = free_list; off != NO_BLOCK; off = *next_free(off)) {
+        uint32_t size = block_size(off);
+        *total += size;
+        if (size > *largest) {
+            *largest = size;
+        }
+    }
+}
+
+/* Pools, with the heap behind them */
+
+static uint32_t tcp_seg_blocks[NUM_TCP_SEG * SIZE_TCP_SEG / 4];
+static uint32_t pbuf_blocks[NUM_PBUF * SIZE_PBUF / 4];
+static uint32_t tcp_pcb_blocks[NUM_TCP_PCB * SIZE_TCP_PCB / 4];
+static uint32_t netbuf_blocks[NUM_NETBUF * SIZE_NETBUF / 4];
+
+static esp_mempool_t pools[4];
+static size_t npools;
+static uint32_t failures;
+
+static void *mem_alloc(size_t size)
+{
+    void *ptr = esp_mempool_alloc(pools, npools, size);
+
+    if (!ptr) {
+        ptr = heap_alloc(size);
+    }
+    if (!ptr) {
+        failures++;
+    }
+    return ptr;
+}
+
+static void mem_free(void *ptr)
+{
+    if (!esp_mempool_free(pools, npools, ptr)) {
+        heap_free(ptr);
+    }
+}
+
+/* Allocations waiting to be freed, in buckets by the step they are due */
+
+#define HORIZON 65536
+#define MAX_LIVE 8192
+
+typedef struct live {
+    void *ptr;
+    struct live *next;
+} live_t;
+
+static live_t live[MAX_LIVE];
+static live_t *live_free;
+static live_t *due[HORIZON];
+static uint32_t step;
+static uint32_t rng = 12345;
+
+static uint32_t rand_range(uint32_t lo, uint32_t hi)
+{
+    rng = rng * 1103515245 + 12345;
+    return lo + (rng >> 8) % (hi - lo + 1);
+}
+
+static void hold(size_t size, uint32_t lo, uint32_t hi)
+{
+    void *ptr = mem_alloc(size);
+    live_t *l = live_free;
+
+    if (!ptr) {
+        return;
+    }
+    if (!l) {
+        mem_free(ptr);
+        return;
+    }
+    live_free = l->next;
+    l->ptr = ptr;
+    uint32_t when = (step + rand_range(lo, hi)) % HORIZON;
+    l->next = due[when];
+    due[when] = l;
+}
+
+static void expire(uint32_t when)
+{
+    live_t *l = due[when % HORIZON];
+
+    due[when % HORIZON] = NULL;
+    while (l) {
+        live_t *next = l->next;
+        mem_free(l->ptr);
+        l->next = live_free;
+        live_free = l;
+        l = next;
+    }
+}
+
+static void run(const char *name, bool use_pools, uint32_t steps)
+{
+    uint32_t pool_bytes = 0, free_total, largest, min_largest = HEAP_SIZE;
+    uint64_t ops = 0;
+
+    npools = 0;
+    if (use_pools) {
+        pools[npools++] = (esp_mempool_t)ESP_MEMPOOL_INIT("TCP_SEG", SIZE_TCP_SEG, NUM_TCP_SEG, tcp_seg_blocks);
+        pools[npools++] = (esp_mempool_t)ESP_MEMPOOL_INIT("PBUF", SIZE_PBUF, NUM_PBUF, pbuf_blocks);
+        pools[npools++] = (esp_mempool_t)ESP_MEMPOOL_INIT("TCP_PCB", SIZE_TCP_PCB, NUM_TCP_PCB, tcp_pcb_blocks);
+        pools[npools++] = (esp_mempool_t)ESP_MEMPOOL_INIT("NETBUF", SIZE_NETBUF, NUM_NETBUF, netbuf_blocks);
+        pool_bytes = sizeof(tcp_seg_blocks) + sizeof(pbuf_blocks) + sizeof(tcp_pcb_blocks) +
+                     sizeof(netbuf_blocks);
+    }
+    heap_init(HEAP_SIZE - pool_bytes);
+    memset(due, 0, sizeof(due));
+    live_free = NULL;
+    for (int i = 0; i < MAX_LIVE; i++) {
+        live[i].next = live_free;
+        live_free = &live[i];
+    }
+    failures = 0;
+    rng = 12345;
+
+    clock_t start = clock();
+    for (step = 0; step < steps; step++) {
+        expire(step);
+
+        /* A received frame: its pbuf header, or a heap copy of the frame if
+         * the rx pool is short, a tcp_seg until processed, and a netbuf
+         * until the application reads it. */
+        uint32_t len = rand_range(60, 1460);
+        if (rand_range(0, 9) < 3) {
+            hold(SIZE_PBUF + len, 1, 12);
+        } else {
+            hold(SIZE_PBUF, 1, 12);
+        }
+        hold(SIZE_TCP_SEG, 1, 4);
+        hold(SIZE_NETBUF, 1, 12);
+        ops += 3;
+
+        /* Half the time, data sent: a PBUF_RAM frame and its tcp_seg
+         * until acknowledged. */
+        if (rand_range(0, 1)) {
+            uint32_t hold_steps = rand_range(1, 40);
+            hold(SIZE_PBUF + 54 + rand_range(20, 1460), hold_steps, hold_steps);
+            hold(SIZE_TCP_SEG, hold_steps, hold_steps);
+            ops += 2;
+        }
+
+        /* Now and then a connection, and longer lived application data */
+        if (rand_range(0, 1999) == 0) {
+            hold(SIZE_TCP_PCB, 1000, 10000);
+            ops++;
+        }
+        if (rand_range(0, 199) == 0) {
+            hold(rand_range(16, 600), 1000, 20000);
+            ops++;
+        }
+
+        if ((step & 1023) == 0) {
+            heap_free_space(&free_total, &largest);
+            if (largest < min_largest) {
+                min_largest = largest;
+            }
+        }
+    }
+    double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    heap_free_space(&free_total, &largest);
+    uint32_t fallbacks = 0;
+    for (size_t i = 0; i < npools; i++) {
+        fallbacks += pools[i].fallbacks;
+    }
+    printf("%-7s %6u %11.0f %8u %8u %8u %10u %6.1f%% %9u\n", name, heap_size,
+           ops / secs, failures, free_total, largest, min_largest,
+           100.0 * (free_total - largest) / free_total, fallbacks);
+
+    for (uint32_t i = 0; i < HORIZON; i++) {
+        expire(i);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t steps = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000000;
+
+    printf("%u steps, %u byte heap\n", steps, HEAP_SIZE);
+    printf("%-7s %6s %11s %8s %8s %8s %10s %7s %9s\n", "memp", "heap", "allocs/s",
+           "failures", "free", "largest", "min largest", "frag", "fallbacks");
+    run("malloc", false, steps);
+    run("pools", true, steps);
+    return 0;
+}
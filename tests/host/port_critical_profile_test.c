@@ -0,0 +1,160 @@
+/* Host-side tests for the critical section profile in
+ * FreeRTOS/Source/portable/esp8266/port_critical_profile.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "port_critical_profile.h"
+#include "host_test.h"
+
+#define CALLERS PORT_CRITICAL_PROFILE_CALLERS
+
+static port_critical_profile_t profile;
+
+static const port_critical_caller_t *find(uint32_t caller)
+{
+    for (int i = 0; i < CALLERS; i++) {
+        if (profile.callers[i].count && profile.callers[i].caller == caller) {
+            return &profile.callers[i];
+        }
+    }
+    return NULL;
+}
+
+HOST_TEST(test_bucket)
+{
+    CHECK_EQ(0, port_critical_profile_bucket(0));
+    CHECK_EQ(0, port_critical_profile_bucket(1));
+    CHECK_EQ(0, port_critical_profile_bucket((1 << PORT_CRITICAL_PROFILE_SHIFT) - 1));
+    CHECK_EQ(1, port_critical_profile_bucket(1 << PORT_CRITICAL_PROFILE_SHIFT));
+    CHECK_EQ(1, port_critical_profile_bucket((2 << PORT_CRITICAL_PROFILE_SHIFT) - 1));
+    CHECK_EQ(2, port_critical_profile_bucket(2 << PORT_CRITICAL_PROFILE_SHIFT));
+    for (int b = 1; b < PORT_CRITICAL_PROFILE_BUCKETS - 1; b++) {
+        uint32_t low = 1u << (PORT_CRITICAL_PROFILE_SHIFT + b - 1);
+        CHECK_EQ(b, port_critical_profile_bucket(low));
+        CHECK_EQ(b, port_critical_profile_bucket(2 * low - 1));
+    }
+    /* Everything longer goes in the last */
+    uint32_t last = 1u << (PORT_CRITICAL_PROFILE_SHIFT + PORT_CRITICAL_PROFILE_BUCKETS - 2);
+    CHECK_EQ(PORT_CRITICAL_PROFILE_BUCKETS - 1, port_critical_profile_bucket(last));
+    CHECK_EQ(PORT_CRITICAL_PROFILE_BUCKETS - 1, port_critical_profile_bucket(0xffffffffu));
+}
+
+HOST_TEST(test_record)
+{
+    const port_critical_caller_t *a, *b;
+
+    port_critical_profile_reset(&profile);
+    port_critical_profile_record(&profile, 0x40201000, 100);
+    port_critical_profile_record(&profile, 0x40201000, 5000);
+    port_critical_profile_record(&profile, 0x40201000, 300);
+    port_critical_profile_record(&profile, 0x40100abd, 800000);
+
+    a = find(0x40201000);
+    CHECK(a != NULL);
+    CHECK_EQ(3, a->count);
+    CHECK_EQ(5000, a->max_cycles);
+    CHECK_EQ(5400, a->total_cycles);
+    CHECK_EQ(1, a->histogram[port_critical_profile_bucket(100)]);
+    CHECK_EQ(1, a->histogram[port_critical_profile_bucket(300)]);
+    CHECK_EQ(1, a->histogram[port_critical_profile_bucket(5000)]);
+
+    b = find(0x40100abd);
+    CHECK(b != NULL);
+    CHECK_EQ(1, b->count);
+    CHECK_EQ(800000, b->max_cycles);
+    CHECK_EQ(1, b->histogram[port_critical_profile_bucket(800000)]);
+    CHECK_EQ(0, profile.other.count);
+
+    port_critical_profile_reset(&profile);
+    CHECK(find(0x40201000) == NULL);
+    CHECK(find(0x40100abd) == NULL);
+}
+
+HOST_TEST(test_many_callers)
+{
+    uint32_t callers[3 * CALLERS];
+    uint32_t counts[3 * CALLERS] = { 0 };
+    bool seen[3 * CALLERS] = { false };
+    int order[3 * CALLERS];
+    int distinct = 0;
+    uint32_t other = 0;
+
+    srand(1);
+    /* Some only apart in their low bits, as they hash the same */
+    for (int i = 0; i < 3 * CALLERS; i++) {
+        callers[i] = i % 4 == 3 ? callers[i - 1] + 1 : 0x40200000 + (rand() % 0x10000) * 4;
+    }
+    port_critical_profile_reset(&profile);
+    for (int n = 0; n < 10000; n++) {
+        int i = rand() % (3 * CALLERS);
+
+        if (!seen[i]) {
+            seen[i] = true;
+            order[distinct++] = i;
+        }
+        counts[i]++;
+        port_critical_profile_record(&profile, callers[i], rand() % 100000);
+    }
+    CHECK_EQ(3 * CALLERS, distinct);
+
+    /* The first seen have a place each, the rest are counted together */
+    for (int k = 0; k < distinct; k++) {
+        int i = order[k];
+        const port_critical_caller_t *c = find(callers[i]);
+
+        if (k < CALLERS) {
+            CHECK(c != NULL);
+            CHECK_EQ(counts[i], c ? c->count : 0);
+        } else {
+            CHECK(c == NULL);
+            other += counts[i];
+        }
+    }
+    CHECK_EQ(other, profile.other.count);
+    CHECK_EQ(0, profile.other.caller);
+}
+
+HOST_TEST(test_top)
+{
+    const port_critical_caller_t *top[CALLERS + 1];
+
+    port_critical_profile_reset(&profile);
+    CHECK_EQ(0, port_critical_profile_top(&profile, top, CALLERS + 1));
+
+    /* Caller i's longest is 1000 * (i * 7 % CALLERS + 1), and the ones that
+     * don't fit are the longest of all */
+    for (int i = 0; i < CALLERS + 4; i++) {
+        uint32_t max = i < CALLERS ? 1000 * (i * 7 % CALLERS + 1) : 100000;
+
+        port_critical_profile_record(&profile, 0x40210000 + 0x40 * i, 10);
+        port_critical_profile_record(&profile, 0x40210000 + 0x40 * i, max);
+    }
+
+    CHECK_EQ(CALLERS + 1, port_critical_profile_top(&profile, top, CALLERS + 8));
+    CHECK_EQ(0, top[0]->caller);
+    CHECK_EQ(100000, top[0]->max_cycles);
+    for (int i = 1; i < CALLERS + 1; i++) {
+        CHECK_EQ(1000 * (CALLERS - i + 1), top[i]->max_cycles);
+    }
+
+    CHECK_EQ(3, port_critical_profile_top(&profile, top, 3));
+    CHECK_EQ(100000, top[0]->max_cycles);
+    CHECK_EQ(1000 * CALLERS, top[1]->max_cycles);
+    CHECK_EQ(1000 * (CALLERS - 1), top[2]->max_cycles);
+
+    CHECK_EQ(0, port_critical_profile_top(&profile, top, 0));
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_bucket),
+    HOST_TEST_ENTRY(test_record),
+    HOST_TEST_ENTRY(test_many_callers),
+    HOST_TEST_ENTRY(test_top),
+};
+
+HOST_TEST_MAIN("port_critical_profile", tests)
@@ -0,0 +1,269 @@
+/* Host-side tests for the tickless idle arithmetic in
+ * FreeRTOS/Source/portable/esp8266/port_tickless.c
+ *
+ * Besides the single cases, a simulated CCOUNT runs for hours of ticks
+ * across several wraps, with the tick interrupt as sdk__xt_timer_int()
+ * handles it and tickless sleeps ended by the tick or by other interrupts at
+ * random. The tick count must keep to CCOUNT throughout, on the same
+ * boundaries as if the tick had never stopped.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "port_tickless.h"
+#include "host_test.h"
+
+#define CYCLES_80MHZ  800000    /* 10 ms ticks */
+#define CYCLES_160MHZ 1600000
+#define FRC2_PER_TICK 50000
+
+HOST_TEST(test_max_ticks)
+{
+    static const uint32_t cycles[] = { CYCLES_80MHZ, CYCLES_160MHZ, 80000, 1 << 20 };
+
+    for (int i = 0; i < sizeof(cycles) / sizeof(cycles[0]); i++) {
+        uint32_t max = port_tickless_max_ticks(cycles[i]);
+
+        /* Waking a whole sleep on from the last tick, plus the tick
+         * already under way, stays within half the CCOUNT range */
+        CHECK((uint64_t)(max + 1) * cycles[i] < 0x80000000u);
+        CHECK((uint64_t)(max + 3) * cycles[i] >= 0x80000000u);
+    }
+    CHECK_EQ(2683, port_tickless_max_ticks(CYCLES_80MHZ));
+}
+
+HOST_TEST(test_sleep_ticks)
+{
+    uint32_t max = port_tickless_max_ticks(CYCLES_80MHZ);
+
+    CHECK_EQ(0, port_tickless_sleep_ticks(0, max, false, 0, FRC2_PER_TICK));
+    CHECK_EQ(0, port_tickless_sleep_ticks(1, max, false, 0, FRC2_PER_TICK));
+    CHECK_EQ(2, port_tickless_sleep_ticks(2, max, false, 0, FRC2_PER_TICK));
+    CHECK_EQ(500, port_tickless_sleep_ticks(500, max, false, 0, FRC2_PER_TICK));
+    CHECK_EQ(max, port_tickless_sleep_ticks(0xffffffffu, max, false, 0, FRC2_PER_TICK));
+    /* Up to the tick after the next ets_timer */
+    CHECK_EQ(4, port_tickless_sleep_ticks(500, max, true, 3 * FRC2_PER_TICK + 10, FRC2_PER_TICK));
+    CHECK_EQ(500, port_tickless_sleep_ticks(500, max, true, 600 * FRC2_PER_TICK, FRC2_PER_TICK));
+    /* An ets_timer due now or within a tick leaves nothing to save */
+    CHECK_EQ(0, port_tickless_sleep_ticks(500, max, true, 0, FRC2_PER_TICK));
+    CHECK_EQ(0, port_tickless_sleep_ticks(500, max, true, FRC2_PER_TICK - 1, FRC2_PER_TICK));
+    CHECK_EQ(2, port_tickless_sleep_ticks(500, max, true, FRC2_PER_TICK, FRC2_PER_TICK));
+}
+
+HOST_TEST(test_woken_by_tick)
+{
+    uint32_t last = 0u - 3 * CYCLES_80MHZ;  /* Wakes across the wrap */
+    uint32_t compare;
+
+    for (uint32_t late = 0; late < 3 * CYCLES_80MHZ; late += CYCLES_80MHZ / 2) {
+        uint32_t wake = last + 10 * CYCLES_80MHZ;
+        uint32_t step = port_tickless_correct(last, CYCLES_80MHZ, 10, wake + late, &compare);
+
+        /* The tick interrupt counts the last tick, and any after it */
+        CHECK_EQ(9, step);
+        CHECK_EQ(wake, compare);
+    }
+}
+
+HOST_TEST(test_woken_early)
+{
+    uint32_t last = 0u - 3 * CYCLES_80MHZ;
+    uint32_t compare;
+
+    /* Within the first tick: nothing to count, tick where it was */
+    CHECK_EQ(0, port_tickless_correct(last, CYCLES_80MHZ, 10, last + 100, &compare));
+    CHECK_EQ(last + CYCLES_80MHZ, compare);
+
+    /* Part way through */
+    CHECK_EQ(4, port_tickless_correct(last, CYCLES_80MHZ, 10, last + 4 * CYCLES_80MHZ + 7, &compare));
+    CHECK_EQ(last + 5 * CYCLES_80MHZ, compare);
+
+    /* Just short of a boundary: count it, rather than set CCOMPARE0 where
+     * CCOUNT may already have passed */
+    uint32_t now = last + 5 * CYCLES_80MHZ - PORT_TICKLESS_MARGIN / 2;
+    CHECK_EQ(5, port_tickless_correct(last, CYCLES_80MHZ, 10, now, &compare));
+    CHECK_EQ(last + 6 * CYCLES_80MHZ, compare);
+
+    /* Just short of the wake time itself: CCOMPARE0 is already set there */
+    now = last + 10 * CYCLES_80MHZ - PORT_TICKLESS_MARGIN / 2;
+    CHECK_EQ(9, port_tickless_correct(last, CYCLES_80MHZ, 10, now, &compare));
+    CHECK_EQ(last + 10 * CYCLES_80MHZ, compare);
+}
+
+/* Simulated CPU: a 64-bit cycle count, of which CCOUNT is the low 32 bits */
+typedef struct {
+    uint32_t cycles_per_tick;
+    uint64_t time;
+    uint64_t start;         /* Time of tick 0 */
+    uint32_t ccompare;
+    uint64_t ticks;         /* Tick count */
+} cpu_t;
+
+static uint32_t ccount(const cpu_t *cpu)
+{
+    return (uint32_t)cpu->time;
+}
+
+/* sdk__xt_timer_int() in open_esplibs/libmain/os_cpu_a.c */
+static void tick_interrupt(cpu_t *cpu)
+{
+    uint32_t trigger, current;
+
+    do {
+        trigger = cpu->ccompare;
+        cpu->ccompare = trigger + cpu->cycles_per_tick;
+        cpu->ticks++;
+        current = ccount(cpu);
+    } while (current - trigger > cpu->cycles_per_tick);
+}
+
+/* Whether CCOUNT has reached CCOMPARE0 since 'from' */
+static bool reached(const cpu_t *cpu, uint64_t from)
+{
+    return (uint32_t)(cpu->ccompare - (uint32_t)from) <= cpu->time - from;
+}
+
+/* Run to 'until' with the tick running */
+static void run_ticking(cpu_t *cpu, uint64_t until)
+{
+    while (true) {
+        uint64_t due = cpu->time + (uint32_t)(cpu->ccompare - ccount(cpu));
+        if (due > until) {
+            break;
+        }
+        cpu->time = due + rand() % 200;     /* Interrupt latency */
+        tick_interrupt(cpu);
+    }
+    cpu->time = until;
+}
+
+/* The tick count keeps to the clock, short by no more than a tick and
+ * ahead by no more than the margin, and the next tick is on a boundary */
+static bool in_step(const cpu_t *cpu)
+{
+    uint64_t counted = cpu->start + cpu->ticks * cpu->cycles_per_tick;
+
+    return counted <= cpu->time + PORT_TICKLESS_MARGIN &&
+           cpu->time < counted + 2 * cpu->cycles_per_tick &&
+           cpu->ccompare == (uint32_t)(counted + cpu->cycles_per_tick);
+}
+
+/* vPortSuppressTicksAndSleep() in port.c, for 'expected' ticks, ended by
+ * another interrupt 'early' cycles after sleeping if that comes first */
+static bool tickless_sleep(cpu_t *cpu, uint32_t expected, uint64_t early, uint32_t *slept)
+{
+    uint32_t max = port_tickless_max_ticks(cpu->cycles_per_tick);
+    uint32_t ticks = port_tickless_sleep_ticks(expected, max, false, 0, FRC2_PER_TICK);
+    uint32_t compare;
+    uint64_t before = cpu->ticks;
+
+    *slept = 0;
+    if (!ticks || (int32_t)(cpu->ccompare - ccount(cpu)) < PORT_TICKLESS_MARGIN) {
+        return true;
+    }
+    uint32_t last = cpu->ccompare - cpu->cycles_per_tick;
+    uint32_t wake = last + ticks * cpu->cycles_per_tick;
+    uint64_t from = cpu->time;
+    cpu->ccompare = wake;
+
+    uint64_t woken = from + (uint32_t)(wake - ccount(cpu));
+    if (early < woken - from) {
+        cpu->time = from + early;
+        /* Sometimes the tick comes due while the interrupt is handled */
+        if (rand() % 4 == 0) {
+            cpu->time += rand() % 1000;
+        }
+    } else {
+        cpu->time = woken + rand() % 200;
+        tick_interrupt(cpu);
+    }
+
+    uint32_t step = port_tickless_correct(last, cpu->cycles_per_tick, ticks, ccount(cpu), &compare);
+    if (compare != wake) {
+        cpu->ccompare = compare;
+    }
+    cpu->ticks += step;
+    /* Interrupts on again: a tick that came due is taken */
+    if (cpu->ccompare == wake && reached(cpu, from)) {
+        tick_interrupt(cpu);
+    }
+    *slept = cpu->ticks - before;
+    /* Never beyond the tick the scheduler expects to unblock a task on */
+    return cpu->ticks - before <= ticks;
+}
+
+static void simulate(uint32_t cycles_per_tick, uint32_t seed, uint64_t *slept_total)
+{
+    cpu_t cpu = { .cycles_per_tick = cycles_per_tick };
+    bool ok = true;
+
+    srand(seed);
+    cpu.time = 0x100000000ull - 10ull * cycles_per_tick + rand() % 1000;
+    cpu.start = cpu.time;
+    cpu.ccompare = ccount(&cpu) + cycles_per_tick;
+    *slept_total = 0;
+
+    for (int i = 0; i < 50000 && ok; i++) {
+        uint32_t slept;
+
+        switch (rand() % 3) {
+        case 0:
+            run_ticking(&cpu, cpu.time + rand() % (5 * cycles_per_tick));
+            break;
+        case 1:
+            ok = tickless_sleep(&cpu, 2 + rand() % 3000, UINT64_MAX, &slept);
+            *slept_total += slept;
+            break;
+        default:
+            ok = tickless_sleep(&cpu, 2 + rand() % 3000,
+                       (uint64_t)rand() * rand() % (3000ull * cycles_per_tick), &slept);
+            *slept_total += slept;
+            break;
+        }
+        ok = ok && in_step(&cpu);
+    }
+    CHECK(ok);
+    /* Crossed several CCOUNT wraps */
+    CHECK(cpu.time - cpu.start > 4 * 0x100000000ull);
+}
+
+HOST_TEST(test_simulated_80mhz)
+{
+    uint64_t slept;
+
+    simulate(CYCLES_80MHZ, 1, &slept);
+    CHECK(slept > 0);
+}
+
+HOST_TEST(test_simulated_160mhz)
+{
+    uint64_t slept;
+
+    simulate(CYCLES_160MHZ, 2, &slept);
+    CHECK(slept > 0);
+}
+
+HOST_TEST(test_simulated_short_ticks)
+{
+    uint64_t slept;
+
+    /* 1 kHz tick at 80 MHz: the margin matters more */
+    simulate(80000, 3, &slept);
+    CHECK(slept > 0);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_max_ticks),
+    HOST_TEST_ENTRY(test_sleep_ticks),
+    HOST_TEST_ENTRY(test_woken_by_tick),
+    HOST_TEST_ENTRY(test_woken_early),
+    HOST_TEST_ENTRY(test_simulated_80mhz),
+    HOST_TEST_ENTRY(test_simulated_160mhz),
+    HOST_TEST_ENTRY(test_simulated_short_ticks),
+};
+
+HOST_TEST_MAIN("port_tickless", tests)
@@ -0,0 +1,409 @@
+/* FreeRTOS task, task notification and queue stand-ins on pthreads
+ *
+ * Each thread that calls into these gets a task handle of its own on first
+ * use. Queues follow the FreeRTOS semantics: items are copied in and out,
+ * and senders and receivers block with a timeout in ticks.
+ *
+ * Built with HOST_THREADS this also provides semaphores, mutexes and a
+ * process-wide lock for critical sections, for running the lwip port.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notifications;
+} host_task_t;
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+static __thread host_task_t *current_task;
+
+/* Absolute CLOCK_MONOTONIC time 'ticks' from now, for the timed waits */
+static struct timespec deadline(TickType_t ticks)
+{
+    struct timespec ts;
+    uint64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = ts.tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    return ts;
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Wait on 'cond', returning false once 'end' has passed */
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+                      const struct timespec *end)
+{
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, end) != ETIMEDOUT;
+}
+
+static host_task_t *task_new(void)
+{
+    host_task_t *task = calloc(1, sizeof(host_task_t));
+
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->cond);
+    return task;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!current_task) {
+        current_task = task_new();
+    }
+    return current_task;
+}
+
+typedef struct {
+    host_task_t *task;
+    TaskFunction_t func;
+    void *param;
+} task_start_t;
+
+static void *task_thread(void *arg)
+{
+    task_start_t start = *(task_start_t *)arg;
+
+    free(arg);
+    current_task = start.task;
+    start.func(start.param);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack_depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *created)
+{
+    task_start_t *start = malloc(sizeof(task_start_t));
+    pthread_t thread;
+
+    *start = (task_start_t){ task_new(), func, param };
+    if (created) {
+        *created = start->task;
+    }
+    if (pthread_create(&thread, NULL, task_thread, start)) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 / portTICK_PERIOD_MS + ts.tv_nsec / (portTICK_PERIOD_MS * 1000000);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec end = deadline(ticks);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL) == EINTR) {
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_task_t *task = xTaskGetCurrentTaskHandle();
+    struct timespec end = deadline(ticks_to_wait);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (!task->notifications && ticks_to_wait &&
+           cond_wait(&task->cond, &task->lock, ticks_to_wait, &end)) {
+    }
+    value = task->notifications;
+    if (value) {
+        task->notifications = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    host_task_t *task = handle;
+
+    pthread_mutex_lock(&task->lock);
+    task->notifications++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t handle, BaseType_t *higher_priority_task_woken)
+{
+    xTaskNotifyGive(handle);
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdTRUE;
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct host_queue) + length * item_size);
+
+    if (!queue) {
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_full);
+    queue->length = length;
+    queue->item_size = item_size;
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec end = deadline(ticks_to_wait);
+    BaseType_t sent = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && ticks_to_wait &&
+           cond_wait(&queue->not_full, &queue->lock, ticks_to_wait, &end)) {
+    }
+    if (queue->count < queue->length) {
+        UBaseType_t i = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + i * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        sent = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return sent;
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void *item,
+                                   BaseType_t *higher_priority_task_woken)
+{
+    BaseType_t sent = xQueueSendToBack(queue, item, 0);
+
+    if (sent && higher_priority_task_woken) {
+        *higher_priority_task_woken = pdTRUE;
+    }
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait)
+{
+    struct timespec end = deadline(ticks_to_wait);
+    BaseType_t received = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count && ticks_to_wait &&
+           cond_wait(&queue->not_empty, &queue->lock, ticks_to_wait, &end)) {
+    }
+    if (queue->count) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        received = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return received;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+#if HOST_THREADS
+
+static pthread_mutex_t critical_lock;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+
+static void critical_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&critical_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void vPortEnterCritical(void)
+{
+    pthread_once(&critical_once, critical_init);
+    pthread_mutex_lock(&critical_lock);
+    host_critical_nesting++;
+}
+
+void vPortExitCritical(void)
+{
+    host_critical_nesting--;
+    pthread_mutex_unlock(&critical_lock);
+}
+
+/* A counting semaphore, which also serves as a binary semaphore and a
+ * mutex. A recursive mutex additionally records its holder. */
+struct host_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t count;
+    UBaseType_t max_count;
+    host_task_t *holder;
+    UBaseType_t depth;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    SemaphoreHandle_t sem = calloc(1, sizeof(struct host_sem));
+
+    if (!sem) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->lock, NULL);
+    cond_init(&sem->cond);
+    sem->count = initial_count;
+    sem->max_count = max_count;
+
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+    free(sem);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait)
+{
+    struct timespec end = deadline(ticks_to_wait);
+    BaseType_t taken = pdFALSE;
+
+    pthread_mutex_lock(&sem->lock);
+    while (!sem->count && ticks_to_wait &&
+           cond_wait(&sem->cond, &sem->lock, ticks_to_wait, &end)) {
+    }
+    if (sem->count) {
+        sem->count--;
+        taken = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t given = pdFALSE;
+
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count < sem->max_count) {
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+        given = pdTRUE;
+    }
+    pthread_mutex_unlock(&sem->lock);
+
+    return given;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks_to_wait)
+{
+    host_task_t *task = xTaskGetCurrentTaskHandle();
+
+    if (sem->holder == task) {
+        sem->depth++;
+        return pdTRUE;
+    }
+    if (!xSemaphoreTake(sem, ticks_to_wait)) {
+        return pdFALSE;
+    }
+    sem->holder = task;
+    sem->depth = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    if (sem->holder != xTaskGetCurrentTaskHandle()) {
+        return pdFALSE;
+    }
+    if (--sem->depth == 0) {
+        sem->holder = NULL;
+        xSemaphoreGive(sem);
+    }
+    return pdTRUE;
+}
+
+#endif /* HOST_THREADS */
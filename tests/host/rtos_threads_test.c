@@ -0,0 +1,133 @@
+/* Host-side tests for the threaded RTOS stand-ins in rtos_threads.c, as used
+ * to run the lwip port (built with HOST_THREADS)
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "host_test.h"
+
+unsigned host_critical_nesting;
+
+static SemaphoreHandle_t sem;
+static SemaphoreHandle_t done;
+
+static void give_later(void *arg)
+{
+    vTaskDelay(2);
+    xSemaphoreGive(sem);
+    xSemaphoreGive(done);
+}
+
+HOST_TEST(test_binary_semaphore)
+{
+    sem = xSemaphoreCreateBinary();
+    done = xSemaphoreCreateCounting(10, 0);
+    CHECK(sem && done);
+
+    CHECK(!xSemaphoreTake(sem, 0));
+    CHECK(xSemaphoreGive(sem));
+    CHECK(!xSemaphoreGive(sem));
+    CHECK(xSemaphoreTake(sem, 0));
+
+    // Blocks until another task gives it
+    CHECK_EQ(pdPASS, xTaskCreate(give_later, "give", 0, NULL, 0, NULL));
+    CHECK(xSemaphoreTake(sem, portMAX_DELAY));
+    CHECK(xSemaphoreTake(done, portMAX_DELAY));
+
+    // Times out
+    TickType_t start = xTaskGetTickCount();
+    CHECK(!xSemaphoreTake(sem, 3));
+    CHECK(xTaskGetTickCount() - start >= 3);
+
+    vSemaphoreDelete(sem);
+    vSemaphoreDelete(done);
+}
+
+static volatile bool other_took;
+
+static void take_mutex(void *arg)
+{
+    other_took = xSemaphoreTakeRecursive(sem, 2);
+    if (other_took) {
+        xSemaphoreGiveRecursive(sem);
+    }
+    xSemaphoreGive(done);
+}
+
+HOST_TEST(test_recursive_mutex)
+{
+    sem = xSemaphoreCreateRecursiveMutex();
+    done = xSemaphoreCreateCounting(10, 0);
+
+    CHECK(xSemaphoreTakeRecursive(sem, portMAX_DELAY));
+    CHECK(xSemaphoreTakeRecursive(sem, portMAX_DELAY));
+
+    // Held by this task, so another one can not take it
+    xTaskCreate(take_mutex, "take", 0, NULL, 0, NULL);
+    CHECK(xSemaphoreTake(done, portMAX_DELAY));
+    CHECK(!other_took);
+
+    CHECK(xSemaphoreGiveRecursive(sem));
+    xTaskCreate(take_mutex, "take", 0, NULL, 0, NULL);
+    CHECK(xSemaphoreTake(done, portMAX_DELAY));
+    CHECK(!other_took);
+
+    // Released once given as many times as taken
+    CHECK(xSemaphoreGiveRecursive(sem));
+    CHECK(!xSemaphoreGiveRecursive(sem));
+    xTaskCreate(take_mutex, "take", 0, NULL, 0, NULL);
+    CHECK(xSemaphoreTake(done, portMAX_DELAY));
+    CHECK(other_took);
+
+    vSemaphoreDelete(sem);
+    vSemaphoreDelete(done);
+}
+
+#define CRITICAL_TASKS 4
+#define CRITICAL_LOOPS 100000
+
+static volatile uint32_t counter;
+
+static void count_task(void *arg)
+{
+    for (int i = 0; i < CRITICAL_LOOPS; i++) {
+        taskENTER_CRITICAL();
+        portENTER_CRITICAL();
+        uint32_t value = counter;
+        portEXIT_CRITICAL();
+        counter = value + 1;
+        taskEXIT_CRITICAL();
+    }
+    xSemaphoreGive(done);
+}
+
+HOST_TEST(test_critical_section)
+{
+    done = xSemaphoreCreateCounting(CRITICAL_TASKS, 0);
+    counter = 0;
+
+    for (int i = 0; i < CRITICAL_TASKS; i++) {
+        CHECK_EQ(pdPASS, xTaskCreate(count_task, "count", 0, NULL, 0, NULL));
+    }
+    for (int i = 0; i < CRITICAL_TASKS; i++) {
+        CHECK(xSemaphoreTake(done, portMAX_DELAY));
+    }
+    CHECK_EQ(CRITICAL_TASKS * CRITICAL_LOOPS, counter);
+    CHECK_EQ(0, host_critical_nesting);
+
+    vSemaphoreDelete(done);
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_binary_semaphore),
+    HOST_TEST_ENTRY(test_recursive_mutex),
+    HOST_TEST_ENTRY(test_critical_section),
+};
+
+HOST_TEST_MAIN("rtos_threads", tests)
@@ -0,0 +1,519 @@
+/* Register-level simulation of the ESP8266 SPI flash controller on the host
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "flashchip.h"
+#include "esp/rom.h"
+#include "esp/spi_regs.h"
+#include "esp/wdev_regs.h"
+#include "esp/dport_regs.h"
+#include "esp/interrupts.h"
+#include "spi_sim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define REGS_PAGE       0x60000000
+#define REGS_PAGE_SIZE  4096
+#define WDEV_PAGE       0x3ff20000
+#define DPORT_PAGE      0x3ff00000
+#define MAPPED_BASE     0x40200000
+#define MAPPED_SIZE     0x100000
+#define PAGE_SIZE       256
+#define SECTOR_SIZE     4096
+
+#define CMD_ERASE_SUSPEND   0x75
+#define CMD_ERASE_RESUME    0x7a
+#define STATUS_BUSY         0x01
+
+// How often the controller looks at SPI(0).CMD
+#define POLL_INTERVAL_US 20
+
+sdk_flashchip_t sdk_flashchip;
+unsigned host_critical_nesting;
+uint8_t rboot_megabyte;
+spi_sim_stats_t spi_sim_stats;
+spi_sim_hspi_t spi_sim_hspi;
+spi_sim_cmd_t spi_sim_log[SPI_SIM_LOG_SIZE];
+uint32_t spi_sim_log_len;
+uint32_t spi_sim_erase_time_us;
+bool spi_sim_erase_suspend;
+void (*spi_sim_delay_hook)(void);
+
+static uint8_t *flash_image;
+static void *regs_page;
+static void *wdev_page;
+static void *dport_page;
+static uint8_t *mapped_window;
+static bool running;
+static bool cache_enabled;
+static bool write_enabled;
+static uint64_t start_ns;
+static uint32_t cache_disabled_at;
+
+// Sector erase in progress
+static volatile bool erasing;
+static bool erase_suspended;
+static uint32_t erase_sector;
+static uint32_t erase_end;        // time the erase finishes, if running
+static uint32_t erase_remaining;  // time left, if suspended
+
+// Interrupts and task notification. The handler table lives for the whole
+// process, like the one in the SDK.
+static _xt_isr isr_handlers[16];
+static void *isr_args[16];
+static uint32_t int_enabled;
+static volatile uint32_t notifications;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t now_us(void)
+{
+    return (monotonic_ns() - start_ns) / 1000;
+}
+
+/* Update the erase in progress, and return true if the chip is busy */
+static bool update_busy(void)
+{
+    uint32_t now = now_us();
+
+    WDEV.SYS_TIME = now;
+    if (!erasing || erase_suspended) {
+        return false;
+    }
+    if ((int32_t)(now - erase_end) < 0) {
+        return true;
+    }
+    memset(flash_image + erase_sector, 0xff, SECTOR_SIZE);
+    erasing = false;
+    return false;
+}
+
+static void *map_fixed(uintptr_t addr, size_t size)
+{
+    void *p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    if (p != (void *)addr) {
+        munmap(p, size);
+        return NULL;
+    }
+    return p;
+}
+
+static void log_cmd(spi_sim_op_t op, uint32_t addr, uint32_t size)
+{
+    if (spi_sim_log_len < SPI_SIM_LOG_SIZE) {
+        spi_sim_log[spi_sim_log_len] = (spi_sim_cmd_t){ op, addr, size };
+    }
+    spi_sim_log_len++;
+}
+
+static void do_read(uint32_t addr, uint32_t size)
+{
+    log_cmd(SPI_SIM_READ, addr, size);
+    spi_sim_stats.read_cmds++;
+    if (erasing && addr < erase_sector + SECTOR_SIZE && erase_sector < addr + size) {
+        spi_sim_stats.erasing_reads++;
+    }
+    if (size > spi_sim_stats.max_read_size) {
+        spi_sim_stats.max_read_size = size;
+    }
+    if (size >= 64) {
+        spi_sim_stats.hangs++;
+        size = 64;
+    }
+    memcpy((void *)SPI(0).W, flash_image + addr, size);
+}
+
+static void do_program(uint32_t addr, uint32_t size)
+{
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+    uint8_t *data = (uint8_t *)SPI(0).W;
+
+    spi_sim_stats.program_cmds++;
+    log_cmd(SPI_SIM_PROGRAM, addr, size);
+    if (!write_enabled) {
+        spi_sim_stats.unenabled_cmds++;
+        return;
+    }
+    write_enabled = false;
+    if (erasing) {
+        spi_sim_stats.erasing_writes++;
+        return;
+    }
+    if ((addr % PAGE_SIZE) + size > PAGE_SIZE) {
+        spi_sim_stats.page_wraps++;
+    }
+    // Like real chips, wrap around within the page
+    for (uint32_t i = 0; i < size && i < 64; i++) {
+        flash_image[page + (addr + i) % PAGE_SIZE] &= data[i];
+    }
+}
+
+static void do_erase(uint32_t addr)
+{
+    spi_sim_stats.erase_cmds++;
+    log_cmd(SPI_SIM_ERASE, addr, 0);
+    if (!write_enabled) {
+        spi_sim_stats.unenabled_cmds++;
+        return;
+    }
+    write_enabled = false;
+    if (erasing) {
+        spi_sim_stats.erasing_writes++;
+        return;
+    }
+    erasing = true;
+    erase_suspended = false;
+    erase_sector = addr & ~(SECTOR_SIZE - 1);
+    erase_end = now_us() + spi_sim_erase_time_us;
+}
+
+static void do_user_command(uint8_t command)
+{
+    uint32_t now = now_us();
+
+    if (command == CMD_ERASE_SUSPEND && spi_sim_erase_suspend) {
+        if (erasing && !erase_suspended) {
+            spi_sim_stats.suspends++;
+            erase_suspended = true;
+            erase_remaining = erase_end - now;
+            if ((int32_t)erase_remaining < 0) {
+                erase_remaining = 0;
+            }
+        }
+    } else if (command == CMD_ERASE_RESUME && spi_sim_erase_suspend) {
+        if (erasing && erase_suspended) {
+            erase_suspended = false;
+            erase_end = now + erase_remaining;
+        }
+    }
+}
+
+/* Carry out a user transaction on SPI(1), with a device on the other end that
+ * answers each byte with the byte XORed with its position in the stream.
+ */
+static void hspi_tick(void)
+{
+    uint8_t *w = (uint8_t *)SPI(1).W;
+    uint32_t bytes;
+
+    if (SPI(1).CMD & SPI_CMD_USR) {
+        bytes = (FIELD2VAL(SPI_USER1_MOSI_BITLEN, SPI(1).USER1) + 1) / 8;
+        spi_sim_hspi.transactions++;
+        if (SPI(1).USER0 & SPI_USER0_COMMAND) {
+            spi_sim_hspi.command_phases++;
+        }
+        if (bytes > 64) {
+            spi_sim_hspi.overruns++;
+            bytes = 64;
+        }
+        for (uint32_t i = 0; i < bytes; i++) {
+            uint32_t pos = spi_sim_hspi.out_len++;
+            if (pos < SPI_SIM_HSPI_LOG_SIZE) {
+                spi_sim_hspi.out[pos] = w[i];
+            }
+            w[i] ^= (uint8_t)(pos * 7 + 1);
+        }
+        SPI(1).SLAVE0 |= SPI_SLAVE0_TRANS_DONE;
+        SPI(1).CMD &= ~SPI_CMD_USR;
+    }
+
+    // Level triggered, like the hardware
+    DPORT.SPI_INT_STATUS = SPI(1).SLAVE0 & SPI_SLAVE0_TRANS_DONE ? DPORT_SPI_INT_STATUS_SPI1 : 0;
+    if ((SPI(1).SLAVE0 & SPI_SLAVE0_TRANS_DONE_EN) && DPORT.SPI_INT_STATUS &&
+            (int_enabled & BIT(INUM_SPI)) && isr_handlers[INUM_SPI]) {
+        spi_sim_hspi.interrupts++;
+        isr_handlers[INUM_SPI](isr_args[INUM_SPI]);
+        if (SPI(1).SLAVE0 & SPI_SLAVE0_TRANS_DONE) {
+            spi_sim_hspi.uncleared_interrupts++;
+        }
+    }
+}
+
+static void flash_tick(void)
+{
+    uint32_t cmd = SPI(0).CMD;
+    uint32_t addr = SPI(0).ADDR & 0x00ffffff;
+    uint32_t size = SPI(0).ADDR >> 24;
+
+    bool busy = update_busy();
+
+    if (!cmd) {
+        return;
+    }
+    if (cache_enabled) {
+        spi_sim_stats.unsafe_cmds++;
+    }
+    if (addr >= SPI_SIM_FLASH_SIZE) {
+        addr %= SPI_SIM_FLASH_SIZE;
+    }
+    if (cmd & SPI_CMD_READ_SR) {
+        SPI(0).RSTATUS = busy ? STATUS_BUSY : 0;
+    } else if (cmd & SPI_CMD_USR) {
+        do_user_command(SPI(0).USER2 & SPI_USER2_COMMAND_VALUE_M);
+    } else if (busy) {
+        spi_sim_stats.busy_cmds++;
+    } else if (cmd & SPI_CMD_READ) {
+        do_read(addr, size);
+    } else if (cmd & SPI_CMD_PP) {
+        do_program(addr, size);
+    } else if (cmd & SPI_CMD_SE) {
+        do_erase(addr);
+    }
+    SPI(0).CMD = 0;
+}
+
+/* The controller runs from a periodic timer signal on the test thread, so it
+ * interrupts the driver's busy-wait loops much like the hardware completing a
+ * command would, without depending on a second CPU being available.
+ */
+static void controller_tick(int sig)
+{
+    hspi_tick();
+    flash_tick();
+}
+
+static void set_poll_timer(long interval_us)
+{
+    struct itimerval it = {
+        .it_interval = { .tv_usec = interval_us },
+        .it_value = { .tv_usec = interval_us },
+    };
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+bool spi_sim_init(void)
+{
+    uint32_t seed = 1;
+
+    spi_sim_free();
+    regs_page = map_fixed(REGS_PAGE, REGS_PAGE_SIZE);
+    wdev_page = map_fixed(WDEV_PAGE, REGS_PAGE_SIZE);
+    dport_page = map_fixed(DPORT_PAGE, REGS_PAGE_SIZE);
+    mapped_window = map_fixed(MAPPED_BASE, MAPPED_SIZE);
+    if (!regs_page || !wdev_page || !dport_page || !mapped_window) {
+        printf("spi_sim: unable to map registers at 0x%08x/0x%08x/0x%08x or flash at 0x%08x\n",
+               REGS_PAGE, WDEV_PAGE, DPORT_PAGE, MAPPED_BASE);
+        spi_sim_free();
+        return false;
+    }
+
+    flash_image = malloc(SPI_SIM_FLASH_SIZE);
+    for (uint32_t i = 0; i < SPI_SIM_FLASH_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        flash_image[i] = seed >> 16;
+    }
+
+    sdk_flashchip.device_id = 0x1540ef;
+    sdk_flashchip.chip_size = SPI_SIM_FLASH_SIZE;
+    sdk_flashchip.block_size = 64 * 1024;
+    sdk_flashchip.sector_size = SECTOR_SIZE;
+    sdk_flashchip.page_size = PAGE_SIZE;
+    sdk_flashchip.status_mask = 0xffff;
+
+    start_ns = monotonic_ns();
+    erasing = false;
+    spi_sim_erase_time_us = SPI_SIM_ERASE_TIME_US;
+    spi_sim_erase_suspend = true;
+    spi_sim_delay_hook = NULL;
+    memset(isr_handlers, 0, sizeof(isr_handlers));
+    memset(isr_args, 0, sizeof(isr_args));
+    int_enabled = 0;
+    notifications = 0;
+
+    rboot_megabyte = 0;
+    Cache_Read_Enable(0, 0, 1);
+    spi_sim_reset_stats();
+
+    struct sigaction sa = { .sa_handler = controller_tick, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+    set_poll_timer(POLL_INTERVAL_US);
+    running = true;
+    return true;
+}
+
+void spi_sim_free(void)
+{
+    if (running) {
+        set_poll_timer(0);
+        signal(SIGALRM, SIG_DFL);
+        running = false;
+    }
+    if (regs_page) {
+        munmap(regs_page, REGS_PAGE_SIZE);
+        regs_page = NULL;
+    }
+    if (wdev_page) {
+        munmap(wdev_page, REGS_PAGE_SIZE);
+        wdev_page = NULL;
+    }
+    if (dport_page) {
+        munmap(dport_page, REGS_PAGE_SIZE);
+        dport_page = NULL;
+    }
+    if (mapped_window) {
+        munmap(mapped_window, MAPPED_SIZE);
+        mapped_window = NULL;
+    }
+    free(flash_image);
+    flash_image = NULL;
+}
+
+uint8_t *spi_sim_flash(void)
+{
+    return flash_image;
+}
+
+void spi_sim_reset_stats(void)
+{
+    memset(&spi_sim_stats, 0, sizeof(spi_sim_stats));
+    spi_sim_log_len = 0;
+    memset(&spi_sim_hspi, 0, sizeof(spi_sim_hspi));
+}
+
+/* ROM routines */
+
+void Cache_Read_Disable(void)
+{
+    spi_sim_stats.cache_disables++;
+    cache_enabled = false;
+    cache_disabled_at = now_us();
+    // Any access to the window from now on faults, like on the device
+    mprotect(mapped_window, MAPPED_SIZE, PROT_NONE);
+}
+
+void Cache_Read_Enable(uint32_t odd_even, uint32_t mb_count, uint32_t no_idea)
+{
+    // Like spiflash-cache-enable.S, the arguments are ignored in favour of
+    // rboot_megabyte.  Re-enabling starts with an empty cache, so the window
+    // is refreshed from the flash image.
+    mprotect(mapped_window, MAPPED_SIZE, PROT_READ | PROT_WRITE);
+    if (rboot_megabyte * MAPPED_SIZE < SPI_SIM_FLASH_SIZE) {
+        memcpy(mapped_window, flash_image + rboot_megabyte * MAPPED_SIZE, MAPPED_SIZE);
+    }
+    mprotect(mapped_window, MAPPED_SIZE, PROT_READ);
+    if (!cache_enabled && now_us() - cache_disabled_at > spi_sim_stats.max_cache_off_us) {
+        spi_sim_stats.max_cache_off_us = now_us() - cache_disabled_at;
+    }
+    cache_enabled = true;
+}
+
+int SPI_write_enable(sdk_flashchip_t *chip)
+{
+    log_cmd(SPI_SIM_WRITE_ENABLE, 0, 0);
+    write_enabled = true;
+    return 0;
+}
+
+int Wait_SPI_Idle(sdk_flashchip_t *chip)
+{
+    while (SPI(0).CMD) {}
+    while (erasing && !erase_suspended) {}
+    return 0;
+}
+
+/* FreeRTOS */
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint32_t end = now_us() + ticks * portTICK_PERIOD_MS * 1000;
+
+    spi_sim_stats.task_delays++;
+    if (host_critical_nesting || !cache_enabled) {
+        spi_sim_stats.unsafe_delays++;
+    }
+    if (spi_sim_delay_hook) {
+        spi_sim_delay_hook();
+    }
+    while ((int32_t)(now_us() - end) < 0) {
+        pause();
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return now_us() / (portTICK_PERIOD_MS * 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)&notifications;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    uint32_t end = now_us() + ticks_to_wait * portTICK_PERIOD_MS * 1000;
+    uint32_t value;
+
+    while (!notifications && (ticks_to_wait == portMAX_DELAY || (int32_t)(now_us() - end) < 0)) {
+        pause();
+    }
+    value = notifications;
+    if (value) {
+        notifications = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+    if (task == (TaskHandle_t)&notifications) {
+        notifications++;
+    }
+    *higher_priority_task_woken = pdTRUE;
+}
+
+/* Interrupts */
+
+void _xt_isr_attach(uint8_t i, _xt_isr func, void *arg)
+{
+    isr_handlers[i] = func;
+    isr_args[i] = arg;
+}
+
+_xt_isr _xt_isr_get(uint8_t i, void **arg)
+{
+    *arg = isr_args[i];
+    return isr_handlers[i];
+}
+
+uint32_t _xt_isr_unmask(uint32_t unmask)
+{
+    uint32_t old = int_enabled;
+
+    int_enabled |= unmask;
+    return old;
+}
+
+uint32_t _xt_isr_mask(uint32_t mask)
+{
+    uint32_t old = int_enabled;
+
+    int_enabled &= ~mask;
+    return old;
+}
@@ -0,0 +1,117 @@
+/* Register-level simulation of the ESP8266 SPI flash controller on the host
+ *
+ * Lets core/spiflash.c run unmodified: the SPI(0) register block and the
+ * memory-mapped flash window are mapped at their real addresses, and a
+ * periodic timer signal plays the part of the controller, carrying out each
+ * command written to SPI(0).CMD on a RAM-backed flash image and clearing CMD
+ * when done.  The ROM routines spiflash.c relies on (Cache_Read_Enable() etc.)
+ * are stand-ins that keep track of how they are used.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _SPI_SIM_H
+#define _SPI_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPI_SIM_FLASH_SIZE (2 * 1024 * 1024)
+
+// Default time a sector erase keeps the chip busy
+#define SPI_SIM_ERASE_TIME_US 40000
+
+typedef struct {
+    uint32_t read_cmds;
+    uint32_t program_cmds;
+    uint32_t erase_cmds;
+    uint32_t max_read_size;    // largest single read command
+    uint32_t hangs;            // read commands of 64+ bytes (hang real chips)
+    uint32_t page_wraps;       // program commands crossing a page boundary
+    uint32_t unsafe_cmds;      // commands issued with the cache enabled
+    uint32_t unenabled_cmds;   // program/erase without a write enable first
+    uint32_t cache_disables;   // calls to Cache_Read_Disable()
+    uint32_t max_cache_off_us; // longest time the cache was disabled
+    uint32_t busy_cmds;        // read/program/erase while an erase is running
+    uint32_t erasing_reads;    // reads from a sector with a suspended erase
+    uint32_t erasing_writes;   // program/erase while an erase is suspended
+    uint32_t suspends;         // erase suspend commands acted on
+    uint32_t task_delays;      // calls to vTaskDelay()
+    uint32_t unsafe_delays;    // ...made in a critical section or without cache
+} spi_sim_stats_t;
+
+extern spi_sim_stats_t spi_sim_stats;
+
+typedef enum {
+    SPI_SIM_WRITE_ENABLE,
+    SPI_SIM_READ,
+    SPI_SIM_PROGRAM,
+    SPI_SIM_ERASE,
+} spi_sim_op_t;
+
+typedef struct {
+    spi_sim_op_t op;
+    uint32_t addr;
+    uint32_t size;
+} spi_sim_cmd_t;
+
+/* Log of the flash commands carried out since spi_sim_reset_stats().  Only
+ * the first SPI_SIM_LOG_SIZE are kept, but all are counted.
+ */
+#define SPI_SIM_LOG_SIZE 1024
+
+extern spi_sim_cmd_t spi_sim_log[SPI_SIM_LOG_SIZE];
+extern uint32_t spi_sim_log_len;
+
+/* SPI(1) (HSPI) user transactions.  The simulated device answers each byte
+ * with the byte XORed with (position * 7 + 1), where position counts bytes
+ * since spi_sim_reset_stats().
+ */
+#define SPI_SIM_HSPI_LOG_SIZE 16384
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t command_phases;        // transactions with a command phase
+    uint32_t overruns;              // transactions of more than 64 bytes
+    uint32_t interrupts;            // calls to the INUM_SPI handler
+    uint32_t uncleared_interrupts;  // ...that returned with TRANS_DONE set
+    uint32_t out_len;               // bytes sent
+    uint8_t out[SPI_SIM_HSPI_LOG_SIZE];
+} spi_sim_hspi_t;
+
+extern spi_sim_hspi_t spi_sim_hspi;
+
+/* How long a sector erase takes, and whether the chip supports erase
+ * suspend/resume.  Reset by spi_sim_init().
+ */
+extern uint32_t spi_sim_erase_time_us;
+extern bool spi_sim_erase_suspend;
+
+/* If set, called from vTaskDelay(), to stand in for other tasks using the
+ * flash in the meantime.  Reset by spi_sim_init().
+ */
+extern void (*spi_sim_delay_hook)(void);
+
+/* Set by Cache_Read_Enable() on the device.  The simulation starts with
+ * megabyte 0 mapped.
+ */
+extern uint8_t rboot_megabyte;
+
+/** Map the registers and flash window, fill the flash with a pseudo-random
+ *  pattern and start the controller.  Returns false (after printing
+ *  why) if the fixed addresses are not available on this host.
+ */
+bool spi_sim_init(void);
+
+/** Stop the controller and unmap everything */
+void spi_sim_free(void);
+
+/** Direct access to the flash image */
+uint8_t *spi_sim_flash(void);
+
+/** Zero all counters in spi_sim_stats and spi_sim_hspi, and clear the
+ *  command logs
+ */
+void spi_sim_reset_stats(void);
+
+#endif /* _SPI_SIM_H */
@@ -0,0 +1,9 @@
+/* Forced into core sources built for the register-level SPI simulation, so
+ * that Xtensa barrier instructions in inline assembly still assemble on the
+ * host (as nothing).  Needs -fno-toplevel-reorder so that the macro is
+ * defined before any function using it.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+__asm__(".macro memw\n.endm");
@@ -0,0 +1,432 @@
+/* Host-side tests for core/spiflash.c, run against the register-level SPI
+ * controller simulation in spi_sim.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "FreeRTOS.h"
+#include "esp/rom.h"
+#include "spiflash.h"
+#include "spi_sim.h"
+#include "host_test.h"
+
+#define MB (1024 * 1024)
+#define GUARD 8
+
+static const uint32_t addrs[] = {
+    0, 1, 2, 3, 4, 5, 0x3fe, 0xffd, 0x1000, 0x12345,
+    MB - 4096, MB - 61, MB - 3, MB, MB + 1, MB + 0x7ff7, 2 * MB - 4096,
+};
+
+static const uint32_t sizes[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 59, 60, 61, 63, 64, 65, 119, 120, 121, 255, 256,
+    257, 4096, 5000,
+};
+
+/* Read every combination of address, size and destination alignment, and
+ * check the result and the bytes around it.
+ */
+static void check_reads(void)
+{
+    static uint8_t buf[5000 + 2 * GUARD + 4];
+    uint8_t *flash = spi_sim_flash();
+
+    for (int a = 0; a < sizeof(addrs) / sizeof(addrs[0]); a++) {
+        for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uint32_t addr = addrs[a], size = sizes[s];
+            if (addr + size > SPI_SIM_FLASH_SIZE) continue;
+            for (int align = 0; align < 4; align++) {
+                uint8_t *dst = buf + GUARD + align;
+                memset(buf, 0xa5, sizeof(buf));
+                CHECK(spiflash_read(addr, dst, size));
+                CHECK_MEM(flash + addr, dst, size);
+                for (int i = 0; i < GUARD; i++) {
+                    CHECK_EQ(0xa5, dst[-1 - i]);
+                    CHECK_EQ(0xa5, dst[size + i]);
+                }
+            }
+        }
+    }
+    CHECK(!spiflash_read(SPI_SIM_FLASH_SIZE - 4, buf, 5));
+    CHECK(!spiflash_read(0, NULL, 5));
+}
+
+HOST_TEST(test_read_mapped_window)
+{
+    CHECK(spi_sim_init());
+    check_reads();
+
+    // Everything in the first megabyte came from the window
+    spi_sim_reset_stats();
+    uint8_t buf[4096];
+    CHECK(spiflash_read(0x10001, buf, sizeof(buf) - 1));
+    CHECK_EQ(0, spi_sim_stats.read_cmds);
+    CHECK_EQ(0, spi_sim_stats.cache_disables);
+    CHECK_EQ(0, host_critical_nesting);
+
+    // ...while the second megabyte still needs SPI commands
+    CHECK(spiflash_read(MB + 0x10000, buf, sizeof(buf)));
+    CHECK_EQ(69, spi_sim_stats.read_cmds);
+    CHECK_EQ(60, spi_sim_stats.max_read_size);
+    CHECK_EQ(0, spi_sim_stats.hangs);
+    CHECK_EQ(0, spi_sim_stats.unsafe_cmds);
+    spi_sim_free();
+}
+
+HOST_TEST(test_read_other_megabyte)
+{
+    uint8_t buf[256];
+
+    CHECK(spi_sim_init());
+    rboot_megabyte = 1;
+    spiflash_erase_sector(0);   // remaps the window
+    check_reads();
+
+    spi_sim_reset_stats();
+    CHECK(spiflash_read(MB + 3, buf, sizeof(buf)));
+    CHECK_EQ(0, spi_sim_stats.read_cmds);
+    CHECK(spiflash_read(3, buf, sizeof(buf)));
+    CHECK_EQ(5, spi_sim_stats.read_cmds);
+    CHECK_EQ(0, spi_sim_stats.hangs);
+    spi_sim_free();
+}
+
+/* Before Cache_Read_Enable() has worked out which megabyte to map, every
+ * read has to go through the controller.
+ */
+HOST_TEST(test_read_unmapped)
+{
+    CHECK(spi_sim_init());
+    rboot_megabyte = 0x80;
+    check_reads();
+    CHECK_EQ(60, spi_sim_stats.max_read_size);
+    CHECK_EQ(0, spi_sim_stats.hangs);
+    CHECK_EQ(0, spi_sim_stats.unsafe_cmds);
+    CHECK_EQ(0, host_critical_nesting);
+    spi_sim_free();
+}
+
+/* Mapped reads must see data written and erased through the controller */
+HOST_TEST(test_write_read_back)
+{
+    static uint8_t data[1000], buf[1000];
+    uint32_t seed = 42;
+
+    CHECK(spi_sim_init());
+    for (uint32_t addr = 0x20000; addr < 0x22000; addr += 4096) {
+        CHECK(spiflash_erase_sector(addr));
+    }
+    for (int i = 0; i < 40; i++) {
+        uint32_t addr = 0x20000 + (seed >> 8) % 0x1c00;
+        uint32_t size = 1 + (seed >> 4) % sizeof(data);
+        seed = seed * 1103515245 + 12345;
+
+        // Only ever write to erased flash
+        CHECK(spiflash_read(addr, buf, size));
+        for (int j = 0; j < size; j++) {
+            data[j] = buf[j] & (seed >> (j % 24));
+        }
+        CHECK(spiflash_write(addr, data, size));
+        CHECK(spiflash_read(addr, buf, size));
+        CHECK_MEM(data, buf, size);
+        CHECK_MEM(data, spi_sim_flash() + addr, size);
+    }
+    CHECK(spiflash_erase_sector(0x20000));
+    CHECK(spiflash_read(0x20ff0, buf, 32));
+    for (int j = 0; j < 16; j++) {
+        CHECK_EQ(0xff, buf[j]);
+    }
+    CHECK_EQ(0, spi_sim_stats.page_wraps);
+    CHECK_EQ(0, spi_sim_stats.unenabled_cmds);
+    CHECK_EQ(0, spi_sim_stats.unsafe_cmds);
+    CHECK_EQ(0, host_critical_nesting);
+    spi_sim_free();
+}
+
+/* Write every combination of page offset and size, from a source buffer
+ * that ends right before an inaccessible page so that reading past its end
+ * faults.  Check the result, and that the write took the least possible
+ * number of program commands, each preceded by a write enable.
+ */
+HOST_TEST(test_write_commands)
+{
+    static const uint32_t offsets[] = { 0, 1, 2, 3, 4, 63, 64, 65, 200, 253, 255 };
+    static const uint32_t write_sizes[] = {
+        1, 2, 3, 4, 5, 6, 7, 63, 64, 65, 66, 67, 191, 192, 193, 255, 256, 257,
+        1000, 1023,
+    };
+    static uint8_t before[2048];
+    uint8_t *flash, *src_page;
+    uint32_t seed = 7;
+
+    CHECK(spi_sim_init());
+    flash = spi_sim_flash();
+    src_page = mmap(NULL, 8192, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(src_page != MAP_FAILED);
+    CHECK(mprotect(src_page + 4096, 4096, PROT_NONE) == 0);
+
+    for (int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+        for (int s = 0; s < sizeof(write_sizes) / sizeof(write_sizes[0]); s++) {
+            uint32_t addr = 0x40000 + 512 + offsets[o] + 2048 * (o * 32 + s);
+            uint32_t size = write_sizes[s];
+            uint8_t *src = src_page + 4096 - size;
+            uint32_t next = addr, expected_cmds = 0;
+
+            for (int i = 0; i < size; i++) {
+                seed = seed * 1103515245 + 12345;
+                src[i] = seed >> 16;
+            }
+            memcpy(before, flash + addr - 512, size + 1024);
+
+            spi_sim_reset_stats();
+            CHECK(spiflash_write(addr, src, size));
+
+            for (int i = 0; i < size + 1024; i++) {
+                uint8_t expected = before[i];
+                if (i >= 512 && i < 512 + size) {
+                    expected &= src[i - 512];
+                }
+                CHECK_EQ(expected, flash[addr - 512 + i]);
+            }
+
+            for (uint32_t a = addr; a < addr + size; a = (a | 0xff) + 1) {
+                uint32_t end = (a | 0xff) + 1 < addr + size ? (a | 0xff) + 1 : addr + size;
+                expected_cmds += (end - a + 63) / 64;
+            }
+            CHECK_EQ(expected_cmds * 2, spi_sim_log_len);
+            for (int i = 0; i < spi_sim_log_len; i += 2) {
+                spi_sim_cmd_t *cmd = &spi_sim_log[i + 1];
+                CHECK_EQ(SPI_SIM_WRITE_ENABLE, spi_sim_log[i].op);
+                CHECK_EQ(SPI_SIM_PROGRAM, cmd->op);
+                CHECK_EQ(next, cmd->addr);
+                CHECK(cmd->size >= 1 && cmd->size <= 64);
+                next += cmd->size;
+            }
+            CHECK_EQ(addr + size, next);
+            CHECK_EQ(0, spi_sim_stats.page_wraps);
+            CHECK_EQ(0, spi_sim_stats.unenabled_cmds);
+        }
+    }
+
+    munmap(src_page, 8192);
+    spi_sim_free();
+}
+
+#define ERASE_SECTOR 0x30000
+
+static void fill_sector(uint32_t addr)
+{
+    static uint8_t data[256];
+
+    memset(data, 0, sizeof(data));
+    for (uint32_t i = 0; i < SPI_FLASH_SECTOR_SIZE; i += sizeof(data)) {
+        spiflash_write(addr + i, data, sizeof(data));
+    }
+}
+
+static void check_erased(uint32_t addr)
+{
+    uint8_t *flash = spi_sim_flash();
+
+    for (uint32_t i = 0; i < SPI_FLASH_SECTOR_SIZE; i++) {
+        CHECK_EQ(0xff, flash[addr + i]);
+    }
+}
+
+static void check_erase_safe(void)
+{
+    CHECK_EQ(0, spi_sim_stats.busy_cmds);
+    CHECK_EQ(0, spi_sim_stats.erasing_reads);
+    CHECK_EQ(0, spi_sim_stats.erasing_writes);
+    CHECK_EQ(0, spi_sim_stats.unsafe_cmds);
+    CHECK_EQ(0, spi_sim_stats.unsafe_delays);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+/* Compare the longest time the cache (and interrupts) are disabled by
+ * spiflash_erase_sector() and spiflash_erase_sector_yield().
+ */
+HOST_TEST(test_erase_yield)
+{
+    uint32_t blocking_us, yield_us;
+
+    CHECK(spi_sim_init());
+
+    fill_sector(ERASE_SECTOR);
+    spi_sim_reset_stats();
+    CHECK(spiflash_erase_sector(ERASE_SECTOR));
+    check_erased(ERASE_SECTOR);
+    blocking_us = spi_sim_stats.max_cache_off_us;
+    CHECK(blocking_us >= SPI_SIM_ERASE_TIME_US);
+
+    fill_sector(ERASE_SECTOR);
+    spi_sim_reset_stats();
+    CHECK(spiflash_erase_sector_yield(ERASE_SECTOR));
+    check_erased(ERASE_SECTOR);
+    check_erase_safe();
+    yield_us = spi_sim_stats.max_cache_off_us;
+    CHECK(spi_sim_stats.suspends >= SPI_SIM_ERASE_TIME_US / SPIFLASH_ERASE_SLICE_US - 1);
+    CHECK(spi_sim_stats.task_delays == spi_sim_stats.suspends);
+    CHECK(yield_us < SPI_SIM_ERASE_TIME_US / 4);
+    printf("  longest cache/interrupt disable during a %d ms erase: "
+           "%u us blocking, %u us yielding\n",
+           SPI_SIM_ERASE_TIME_US / 1000, blocking_us, yield_us);
+
+    CHECK(!spiflash_erase_sector_yield(ERASE_SECTOR + 1));
+    CHECK(!spiflash_erase_sector_yield(SPI_SIM_FLASH_SIZE));
+    spi_sim_free();
+}
+
+static int hook_calls;
+static int hook_mode;
+
+enum { HOOK_READS, HOOK_WRITES, HOOK_SDK };
+
+/* Another task using the flash while the erase is suspended */
+static void other_task(void)
+{
+    uint8_t data[16], buf[16];
+    uint8_t *flash = spi_sim_flash();
+
+    if (hook_calls++ == 0) {
+        // Reads from other sectors don't disturb the erase
+        CHECK(spiflash_read(0x1000, buf, sizeof(buf)));
+        CHECK_MEM(flash + 0x1000, buf, sizeof(buf));
+        CHECK(spiflash_read(MB + 0x1000, buf, sizeof(buf)));
+        CHECK_MEM(flash + MB + 0x1000, buf, sizeof(buf));
+    } else if (hook_mode == HOOK_SDK) {
+        // The SDK spi_flash functions send their own commands, after
+        // finishing the erase
+        vPortEnterCritical();
+        Cache_Read_Disable();
+        spiflash_finish_suspended_erase();
+        Cache_Read_Enable(0, 0, 1);
+        vPortExitCritical();
+        check_erased(ERASE_SECTOR);
+    } else if (hook_mode == HOOK_WRITES) {
+        // Writing anywhere needs the erase to finish first
+        memset(data, 0, sizeof(data));
+        CHECK(spiflash_write(ERASE_SECTOR + SPI_FLASH_SECTOR_SIZE, data, sizeof(data)));
+        CHECK_MEM(data, flash + ERASE_SECTOR + SPI_FLASH_SECTOR_SIZE, sizeof(data));
+        check_erased(ERASE_SECTOR);
+    } else if (hook_calls == 2) {
+        // So does reading the sector being erased
+        memset(data, 0xff, sizeof(data));
+        CHECK(spiflash_read(ERASE_SECTOR + 100, buf, sizeof(buf)));
+        CHECK_MEM(data, buf, sizeof(buf));
+        check_erased(ERASE_SECTOR);
+    }
+}
+
+HOST_TEST(test_erase_yield_interrupted)
+{
+    CHECK(spi_sim_init());
+    spi_sim_delay_hook = other_task;
+
+    for (int i = HOOK_READS; i <= HOOK_SDK; i++) {
+        hook_calls = 0;
+        hook_mode = i;
+        fill_sector(ERASE_SECTOR);
+        spi_sim_reset_stats();
+        CHECK(spiflash_erase_sector_yield(ERASE_SECTOR));
+        CHECK_EQ(2, hook_calls);
+        check_erased(ERASE_SECTOR);
+        check_erase_safe();
+    }
+    spi_sim_free();
+}
+
+static void check_histogram(spiflash_op_stats_t *op)
+{
+    uint32_t total = 0;
+
+    for (int i = 0; i < SPIFLASH_STATS_BUCKETS; i++) {
+        total += op->histogram[i];
+    }
+    CHECK_EQ(op->count, total);
+}
+
+HOST_TEST(test_stats)
+{
+    spiflash_stats_t stats;
+    uint8_t buf[256];
+
+    CHECK(spi_sim_init());
+    spiflash_reset_stats();
+
+    CHECK(spiflash_read(0x1000, buf, 100));
+    CHECK(spiflash_read(MB + 0x1000, buf, sizeof(buf)));
+    CHECK(!spiflash_read(0, NULL, 10));
+    CHECK(spiflash_erase_sector(ERASE_SECTOR));
+    CHECK(spiflash_write(ERASE_SECTOR, buf, sizeof(buf)));
+    CHECK(spiflash_write(ERASE_SECTOR + sizeof(buf), buf, 3));
+
+    spiflash_get_stats(&stats);
+    CHECK_EQ(2, stats.ops[SPIFLASH_OP_READ].count);
+    CHECK_EQ(100 + sizeof(buf), stats.ops[SPIFLASH_OP_READ].bytes);
+    CHECK_EQ(2, stats.ops[SPIFLASH_OP_WRITE].count);
+    CHECK_EQ(sizeof(buf) + 3, stats.ops[SPIFLASH_OP_WRITE].bytes);
+    CHECK_EQ(1, stats.ops[SPIFLASH_OP_ERASE].count);
+    CHECK_EQ(SPI_FLASH_SECTOR_SIZE, stats.ops[SPIFLASH_OP_ERASE].bytes);
+    for (int i = 0; i < SPIFLASH_OP_MAX; i++) {
+        check_histogram(&stats.ops[i]);
+        CHECK(stats.ops[i].total_us >= stats.ops[i].max_us);
+    }
+
+    // A 40 ms erase lands in the 32768..65535 us bucket, and is the longest
+    // critical section
+    CHECK_EQ(1, stats.ops[SPIFLASH_OP_ERASE].histogram[16]);
+    CHECK(stats.ops[SPIFLASH_OP_ERASE].max_us >= SPI_SIM_ERASE_TIME_US);
+    CHECK(stats.max_critical_us >= SPI_SIM_ERASE_TIME_US);
+    CHECK(stats.max_critical_us <= stats.ops[SPIFLASH_OP_ERASE].max_us);
+    CHECK_EQ(SPIFLASH_OP_ERASE, stats.max_critical_op);
+
+    // With yielding erases, the longest critical section is much shorter
+    // than the erase
+    spiflash_reset_stats();
+    CHECK(spiflash_erase_sector_yield(ERASE_SECTOR));
+    spiflash_get_stats(&stats);
+    CHECK_EQ(1, stats.ops[SPIFLASH_OP_ERASE].count);
+    CHECK(stats.ops[SPIFLASH_OP_ERASE].max_us >= SPI_SIM_ERASE_TIME_US);
+    CHECK(stats.max_critical_us < SPI_SIM_ERASE_TIME_US / 4);
+    CHECK_EQ(0, stats.ops[SPIFLASH_OP_READ].count);
+    CHECK_EQ(0, host_critical_nesting);
+    spi_sim_free();
+}
+
+/* Chips without erase suspend fall back to erasing in one go.  This leaves
+ * the driver assuming suspend is unsupported, so it must run last.
+ */
+HOST_TEST(test_erase_no_suspend)
+{
+    CHECK(spi_sim_init());
+    spi_sim_erase_suspend = false;
+    fill_sector(ERASE_SECTOR);
+    spi_sim_reset_stats();
+    CHECK(spiflash_erase_sector_yield(ERASE_SECTOR));
+    check_erased(ERASE_SECTOR);
+    check_erase_safe();
+    CHECK_EQ(0, spi_sim_stats.task_delays);
+    CHECK(spi_sim_stats.max_cache_off_us >= SPI_SIM_ERASE_TIME_US);
+    spi_sim_free();
+}
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_read_mapped_window),
+    HOST_TEST_ENTRY(test_read_other_megabyte),
+    HOST_TEST_ENTRY(test_read_unmapped),
+    HOST_TEST_ENTRY(test_write_read_back),
+    HOST_TEST_ENTRY(test_write_commands),
+    HOST_TEST_ENTRY(test_erase_yield),
+    HOST_TEST_ENTRY(test_erase_yield_interrupted),
+    HOST_TEST_ENTRY(test_stats),
+    HOST_TEST_ENTRY(test_erase_no_suspend),
+};
+
+HOST_TEST_MAIN("spiflash", tests)
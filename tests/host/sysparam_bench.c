@@ -0,0 +1,292 @@
+/* Host-side throughput benchmark for core/sysparam.c
+ *
+ * Runs sysparam_set_data()/sysparam_get_data()/sysparam_compact() and the
+ * sysparam_batch_*() API over a few realistic key populations, and compares
+ * flash wear with and without log mode.  It reports,
+ * per operation, the number of flash calls, bytes moved, sector erases, host
+ * wall time, and the modelled time the real flash would spend busy (see
+ * flash_emu.h).
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sysparam.h>
+#include "flash_emu.h"
+
+#define FLASH_SIZE  (1024 * 1024)
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define AREA_BASE   0x10000
+
+#define MAX_KEYS    512
+#define BUNDLE_KEYS 30
+#define VALUE_SIZE_KEYS 20
+#define WEAR_SECTORS    4
+#define WEAR_SETTINGS   20
+#define WEAR_UPDATES    20000
+
+static const char *groups[] = {
+    "wifi", "mqtt", "ota", "ntp", "led", "sensor", "cal", "app",
+};
+
+static const char *fields[] = {
+    "ssid", "password", "host", "port", "client_id", "interval", "enabled",
+    "offset", "gain", "threshold", "topic", "user",
+};
+
+static char keys[MAX_KEYS][32];
+static char values[MAX_KEYS][64];
+static unsigned order[MAX_KEYS];
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return rng_state >> 8;
+}
+
+static void make_population(int count)
+{
+    for (int i = 0; i < count; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "%s.%s.%d",
+                 groups[i % 8], fields[(i / 8) % 12], i / 96);
+        int len = 4 + rng() % 40;
+        for (int j = 0; j < len; j++) {
+            values[i][j] = 'a' + rng() % 26;
+        }
+        values[i][len] = 0;
+        order[i] = i;
+    }
+    // Shuffle the access order so lookups don't follow insertion order
+    for (int i = count - 1; i > 0; i--) {
+        unsigned j = rng() % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t phase_start;
+
+static void begin_phase(void)
+{
+    flash_emu_reset_stats();
+    phase_start = now_ns();
+}
+
+static void end_phase(const char *name, int ops)
+{
+    uint64_t wall = now_ns() - phase_start;
+
+    printf("  %-10s %5d ops | per op: reads %7.1f (%7.1f B) "
+           "writes %6.1f (%6.1f B) | erases %3u | wall %8.2f us | "
+           "flash busy %9.1f us\n",
+           name, ops,
+           (double)flash_emu_stats.read_calls / ops,
+           (double)flash_emu_stats.read_bytes / ops,
+           (double)flash_emu_stats.write_calls / ops,
+           (double)flash_emu_stats.write_bytes / ops,
+           flash_emu_stats.erase_calls,
+           wall / 1e3 / ops,
+           flash_emu_stats.busy_ns / 1e3 / ops);
+}
+
+static void check(sysparam_status_t status, const char *what)
+{
+    if (status != SYSPARAM_OK) {
+        fprintf(stderr, "%s failed (%d)\n", what, status);
+        exit(1);
+    }
+}
+
+static void run_population(int count)
+{
+    uint16_t region_sectors = (count * 128 + FLASH_EMU_SECTOR_SIZE - 1) / FLASH_EMU_SECTOR_SIZE;
+    int bundle = min(count, BUNDLE_KEYS);
+    sysparam_batch_t batch;
+    uint8_t *buf;
+    size_t len;
+
+    make_population(count);
+    flash_emu_init(FLASH_SIZE);
+    check(sysparam_create_area(AREA_BASE, region_sectors * 2, false), "create_area");
+    check(sysparam_init(AREA_BASE, 0), "init");
+
+    printf("%d keys, %d sectors:\n", count, region_sectors * 2);
+
+    begin_phase();
+    for (int i = 0; i < count; i++) {
+        check(sysparam_set_string(keys[i], values[i]), "set");
+    }
+    end_phase("set new", count);
+
+    begin_phase();
+    for (int i = 0; i < count; i++) {
+        check(sysparam_get_data(keys[order[i]], &buf, &len, NULL), "get");
+        free(buf);
+    }
+    end_phase("get hit", count);
+
+    begin_phase();
+    for (int i = 0; i < count; i++) {
+        if (sysparam_get_data("no.such.key", &buf, &len, NULL) == SYSPARAM_OK) {
+            free(buf);
+        }
+    }
+    end_phase("get miss", count);
+
+    begin_phase();
+    for (int i = 0; i < count; i++) {
+        values[order[i]][0] ^= 0x20;
+        check(sysparam_set_string(keys[order[i]], values[order[i]]), "update");
+    }
+    end_phase("update", count);
+
+    // Apply a configuration bundle, first one key at a time and then the same
+    // number of changes as a single batch
+    begin_phase();
+    for (int i = 0; i < bundle; i++) {
+        values[order[i]][1] ^= 0x20;
+        check(sysparam_set_string(keys[order[i]], values[order[i]]), "bundle");
+    }
+    end_phase("bundle", bundle);
+
+    begin_phase();
+    check(sysparam_batch_begin(&batch), "batch_begin");
+    for (int i = 0; i < bundle; i++) {
+        values[order[i]][1] ^= 0x20;
+        check(sysparam_batch_set_string(&batch, keys[order[i]], values[order[i]]), "batch_set");
+    }
+    check(sysparam_batch_commit(&batch), "batch_commit");
+    end_phase("batch", bundle);
+
+    begin_phase();
+    check(sysparam_init(AREA_BASE, 0), "init");
+    end_phase("init", 1);
+
+    begin_phase();
+    check(sysparam_compact(), "compact");
+    end_phase("compact", 1);
+
+    flash_emu_free();
+}
+
+/* Write values of increasing size, to show the cost of the write path itself.
+ * Every flash call runs with interrupts disabled on the real device, so the
+ * number of calls and the longest one matter as much as the total.
+ */
+static void run_value_sizes(void)
+{
+    static const int sizes[] = { 8, 32, 128, 512, 2048 };
+    static uint8_t value[2048];
+    char key[16];
+    uint32_t calls;
+
+    printf("value sizes (%d keys each):\n", VALUE_SIZE_KEYS);
+    for (int i = 0; i < sizeof(value); i++) {
+        value[i] = rng();
+    }
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        flash_emu_init(FLASH_SIZE);
+        check(sysparam_create_area(AREA_BASE, 64, false), "create_area");
+        check(sysparam_init(AREA_BASE, 0), "init");
+
+        begin_phase();
+        for (int j = 0; j < VALUE_SIZE_KEYS; j++) {
+            snprintf(key, sizeof(key), "blob%d", j);
+            value[0] = j;
+            check(sysparam_set_data(key, value, sizes[i], true), "set");
+        }
+        calls = flash_emu_stats.read_calls + flash_emu_stats.write_calls + flash_emu_stats.erase_calls;
+        printf("  %5d B  per op: writes %6.1f | critical sections %6.1f, "
+               "%8.1f us total, %7.1f us max\n",
+               sizes[i],
+               (double)flash_emu_stats.write_calls / VALUE_SIZE_KEYS,
+               (double)calls / VALUE_SIZE_KEYS,
+               flash_emu_stats.busy_ns / 1e3 / VALUE_SIZE_KEYS,
+               flash_emu_stats.max_busy_ns / 1e3);
+        flash_emu_free();
+    }
+}
+
+/* Keep updating a counter next to a few settings, in the default two-region
+ * format and in log mode over the same number of sectors, and compare how
+ * often (and how evenly) sectors get erased.
+ */
+static void run_wear(void)
+{
+    static const char *formats[] = { "regions", "log" };
+    char key[16];
+    uint32_t max_erases, min_erases;
+    uint64_t busy, max_op_busy;
+
+    printf("wear (%d settings + a counter updated %d times, %d sectors):\n",
+           WEAR_SETTINGS, WEAR_UPDATES, WEAR_SECTORS);
+    make_population(WEAR_SETTINGS);
+    for (int f = 0; f < 2; f++) {
+        flash_emu_init(FLASH_SIZE);
+        if (f) {
+            check(sysparam_create_log_area(AREA_BASE, WEAR_SECTORS, false), "create_log_area");
+        } else {
+            check(sysparam_create_area(AREA_BASE, WEAR_SECTORS, false), "create_area");
+        }
+        check(sysparam_init(AREA_BASE, 0), "init");
+        for (int i = 0; i < WEAR_SETTINGS; i++) {
+            check(sysparam_set_string(keys[i], values[i]), "set");
+        }
+
+        begin_phase();
+        max_op_busy = 0;
+        for (int i = 0; i < WEAR_UPDATES; i++) {
+            busy = flash_emu_stats.busy_ns;
+            check(sysparam_set_int32("counter", i), "update");
+            busy = flash_emu_stats.busy_ns - busy;
+            max_op_busy = busy > max_op_busy ? busy : max_op_busy;
+        }
+        snprintf(key, sizeof(key), "%s", formats[f]);
+        end_phase(key, WEAR_UPDATES);
+
+        max_erases = 0;
+        min_erases = ~0;
+        for (int i = 0; i < WEAR_SECTORS; i++) {
+            uint32_t erases = flash_emu_sector_erases(AREA_BASE + i * FLASH_EMU_SECTOR_SIZE);
+            max_erases = erases > max_erases ? erases : max_erases;
+            min_erases = erases < min_erases ? erases : min_erases;
+        }
+        printf("  %-10s sector erases: min %u, max %u | slowest update %.1f ms\n",
+               "", min_erases, max_erases, max_op_busy / 1e6);
+        flash_emu_free();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const int populations[] = { 16, 64, 200, 500 };
+
+    if (argc > 1) {
+        int count = atoi(argv[1]);
+        if (count < 1 || count > MAX_KEYS) {
+            fprintf(stderr, "usage: %s [num_keys (1..%d)]\n", argv[0], MAX_KEYS);
+            return 1;
+        }
+        run_population(count);
+        return 0;
+    }
+    for (int i = 0; i < sizeof(populations) / sizeof(populations[0]); i++) {
+        run_population(populations[i]);
+    }
+    run_value_sizes();
+    run_wear();
+    return 0;
+}
@@ -0,0 +1,717 @@
+/* Host-side functional tests for core/sysparam.c
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <sysparam.h>
+#include "FreeRTOS.h"
+#include "flash_emu.h"
+#include "host_test.h"
+
+#define FLASH_SIZE  (256 * 1024)
+#define AREA_BASE   0x10000
+
+static void setup_area(uint16_t num_sectors)
+{
+    flash_emu_init(FLASH_SIZE);
+    CHECK_EQ(SYSPARAM_OK, sysparam_create_area(AREA_BASE, num_sectors, false));
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+}
+
+static void check_string(const char *key, const char *expected)
+{
+    char *value = NULL;
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_string(key, &value));
+    CHECK(value != NULL);
+    CHECK_EQ(strlen(expected), strlen(value));
+    CHECK_MEM(expected, value, strlen(expected));
+    free(value);
+}
+
+HOST_TEST(test_set_get_string)
+{
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("wifi_ssid", "esp-open-rtos"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("wifi_password", "secret"));
+    check_string("wifi_ssid", "esp-open-rtos");
+    check_string("wifi_password", "secret");
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+HOST_TEST(test_get_missing)
+{
+    uint8_t *value = NULL;
+    int32_t number = 42;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("present", "yes"));
+    CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_data("absent", &value, NULL, NULL));
+    CHECK(value == NULL);
+    CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_int32("absent", &number));
+    CHECK_EQ(42, number);
+}
+
+HOST_TEST(test_binary_values)
+{
+    int32_t i32 = 0;
+    int8_t i8 = 0;
+    bool flag = false;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", -123456));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_int8("level", -7));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_bool("enabled", true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("counter", &i32));
+    CHECK_EQ(-123456, i32);
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int8("level", &i8));
+    CHECK_EQ(-7, i8);
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_bool("enabled", &flag));
+    CHECK(flag);
+    CHECK_EQ(SYSPARAM_PARSEFAILED, sysparam_get_int32("enabled", &i32));
+}
+
+HOST_TEST(test_update_and_delete)
+{
+    char *value = NULL;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("host", "first.example.com"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("host", "second.example.com"));
+    check_string("host", "second.example.com");
+
+    // Writing an identical value must not touch the flash at all
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("host", "second.example.com"));
+    CHECK_EQ(0, flash_emu_stats.write_calls);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("host", NULL, 0, false));
+    CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_string("host", &value));
+}
+
+HOST_TEST(test_persistence)
+{
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("name", "device-1"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("boots", 17));
+
+    // Re-scan the flash as if the device had rebooted
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, AREA_BASE + 16 * FLASH_EMU_SECTOR_SIZE));
+    check_string("name", "device-1");
+    int32_t boots = 0;
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("boots", &boots));
+    CHECK_EQ(17, boots);
+}
+
+HOST_TEST(test_compaction_on_full)
+{
+    char key[16], value[32];
+    int32_t counter = 0;
+
+    setup_area(2);
+    for (int i = 0; i < 8; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(value, sizeof(value), "value-%d", i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+    }
+
+    // Keep rewriting a counter until the region has to be compacted (more
+    // than once)
+    flash_emu_reset_stats();
+    for (int i = 0; i < 1000; i++) {
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+    }
+    CHECK(flash_emu_stats.erase_calls >= 2);
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("counter", &counter));
+    CHECK_EQ(999, counter);
+    for (int i = 0; i < 8; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(value, sizeof(value), "value-%d", i);
+        check_string(key, value);
+    }
+}
+
+HOST_TEST(test_explicit_compact)
+{
+    uint32_t base, num_sectors;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("a", "1"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("a", "2"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_compact());
+    check_string("a", "2");
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_info(&base, &num_sectors));
+    CHECK_EQ(AREA_BASE, base);
+    CHECK_EQ(4, num_sectors);
+}
+
+HOST_TEST(test_iterate)
+{
+    sysparam_iter_t iter;
+    int count = 0;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("one", "1"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("two", "2"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("three", "3"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("two", NULL, 0, false));
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_iter_start(&iter));
+    while (sysparam_iter_next(&iter) == SYSPARAM_OK) {
+        CHECK(strcmp(iter.key, "two") != 0);
+        count++;
+    }
+    sysparam_iter_end(&iter);
+    CHECK_EQ(2, count);
+}
+
+HOST_TEST(test_many_keys)
+{
+    char key[32], value[32];
+
+    setup_area(16);
+    for (int i = 0; i < 200; i++) {
+        snprintf(key, sizeof(key), "group%d.key%d", i % 7, i);
+        snprintf(value, sizeof(value), "value %d", i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+    }
+    // Rewrite everything a few times, forcing several compactions
+    for (int round = 1; round <= 4; round++) {
+        for (int i = 0; i < 200; i++) {
+            snprintf(key, sizeof(key), "group%d.key%d", i % 7, i);
+            snprintf(value, sizeof(value), "value %d/%d", i, round);
+            CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+        }
+    }
+    for (int i = 0; i < 200; i += 3) {
+        snprintf(key, sizeof(key), "group%d.key%d", i % 7, i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_data(key, NULL, 0, false));
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < 200; i++) {
+            char *found = NULL;
+            snprintf(key, sizeof(key), "group%d.key%d", i % 7, i);
+            if (i % 3 == 0) {
+                CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_string(key, &found));
+            } else {
+                snprintf(value, sizeof(value), "value %d/4", i);
+                check_string(key, value);
+            }
+        }
+        // Same again after a "reboot"
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    }
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+}
+
+HOST_TEST(test_large_value)
+{
+    static uint8_t value[1000];
+    uint8_t *found = NULL;
+    size_t len = 0;
+
+    setup_area(4);
+    for (int i = 0; i < sizeof(value); i++) {
+        value[i] = i * 7;
+    }
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("k", "x"));
+
+    // Large payloads are written (and verified) a flash page at a time
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("blob", value, sizeof(value), true));
+    CHECK(flash_emu_stats.write_calls <= 2 * 3 + 5);
+    CHECK(flash_emu_stats.max_busy_ns < 2 * FLASH_EMU_PAGE_SIZE * FLASH_EMU_PROGRAM_BYTE_NS);
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_data("blob", &found, &len, NULL));
+    CHECK_EQ(sizeof(value), len);
+    CHECK_MEM(value, found, sizeof(value));
+    free(found);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+HOST_TEST(test_batch_commit)
+{
+    sysparam_batch_t batch;
+    char *value = NULL;
+    int32_t number = 0;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("wifi_ssid", "old-ssid"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("wifi_password", "old-password"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("obsolete", "x"));
+
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "wifi_ssid", "typo"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "wifi_password", "new-password"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_int32(&batch, "channel", 11));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_data(&batch, "obsolete", NULL, 0, false));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "wifi_ssid", "new-ssid"));
+    CHECK_EQ(4, batch.count);
+
+    // Nothing is written until the batch is committed, and then only once
+    CHECK_EQ(0, flash_emu_stats.write_calls);
+    check_string("wifi_ssid", "old-ssid");
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+    CHECK_EQ(0, flash_emu_stats.erase_calls);
+    CHECK(batch.buf == NULL);
+
+    for (int pass = 0; pass < 2; pass++) {
+        check_string("wifi_ssid", "new-ssid");
+        check_string("wifi_password", "new-password");
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("channel", &number));
+        CHECK_EQ(11, number);
+        CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_string("obsolete", &value));
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    }
+
+    // Individual updates still work on top of a committed batch
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("wifi_ssid", "later-ssid"));
+    check_string("wifi_ssid", "later-ssid");
+    CHECK_EQ(SYSPARAM_OK, sysparam_compact());
+    check_string("wifi_ssid", "later-ssid");
+    check_string("wifi_password", "new-password");
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+    CHECK_EQ(0, host_critical_nesting);
+}
+
+/* Magic of the active region of the area set up by setup_area(num_sectors) */
+static uint32_t active_magic(uint16_t num_sectors)
+{
+    const uint8_t *flash = flash_emu_data();
+    uint32_t region_size = num_sectors / 2 * FLASH_EMU_SECTOR_SIZE;
+
+    for (uint32_t addr = AREA_BASE; addr < AREA_BASE + 2 * region_size; addr += region_size) {
+        uint32_t magic;
+        uint16_t flags_size;
+
+        memcpy(&magic, flash + addr, sizeof(magic));
+        memcpy(&flags_size, flash + addr + 4, sizeof(flags_size));
+        if (flags_size & 0x4000) {
+            return magic;
+        }
+    }
+    return 0;
+}
+
+/* A region holding a batch has a magic older code does not recognize, until
+ * compacting writes the batch out as plain entries */
+HOST_TEST(test_batch_region_magic)
+{
+    sysparam_batch_t batch;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("plain", "value"));
+    CHECK_EQ(0x70524f45, active_magic(4));
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "batched", "value"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+    CHECK_EQ(0x70524f44, active_magic(4));
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    check_string("plain", "value");
+    check_string("batched", "value");
+    CHECK_EQ(SYSPARAM_OK, sysparam_compact());
+    CHECK_EQ(0x70524f45, active_magic(4));
+
+    // Both kinds of region header are found again, whichever is active
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    check_string("plain", "value");
+    check_string("batched", "value");
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "batched", "again"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+    CHECK_EQ(0x70524f44, active_magic(4));
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    check_string("batched", "again");
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+}
+
+HOST_TEST(test_batch_unchanged)
+{
+    sysparam_batch_t batch;
+
+    setup_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("a", "1"));
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "a", "1"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_data(&batch, "missing", NULL, 0, false));
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+    CHECK_EQ(0, flash_emu_stats.write_calls);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "a", "2"));
+    sysparam_batch_abort(&batch);
+    CHECK(batch.buf == NULL);
+    check_string("a", "1");
+}
+
+HOST_TEST(test_batch_compaction)
+{
+    sysparam_batch_t batch;
+    char key[16], value[32];
+
+    // Fill the region with dead values, so the batch has to compact first
+    setup_area(2);
+    for (int i = 0; i < 480; i++) {
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+    }
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    for (int i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(value, sizeof(value), "batch value %d", i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, key, value));
+    }
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+    CHECK_EQ(1, flash_emu_stats.erase_calls);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    for (int i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(value, sizeof(value), "batch value %d", i);
+        check_string(key, value);
+    }
+
+    // A batch that can never fit fails without changing anything
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    for (int i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        memset(value, 'a' + i % 26, sizeof(value) - 1);
+        value[sizeof(value) - 1] = 0;
+        CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, key, value));
+        CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_data(&batch, value + i % 8, (uint8_t *)value, sizeof(value), true));
+    }
+    CHECK_EQ(SYSPARAM_ERR_FULL, sysparam_batch_commit(&batch));
+    check_string("key0", "batch value 0");
+}
+
+/* Cut the power after every possible number of program commands while a batch
+ * is being committed, and check that after a reboot either none or all of the
+ * batch is visible.
+ */
+HOST_TEST(test_batch_power_cut)
+{
+    static const char *keys[] = { "ip", "netmask", "gateway", "dns" };
+    static const char *old_values[] = { "10.0.0.2", "255.0.0.0", "10.0.0.1", NULL };
+    static const char *new_values[] = { "192.168.1.20", "255.255.255.0", "192.168.1.1", "192.168.1.1" };
+    sysparam_batch_t batch;
+    uint32_t total_cmds = 0;
+
+    for (int cut = 0; ; cut++) {
+        bool applied;
+        char *value = NULL;
+        sysparam_status_t status;
+
+        setup_area(4);
+        for (int i = 0; i < 4; i++) {
+            if (old_values[i]) {
+                CHECK_EQ(SYSPARAM_OK, sysparam_set_string(keys[i], old_values[i]));
+            }
+        }
+        CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+        for (int i = 0; i < 4; i++) {
+            CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, keys[i], new_values[i]));
+        }
+        flash_emu_reset_stats();
+        flash_emu_fail_after(cut);
+        status = sysparam_batch_commit(&batch);
+        flash_emu_fail_after(-1);
+        CHECK_EQ(0, flash_emu_stats.bit_violations);
+
+        // Reboot, then check that the batch was applied atomically
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+        applied = sysparam_get_string("dns", &value) == SYSPARAM_OK;
+        free(value);
+        for (int i = 0; i < 4; i++) {
+            const char *expected = applied ? new_values[i] : old_values[i];
+            if (expected) {
+                check_string(keys[i], expected);
+            }
+        }
+        CHECK_EQ(0, flash_emu_stats.bit_violations);
+        if (status == SYSPARAM_OK) {
+            CHECK(applied);
+            total_cmds = cut;
+            break;
+        }
+        CHECK(cut < 64);
+    }
+    CHECK(total_cmds > 4);
+}
+
+static void setup_log_area(uint16_t num_sectors)
+{
+    flash_emu_init(FLASH_SIZE);
+    CHECK_EQ(SYSPARAM_OK, sysparam_create_log_area(AREA_BASE, num_sectors, false));
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+}
+
+HOST_TEST(test_log_basic)
+{
+    sysparam_batch_t batch;
+    uint32_t base, num_sectors;
+    int32_t number = 0;
+    char *value = NULL;
+
+    setup_log_area(4);
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_info(&base, &num_sectors));
+    CHECK_EQ(AREA_BASE, base);
+    CHECK_EQ(4, num_sectors);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("hostname", "esp"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("hostname", "esp-log"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("boot_count", 7));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_string("obsolete", "x"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("obsolete", NULL, 0, false));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_begin(&batch));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_string(&batch, "ip", "10.0.0.2"));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_set_int32(&batch, "boot_count", 8));
+    CHECK_EQ(SYSPARAM_OK, sysparam_batch_commit(&batch));
+
+    // Reboot, then compact (reclaiming every sector) and reboot again
+    for (int i = 0; i < 2; i++) {
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+        check_string("hostname", "esp-log");
+        check_string("ip", "10.0.0.2");
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("boot_count", &number));
+        CHECK_EQ(8, number);
+        CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_string("obsolete", &value));
+        CHECK_EQ(SYSPARAM_OK, sysparam_compact());
+    }
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+
+    // An existing area in the other format is not clobbered
+    CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_create_area(AREA_BASE, 4, false));
+    CHECK_EQ(SYSPARAM_ERR_BADVALUE, sysparam_create_log_area(AREA_BASE + 0x10000, 2, false));
+}
+
+/* Keep updating a counter next to some settings, and check that every sector
+ * of a log-mode area wears at the same rate.
+ */
+HOST_TEST(test_log_wear)
+{
+    sysparam_erase_stats_t stats;
+    char key[16], value[32];
+    int32_t number = 0;
+    uint32_t min_erases = ~0, max_erases = 0;
+
+    setup_log_area(4);
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "setting%d", i);
+        snprintf(value, sizeof(value), "value of setting %d", i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+    }
+    for (int i = 0; i < 5000; i++) {
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+    }
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_erase_stats(&stats));
+    CHECK_EQ(4, stats.num_sectors);
+    CHECK(stats.erases >= 8);
+    CHECK(stats.max_erase_count - stats.min_erase_count <= 1);
+    CHECK_EQ(stats.erases + 4, stats.total_erase_count);
+    for (int i = 0; i < 4; i++) {
+        uint32_t erases = flash_emu_sector_erases(AREA_BASE + i * FLASH_EMU_SECTOR_SIZE);
+        min_erases = erases < min_erases ? erases : min_erases;
+        max_erases = erases > max_erases ? erases : max_erases;
+    }
+    CHECK(max_erases - min_erases <= 1);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    for (int i = 0; i < 20; i++) {
+        snprintf(key, sizeof(key), "setting%d", i);
+        snprintf(value, sizeof(value), "value of setting %d", i);
+        check_string(key, value);
+    }
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("counter", &number));
+    CHECK_EQ(4999, number);
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+
+    // The lifetime counts survive recreating the area
+    CHECK_EQ(SYSPARAM_OK, sysparam_create_log_area(AREA_BASE, 4, true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_erase_stats(&stats));
+    CHECK_EQ(0, stats.erases);
+    CHECK(stats.min_erase_count >= min_erases + 1);
+}
+
+/* Cut the power at every point while the oldest sector of the log is being
+ * reclaimed, and check that nothing is lost.
+ */
+HOST_TEST(test_log_power_cut)
+{
+    sysparam_erase_stats_t stats;
+    char key[16], value[32];
+    int32_t number;
+    int first_reclaim = -1;
+
+    // Find out which update reclaims a sector for the first time
+    setup_log_area(3);
+    for (int i = 0; first_reclaim < 0; i++) {
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_erase_stats(&stats));
+        if (stats.erases) first_reclaim = i;
+        if (i % 50 == 0) {
+            snprintf(key, sizeof(key), "key%d", i / 50);
+            snprintf(value, sizeof(value), "value %d", i);
+            CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+        }
+    }
+
+    for (int cut = 0; ; cut++) {
+        sysparam_status_t status;
+
+        setup_log_area(3);
+        for (int i = 0; i < first_reclaim; i++) {
+            CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+            if (i % 50 == 0) {
+                snprintf(key, sizeof(key), "key%d", i / 50);
+                snprintf(value, sizeof(value), "value %d", i);
+                CHECK_EQ(SYSPARAM_OK, sysparam_set_string(key, value));
+            }
+        }
+        flash_emu_reset_stats();
+        flash_emu_fail_after(cut);
+        status = sysparam_set_int32("counter", first_reclaim);
+        flash_emu_fail_after(-1);
+
+        // Reboot, then check that everything is still there and that the
+        // area is usable
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("counter", &number));
+        CHECK(number == first_reclaim - 1 || number == first_reclaim);
+        if (status == SYSPARAM_OK) {
+            CHECK_EQ(first_reclaim, number);
+        }
+        for (int i = 0; i < first_reclaim; i += 50) {
+            snprintf(key, sizeof(key), "key%d", i / 50);
+            snprintf(value, sizeof(value), "value %d", i);
+            check_string(key, value);
+        }
+        for (int i = 0; i < 1000; i++) {
+            CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("counter", i));
+        }
+        CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("counter", &number));
+        CHECK_EQ(999, number);
+        check_string("key0", "value 0");
+        CHECK_EQ(0, flash_emu_stats.bit_violations);
+        if (status == SYSPARAM_OK) break;
+        CHECK(cut < 256);
+    }
+}
+
+HOST_TEST(test_log_full)
+{
+    static uint8_t big[4096];
+    char key[16];
+    int count = 0;
+    sysparam_status_t status;
+
+    setup_log_area(3);
+
+    // A value must fit in a single sector
+    CHECK_EQ(SYSPARAM_ERR_FULL, sysparam_set_data("big", big, sizeof(big), true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("big", big, 4000, true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("big", NULL, 0, true));
+
+    // Fill it up.  Two of the three sectors can be used.
+    while (true) {
+        snprintf(key, sizeof(key), "key%d", count);
+        memset(big, count, 200);
+        status = sysparam_set_data(key, big, 200, true);
+        if (status != SYSPARAM_OK) break;
+        count++;
+    }
+    CHECK_EQ(SYSPARAM_ERR_FULL, status);
+    CHECK(count >= 2 * 4000 / 213 - 1);
+
+    CHECK_EQ(SYSPARAM_OK, sysparam_init(AREA_BASE, 0));
+    for (int i = 0; i < count; i++) {
+        uint8_t data[200];
+        size_t len = 0;
+        snprintf(key, sizeof(key), "key%d", i);
+        memset(big, i, 200);
+        CHECK_EQ(SYSPARAM_OK, sysparam_get_data_static(key, data, sizeof(data), &len, NULL));
+        CHECK_EQ(200, len);
+        CHECK_MEM(big, data, 200);
+    }
+
+    // Freeing some space makes room again
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("key0", NULL, 0, true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("key1", NULL, 0, true));
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_data("new", big, 200, true));
+    CHECK_EQ(0, flash_emu_stats.bit_violations);
+}
+
+#if SYSPARAM_KEY_INDEX
+HOST_TEST(test_index_lookup_cost)
+{
+    char key[32];
+    int32_t value = 0;
+
+    setup_area(8);
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "sensor.%d.offset", i);
+        CHECK_EQ(SYSPARAM_OK, sysparam_set_int32(key, i));
+    }
+
+    // A hit costs a key check, the value header and the value itself
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("sensor.42.offset", &value));
+    CHECK_EQ(42, value);
+    CHECK(flash_emu_stats.read_calls <= 4);
+
+    // A miss normally doesn't touch the flash at all
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_NOTFOUND, sysparam_get_int32("sensor.100.offset", &value));
+    CHECK(flash_emu_stats.read_calls <= 2);
+
+    // Updating an existing key doesn't need a scan either
+    flash_emu_reset_stats();
+    CHECK_EQ(SYSPARAM_OK, sysparam_set_int32("sensor.42.offset", -42));
+    CHECK(flash_emu_stats.read_calls <= 12);
+    CHECK_EQ(SYSPARAM_OK, sysparam_get_int32("sensor.42.offset", &value));
+    CHECK_EQ(-42, value);
+}
+#endif
+
+static const host_test_case_t tests[] = {
+    HOST_TEST_ENTRY(test_set_get_string),
+    HOST_TEST_ENTRY(test_get_missing),
+    HOST_TEST_ENTRY(test_binary_values),
+    HOST_TEST_ENTRY(test_update_and_delete),
+    HOST_TEST_ENTRY(test_persistence),
+    HOST_TEST_ENTRY(test_compaction_on_full),
+    HOST_TEST_ENTRY(test_explicit_compact),
+    HOST_TEST_ENTRY(test_iterate),
+    HOST_TEST_ENTRY(test_many_keys),
+    HOST_TEST_ENTRY(test_large_value),
+    HOST_TEST_ENTRY(test_batch_commit),
+    HOST_TEST_ENTRY(test_batch_region_magic),
+    HOST_TEST_ENTRY(test_batch_unchanged),
+    HOST_TEST_ENTRY(test_batch_compaction),
+    HOST_TEST_ENTRY(test_batch_power_cut),
+    HOST_TEST_ENTRY(test_log_basic),
+    HOST_TEST_ENTRY(test_log_wear),
+    HOST_TEST_ENTRY(test_log_power_cut),
+    HOST_TEST_ENTRY(test_log_full),
+#if SYSPARAM_KEY_INDEX
+    HOST_TEST_ENTRY(test_index_lookup_cost),
+#endif
+};
+
+HOST_TEST_MAIN(SYSPARAM_KEY_INDEX ? "sysparam (key index)" : "sysparam", tests)
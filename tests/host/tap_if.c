@@ -0,0 +1,159 @@
+/* Linux TAP interface, or a socketpair to a second process, standing in for
+ * the wifi link in the host lwip harness
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "tap_if.h"
+
+static int tap_fd = -1;
+static FILE *pcap;
+static pthread_mutex_t pcap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool set_addr(int sock, struct ifreq *ifr, unsigned long request, const char *addr)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ifr->ifr_addr;
+
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    if (inet_pton(AF_INET, addr, &sin->sin_addr) != 1) {
+        return false;
+    }
+    return ioctl(sock, request, ifr) == 0;
+}
+
+static void pcap_record(const void *frame, size_t len)
+{
+    struct timeval tv;
+    uint32_t header[4];
+
+    if (!pcap) {
+        return;
+    }
+    gettimeofday(&tv, NULL);
+    header[0] = tv.tv_sec;
+    header[1] = tv.tv_usec;
+    header[2] = header[3] = len;
+    pthread_mutex_lock(&pcap_lock);
+    fwrite(header, sizeof(header), 1, pcap);
+    fwrite(frame, len, 1, pcap);
+    fflush(pcap);
+    pthread_mutex_unlock(&pcap_lock);
+}
+
+static bool pcap_open(const char *pcap_path)
+{
+    /* Ethernet, microsecond timestamps */
+    static const uint32_t file_header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+
+    if (!pcap_path) {
+        return true;
+    }
+    pcap = fopen(pcap_path, "wb");
+    if (!pcap) {
+        perror(pcap_path);
+        return false;
+    }
+    fwrite(file_header, sizeof(file_header), 1, pcap);
+    return true;
+}
+
+bool tap_if_open(const char *name, const char *addr, const char *netmask, const char *pcap_path)
+{
+    struct ifreq ifr;
+    int sock;
+    bool ok;
+
+    tap_fd = open("/dev/net/tun", O_RDWR);
+    if (tap_fd < 0) {
+        perror("tap_if: /dev/net/tun");
+        return false;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(tap_fd, TUNSETIFF, &ifr) < 0) {
+        perror("tap_if: TUNSETIFF (needs CAP_NET_ADMIN)");
+        close(tap_fd);
+        tap_fd = -1;
+        return false;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ok = set_addr(sock, &ifr, SIOCSIFADDR, addr) && set_addr(sock, &ifr, SIOCSIFNETMASK, netmask);
+    if (ok) {
+        ok = ioctl(sock, SIOCGIFFLAGS, &ifr) == 0;
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING | IFF_MULTICAST;
+        ok = ok && ioctl(sock, SIOCSIFFLAGS, &ifr) == 0;
+    }
+    close(sock);
+    if (!ok) {
+        perror("tap_if: configuring interface");
+        close(tap_fd);
+        tap_fd = -1;
+        return false;
+    }
+
+    return pcap_open(pcap_path);
+}
+
+int tap_if_fork(const char *pcap_path)
+{
+    int fds[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0) {
+        perror("tap_if: socketpair");
+        return -1;
+    }
+    pid = fork();
+    if (pid < 0) {
+        perror("tap_if: fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(fds[0]);
+        tap_fd = fds[1];
+        return 0;
+    }
+    close(fds[1]);
+    tap_fd = fds[0];
+    return pcap_open(pcap_path) ? pid : -1;
+}
+
+int tap_if_read(void *buf, size_t size)
+{
+    ssize_t len = read(tap_fd, buf, size);
+
+    if (len > 0) {
+        pcap_record(buf, len);
+    }
+    return len;
+}
+
+void tap_if_write(const void *buf, size_t len)
+{
+    pcap_record(buf, len);
+    if (write(tap_fd, buf, len) != len) {
+        perror("tap_if: write");
+    }
+}
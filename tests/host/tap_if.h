@@ -0,0 +1,36 @@
+/* Linux TAP interface, or a socketpair to a second process, standing in for
+ * the wifi link in the host lwip harness (see lwip_host.c), with optional
+ * capture of every frame to a pcap file
+ *
+ * Kept apart from the lwip sources so that the Linux socket and ioctl
+ * headers it needs do not meet lwip's own definitions.
+ *
+ * Part of esp-open-rtos
+ * BSD Licensed as described in the file LICENSE
+ */
+#ifndef _TAP_IF_H
+#define _TAP_IF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Create the TAP interface 'name', give the host end 'addr'/'netmask' and
+ * bring it up. This needs CAP_NET_ADMIN. If 'pcap_path' is not NULL, frames
+ * in both directions are also written there. */
+bool tap_if_open(const char *name, const char *addr, const char *netmask, const char *pcap_path);
+
+/* Fork, with an AF_UNIX SOCK_SEQPACKET socketpair as the link between the
+ * two processes, which needs no privileges. Returns 0 in the child and its
+ * pid in the parent, as fork(), or -1 on error. The child is killed when the
+ * parent exits. Frames are captured to 'pcap_path' by the parent if it is
+ * not NULL. */
+int tap_if_fork(const char *pcap_path);
+
+/* Read one frame, blocking until there is one. Returns its length, or -1 on
+ * error. */
+int tap_if_read(void *buf, size_t size);
+
+/* Send one frame to the host, or to the other process. */
+void tap_if_write(const void *buf, size_t len);
+
+#endif /* _TAP_IF_H */